@@ -0,0 +1,390 @@
+// bench.h: helpers shared by the r128 benchmarks. POSIX only.
+
+#ifndef H_BENCH_H
+#define H_BENCH_H
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Monotonic wall clock in seconds.
+static double bench_now(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Reads an optional positive integer argument, or returns def.
+static long bench_arg(int argc, char **argv, int index, long def)
+{
+   long v;
+
+   if (index >= argc) {
+      return def;
+   }
+
+   v = strtol(argv[index], NULL, 0);
+   return v > 0 ? v : def;
+}
+
+// Keeps the compiler from discarding a computed value.
+#define BENCH_KEEP(x) __asm__ __volatile__("" : : "g"(&(x)) : "memory")
+
+// Timestamps for timing a single operation or a short batch. On x86 these read
+// the time-stamp counter, fenced so that the timed instructions cannot move
+// across the reads; elsewhere they are the monotonic clock in ns. Convert with
+// bench_ticks_per_ns.
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+
+static __inline unsigned long long bench_ticks_begin(void)
+{
+   unsigned long long t;
+   _mm_lfence();
+   t = __rdtsc();
+   _mm_lfence();
+   return t;
+}
+
+static __inline unsigned long long bench_ticks_end(void)
+{
+   unsigned long long t;
+   unsigned aux;
+   t = __rdtscp(&aux);
+   _mm_lfence();
+   return t;
+}
+#else
+static __inline unsigned long long bench_ticks_begin(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (unsigned long long)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+#define bench_ticks_end bench_ticks_begin
+#endif
+
+// Ticks per ns, measured against the monotonic clock over about 50 ms.
+static __inline double bench_ticks_per_ns(void)
+{
+   double start = bench_now(), t;
+   unsigned long long ticks = bench_ticks_begin();
+
+   do {
+      t = bench_now() - start;
+   } while (t < 0.05);
+   return (double)(bench_ticks_end() - ticks) / (t * 1e9);
+}
+
+// Hardware counters, read with perf_event_open on Linux. Counters the machine
+// or kernel does not provide (no PMU in a virtual machine, perf_event_paranoid
+// above 2, not Linux) read as -1; bench_counters_open returns zero if none are
+// available and leaves the reason in c->error.
+enum {
+   BENCH_CYCLES,
+   BENCH_INSTRUCTIONS,
+   BENCH_BRANCHES,
+   BENCH_BRANCH_MISSES,
+   BENCH_CACHE_MISSES,
+   BENCH_COUNTERS
+};
+
+typedef struct BenchCounters {
+   int fd[BENCH_COUNTERS];
+   double count[BENCH_COUNTERS];   // from the last start/stop; -1 if unavailable
+   const char *error;
+} BenchCounters;
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static __inline int bench_counters_open(BenchCounters *c)
+{
+   static const unsigned long long config[BENCH_COUNTERS] = {
+      PERF_COUNT_HW_CPU_CYCLES,
+      PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+      PERF_COUNT_HW_BRANCH_MISSES,
+      PERF_COUNT_HW_CACHE_MISSES,
+   };
+   int i, any = 0;
+
+   c->error = NULL;
+   for (i = 0; i < BENCH_COUNTERS; ++i) {
+      struct perf_event_attr attr;
+
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = config[i];
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+      c->fd[i] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+      c->count[i] = -1;
+      if (c->fd[i] >= 0) {
+         any = 1;
+      } else if (!c->error) {
+         c->error = errno == ENOENT ? "no hardware counters (virtual machine?)" :
+            errno == EACCES || errno == EPERM ? "not permitted (see /proc/sys/kernel/perf_event_paranoid)" :
+            strerror(errno);
+      }
+   }
+   return any;
+}
+
+static __inline void bench_counters_start(BenchCounters *c)
+{
+   int i;
+
+   for (i = 0; i < BENCH_COUNTERS; ++i) {
+      if (c->fd[i] >= 0) {
+         ioctl(c->fd[i], PERF_EVENT_IOC_RESET, 0);
+         ioctl(c->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+      }
+   }
+}
+
+// Counts are scaled up when the kernel multiplexed a counter.
+static __inline void bench_counters_stop(BenchCounters *c)
+{
+   int i;
+
+   for (i = 0; i < BENCH_COUNTERS; ++i) {
+      unsigned long long v[3];
+
+      c->count[i] = -1;
+      if (c->fd[i] >= 0) {
+         ioctl(c->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+         if (read(c->fd[i], v, sizeof(v)) == (ssize_t)sizeof(v) && v[2]) {
+            c->count[i] = (double)v[0] * ((double)v[1] / (double)v[2]);
+         }
+      }
+   }
+}
+
+static __inline void bench_counters_close(BenchCounters *c)
+{
+   int i;
+
+   for (i = 0; i < BENCH_COUNTERS; ++i) {
+      if (c->fd[i] >= 0) {
+         close(c->fd[i]);
+      }
+      c->fd[i] = -1;
+   }
+}
+#else
+static __inline int bench_counters_open(BenchCounters *c)
+{
+   int i;
+
+   for (i = 0; i < BENCH_COUNTERS; ++i) {
+      c->fd[i] = -1;
+      c->count[i] = -1;
+   }
+   c->error = "not supported on this system";
+   return 0;
+}
+
+static __inline void bench_counters_start(BenchCounters *c) { (void)c; }
+static __inline void bench_counters_stop(BenchCounters *c) { (void)c; }
+static __inline void bench_counters_close(BenchCounters *c) { (void)c; }
+#endif   //__linux__
+
+// JSON results, compared across builds by bench_diff. A file describes the
+// build and machine and holds one entry per measurement with the time of every
+// repetition, lower being better:
+//
+//   { "benchmark": "bench_ops", "compiler": "gcc 12.2.0", "flags": "-O2",
+//     "cpu": "...", "args": "65536 20", "results": [
+//       { "op": "div", "dist": "full", "metric": "latency", "unit": "ns",
+//         "median": 21.4, "min": 21.1, "samples": [21.3, 21.1, ...],
+//         "counters": { "cycles": 63.2, ... } },
+//       ... ] }
+//
+// The Makefile passes the compiler flags in BENCH_FLAGS.
+
+#ifndef BENCH_FLAGS
+#  define BENCH_FLAGS ""
+#endif
+
+#if defined(__clang__)
+#  define BENCH_COMPILER "clang " __clang_version__
+#elif defined(__GNUC__)
+#  define BENCH_COMPILER "gcc " __VERSION__
+#elif defined(_MSC_VER)
+#  define BENCH_COMPILER "msvc"
+#else
+#  define BENCH_COMPILER "unknown"
+#endif
+
+typedef struct BenchJson {
+   FILE *f;
+   int results;
+} BenchJson;
+
+static const char *benchCounterNames[BENCH_COUNTERS] = {
+   "cycles", "instructions", "branches", "branch-misses", "cache-misses"
+};
+
+static __inline void bench_json_string(FILE *f, const char *s)
+{
+   fputc('"', f);
+   for (; *s; ++s) {
+      if (*s == '"' || *s == '\\') {
+         fprintf(f, "\\%c", *s);
+      } else if ((unsigned char)*s < 0x20) {
+         fprintf(f, "\\u%04x", (unsigned char)*s);
+      } else {
+         fputc(*s, f);
+      }
+   }
+   fputc('"', f);
+}
+
+// The processor model from /proc/cpuinfo, or "unknown".
+static __inline void bench_cpu_model(char *buf, size_t size)
+{
+   FILE *f = fopen("/proc/cpuinfo", "r");
+   char line[256];
+
+   snprintf(buf, size, "unknown");
+   if (!f) {
+      return;
+   }
+   while (fgets(line, sizeof(line), f)) {
+      char *colon = strchr(line, ':');
+      if (colon && (!strncmp(line, "model name", 10) || !strncmp(line, "Model", 5))) {
+         size_t n;
+         for (++colon; *colon == ' '; ++colon) {
+         }
+         snprintf(buf, size, "%s", colon);
+         n = strlen(buf);
+         if (n && buf[n - 1] == '\n') {
+            buf[n - 1] = '\0';
+         }
+         break;
+      }
+   }
+   fclose(f);
+}
+
+// Removes "--json FILE" from the arguments and returns FILE, or NULL.
+static __inline const char *bench_json_arg(int *argc, char **argv)
+{
+   const char *path = NULL;
+   int i, j;
+
+   for (i = j = 1; i < *argc; ++i) {
+      if (!strcmp(argv[i], "--json") && i + 1 < *argc) {
+         path = argv[++i];
+      } else {
+         argv[j++] = argv[i];
+      }
+   }
+   *argc = j;
+   argv[j] = NULL;
+   return path;
+}
+
+// Starts a result file; the arguments are the ones left after bench_json_arg.
+static __inline int bench_json_open(BenchJson *j, const char *path, const char *name, int argc, char **argv)
+{
+   char cpu[256];
+   int i;
+
+   j->results = 0;
+   j->f = fopen(path, "w");
+   if (!j->f) {
+      fprintf(stderr, "cannot write %s: %s\n", path, strerror(errno));
+      return 0;
+   }
+
+   bench_cpu_model(cpu, sizeof(cpu));
+   fprintf(j->f, "{\n  \"benchmark\": ");
+   bench_json_string(j->f, name);
+   fprintf(j->f, ",\n  \"compiler\": ");
+   bench_json_string(j->f, BENCH_COMPILER);
+   fprintf(j->f, ",\n  \"flags\": ");
+   bench_json_string(j->f, BENCH_FLAGS);
+   fprintf(j->f, ",\n  \"cpu\": ");
+   bench_json_string(j->f, cpu);
+   fprintf(j->f, ",\n  \"args\": \"");
+   for (i = 1; i < argc; ++i) {
+      fprintf(j->f, "%s%s", i > 1 ? " " : "", argv[i]);
+   }
+   fprintf(j->f, "\",\n  \"results\": [");
+   return 1;
+}
+
+static __inline int bench_compare_double(const void *a, const void *b)
+{
+   double x = *(const double *)a, y = *(const double *)b;
+   return x < y ? -1 : x > y;
+}
+
+// Writes one measurement: n repetitions of op on dist, in unit per operation.
+// Counters, if not NULL, are per operation; negative ones are left out.
+static __inline void bench_json_result(BenchJson *j, const char *op, const char *dist, const char *metric,
+   const char *unit, const double *samples, int n, const double *counters)
+{
+   double sorted[256];
+   int i, m = n < 256 ? n : 256;
+
+   if (!j->f || n <= 0) {
+      return;
+   }
+
+   memcpy(sorted, samples, m * sizeof(double));
+   qsort(sorted, m, sizeof(double), bench_compare_double);
+
+   fprintf(j->f, "%s\n    { \"op\": ", j->results++ ? "," : "");
+   bench_json_string(j->f, op);
+   fprintf(j->f, ", \"dist\": ");
+   bench_json_string(j->f, dist);
+   fprintf(j->f, ", \"metric\": ");
+   bench_json_string(j->f, metric);
+   fprintf(j->f, ", \"unit\": ");
+   bench_json_string(j->f, unit);
+   fprintf(j->f, ",\n      \"median\": %.6g, \"min\": %.6g, \"samples\": [",
+      m & 1 ? sorted[m / 2] : (sorted[m / 2 - 1] + sorted[m / 2]) / 2, sorted[0]);
+   for (i = 0; i < m; ++i) {
+      fprintf(j->f, "%s%.6g", i ? ", " : "", samples[i]);
+   }
+   fprintf(j->f, "]");
+
+   if (counters) {
+      int any = 0;
+      for (i = 0; i < BENCH_COUNTERS; ++i) {
+         if (counters[i] >= 0) {
+            fprintf(j->f, "%s\"%s\": %.6g", any++ ? ", " : ",\n      \"counters\": { ",
+               benchCounterNames[i], counters[i]);
+         }
+      }
+      if (any) {
+         fprintf(j->f, " }");
+      }
+   }
+   fprintf(j->f, " }");
+}
+
+static __inline void bench_json_close(BenchJson *j)
+{
+   if (j->f) {
+      fprintf(j->f, "\n  ]\n}\n");
+      fclose(j->f);
+      j->f = NULL;
+   }
+}
+
+#endif   //H_BENCH_H
@@ -0,0 +1,120 @@
+// bench_array: the dispatched array kernels at each CPU level.
+//
+// Runs r128AddArray, r128SubArray and r128MulArray over random values once
+// with each level up to the best the processor supports (see r128CpuSet), and
+// reports ns per element and the speedup over the scalar kernels. Functions
+// without a kernel for a level run the best lower one, as r128CpuReport shows.
+//
+// With --json FILE, every repetition's time is also written to FILE for
+// bench_diff, with the level as the distribution.
+//
+// usage: bench_array [--json FILE] [elements] [repetitions]
+
+#define R128_IMPLEMENTATION
+#include "../r128.h"
+#include "bench.h"
+
+#include <string.h>
+
+static const char *levelNames[R128Cpu_Count] = { "scalar", "avx2", "avx512ifma" };
+
+static const struct {
+   const char *name;
+   void (*fn)(R128 *dst, const R128 *a, const R128 *b, size_t n);
+} ops[] = {
+   { "add", r128AddArray },
+   { "sub", r128SubArray },
+   { "mul", r128MulArray },
+};
+
+enum { OPS = sizeof(ops) / sizeof(ops[0]) };
+
+static R128_U64 rng = R128_LIT_U64(0x9e3779b97f4a7c15);
+
+static R128_U64 next(void)
+{
+   rng ^= rng << 13;
+   rng ^= rng >> 7;
+   rng ^= rng << 17;
+   return rng;
+}
+
+int main(int argc, char **argv)
+{
+   const char *jsonPath = bench_json_arg(&argc, argv);
+   BenchJson json = { 0 };
+   size_t count, i;
+   double ns[OPS][R128Cpu_Count];
+   double *samples;
+   R128 *a, *b, *c;
+   char report[512];
+   int reps, passes, best, level, op, rep;
+
+   count = (size_t)bench_arg(argc, argv, 1, 4096);
+   reps = (int)bench_arg(argc, argv, 2, 5);
+   passes = (int)((1 << 22) / count) + 1;
+   if (jsonPath && !bench_json_open(&json, jsonPath, "bench_array", argc, argv)) {
+      return 1;
+   }
+
+   samples = (double *)malloc(reps * sizeof(double));
+   a = (R128 *)malloc(count * sizeof(R128));
+   b = (R128 *)malloc(count * sizeof(R128));
+   c = (R128 *)malloc(count * sizeof(R128));
+   if (!samples || !a || !b || !c) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+   }
+
+   // values around +-2^20, with full fractions
+   for (i = 0; i < count; ++i) {
+      R128_SET2(&a[i], next(), (R128_U64)((R128_S64)next() >> 43));
+      R128_SET2(&b[i], next(), (R128_U64)((R128_S64)next() >> 43));
+   }
+
+   best = r128CpuSet(R128Cpu_Count);
+   r128CpuReport(report, sizeof(report));
+   printf("%s\n%lu elements, best of %d; ns per element\n", report, (unsigned long)count, reps);
+
+   for (level = R128Cpu_Scalar; level <= best; ++level) {
+      r128CpuSet((R128Cpu)level);
+      for (op = 0; op < OPS; ++op) {
+         ns[op][level] = 1e30;
+         for (rep = 0; rep < reps; ++rep) {
+            double t = bench_now();
+            int pass;
+
+            for (pass = 0; pass < passes; ++pass) {
+               ops[op].fn(c, a, b, count);
+               BENCH_KEEP(c[0]);
+            }
+            samples[rep] = (bench_now() - t) * 1e9 / ((double)passes * count);
+            if (samples[rep] < ns[op][level]) {
+               ns[op][level] = samples[rep];
+            }
+         }
+         if (jsonPath) {
+            bench_json_result(&json, ops[op].name, levelNames[level], "time", "ns", samples, reps, NULL);
+         }
+      }
+   }
+   r128CpuSet(R128Cpu_Auto);
+
+   printf("%-6s", "op");
+   for (level = R128Cpu_Scalar; level <= best; ++level) {
+      printf(" %10s %8s", levelNames[level], "speedup");
+   }
+   printf("\n");
+   for (op = 0; op < OPS; ++op) {
+      printf("%-6s", ops[op].name);
+      for (level = R128Cpu_Scalar; level <= best; ++level) {
+         printf(" %10.3f %8.2f", ns[op][level], ns[op][R128Cpu_Scalar] / ns[op][level]);
+      }
+      printf("\n");
+   }
+
+   if (jsonPath) {
+      bench_json_close(&json);
+   }
+   return 0;
+}
@@ -0,0 +1,97 @@
+// bench_atomic: contention benchmark for R128Atomic.
+//
+// Every thread adds into one shared total, either with r128AtomicFetchAdd or
+// with r128Add under a pthread mutex, for 1 to max-threads threads.
+//
+// usage: bench_atomic [ops-per-thread] [max-threads]
+
+#define R128_IMPLEMENTATION
+#include "../r128_atomic.h"
+#include "bench.h"
+
+#include <pthread.h>
+
+static long opsPerThread;
+static R128Atomic atomicTotal;
+static R128 mutexTotal;
+static pthread_mutex_t mutexLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *run_atomic(void *arg)
+{
+   R128 inc;
+   long i;
+
+   (void)arg;
+   r128FromFloat(&inc, 0.01);
+   for (i = 0; i < opsPerThread; ++i) {
+      r128AtomicFetchAdd(NULL, &atomicTotal, &inc);
+   }
+   return NULL;
+}
+
+static void *run_mutex(void *arg)
+{
+   R128 inc;
+   long i;
+
+   (void)arg;
+   r128FromFloat(&inc, 0.01);
+   for (i = 0; i < opsPerThread; ++i) {
+      pthread_mutex_lock(&mutexLock);
+      r128Add(&mutexTotal, &mutexTotal, &inc);
+      pthread_mutex_unlock(&mutexLock);
+   }
+   return NULL;
+}
+
+// Returns ns per operation, summed over all threads.
+static double run(void *(*fn)(void *), int threads)
+{
+   pthread_t tid[64];
+   double start;
+   int i;
+
+   start = bench_now();
+   for (i = 0; i < threads; ++i) {
+      pthread_create(&tid[i], NULL, fn, NULL);
+   }
+   for (i = 0; i < threads; ++i) {
+      pthread_join(tid[i], NULL);
+   }
+   return (bench_now() - start) * 1e9 / ((double)opsPerThread * threads);
+}
+
+int main(int argc, char **argv)
+{
+   int maxThreads, threads;
+
+   opsPerThread = bench_arg(argc, argv, 1, 200000);
+   maxThreads = (int)bench_arg(argc, argv, 2, 64);
+   if (maxThreads > 64) {
+      maxThreads = 64;
+   }
+
+   printf("R128Atomic is %slock-free\n", r128AtomicIsLockFree() ? "" : "NOT ");
+   printf("%8s %14s %14s %10s\n", "threads", "atomic ns/op", "mutex ns/op", "speedup");
+
+   for (threads = 1; threads <= maxThreads; threads *= 2) {
+      R128 got;
+      double tAtomic, tMutex;
+
+      r128AtomicInit(&atomicTotal, &R128_zero);
+      r128Copy(&mutexTotal, &R128_zero);
+
+      tAtomic = run(run_atomic, threads);
+      tMutex = run(run_mutex, threads);
+
+      r128AtomicLoad(&got, &atomicTotal);
+      if (r128Cmp(&got, &mutexTotal) != 0) {
+         fprintf(stderr, "totals differ at %d threads\n", threads);
+         return 1;
+      }
+
+      printf("%8d %14.2f %14.2f %9.2fx\n", threads, tAtomic, tMutex, tMutex / tAtomic);
+   }
+
+   return 0;
+}
@@ -0,0 +1,392 @@
+// bench_compare: R128 against double, long double, __int128 and __float128.
+//
+// Runs the same kernels over the same decimal inputs for each type:
+//   sum      s += x[i]
+//   dot      s += x[i] * y[i]
+//   axpy     z[i] = 0.3 * x[i] + y[i]
+//   divide   z[i] = x[i] / y[i]
+//   poly     z[i] = p(x[i] / 1024), degree 8 by Horner's rule, p's k-th
+//            coefficient (k + 1) / 10
+//   parse    x[i] from its decimal string
+//   format   x[i] to a decimal string with enough digits to read it back
+// where x are prices in (-1000, 1000) with 4 decimals and y quantities in
+// (0, 10000) with 2 decimals, each type reading them from the same strings.
+//
+// Reports ns per element (the best of several runs) and the largest relative
+// error. sum, dot, axpy and parse are measured against the exact decimal
+// result; divide and poly against __float128 evaluated on the exact inputs, so
+// the __float128 row shows "ref" there; format against reading the string back
+// with __float128. Fixed-point errors are absolute (about 2^-64 per rounding),
+// so their relative errors are largest for the results closest to zero.
+//
+// Q64 is a signed __int128 with 64 fraction bits, the usual hand-rolled fixed
+// point: add and compare are native, multiply truncates from four 64x64
+// products, and divide produces the quotient 32 bits at a time (valid for
+// divisors below 2^31).
+//
+// Needs GCC or Clang on x86-64 with libquadmath.
+//
+// usage: bench_compare [elements] [repetitions]
+
+#define R128_IMPLEMENTATION
+#include "../r128.h"
+#include "bench.h"
+
+#include <quadmath.h>
+#include <string.h>
+
+typedef __float128 quad;
+
+struct Q64 {
+   __int128 v;
+};
+
+static inline Q64 operator+(Q64 a, Q64 b) { Q64 r; r.v = a.v + b.v; return r; }
+
+static inline Q64 operator*(Q64 a, Q64 b)
+{
+   int neg = (a.v < 0) != (b.v < 0);
+   unsigned __int128 ua = a.v < 0 ? -(unsigned __int128)a.v : (unsigned __int128)a.v;
+   unsigned __int128 ub = b.v < 0 ? -(unsigned __int128)b.v : (unsigned __int128)b.v;
+   R128_U64 a0 = (R128_U64)ua, a1 = (R128_U64)(ua >> 64);
+   R128_U64 b0 = (R128_U64)ub, b1 = (R128_U64)(ub >> 64);
+   unsigned __int128 p = ((unsigned __int128)a1 * b1 << 64) + (unsigned __int128)a1 * b0 +
+      (unsigned __int128)a0 * b1 + (((unsigned __int128)a0 * b0) >> 64);
+   Q64 r;
+   r.v = neg ? -(__int128)p : (__int128)p;
+   return r;
+}
+
+static inline Q64 operator/(Q64 a, Q64 b)
+{
+   int neg = (a.v < 0) != (b.v < 0);
+   unsigned __int128 ua = a.v < 0 ? -(unsigned __int128)a.v : (unsigned __int128)a.v;
+   unsigned __int128 ub = b.v < 0 ? -(unsigned __int128)b.v : (unsigned __int128)b.v;
+   unsigned __int128 q = ua / ub, rem = ua % ub;
+   q = (q << 32) + (rem << 32) / ub;
+   rem = (rem << 32) % ub;
+   q = (q << 32) + (rem << 32) / ub;
+   Q64 r;
+   r.v = neg ? -(__int128)q : (__int128)q;
+   return r;
+}
+
+// Per-type conversions. parse and format are what an application would use:
+// strtod, snprintf, r128FromString, r128ToString and so on.
+template <class T> struct Num;
+
+template <> struct Num<double> {
+   static const char *name() { return "double"; }
+   static double parse(const char *s) { return strtod(s, NULL); }
+   static int format(char *buf, size_t size, double v) { return snprintf(buf, size, "%.17g", v); }
+   static quad toQuad(double v) { return v; }
+};
+
+template <> struct Num<long double> {
+   static const char *name() { return "long double"; }
+   static long double parse(const char *s) { return strtold(s, NULL); }
+   static int format(char *buf, size_t size, long double v) { return snprintf(buf, size, "%.21Lg", v); }
+   static quad toQuad(long double v) { return v; }
+};
+
+template <> struct Num<quad> {
+   static const char *name() { return "__float128"; }
+   static quad parse(const char *s) { return strtoflt128(s, NULL); }
+   static int format(char *buf, size_t size, quad v) { return quadmath_snprintf(buf, size, "%.36Qg", v); }
+   static quad toQuad(quad v) { return v; }
+};
+
+template <> struct Num<R128> {
+   static const char *name() { return "R128"; }
+   static R128 parse(const char *s) { R128 r; r128FromString(&r, s, NULL); return r; }
+   static int format(char *buf, size_t size, const R128 &v) { return r128ToString(buf, size, &v); }
+   static quad toQuad(const R128 &v) { return (quad)(R128_S64)v.hi + (quad)v.lo / (quad)18446744073709551616.0; }
+};
+
+template <> struct Num<Q64> {
+   static const char *name() { return "Q64"; }
+
+   static Q64 parse(const char *s)
+   {
+      static const R128_U64 pow10[20] = { 1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull,
+         10000000ull, 100000000ull, 1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull,
+         10000000000000ull, 100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+         100000000000000000ull, 1000000000000000000ull, 10000000000000000000ull };
+      R128_U64 ip = 0, fp = 0;
+      int neg = *s == '-', digits = 0;
+      Q64 r;
+
+      s += neg || *s == '+';
+      for (; *s >= '0' && *s <= '9'; ++s) {
+         ip = ip * 10 + (R128_U64)(*s - '0');
+      }
+      if (*s == '.') {
+         for (++s; *s >= '0' && *s <= '9' && digits < 19; ++s, ++digits) {
+            fp = fp * 10 + (R128_U64)(*s - '0');
+         }
+      }
+      r.v = (__int128)(((unsigned __int128)ip << 64) +
+         (((unsigned __int128)fp << 64) + pow10[digits] / 2) / pow10[digits]);
+      if (neg) {
+         r.v = -r.v;
+      }
+      return r;
+   }
+
+   static int format(char *buf, size_t size, Q64 v)
+   {
+      unsigned __int128 u = v.v < 0 ? -(unsigned __int128)v.v : (unsigned __int128)v.v;
+      R128_U64 frac = (R128_U64)u;
+      int n = snprintf(buf, size, "%s%llu.", v.v < 0 ? "-" : "", (unsigned long long)(u >> 64)), i;
+
+      for (i = 0; i < 20 && (size_t)n + 1 < size; ++i) {
+         unsigned __int128 t = (unsigned __int128)frac * 10;
+         buf[n++] = (char)('0' + (int)(t >> 64));
+         frac = (R128_U64)t;
+      }
+      buf[n] = '\0';
+      return n;
+   }
+
+   static quad toQuad(Q64 v) { return (quad)v.v / (quad)18446744073709551616.0; }
+};
+
+enum { SUM, DOT, AXPY, DIVIDE, POLY, PARSE, FORMAT, KERNELS };
+
+static const char *kernelNames[KERNELS] = { "sum", "dot", "axpy", "divide", "poly", "parse", "format" };
+
+#define DEGREE 8
+#define STRIDE 64
+
+static size_t count;
+static int reps;
+static R128_S64 *X, *Y;             // x * 10^4 and y * 10^2
+static char *xText, *yText;         // the decimal strings
+static const char **xs, **ys;
+static char *formatted;
+static quad exact[KERNELS];         // exact sum and dot
+static quad *refAxpy, *refDivide, *refPoly;
+
+static double timeNs[5][KERNELS];
+static quad maxError[5][KERNELS];
+
+static quad relError(quad v, quad ref)
+{
+   quad e = v - ref;
+   if (e < 0) {
+      e = -e;
+   }
+   if (ref < 0) {
+      ref = -ref;
+   }
+   return ref != 0 ? e / ref : e;
+}
+
+template <class F>
+static double best_ns(F fn)
+{
+   double best = 1e30;
+
+   for (int rep = 0; rep < reps; ++rep) {
+      double start = bench_now(), t;
+      fn();
+      t = (bench_now() - start) * 1e9 / count;
+      if (t < best) {
+         best = t;
+      }
+   }
+   return best;
+}
+
+template <class T>
+static void run(int row)
+{
+   typedef Num<T> N;
+   T *x = new T[count], *y = new T[count], *z = new T[count];
+   T zero = N::parse("0"), a = N::parse("0.3"), scale = N::parse("0.0009765625"), c[DEGREE + 1];
+   T s;
+   size_t i;
+
+   for (i = 0; i <= DEGREE; ++i) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "0.%d", (int)(i + 1));
+      c[i] = N::parse(buf);
+   }
+   for (i = 0; i < count; ++i) {
+      x[i] = N::parse(xs[i]);
+      y[i] = N::parse(ys[i]);
+   }
+
+   timeNs[row][SUM] = best_ns([&] {
+      s = zero;
+      for (size_t j = 0; j < count; ++j) {
+         s = s + x[j];
+      }
+      BENCH_KEEP(s);
+   });
+   maxError[row][SUM] = relError(N::toQuad(s), exact[SUM]);
+
+   timeNs[row][DOT] = best_ns([&] {
+      s = zero;
+      for (size_t j = 0; j < count; ++j) {
+         s = s + x[j] * y[j];
+      }
+      BENCH_KEEP(s);
+   });
+   maxError[row][DOT] = relError(N::toQuad(s), exact[DOT]);
+
+   timeNs[row][AXPY] = best_ns([&] {
+      for (size_t j = 0; j < count; ++j) {
+         z[j] = a * x[j] + y[j];
+      }
+      BENCH_KEEP(z[count - 1]);
+   });
+   for (i = 0; i < count; ++i) {
+      quad e = relError(N::toQuad(z[i]), refAxpy[i]);
+      maxError[row][AXPY] = e > maxError[row][AXPY] ? e : maxError[row][AXPY];
+   }
+
+   timeNs[row][DIVIDE] = best_ns([&] {
+      for (size_t j = 0; j < count; ++j) {
+         z[j] = x[j] / y[j];
+      }
+      BENCH_KEEP(z[count - 1]);
+   });
+   for (i = 0; i < count; ++i) {
+      quad e = relError(N::toQuad(z[i]), refDivide[i]);
+      maxError[row][DIVIDE] = e > maxError[row][DIVIDE] ? e : maxError[row][DIVIDE];
+   }
+
+   timeNs[row][POLY] = best_ns([&] {
+      for (size_t j = 0; j < count; ++j) {
+         T t = x[j] * scale, p = c[DEGREE];
+         for (int k = DEGREE - 1; k >= 0; --k) {
+            p = p * t + c[k];
+         }
+         z[j] = p;
+      }
+      BENCH_KEEP(z[count - 1]);
+   });
+   for (i = 0; i < count; ++i) {
+      quad e = relError(N::toQuad(z[i]), refPoly[i]);
+      maxError[row][POLY] = e > maxError[row][POLY] ? e : maxError[row][POLY];
+   }
+
+   timeNs[row][PARSE] = best_ns([&] {
+      for (size_t j = 0; j < count; ++j) {
+         z[j] = N::parse(xs[j]);
+      }
+      BENCH_KEEP(z[count - 1]);
+   });
+   for (i = 0; i < count; ++i) {
+      quad e = relError(N::toQuad(z[i]), (quad)X[i] / 10000);
+      maxError[row][PARSE] = e > maxError[row][PARSE] ? e : maxError[row][PARSE];
+   }
+
+   timeNs[row][FORMAT] = best_ns([&] {
+      for (size_t j = 0; j < count; ++j) {
+         N::format(formatted + j * STRIDE, STRIDE, x[j]);
+      }
+      BENCH_KEEP(formatted[0]);
+   });
+   for (i = 0; i < count; ++i) {
+      quad e = relError(strtoflt128(formatted + i * STRIDE, NULL), N::toQuad(x[i]));
+      maxError[row][FORMAT] = e > maxError[row][FORMAT] ? e : maxError[row][FORMAT];
+   }
+
+   delete[] x;
+   delete[] y;
+   delete[] z;
+}
+
+int main(int argc, char **argv)
+{
+   static const char *rowNames[5] = { "R128", "double", "long double", "Q64", "__float128" };
+   R128_U64 rng = 0x9e3779b97f4a7c15ull;
+   __int128 sum = 0, dot = 0;
+   size_t i;
+   int row, k;
+
+   count = (size_t)bench_arg(argc, argv, 1, 1 << 20);
+   reps = (int)bench_arg(argc, argv, 2, 3);
+
+   X = new R128_S64[count];
+   Y = new R128_S64[count];
+   xText = new char[count * 24];
+   yText = new char[count * 24];
+   xs = new const char *[count];
+   ys = new const char *[count];
+   formatted = new char[count * STRIDE];
+   refAxpy = new quad[count];
+   refDivide = new quad[count];
+   refPoly = new quad[count];
+
+   for (i = 0; i < count; ++i) {
+      R128_S64 ax;
+      quad t, p, xq, yq;
+
+      rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+      X[i] = (R128_S64)(rng % 19999999) - 9999999;
+      Y[i] = 1 + (R128_S64)((rng >> 32) % 999999);
+      ax = X[i] < 0 ? -X[i] : X[i];
+      snprintf(xText + i * 24, 24, "%s%lld.%04lld", X[i] < 0 ? "-" : "", (long long)(ax / 10000), (long long)(ax % 10000));
+      snprintf(yText + i * 24, 24, "%lld.%02lld", (long long)(Y[i] / 100), (long long)(Y[i] % 100));
+      xs[i] = xText + i * 24;
+      ys[i] = yText + i * 24;
+
+      sum += X[i];
+      dot += (__int128)X[i] * Y[i];
+
+      // 0.3 * x + y = (3 * X + 1000 * Y) / 10^5, exactly
+      refAxpy[i] = (quad)(3 * X[i] + 1000 * Y[i]) / 100000;
+      xq = (quad)X[i] / 10000;
+      yq = (quad)Y[i] / 100;
+      refDivide[i] = xq / yq;
+      t = xq / 1024;
+      p = (quad)(DEGREE + 1) / 10;
+      for (k = DEGREE - 1; k >= 0; --k) {
+         p = p * t + (quad)(k + 1) / 10;
+      }
+      refPoly[i] = p;
+   }
+   exact[SUM] = (quad)sum / 10000;
+   exact[DOT] = (quad)dot / 1000000;
+
+   run<R128>(0);
+   run<double>(1);
+   run<long double>(2);
+   run<Q64>(3);
+   run<quad>(4);
+
+   printf("%lu elements, best of %d\n\nns per element\n%-12s", (unsigned long)count, reps, "");
+   for (k = 0; k < KERNELS; ++k) {
+      printf(" %9s", kernelNames[k]);
+   }
+   printf("\n");
+   for (row = 0; row < 5; ++row) {
+      printf("%-12s", rowNames[row]);
+      for (k = 0; k < KERNELS; ++k) {
+         printf(" %9.2f", timeNs[row][k]);
+      }
+      printf("\n");
+   }
+
+   printf("\nlargest relative error\n%-12s", "");
+   for (k = 0; k < KERNELS; ++k) {
+      printf(" %9s", kernelNames[k]);
+   }
+   printf("\n");
+   for (row = 0; row < 5; ++row) {
+      printf("%-12s", rowNames[row]);
+      for (k = 0; k < KERNELS; ++k) {
+         if (row == 4 && (k == DIVIDE || k == POLY)) {
+            printf(" %9s", "ref");
+         } else {
+            printf(" %9.1e", (double)maxError[row][k]);
+         }
+      }
+      printf("\n");
+   }
+
+   return 0;
+}
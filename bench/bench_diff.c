@@ -0,0 +1,392 @@
+// bench_diff: compares two --json result files from bench_ops or bench_text.
+//
+// Matches measurements by op, distribution and metric, and for each computes
+// the change of the mean time with a confidence interval from the repetitions
+// (Welch's t interval, which does not assume equal variances). A measurement is
+// flagged as a regression only if the whole interval lies above the threshold,
+// so noise alone does not trip it; likewise for improvements.
+//
+//    bench_ops 65536 30 --json before.json      (old compiler)
+//    bench_ops 65536 30 --json after.json       (new compiler)
+//    bench_diff before.json after.json
+//
+// Use 10 or more repetitions per run for useful intervals. Exits with 1 if
+// anything regressed, 2 on errors.
+//
+// usage: bench_diff [-t threshold%] [-c confidence%] [-q] before.json after.json
+//   -t  smallest change worth reporting, in percent (default 1)
+//   -c  confidence level of the intervals, in percent (default 95)
+//   -q  list only regressions and improvements
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT };
+
+typedef struct Json {
+   int type;
+   double number;
+   char *string;
+   char **keys;            // objects only
+   struct Json *items;     // array elements or object values
+   int count;
+} Json;
+
+typedef struct Parser {
+   const char *p;
+   const char *error;
+} Parser;
+
+static void skip_space(Parser *ps)
+{
+   while (*ps->p == ' ' || *ps->p == '\t' || *ps->p == '\n' || *ps->p == '\r') {
+      ++ps->p;
+   }
+}
+
+static char *parse_string(Parser *ps)
+{
+   size_t cap = 16, n = 0;
+   char *s = (char *)malloc(cap);
+
+   ++ps->p;    // opening quote
+   while (*ps->p && *ps->p != '"') {
+      char c = *ps->p++;
+      if (c == '\\') {
+         c = *ps->p++;
+         switch (c) {
+         case 'n': c = '\n'; break;
+         case 't': c = '\t'; break;
+         case 'r': c = '\r'; break;
+         case 'b': c = '\b'; break;
+         case 'f': c = '\f'; break;
+         case 'u': {
+            // only the control characters bench.h escapes
+            char hex[5] = { 0 };
+            strncpy(hex, ps->p, 4);
+            c = (char)strtol(hex, NULL, 16);
+            ps->p += strlen(hex);
+            break;
+         }
+         case '\0':
+            ps->error = "unterminated string";
+            return s;
+         default:
+            break;
+         }
+      }
+      if (n + 1 >= cap) {
+         cap *= 2;
+         s = (char *)realloc(s, cap);
+      }
+      s[n++] = c;
+   }
+   s[n] = '\0';
+   if (*ps->p != '"') {
+      ps->error = "unterminated string";
+   } else {
+      ++ps->p;
+   }
+   return s;
+}
+
+static void parse_value(Parser *ps, Json *v);
+
+static void parse_list(Parser *ps, Json *v, char close)
+{
+   int cap = 0;
+
+   ++ps->p;
+   skip_space(ps);
+   if (*ps->p == close) {
+      ++ps->p;
+      return;
+   }
+
+   for (;;) {
+      if (v->count == cap) {
+         cap = cap ? cap * 2 : 8;
+         v->items = (Json *)realloc(v->items, cap * sizeof(Json));
+         if (v->type == JSON_OBJECT) {
+            v->keys = (char **)realloc(v->keys, cap * sizeof(char *));
+         }
+      }
+
+      skip_space(ps);
+      if (v->type == JSON_OBJECT) {
+         if (*ps->p != '"') {
+            ps->error = "expected a key";
+            return;
+         }
+         v->keys[v->count] = parse_string(ps);
+         skip_space(ps);
+         if (*ps->p++ != ':') {
+            ps->error = "expected ':'";
+            return;
+         }
+      }
+      parse_value(ps, &v->items[v->count++]);
+      if (ps->error) {
+         return;
+      }
+
+      skip_space(ps);
+      if (*ps->p == ',') {
+         ++ps->p;
+      } else if (*ps->p == close) {
+         ++ps->p;
+         return;
+      } else {
+         ps->error = v->type == JSON_OBJECT ? "expected ',' or '}'" : "expected ',' or ']'";
+         return;
+      }
+   }
+}
+
+static void parse_value(Parser *ps, Json *v)
+{
+   memset(v, 0, sizeof(*v));
+   skip_space(ps);
+
+   if (*ps->p == '{') {
+      v->type = JSON_OBJECT;
+      parse_list(ps, v, '}');
+   } else if (*ps->p == '[') {
+      v->type = JSON_ARRAY;
+      parse_list(ps, v, ']');
+   } else if (*ps->p == '"') {
+      v->type = JSON_STRING;
+      v->string = parse_string(ps);
+   } else if (!strncmp(ps->p, "true", 4) || !strncmp(ps->p, "false", 5)) {
+      v->type = JSON_BOOL;
+      v->number = *ps->p == 't';
+      ps->p += *ps->p == 't' ? 4 : 5;
+   } else if (!strncmp(ps->p, "null", 4)) {
+      v->type = JSON_NULL;
+      ps->p += 4;
+   } else {
+      char *end;
+      v->type = JSON_NUMBER;
+      v->number = strtod(ps->p, &end);
+      if (end == ps->p) {
+         ps->error = "unexpected character";
+      }
+      ps->p = end;
+   }
+}
+
+static const Json *member(const Json *obj, const char *key)
+{
+   int i;
+
+   if (obj && obj->type == JSON_OBJECT) {
+      for (i = 0; i < obj->count; ++i) {
+         if (!strcmp(obj->keys[i], key)) {
+            return &obj->items[i];
+         }
+      }
+   }
+   return NULL;
+}
+
+static const char *member_string(const Json *obj, const char *key)
+{
+   const Json *v = member(obj, key);
+   return v && v->type == JSON_STRING ? v->string : "";
+}
+
+static int load(const char *path, Json *root)
+{
+   FILE *f = fopen(path, "rb");
+   Parser ps;
+   char *text;
+   long size;
+
+   if (!f) {
+      fprintf(stderr, "cannot open %s\n", path);
+      return 0;
+   }
+   fseek(f, 0, SEEK_END);
+   size = ftell(f);
+   fseek(f, 0, SEEK_SET);
+   text = (char *)malloc(size + 1);
+   if (!text || fread(text, 1, size, f) != (size_t)size) {
+      fprintf(stderr, "cannot read %s\n", path);
+      fclose(f);
+      return 0;
+   }
+   text[size] = '\0';
+   fclose(f);
+
+   ps.p = text;
+   ps.error = NULL;
+   parse_value(&ps, root);
+   if (ps.error) {
+      fprintf(stderr, "%s:%d: %s\n", path, (int)(ps.p - text), ps.error);
+      return 0;
+   }
+   if (!member(root, "results") || member(root, "results")->type != JSON_ARRAY) {
+      fprintf(stderr, "%s: no results array\n", path);
+      return 0;
+   }
+   return 1;
+}
+
+typedef struct Stats {
+   double mean, var;    // sample variance
+   int n;
+} Stats;
+
+static Stats sample_stats(const Json *result)
+{
+   const Json *samples = member(result, "samples");
+   Stats s = { 0, 0, 0 };
+   int i;
+
+   if (!samples || samples->type != JSON_ARRAY) {
+      return s;
+   }
+   for (i = 0; i < samples->count; ++i) {
+      s.mean += samples->items[i].number;
+   }
+   s.n = samples->count;
+   if (s.n) {
+      s.mean /= s.n;
+   }
+   for (i = 0; i < s.n; ++i) {
+      double d = samples->items[i].number - s.mean;
+      s.var += d * d;
+   }
+   if (s.n > 1) {
+      s.var /= s.n - 1;
+   }
+   return s;
+}
+
+// Upper quantile of the standard normal distribution (Abramowitz and Stegun
+// 26.2.23, error below 4.5e-4), for 0 < p < 0.5.
+static double normal_quantile(double p)
+{
+   double t = sqrt(-2 * log(p));
+   return t - (2.515517 + 0.802853 * t + 0.010328 * t * t) /
+      (1 + 1.432788 * t + 0.189269 * t * t + 0.001308 * t * t * t);
+}
+
+// Upper quantile of Student's t with df degrees of freedom, by the
+// Cornish-Fisher expansion around the normal quantile.
+static double t_quantile(double p, double df)
+{
+   double z = normal_quantile(p), z2 = z * z;
+   return z + z * (z2 + 1) / (4 * df) + z * ((5 * z2 + 16) * z2 + 3) / (96 * df * df) +
+      z * (((3 * z2 + 19) * z2 + 17) * z2 - 15) / (384 * df * df * df);
+}
+
+int main(int argc, char **argv)
+{
+   double threshold = 1, confidence = 95;
+   int quiet = 0, regressions = 0, improvements = 0, compared = 0, i, j;
+   const char *paths[2];
+   int npaths = 0;
+   Json files[2];
+   const Json *before, *after;
+
+   for (i = 1; i < argc; ++i) {
+      if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+         threshold = atof(argv[++i]);
+      } else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+         confidence = atof(argv[++i]);
+      } else if (!strcmp(argv[i], "-q")) {
+         quiet = 1;
+      } else if (npaths < 2 && argv[i][0] != '-') {
+         paths[npaths++] = argv[i];
+      } else {
+         npaths = 0;
+         break;
+      }
+   }
+   if (npaths != 2 || confidence <= 0 || confidence >= 100) {
+      fprintf(stderr, "usage: bench_diff [-t threshold%%] [-c confidence%%] [-q] before.json after.json\n");
+      return 2;
+   }
+   if (!load(paths[0], &files[0]) || !load(paths[1], &files[1])) {
+      return 2;
+   }
+
+   for (i = 0; i < 2; ++i) {
+      printf("%-7s %s: %s, %s %s, %s\n", i ? "after" : "before", paths[i],
+         member_string(&files[i], "benchmark"), member_string(&files[i], "compiler"),
+         member_string(&files[i], "flags"), member_string(&files[i], "cpu"));
+   }
+   if (strcmp(member_string(&files[0], "cpu"), member_string(&files[1], "cpu"))) {
+      printf("warning: the files come from different processors\n");
+   }
+   if (strcmp(member_string(&files[0], "args"), member_string(&files[1], "args"))) {
+      printf("warning: the runs used different arguments\n");
+   }
+   printf("\nmean time per operation, change with %g%% confidence interval; threshold %g%%\n\n",
+      confidence, threshold);
+   printf("%-16s %-10s %-10s %10s %10s %9s %9s  %s\n", "op", "dist", "metric", "before", "after",
+      "change %", "+-", "");
+
+   before = member(&files[0], "results");
+   after = member(&files[1], "results");
+   for (i = 0; i < before->count; ++i) {
+      const Json *b = &before->items[i], *a = NULL;
+      const char *op = member_string(b, "op"), *dist = member_string(b, "dist");
+      const char *metric = member_string(b, "metric");
+      Stats sb, sa;
+      double se, df, t, change, margin;
+      const char *verdict = "";
+
+      for (j = 0; j < after->count && !a; ++j) {
+         const Json *c = &after->items[j];
+         if (!strcmp(op, member_string(c, "op")) && !strcmp(dist, member_string(c, "dist")) &&
+            !strcmp(metric, member_string(c, "metric"))) {
+            a = c;
+         }
+      }
+      if (!a) {
+         continue;
+      }
+
+      sb = sample_stats(b);
+      sa = sample_stats(a);
+      if (sb.n < 2 || sa.n < 2 || sb.mean <= 0) {
+         if (!quiet) {
+            printf("%-16s %-10s %-10s %10.3f %10.3f %9s %9s  needs 2 or more repetitions\n", op, dist,
+               metric, sb.mean, sa.mean, "", "");
+         }
+         continue;
+      }
+      ++compared;
+
+      // Welch-Satterthwaite degrees of freedom
+      se = sqrt(sb.var / sb.n + sa.var / sa.n);
+      if (se > 0) {
+         df = pow(se, 4) / (pow(sb.var / sb.n, 2) / (sb.n - 1) + pow(sa.var / sa.n, 2) / (sa.n - 1));
+      } else {
+         df = sb.n + sa.n - 2;
+      }
+      t = t_quantile((1 - confidence / 100) / 2, df);
+
+      change = 100 * (sa.mean - sb.mean) / sb.mean;
+      margin = 100 * t * se / sb.mean;
+      if (change - margin > threshold) {
+         verdict = "SLOWER";
+         ++regressions;
+      } else if (change + margin < -threshold) {
+         verdict = "faster";
+         ++improvements;
+      } else if (quiet) {
+         continue;
+      }
+
+      printf("%-16s %-10s %-10s %10.3f %10.3f %+9.2f %9.2f  %s\n", op, dist, metric, sb.mean, sa.mean,
+         change, margin, verdict);
+   }
+
+   printf("\n%d compared, %d slower, %d faster\n", compared, regressions, improvements);
+   return regressions ? 1 : 0;
+}
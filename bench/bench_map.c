@@ -0,0 +1,128 @@
+// bench_map: group-by aggregation into R128Map.
+//
+// Every thread adds a fee to the accumulator of a random price level, through
+// r128MapAggregate (batched, with prefetch) and r128MapAdd (one key at a time),
+// for 1 to max-threads threads and key cardinalities from 16 to 1M. Checks that
+// the grand total matches the sum of the fees.
+//
+// usage: bench_map [ops-per-thread] [max-threads]
+
+#define R128_IMPLEMENTATION
+#include "../r128_atomic.h"
+#include "bench.h"
+
+#include <pthread.h>
+
+static long opsPerThread;
+static R128Map map;
+static R128 *keys, *fees;
+
+typedef struct Worker {
+   pthread_t tid;
+   int index;
+} Worker;
+
+static void *run_aggregate(void *arg)
+{
+   Worker *w = (Worker *)arg;
+   size_t begin = (size_t)w->index * opsPerThread;
+
+   r128MapAggregate(&map, keys + begin, fees + begin, (size_t)opsPerThread);
+   return NULL;
+}
+
+static void *run_add(void *arg)
+{
+   Worker *w = (Worker *)arg;
+   size_t begin = (size_t)w->index * opsPerThread;
+   long i;
+
+   for (i = 0; i < opsPerThread; ++i) {
+      r128MapAdd(&map, &keys[begin + i], &fees[begin + i]);
+   }
+   return NULL;
+}
+
+// Returns ns per operation, summed over all threads, after checking the total.
+static double run(void *(*fn)(void *), int threads, size_t cardinality)
+{
+   Worker workers[64];
+   R128 total, expect, v;
+   double start, t;
+   size_t slot;
+   int i;
+
+   if (!r128MapInit(&map, cardinality)) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+   }
+
+   start = bench_now();
+   for (i = 0; i < threads; ++i) {
+      workers[i].index = i;
+      pthread_create(&workers[i].tid, NULL, fn, &workers[i]);
+   }
+   for (i = 0; i < threads; ++i) {
+      pthread_join(workers[i].tid, NULL);
+   }
+   t = (bench_now() - start) * 1e9 / ((double)opsPerThread * threads);
+
+   r128SumArray(&expect, fees, (size_t)opsPerThread * threads);
+   r128Copy(&total, &R128_zero);
+   for (slot = 0; slot < r128MapCapacity(&map); ++slot) {
+      r128AtomicLoad(&v, r128MapValue(&map, slot));
+      r128Add(&total, &total, &v);
+   }
+   if (r128Cmp(&total, &expect) != 0) {
+      fprintf(stderr, "totals differ at %d threads, %lu keys\n", threads, (unsigned long)cardinality);
+      exit(1);
+   }
+
+   r128MapFree(&map);
+   return t;
+}
+
+int main(int argc, char **argv)
+{
+   int maxThreads, threads;
+   size_t cardinality, i, n;
+   R128_U64 rng = 0x9e3779b97f4a7c15ull;
+
+   opsPerThread = bench_arg(argc, argv, 1, 1000000);
+   maxThreads = (int)bench_arg(argc, argv, 2, 64);
+   if (maxThreads > 64) {
+      maxThreads = 64;
+   }
+
+   n = (size_t)opsPerThread * maxThreads;
+   keys = (R128 *)malloc(n * sizeof(R128));
+   fees = (R128 *)malloc(n * sizeof(R128));
+   if (!keys || !fees) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+   }
+
+   printf("%10s %8s %16s %16s\n", "keys", "threads", "aggregate ns/op", "add ns/op");
+
+   for (cardinality = 16; cardinality <= (1 << 20); cardinality *= 16) {
+      // price levels 0.01 apart, starting at 1
+      for (i = 0; i < n; ++i) {
+         rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+         r128FromInt(&keys[i], (R128_S64)(rng % cardinality));
+         r128FromFloat(&fees[i], 0.01);
+         r128Mul(&keys[i], &keys[i], &fees[i]);
+         r128Add(&keys[i], &keys[i], &R128_one);
+         r128FromFloat(&fees[i], (double)(rng >> 44) * 0.0001);
+      }
+
+      for (threads = 1; threads <= maxThreads; threads *= 2) {
+         double tAggregate = run(run_aggregate, threads, cardinality);
+         double tAdd = run(run_add, threads, cardinality);
+         printf("%10lu %8d %16.2f %16.2f\n", (unsigned long)cardinality, threads, tAggregate, tAdd);
+      }
+   }
+
+   free(keys);
+   free(fees);
+   return 0;
+}
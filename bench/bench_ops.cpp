@@ -0,0 +1,578 @@
+// bench_ops: latency and throughput of every scalar R128 operation.
+//
+// Each operation runs over arrays of operands in two ways:
+//   latency     a dependent chain: every operation's first operand depends on
+//               the previous result (through an AND with an opaque zero, which
+//               adds about one cycle and leaves the operand unchanged)
+//   throughput  independent operations whose results go to an array
+// and reports the best of several repetitions in ns per operation.
+//
+// Operand distributions:
+//   small   integers in [-1000, 1000]
+//   frac    pure fractions in (-1, 1)
+//   full    random 128-bit values
+//   pow2    full-range dividends and divisors within 2^-20 of +-2^k, k in [-32, 32]
+//   ovf     full-range dividends and divisors below 2^-32, so that nearly every
+//           quotient overflows and div and mod take their saturating exit
+// Zero divisors are replaced by one. Shift amounts are the low 7 bits of the
+// second operand.
+//
+// The cxx rows run the C++ operators on the same data, for comparison with the
+// C functions they wrap.
+//
+// Where Linux perf_event_open provides hardware counters, one more pass of
+// each throughput loop is counted and a second table shows cycles,
+// instructions, IPC, branches, branch misses and last-level cache misses per
+// operation: the cost of the division refinement loops and of the sign
+// branches in mul and div shows up as branch misses, per distribution.
+//
+// With --percentiles, each operation is instead timed one at a time (or in
+// batches of --batch N) with the time-stamp counter, and a table shows the
+// 50th, 90th, 99th and 99.9th percentile and the maximum latency per
+// distribution, less the cost of reading the counter. Data-dependent costs,
+// such as the division refinement loops, show up in the tail; the maximum also
+// catches interrupts and preemption, so pin the process to a quiet core.
+//
+// With --json FILE, every repetition's time and the counters are also written
+// to FILE for bench_diff, which compares two such files:
+//
+//    bench_ops 65536 30 --json before.json
+//
+// usage: bench_ops [--json FILE] [--percentiles] [--batch N] [elements] [repetitions]
+//                  [op or distribution names...]
+
+#define R128_IMPLEMENTATION
+#include "../r128.h"
+#include "bench.h"
+
+#include <string.h>
+
+struct Data {
+   R128 *a, *b;
+   double *fa;
+   const char **strs;
+};
+
+// Zero, but unknown to the compiler.
+static volatile R128_U64 opaqueZero = 0;
+
+static inline R128 operand(const Data &d, size_t i, R128_U64 dep)
+{
+   R128 a = d.a[i];
+   a.lo ^= dep;
+   a.hi ^= dep;
+   return a;
+}
+
+#define BINARY_OP(Name, call) \
+   struct Name { \
+      R128 operator()(const Data &d, size_t i, R128_U64 dep) const { \
+         R128 r, a = operand(d, i, dep); \
+         const R128 &b = d.b[i]; \
+         call; \
+         return r; \
+      } \
+   }
+
+#define UNARY_OP(Name, call) \
+   struct Name { \
+      R128 operator()(const Data &d, size_t i, R128_U64 dep) const { \
+         R128 r, a = operand(d, i, dep); \
+         call; \
+         return r; \
+      } \
+   }
+
+BINARY_OP(OpAdd, r128Add(&r, &a, &b));
+BINARY_OP(OpSub, r128Sub(&r, &a, &b));
+BINARY_OP(OpMul, r128Mul(&r, &a, &b));
+BINARY_OP(OpDiv, r128Div(&r, &a, &b));
+BINARY_OP(OpMod, r128Mod(&r, &a, &b));
+BINARY_OP(OpShl, r128Shl(&r, &a, (int)(b.lo & 127)));
+BINARY_OP(OpShr, r128Shr(&r, &a, (int)(b.lo & 127)));
+BINARY_OP(OpSar, r128Sar(&r, &a, (int)(b.lo & 127)));
+BINARY_OP(OpCmp, r.lo = (R128_U64)r128Cmp(&a, &b); r.hi = 0);
+BINARY_OP(OpMin, r128Min(&r, &a, &b));
+UNARY_OP(OpNeg, r128Neg(&r, &a));
+UNARY_OP(OpFloor, r128Floor(&r, &a));
+UNARY_OP(OpCeil, r128Ceil(&r, &a));
+UNARY_OP(OpFromInt, r128FromInt(&r, (R128_S64)a.hi));
+UNARY_OP(OpToInt, r.lo = (R128_U64)r128ToInt(&a); r.hi = 0);
+UNARY_OP(OpToFloat, double f = r128ToFloat(&a); memcpy(&r.lo, &f, sizeof(f)); r.hi = 0);
+
+BINARY_OP(CxxAdd, r = a + b);
+BINARY_OP(CxxSub, r = a - b);
+BINARY_OP(CxxMul, r = a * b);
+BINARY_OP(CxxDiv, r = a / b);
+BINARY_OP(CxxMod, r = a % b);
+BINARY_OP(CxxShl, r = a << (int)(b.lo & 127));
+BINARY_OP(CxxLess, r.lo = a < b; r.hi = 0);
+UNARY_OP(CxxToDouble, double f = (double)a; memcpy(&r.lo, &f, sizeof(f)); r.hi = 0);
+
+struct OpFromFloat {
+   R128 operator()(const Data &d, size_t i, R128_U64 dep) const
+   {
+      R128 r;
+      R128_U64 bits;
+      double f;
+      memcpy(&bits, &d.fa[i], sizeof(bits));
+      bits ^= dep;
+      memcpy(&f, &bits, sizeof(f));
+      r128FromFloat(&r, f);
+      return r;
+   }
+};
+
+struct CxxFromDouble {
+   R128 operator()(const Data &d, size_t i, R128_U64 dep) const
+   {
+      R128_U64 bits;
+      double f;
+      memcpy(&bits, &d.fa[i], sizeof(bits));
+      bits ^= dep;
+      memcpy(&f, &bits, sizeof(f));
+      return R128(f);
+   }
+};
+
+struct OpToString {
+   R128 operator()(const Data &d, size_t i, R128_U64 dep) const
+   {
+      R128 r, a = operand(d, i, dep);
+      char buf[64];
+      int n = r128ToString(buf, sizeof(buf), &a);
+      r.lo = (R128_U64)n + (unsigned char)buf[n - 1];
+      r.hi = 0;
+      return r;
+   }
+};
+
+struct OpFromString {
+   R128 operator()(const Data &d, size_t i, R128_U64 dep) const
+   {
+      R128 r;
+      r128FromString(&r, d.strs[i] + dep, NULL);
+      return r;
+   }
+};
+
+static size_t count;
+static int reps;
+static R128 *out;
+static BenchJson json;
+static double *latencySamples, *throughputSamples;
+
+// Times every repetition into samples and returns the best.
+template <class Op>
+static double latency(const Op &op, const Data &d, double *samples)
+{
+   double best = 1e30;
+
+   for (int rep = 0; rep < reps; ++rep) {
+      R128_U64 mask = opaqueZero;
+      R128 r = R128_zero;
+      double start = bench_now(), t;
+
+      for (size_t i = 0; i < count; ++i) {
+         r = op(d, i, (r.lo ^ r.hi) & mask);
+      }
+      t = (bench_now() - start) * 1e9 / count;
+      BENCH_KEEP(r);
+      samples[rep] = t;
+      if (t < best) {
+         best = t;
+      }
+   }
+   return best;
+}
+
+template <class Op>
+static double throughput(const Op &op, const Data &d, double *samples)
+{
+   double best = 1e30;
+
+   for (int rep = 0; rep < reps; ++rep) {
+      double start = bench_now(), t;
+
+      for (size_t i = 0; i < count; ++i) {
+         out[i] = op(d, i, 0);
+      }
+      t = (bench_now() - start) * 1e9 / count;
+      BENCH_KEEP(out[count - 1]);
+      samples[rep] = t;
+      if (t < best) {
+         best = t;
+      }
+   }
+   return best;
+}
+
+enum { SMALL, FRAC, FULL, POW2, OVF, DISTS };
+
+static const char *distNames[DISTS] = { "small", "frac", "full", "pow2", "ovf" };
+static Data data[DISTS];
+static int distEnabled[DISTS];
+
+// Hardware counters for one pass of each throughput loop.
+struct CounterRow {
+   const char *name;
+   int dist;
+   double perOp[BENCH_COUNTERS];
+};
+
+static BenchCounters counters;
+static int haveCounters;
+static CounterRow counterRows[64 * DISTS];
+static int counterRowCount;
+
+template <class Op>
+static const double *count_events(const char *name, int dist, const Op &op)
+{
+   CounterRow *row = &counterRows[counterRowCount++];
+   const Data &d = data[dist];
+
+   bench_counters_start(&counters);
+   for (size_t i = 0; i < count; ++i) {
+      out[i] = op(d, i, 0);
+   }
+   bench_counters_stop(&counters);
+   BENCH_KEEP(out[count - 1]);
+
+   row->name = name;
+   row->dist = dist;
+   for (int k = 0; k < BENCH_COUNTERS; ++k) {
+      row->perOp[k] = counters.count[k] >= 0 ? counters.count[k] / count : -1;
+   }
+   return row->perOp;
+}
+
+// Percentile mode: per-operation latency from the time-stamp counter.
+static int percentileMode;
+static int batch = 1;
+static unsigned long long *ticks;
+static double ticksPerNs, overheadTicks;
+
+static int compare_ticks(const void *a, const void *b)
+{
+   unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+   return x < y ? -1 : x > y;
+}
+
+// The cheapest of many empty timings.
+static void measure_overhead()
+{
+   unsigned long long best = ~0ull;
+
+   for (int i = 0; i < 100000; ++i) {
+      unsigned long long t0 = bench_ticks_begin();
+      unsigned long long t1 = bench_ticks_end();
+      if (t1 - t0 < best) {
+         best = t1 - t0;
+      }
+   }
+   overheadTicks = (double)best;
+}
+
+template <class Op>
+static void percentiles(const char *name, const Op &op)
+{
+   static const double pct[] = { 50, 90, 99, 99.9 };
+
+   for (int dist = 0; dist < DISTS; ++dist) {
+      const Data &d = data[dist];
+      R128 r = R128_zero;
+
+      if (!distEnabled[dist]) {
+         continue;
+      }
+
+      for (size_t i = 0, k = 0; i < count; ++i) {
+         unsigned long long t0 = bench_ticks_begin();
+         for (int b = 0; b < batch; ++b, k = k + 1 < count ? k + 1 : 0) {
+            r = op(d, k, 0);
+            BENCH_KEEP(r);
+         }
+         ticks[i] = bench_ticks_end() - t0;
+      }
+      qsort(ticks, count, sizeof(ticks[0]), compare_ticks);
+
+      printf("%-15s %-6s", name, distNames[dist]);
+      for (size_t p = 0; p < sizeof(pct) / sizeof(pct[0]); ++p) {
+         size_t at = (size_t)(pct[p] / 100 * (count - 1) + 0.5);
+         printf(" %9.1f", ((double)ticks[at] - overheadTicks) / batch / ticksPerNs);
+      }
+      printf(" %9.1f\n", ((double)ticks[count - 1] - overheadTicks) / batch / ticksPerNs);
+      fflush(stdout);
+   }
+}
+
+template <class Op>
+static void run(const char *name, const Op &op)
+{
+   if (percentileMode) {
+      percentiles(name, op);
+      return;
+   }
+
+   printf("%-15s", name);
+   for (int dist = 0; dist < DISTS; ++dist) {
+      if (distEnabled[dist]) {
+         const double *perOp = NULL;
+
+         printf(" %8.2f", latency(op, data[dist], latencySamples));
+         printf(" %8.2f", throughput(op, data[dist], throughputSamples));
+         if (haveCounters && counterRowCount < (int)(sizeof(counterRows) / sizeof(counterRows[0]))) {
+            perOp = count_events(name, dist, op);
+         }
+         bench_json_result(&json, name, distNames[dist], "latency", "ns", latencySamples, reps, NULL);
+         bench_json_result(&json, name, distNames[dist], "throughput", "ns", throughputSamples, reps, perOp);
+      }
+   }
+   printf("\n");
+   fflush(stdout);
+}
+
+static void print_count(double v, const char *format)
+{
+   if (v >= 0) {
+      printf(format, v);
+   } else {
+      printf(" %9s", "-");
+   }
+}
+
+// Per operation: cycles, instructions, IPC, branches, branch misses, the miss
+// rate and cache misses.
+static void print_counters()
+{
+   if (!haveCounters) {
+      printf("\nhardware counters unavailable: %s\n", counters.error);
+      return;
+   }
+
+   printf("\nhardware counters per operation (throughput loops)\n");
+   printf("%-15s %-6s %9s %9s %9s %9s %9s %9s %9s\n", "", "", "cycles", "instrs", "IPC",
+      "branches", "br-miss", "miss %", "llc-miss");
+   for (int i = 0; i < counterRowCount; ++i) {
+      const CounterRow &r = counterRows[i];
+      const double *c = r.perOp;
+
+      printf("%-15s %-6s", r.name, distNames[r.dist]);
+      print_count(c[BENCH_CYCLES], " %9.2f");
+      print_count(c[BENCH_INSTRUCTIONS], " %9.2f");
+      print_count(c[BENCH_CYCLES] > 0 && c[BENCH_INSTRUCTIONS] >= 0 ? c[BENCH_INSTRUCTIONS] / c[BENCH_CYCLES] : -1, " %9.2f");
+      print_count(c[BENCH_BRANCHES], " %9.2f");
+      print_count(c[BENCH_BRANCH_MISSES], " %9.3f");
+      print_count(c[BENCH_BRANCHES] > 0 && c[BENCH_BRANCH_MISSES] >= 0 ? 100 * c[BENCH_BRANCH_MISSES] / c[BENCH_BRANCHES] : -1, " %9.2f");
+      print_count(c[BENCH_CACHE_MISSES], " %9.4f");
+      printf("\n");
+   }
+}
+
+static R128_U64 rng = 0x9e3779b97f4a7c15ull;
+
+static R128_U64 next_rand()
+{
+   rng ^= rng << 13;
+   rng ^= rng >> 7;
+   rng ^= rng << 17;
+   return rng;
+}
+
+static void generate(R128 *v, int dist, int divisor)
+{
+   switch (dist) {
+   case SMALL:
+      r128FromInt(v, (R128_S64)(next_rand() % 2001) - 1000);
+      break;
+
+   case FRAC:
+      v->lo = next_rand();
+      v->hi = 0;
+      if (next_rand() & 1) {
+         r128Neg(v, v);
+      }
+      break;
+
+   case POW2:
+      if (divisor) {
+         // 2^k plus or minus up to 2^(k-20)
+         int k = (int)(next_rand() % 65) - 32;
+         R128 p, e;
+         if (k >= 0) {
+            r128Shl(&p, &R128_one, k);
+         } else {
+            r128Shr(&p, &R128_one, -k);
+         }
+         r128Shr(&e, &p, 20);
+         e.lo &= next_rand();
+         e.hi &= next_rand();
+         if (next_rand() & 1) {
+            r128Add(v, &p, &e);
+         } else {
+            r128Sub(v, &p, &e);
+         }
+         if (next_rand() & 1) {
+            r128Neg(v, v);
+         }
+         break;
+      }
+      // full-range dividends
+      /* fall through */
+   default:
+      if (dist == OVF && divisor) {
+         v->lo = next_rand() >> 32;
+         v->hi = 0;
+         break;
+      }
+      v->lo = next_rand();
+      v->hi = next_rand();
+      break;
+   }
+
+   if (divisor && !v->lo && !v->hi) {
+      *v = R128_one;
+   }
+}
+
+static int selected(int argc, char **argv, const char *name)
+{
+   int any = 0;
+
+   for (int i = 3; i < argc; ++i) {
+      int isDist = 0;
+      for (int dist = 0; dist < DISTS; ++dist) {
+         isDist |= !strcmp(argv[i], distNames[dist]);
+      }
+      if (!isDist) {
+         any = 1;
+         if (!strcmp(argv[i], name)) {
+            return 1;
+         }
+      }
+   }
+   return !any;
+}
+
+#define RUN(name, Op) do { if (selected(argc, argv, name)) run(name, Op()); } while (0)
+
+int main(int argc, char **argv)
+{
+   const size_t stride = 48;
+   const char *jsonPath = bench_json_arg(&argc, argv);
+   int anyDist = 0, j = 1;
+
+   // --percentiles and --batch N
+   for (int i = 1; i < argc; ++i) {
+      if (!strcmp(argv[i], "--percentiles")) {
+         percentileMode = 1;
+      } else if (!strcmp(argv[i], "--batch") && i + 1 < argc) {
+         batch = atoi(argv[++i]);
+         batch = batch > 0 ? batch : 1;
+      } else {
+         argv[j++] = argv[i];
+      }
+   }
+   argc = j;
+
+   haveCounters = bench_counters_open(&counters);
+   count = (size_t)bench_arg(argc, argv, 1, 1 << 16);
+   reps = (int)bench_arg(argc, argv, 2, 5);
+   if (jsonPath && !bench_json_open(&json, jsonPath, "bench_ops", argc, argv)) {
+      return 1;
+   }
+
+   for (int i = 3; i < argc; ++i) {
+      for (int dist = 0; dist < DISTS; ++dist) {
+         if (!strcmp(argv[i], distNames[dist])) {
+            distEnabled[dist] = anyDist = 1;
+         }
+      }
+   }
+
+   out = (R128 *)malloc(count * sizeof(R128));
+   latencySamples = (double *)malloc(reps * sizeof(double));
+   throughputSamples = (double *)malloc(reps * sizeof(double));
+   ticks = (unsigned long long *)malloc(count * sizeof(unsigned long long));
+   for (int dist = 0; dist < DISTS; ++dist) {
+      Data &d = data[dist];
+      char *text = (char *)malloc(count * stride);
+
+      distEnabled[dist] |= !anyDist;
+      d.a = (R128 *)malloc(count * sizeof(R128));
+      d.b = (R128 *)malloc(count * sizeof(R128));
+      d.fa = (double *)malloc(count * sizeof(double));
+      d.strs = (const char **)malloc(count * sizeof(char *));
+      if (!out || !ticks || !latencySamples || !throughputSamples || !text || !d.a || !d.b || !d.fa || !d.strs) {
+         fprintf(stderr, "out of memory\n");
+         return 1;
+      }
+
+      for (size_t i = 0; i < count; ++i) {
+         generate(&d.a[i], dist, 0);
+         generate(&d.b[i], dist, 1);
+         d.fa[i] = r128ToFloat(&d.a[i]);
+         r128ToString(text + i * stride, stride, &d.a[i]);
+         d.strs[i] = text + i * stride;
+      }
+   }
+
+   if (percentileMode) {
+      ticksPerNs = bench_ticks_per_ns();
+      measure_overhead();
+      printf("%lu samples of %d operation%s; ns per operation, less %.1f ns timer overhead\n",
+         (unsigned long)count, batch, batch > 1 ? "s" : "", overheadTicks / ticksPerNs);
+      printf("%-15s %-6s %9s %9s %9s %9s %9s\n", "", "", "p50", "p90", "p99", "p99.9", "max");
+   } else {
+      printf("%lu operations, best of %d; ns per operation\n", (unsigned long)count, reps);
+      printf("%-15s", "");
+      for (int dist = 0; dist < DISTS; ++dist) {
+         if (distEnabled[dist]) {
+            printf(" %17s", distNames[dist]);
+         }
+      }
+      printf("\n%-14s", "");
+      for (int dist = 0; dist < DISTS; ++dist) {
+         if (distEnabled[dist]) {
+            printf(" %8s %8s", "latency", "tput");
+         }
+      }
+      printf("\n");
+   }
+
+   RUN("add", OpAdd);
+   RUN("sub", OpSub);
+   RUN("mul", OpMul);
+   RUN("div", OpDiv);
+   RUN("mod", OpMod);
+   RUN("shl", OpShl);
+   RUN("shr", OpShr);
+   RUN("sar", OpSar);
+   RUN("cmp", OpCmp);
+   RUN("min", OpMin);
+   RUN("neg", OpNeg);
+   RUN("floor", OpFloor);
+   RUN("ceil", OpCeil);
+   RUN("fromint", OpFromInt);
+   RUN("toint", OpToInt);
+   RUN("fromfloat", OpFromFloat);
+   RUN("tofloat", OpToFloat);
+   RUN("tostring", OpToString);
+   RUN("fromstring", OpFromString);
+   RUN("cxx+", CxxAdd);
+   RUN("cxx-", CxxSub);
+   RUN("cxx*", CxxMul);
+   RUN("cxx/", CxxDiv);
+   RUN("cxx%", CxxMod);
+   RUN("cxx<<", CxxShl);
+   RUN("cxx<", CxxLess);
+   RUN("cxx(double)", CxxToDouble);
+   RUN("cxxR128(dbl)", CxxFromDouble);
+
+   if (!percentileMode) {
+      print_counters();
+   }
+   bench_counters_close(&counters);
+   bench_json_close(&json);
+   return 0;
+}
@@ -0,0 +1,126 @@
+// bench_parallel: thread scaling of the r128_parallel.h array kernels.
+//
+// Runs add, mul, div, parse, format, inclusive scan and a 1000-bucket histogram
+// over arrays of random values with 1 to max-threads threads and reports ns per
+// element and speedup over one thread.
+//
+// usage: bench_parallel [elements] [max-threads]
+
+#define R128_IMPLEMENTATION
+#include "../r128_parallel.h"
+#include "bench.h"
+
+#include <string.h>
+
+#define STRIDE 48
+
+static size_t count;
+static R128 *a, *b, *c;
+static char *text;
+static const char **strs;
+static R128Histogram hist;
+static R128_U64 histCounts[1000];
+
+static void op_add(void) { r128ParallelAddArray(c, a, b, count); }
+static void op_mul(void) { r128ParallelMulArray(c, a, b, count); }
+static void op_div(void) { r128ParallelDivArray(c, a, b, count); }
+static void op_parse(void) { r128ParallelFromStringArray(c, strs, count); }
+static void op_format(void) { r128ParallelToStringArray(text, STRIDE, a, count); }
+static void op_scan(void) { r128ParallelInclusiveScanArray(c, a, count, NULL); }
+static void op_hist(void) { r128ParallelHistogramArray(histCounts, &hist, a, count); }
+
+static const struct {
+   const char *name;
+   void (*fn)(void);
+} ops[] = {
+   { "add", op_add },
+   { "mul", op_mul },
+   { "div", op_div },
+   { "parse", op_parse },
+   { "format", op_format },
+   { "scan", op_scan },
+   { "histogram", op_hist },
+};
+
+#define OP_COUNT (sizeof(ops) / sizeof(ops[0]))
+
+int main(int argc, char **argv)
+{
+   double base[OP_COUNT];
+   int maxThreads, threads;
+   R128_U64 rng = 0x9e3779b97f4a7c15ull;
+   size_t i, op;
+
+   count = (size_t)bench_arg(argc, argv, 1, 1 << 20);
+   maxThreads = (int)bench_arg(argc, argv, 2, r128ParallelGetThreads());
+
+   a = (R128 *)malloc(count * sizeof(R128));
+   b = (R128 *)malloc(count * sizeof(R128));
+   c = (R128 *)malloc(count * sizeof(R128));
+   text = (char *)malloc(count * STRIDE);
+   strs = (const char **)malloc(count * sizeof(char *));
+   if (!a || !b || !c || !text || !strs) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+   }
+
+   // prices in [-2^31, 2^31) with full fractions; divisors in [1, 2^16)
+   for (i = 0; i < count; ++i) {
+      rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+      a[i].lo = rng;
+      a[i].hi = (R128_U64)(R128_S64)(R128_S32)(rng >> 17);
+      rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+      b[i].lo = rng;
+      b[i].hi = (rng >> 48) | 1;
+   }
+   r128ToStringArray(text, STRIDE, a, count);
+   {
+      R128 min, width;
+      r128FromInt(&min, -2147483647 - 1);
+      r128FromFloat(&width, 4294967296.0 / 1000);
+      r128HistogramInitLinear(&hist, &min, &width, 1000);
+   }
+   for (i = 0; i < count; ++i) {
+      strs[i] = text + i * STRIDE;
+   }
+
+   printf("%lu elements, %d processors\n", (unsigned long)count, r128ParallelGetThreads());
+   printf("%8s", "threads");
+   for (op = 0; op < OP_COUNT; ++op) {
+      printf(" %16s", ops[op].name);
+   }
+   printf("\n%8s", "");
+   for (op = 0; op < OP_COUNT; ++op) {
+      printf(" %16s", "ns/elem speedup");
+   }
+   printf("\n");
+
+   for (threads = 1;; threads *= 2) {
+      if (threads > maxThreads) {
+         threads = maxThreads;
+      }
+      r128ParallelSetThreads(threads);
+      printf("%8d", threads);
+
+      for (op = 0; op < OP_COUNT; ++op) {
+         double start, t;
+
+         ops[op].fn();   // warm up, and start the pool
+         start = bench_now();
+         ops[op].fn();
+         t = (bench_now() - start) * 1e9 / count;
+         if (threads == 1) {
+            base[op] = t;
+         }
+         printf(" %8.2f %6.2fx", t, base[op] / t);
+      }
+      printf("\n");
+
+      if (threads == maxThreads) {
+         break;
+      }
+   }
+
+   r128ParallelShutdown();
+   return 0;
+}
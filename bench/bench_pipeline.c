@@ -0,0 +1,120 @@
+// bench_pipeline: a parse -> compute -> format pipeline over text prices.
+//
+// Generates lines of prices in memory, then converts each to a price with fees
+// (price * 1.0025 + 0.01) through an r128_pipeline.h pipeline with the given
+// threads per stage, and prints the per-stage report. For reference, also runs
+// the same three steps one after the other on the calling thread.
+//
+// usage: bench_pipeline [lines] [parse-threads] [compute-threads] [format-threads] [batch-size] [queue-depth]
+
+#define R128_IMPLEMENTATION
+#include "../r128_pipeline.h"
+#include "bench.h"
+
+#include <string.h>
+
+typedef struct Fees {
+   R128 rate;
+   R128 fixed;
+} Fees;
+
+static void add_fees(void *ctx, R128Batch *batch)
+{
+   const Fees *fees = (const Fees *)ctx;
+   size_t i;
+
+   for (i = 0; i < batch->count; ++i) {
+      r128Mul(&batch->values[i], &batch->values[i], &fees->rate);
+      r128Add(&batch->values[i], &batch->values[i], &fees->fixed);
+   }
+}
+
+// The same work without the pipeline: split, parse, compute and format one
+// batch at a time.
+static size_t serial(const char *in, size_t inSize, char *out, const Fees *fees, size_t batchSize)
+{
+   R128Batch batch;
+   const char *end = in + inSize;
+   size_t outSize = 0;
+
+   memset(&batch, 0, sizeof(batch));
+   batch.values = (R128 *)malloc(batchSize * sizeof(R128));
+   batch.lines = (const char **)malloc(batchSize * sizeof(char *));
+
+   while (in < end) {
+      batch.count = 0;
+      batch.text = out + outSize;
+      batch.textSize = 0;
+      batch.textCapacity = batchSize * R128_PIPELINE_TEXT_PER_VALUE;
+      while (in < end && batch.count < batchSize) {
+         const char *nl = (const char *)memchr(in, '\n', (size_t)(end - in));
+         batch.lines[batch.count++] = in;
+         in = nl ? nl + 1 : end;
+      }
+      r128PipelineParse(NULL, &batch);
+      add_fees((void *)fees, &batch);
+      r128PipelineFormat(NULL, &batch);
+      outSize += batch.textSize;
+   }
+
+   free(batch.values);
+   free((void *)batch.lines);
+   return outSize;
+}
+
+int main(int argc, char **argv)
+{
+   R128Pipeline p;
+   Fees fees;
+   R128_U64 rng = 0x9e3779b97f4a7c15ull;
+   size_t lines, batchSize, inSize = 0, outSize, serialSize, i;
+   char *in, *out, *expect;
+   double start, t;
+
+   lines = (size_t)bench_arg(argc, argv, 1, 1 << 22);
+   batchSize = (size_t)bench_arg(argc, argv, 5, 1024);
+
+   in = (char *)malloc(lines * 24 + 1);
+   expect = (char *)malloc(lines * R128_PIPELINE_TEXT_PER_VALUE + batchSize * R128_PIPELINE_TEXT_PER_VALUE);
+   if (!in || !expect) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+   }
+
+   // prices in [0, 100000) with up to 4 decimals
+   for (i = 0; i < lines; ++i) {
+      rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+      inSize += sprintf(in + inSize, "%lu.%04lu\n", (unsigned long)(rng % 100000), (unsigned long)((rng >> 20) % 10000));
+   }
+
+   r128FromString(&fees.rate, "1.0025", NULL);
+   r128FromString(&fees.fixed, "0.01", NULL);
+
+   r128PipelineInit(&p, batchSize, (size_t)bench_arg(argc, argv, 6, 4));
+   r128PipelineAddStage(&p, "parse", r128PipelineParse, NULL, (int)bench_arg(argc, argv, 2, 1));
+   r128PipelineAddStage(&p, "compute", add_fees, &fees, (int)bench_arg(argc, argv, 3, 1));
+   r128PipelineAddStage(&p, "format", r128PipelineFormat, NULL, (int)bench_arg(argc, argv, 4, 1));
+
+   start = bench_now();
+   serialSize = serial(in, inSize, expect, &fees, batchSize);
+   t = bench_now() - start;
+
+   if (!r128PipelineRunMemory(&p, in, inSize, &out, &outSize)) {
+      fprintf(stderr, "pipeline failed\n");
+      return 1;
+   }
+   if (outSize != serialSize || memcmp(out, expect, outSize)) {
+      fprintf(stderr, "pipeline output differs from the serial output\n");
+      return 1;
+   }
+
+   printf("%lu lines, %.1f MB in, %.1f MB out\n\n", (unsigned long)lines, inSize * 1e-6, outSize * 1e-6);
+   r128PipelineReport(&p, stdout);
+   printf("\npipeline: %.2f Mvalues/s\nserial:   %.2f Mvalues/s\n",
+      lines / p.seconds * 1e-6, lines / t * 1e-6);
+
+   R128_FREE(out);
+   free(in);
+   free(expect);
+   return 0;
+}
@@ -0,0 +1,271 @@
+// bench_reduce: reproducibility stress test and throughput of the reductions.
+//
+// Computes sum, dot, min, max and count over random prices and quantities, then
+// recomputes them over many random partitions of the input, combining the
+// pieces in random order, and with the parallel functions at random thread
+// counts, half the time through an executor that runs the chunks in a random
+// order. Every result must be bit-identical to one serial pass; the same
+// partitions of a double sum and dot are reported for contrast. Finally
+// compares throughput against plain double loops.
+//
+// Exits with status 1 if any R128 result differs.
+//
+// usage: bench_reduce [elements] [trials] [max-threads]
+
+#define R128_IMPLEMENTATION
+#include "../r128_parallel.h"
+#include "bench.h"
+
+#include <string.h>
+#include <math.h>
+
+#define MAX_PIECES 64
+
+static size_t count;
+static R128 *a, *b;
+static double *fa, *fb;
+static R128 lo, hi;
+static R128_U64 rng = 0x9e3779b97f4a7c15ull;
+
+typedef struct Result {
+   R128 sum, dot, min, max;
+   size_t count;
+} Result;
+
+static R128_U64 next_rand(void)
+{
+   rng ^= rng << 13;
+   rng ^= rng >> 7;
+   rng ^= rng << 17;
+   return rng;
+}
+
+static int same(const Result *x, const Result *y)
+{
+   return !memcmp(&x->sum, &y->sum, sizeof(R128)) && !memcmp(&x->dot, &y->dot, sizeof(R128)) &&
+      !memcmp(&x->min, &y->min, sizeof(R128)) && !memcmp(&x->max, &y->max, sizeof(R128)) &&
+      x->count == y->count;
+}
+
+// Runs the chunks one at a time on the calling thread, in a random order.
+static void shuffled_executor(void *executorCtx, size_t chunks, R128ParallelChunk run, void *job)
+{
+   size_t *order = (size_t *)malloc(chunks * sizeof(size_t));
+   size_t i;
+
+   (void)executorCtx;
+   for (i = 0; i < chunks; ++i) {
+      order[i] = i;
+   }
+   for (i = chunks; i > 1; --i) {
+      size_t j = (size_t)(next_rand() % i), t = order[i - 1];
+      order[i - 1] = order[j];
+      order[j] = t;
+   }
+   for (i = 0; i < chunks; ++i) {
+      run(job, order[i]);
+   }
+   free(order);
+}
+
+static void serial(Result *r)
+{
+   r128SumArray(&r->sum, a, count);
+   r128DotArray(&r->dot, a, b, count);
+   r128MinArray(&r->min, a, count);
+   r128MaxArray(&r->max, a, count);
+   r->count = r128CountArray(a, count, &lo, &hi);
+}
+
+static void parallel(Result *r)
+{
+   r128ParallelSumArray(&r->sum, a, count);
+   r128ParallelDotArray(&r->dot, a, b, count);
+   r128ParallelMinArray(&r->min, a, count);
+   r128ParallelMaxArray(&r->max, a, count);
+   r->count = r128ParallelCountArray(a, count, &lo, &hi);
+}
+
+// Splits [0, count) at random points and combines the pieces in random order.
+static void partitioned(Result *r, double *dsum, double *ddot)
+{
+   size_t cut[MAX_PIECES + 1], order[MAX_PIECES];
+   size_t pieces = 1 + (size_t)(next_rand() % MAX_PIECES);
+   R128DotAccumulator acc;
+   size_t i, j;
+
+   cut[0] = 0;
+   for (i = 1; i < pieces; ++i) {
+      cut[i] = (size_t)(next_rand() % (count + 1));
+   }
+   cut[pieces] = count;
+   for (i = 1; i < pieces; ++i) {
+      for (j = i; j > 0 && cut[j - 1] > cut[j]; --j) {
+         size_t t = cut[j];
+         cut[j] = cut[j - 1];
+         cut[j - 1] = t;
+      }
+   }
+   for (i = 0; i < pieces; ++i) {
+      order[i] = i;
+   }
+   for (i = pieces; i > 1; --i) {
+      size_t k = (size_t)(next_rand() % i), t = order[i - 1];
+      order[i - 1] = order[k];
+      order[k] = t;
+   }
+
+   r128Copy(&r->sum, &R128_zero);
+   r128Copy(&r->min, &R128_max);
+   r128Copy(&r->max, &R128_min);
+   r->count = 0;
+   r128DotInit(&acc);
+   *dsum = *ddot = 0;
+
+   for (i = 0; i < pieces; ++i) {
+      size_t begin = cut[order[i]], n = cut[order[i] + 1] - begin;
+      double s = 0, d = 0;
+      R128 t;
+
+      r128SumArray(&t, a + begin, n);
+      r128Add(&r->sum, &r->sum, &t);
+      r128MinArray(&t, a + begin, n);
+      r128Min(&r->min, &r->min, &t);
+      r128MaxArray(&t, a + begin, n);
+      r128Max(&r->max, &r->max, &t);
+      r->count += r128CountArray(a + begin, n, &lo, &hi);
+      r128DotAdd(&acc, a + begin, b + begin, n);
+
+      for (j = begin; j < begin + n; ++j) {
+         s += fa[j];
+         d += fa[j] * fb[j];
+      }
+      *dsum += s;
+      *ddot += d;
+   }
+   r128DotResult(&r->dot, &acc);
+}
+
+static double time_ns(void (*fn)(void))
+{
+   double start;
+
+   fn();
+   start = bench_now();
+   fn();
+   return (bench_now() - start) * 1e9 / count;
+}
+
+static R128 sink;
+static double dsink;
+static size_t csink;
+
+static void op_sum(void) { r128SumArray(&sink, a, count); }
+static void op_dot(void) { r128DotArray(&sink, a, b, count); }
+static void op_min(void) { r128MinArray(&sink, a, count); }
+static void op_count(void) { csink = r128CountArray(a, count, &lo, &hi); }
+static void op_psum(void) { r128ParallelSumArray(&sink, a, count); }
+static void op_pdot(void) { r128ParallelDotArray(&sink, a, b, count); }
+static void op_pmin(void) { r128ParallelMinArray(&sink, a, count); }
+static void op_pcount(void) { csink = r128ParallelCountArray(a, count, &lo, &hi); }
+
+static void op_dsum(void)
+{
+   double s = 0;
+   size_t i;
+   for (i = 0; i < count; ++i) {
+      s += fa[i];
+   }
+   dsink = s;
+}
+
+static void op_ddot(void)
+{
+   double s = 0;
+   size_t i;
+   for (i = 0; i < count; ++i) {
+      s += fa[i] * fb[i];
+   }
+   dsink = s;
+}
+
+int main(int argc, char **argv)
+{
+   Result ref, r;
+   double dsum0 = 0, ddot0 = 0, dsumSpread = 0, ddotSpread = 0;
+   long trials, t;
+   int maxThreads, sumDiffers = 0, dotDiffers = 0, failures = 0;
+   size_t i;
+
+   count = (size_t)bench_arg(argc, argv, 1, 1 << 20);
+   trials = bench_arg(argc, argv, 2, 200);
+   maxThreads = (int)bench_arg(argc, argv, 3, r128ParallelGetThreads() * 2);
+
+   a = (R128 *)malloc(count * sizeof(R128));
+   b = (R128 *)malloc(count * sizeof(R128));
+   fa = (double *)malloc(count * sizeof(double));
+   fb = (double *)malloc(count * sizeof(double));
+   if (!a || !b || !fa || !fb) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+   }
+
+   // prices in (-1000, 1000) with 4 decimals, quantities in [0, 100) with 6
+   for (i = 0; i < count; ++i) {
+      fa[i] = ((R128_S64)(next_rand() % 20000000) - 10000000) * 0.0001;
+      fb[i] = (double)(next_rand() % 100000000) * 0.000001;
+      r128FromFloat(&a[i], fa[i]);
+      r128FromFloat(&b[i], fb[i]);
+   }
+   r128FromInt(&lo, -100);
+   r128FromInt(&hi, 250);
+
+   serial(&ref);
+
+   for (t = 0; t < trials; ++t) {
+      double dsum, ddot;
+
+      partitioned(&r, &dsum, &ddot);
+      failures += !same(&r, &ref);
+      if (t == 0) {
+         dsum0 = dsum;
+         ddot0 = ddot;
+      }
+      sumDiffers += dsum != dsum0;
+      dotDiffers += ddot != ddot0;
+      if (fabs(dsum - dsum0) > dsumSpread) {
+         dsumSpread = fabs(dsum - dsum0);
+      }
+      if (fabs(ddot - ddot0) > ddotSpread) {
+         ddotSpread = fabs(ddot - ddot0);
+      }
+
+      r128ParallelSetThreads(1 + (int)(next_rand() % maxThreads));
+      r128ParallelSetExecutor((t & 1) ? shuffled_executor : NULL, NULL);
+      parallel(&r);
+      failures += !same(&r, &ref);
+   }
+   r128ParallelSetExecutor(NULL, NULL);
+   r128ParallelSetThreads(0);
+
+   printf("%lu elements, %ld trials of random partitions, thread counts and chunk orders\n",
+      (unsigned long)count, trials);
+   printf("R128 results differing from one serial pass: %d\n", failures);
+   printf("double sum differing from the first partition: %d of %ld (max difference %g)\n",
+      sumDiffers, trials, dsumSpread);
+   printf("double dot differing from the first partition: %d of %ld (max difference %g)\n\n",
+      dotDiffers, trials, ddotSpread);
+
+   printf("%-8s %12s %12s %12s\n", "", "serial", "parallel", "double");
+   printf("%-8s %12s %12s %12s\n", "", "ns/elem", "ns/elem", "ns/elem");
+   printf("%-8s %12.2f %12.2f %12.2f\n", "sum", time_ns(op_sum), time_ns(op_psum), time_ns(op_dsum));
+   printf("%-8s %12.2f %12.2f %12.2f\n", "dot", time_ns(op_dot), time_ns(op_pdot), time_ns(op_ddot));
+   printf("%-8s %12.2f %12.2f %12s\n", "min", time_ns(op_min), time_ns(op_pmin), "");
+   printf("%-8s %12.2f %12.2f %12s\n", "count", time_ns(op_count), time_ns(op_pcount), "");
+   BENCH_KEEP(sink);
+   BENCH_KEEP(dsink);
+   BENCH_KEEP(csink);
+
+   r128ParallelShutdown();
+   return failures ? 1 : 0;
+}
@@ -0,0 +1,408 @@
+// bench_replay: re-runs a recorded operation trace and reports the time per
+// operation type.
+//
+// A trace is a file of an R128TraceFileHeader and R128TraceRecords, as
+// recorded by a program built with R128_TRACE (see r128.h) that writes the
+// header and then each full buffer to the file:
+//
+//    static void flush(const R128TraceRecord *records, size_t count, void *f)
+//    {
+//       fwrite(records, sizeof(*records), count, (FILE *)f);
+//    }
+//    ...
+//    R128TraceFileHeader header = {
+//       R128_TRACE_MAGIC, R128_TRACE_VERSION, sizeof(R128TraceRecord), R128TraceOp_Count
+//    };
+//    fwrite(&header, sizeof(header), 1, file);
+//    r128TraceStart(buffer, 65536, flush, file);
+//    ... the workload ...
+//    r128TraceStop();
+//
+// The file is in the byte order of the machine that recorded it, and is
+// rejected on one of the other byte order or with another layout. The replay
+// is built without R128_TRACE, against whichever r128.h is being measured, so
+// the same trace can be timed on every build:
+//   in order   every call in the order it was recorded, ns per call
+//   per op     the calls of one type back to back, ns per call, and the share
+//              of the total time they make up (calls times ns per call)
+// Times include a few cycles of loop and dispatch per call. Text longer than
+// the 31 bytes a record keeps is parsed truncated; the count of such calls is
+// reported.
+//
+// With --json FILE, every repetition's time is also written to FILE for
+// bench_diff. --synth N writes a synthetic trace of N calls, a mix of parsing,
+// arithmetic and formatting on prices, to the trace file instead.
+//
+// usage: bench_replay [--json FILE] [--synth N] trace [repetitions]
+
+#define R128_IMPLEMENTATION
+#include "../r128.h"
+#include "bench.h"
+
+#include <string.h>
+
+static const char *opNames[R128TraceOp_Count] = {
+   "none", "FromInt", "FromFloat", "FromString", "ToInt", "ToFloat", "ToString", "ToStringf",
+   "ToStringOpt", "Copy", "Neg", "Not", "Or", "And", "Xor", "Shl", "Shr", "Sar", "Add", "Sub",
+   "Mul", "Div", "Mod", "Cmp", "IsNeg", "Min", "Max", "Floor", "Ceil"
+};
+
+static R128TraceRecord *records;
+static size_t count;
+static int reps;
+static volatile R128_U64 checksum;
+
+static double double_of(R128_U64 bits)
+{
+   double d;
+   memcpy(&d, &bits, sizeof(d));
+   return d;
+}
+
+// The text of a FromString record: a then b.
+static void record_text(char *text, const R128TraceRecord *r)
+{
+   memcpy(text, &r->a, 16);
+   memcpy(text + 16, &r->b, 16);
+   text[31] = '\0';
+}
+
+static void record_format(R128ToStringFormat *opt, const R128TraceRecord *r)
+{
+   opt->width = (int)(R128_U32)r->b.lo;
+   opt->precision = (int)(R128_U32)(r->b.lo >> 32);
+   opt->sign = (R128ToStringSign)(r->b.hi & 0xff);
+   opt->zeroPad = (int)(r->b.hi >> 8) & 0xff;
+   opt->decimal = (int)(r->b.hi >> 16) & 0xff;
+   opt->leftAlign = (int)(r->b.hi >> 24) & 0xff;
+}
+
+static size_t dst_size(const R128TraceRecord *r, size_t max)
+{
+   return r->arg > 0 && (size_t)r->arg < max ? (size_t)r->arg : max;
+}
+
+// Replays n records, which may be of any mix of types.
+static void replay(const R128TraceRecord *rec, size_t n)
+{
+   R128 out = { 0, 0 };
+   R128_U64 sum = 0;
+   char buf[256];
+   size_t i;
+
+   for (i = 0; i < n; ++i) {
+      const R128TraceRecord *r = &rec[i];
+
+      switch (r->op) {
+      case R128TraceOp_FromInt: r128FromInt(&out, (R128_S64)r->a.lo); break;
+      case R128TraceOp_FromFloat: r128FromFloat(&out, double_of(r->a.lo)); break;
+      case R128TraceOp_FromString:
+         record_text(buf, r);
+         r128FromString(&out, buf, NULL);
+         break;
+      case R128TraceOp_ToInt: sum += (R128_U64)r128ToInt(&r->a); break;
+      case R128TraceOp_ToFloat: sum += (R128_U64)r128ToFloat(&r->a); break;
+      case R128TraceOp_ToString: sum += r128ToString(buf, dst_size(r, sizeof(buf)), &r->a); break;
+      case R128TraceOp_ToStringf: {
+         char format[16];
+         memcpy(format, &r->b, 16);
+         format[15] = '\0';
+         sum += r128ToStringf(buf, dst_size(r, sizeof(buf)), format, &r->a);
+         break;
+      }
+      case R128TraceOp_ToStringOpt: {
+         R128ToStringFormat opt;
+         record_format(&opt, r);
+         sum += r128ToStringOpt(buf, dst_size(r, sizeof(buf)), &r->a, &opt);
+         break;
+      }
+      case R128TraceOp_Copy: r128Copy(&out, &r->a); break;
+      case R128TraceOp_Neg: r128Neg(&out, &r->a); break;
+      case R128TraceOp_Not: r128Not(&out, &r->a); break;
+      case R128TraceOp_Or: r128Or(&out, &r->a, &r->b); break;
+      case R128TraceOp_And: r128And(&out, &r->a, &r->b); break;
+      case R128TraceOp_Xor: r128Xor(&out, &r->a, &r->b); break;
+      case R128TraceOp_Shl: r128Shl(&out, &r->a, r->arg); break;
+      case R128TraceOp_Shr: r128Shr(&out, &r->a, r->arg); break;
+      case R128TraceOp_Sar: r128Sar(&out, &r->a, r->arg); break;
+      case R128TraceOp_Add: r128Add(&out, &r->a, &r->b); break;
+      case R128TraceOp_Sub: r128Sub(&out, &r->a, &r->b); break;
+      case R128TraceOp_Mul: r128Mul(&out, &r->a, &r->b); break;
+      case R128TraceOp_Div: r128Div(&out, &r->a, &r->b); break;
+      case R128TraceOp_Mod: r128Mod(&out, &r->a, &r->b); break;
+      case R128TraceOp_Cmp: sum += (R128_U64)r128Cmp(&r->a, &r->b); break;
+      case R128TraceOp_IsNeg: sum += (R128_U64)r128IsNeg(&r->a); break;
+      case R128TraceOp_Min: r128Min(&out, &r->a, &r->b); break;
+      case R128TraceOp_Max: r128Max(&out, &r->a, &r->b); break;
+      case R128TraceOp_Floor: r128Floor(&out, &r->a); break;
+      case R128TraceOp_Ceil: r128Ceil(&out, &r->a); break;
+      default: break;
+      }
+      sum += out.lo ^ out.hi;
+   }
+   checksum += sum;
+}
+
+// Best time of the repetitions in ns per record, and every one in samples.
+static double measure(const R128TraceRecord *rec, size_t n, double *samples)
+{
+   double best = 1e30;
+   int rep;
+
+   for (rep = 0; rep < reps; ++rep) {
+      double start = bench_now(), t;
+      replay(rec, n);
+      t = (bench_now() - start) * 1e9 / n;
+      samples[rep] = t;
+      if (t < best) {
+         best = t;
+      }
+   }
+   return best;
+}
+
+static R128_U64 rng = 0x9e3779b97f4a7c15ull;
+
+static R128_U64 next_rand(void)
+{
+   rng ^= rng << 13;
+   rng ^= rng >> 7;
+   rng ^= rng << 17;
+   return rng;
+}
+
+// A pricing workload: parse a price and a quantity, multiply, accumulate,
+// compare against a limit, and now and then divide and format.
+static int synthesize(const char *path, size_t n)
+{
+   FILE *f = fopen(path, "wb");
+   R128TraceFileHeader header = {
+      R128_TRACE_MAGIC, R128_TRACE_VERSION, sizeof(R128TraceRecord), R128TraceOp_Count
+   };
+   R128 total = { 0, 0 };
+   size_t i = 0;
+
+   if (!f) {
+      fprintf(stderr, "cannot write %s: %s\n", path, strerror(errno));
+      return 0;
+   }
+   fwrite(&header, sizeof(header), 1, f);
+
+   while (i < n) {
+      R128TraceRecord r[8];
+      R128 price, qty, notional, limit;
+      char text[32];
+      int k = 0, j;
+      R128_U64 x = next_rand();
+
+      memset(r, 0, sizeof(r));
+
+      snprintf(text, sizeof(text), "%u.%02u", (unsigned)(x % 100000), (unsigned)(x >> 20) % 100);
+      r128FromString(&price, text, NULL);
+      r[k].op = R128TraceOp_FromString;
+      r[k].arg = (R128_S32)strlen(text);
+      memcpy(&r[k].a, text, 16);
+      memcpy(&r[k++].b, text + 16, 16);
+
+      r128FromInt(&qty, (R128_S64)((x >> 32) % 1000) + 1);
+      r[k].op = R128TraceOp_FromInt;
+      r[k++].a.lo = qty.hi;
+
+      r128Mul(&notional, &price, &qty);
+      r[k].op = R128TraceOp_Mul;
+      r[k].a = price;
+      r[k++].b = qty;
+
+      r[k].op = R128TraceOp_Add;
+      r[k].a = total;
+      r[k++].b = notional;
+      r128Add(&total, &total, &notional);
+
+      r128FromInt(&limit, 50000000);
+      r[k].op = R128TraceOp_Cmp;
+      r[k].a = notional;
+      r[k++].b = limit;
+
+      if (x % 8 == 0) {
+         r[k].op = R128TraceOp_Div;
+         r[k].a = total;
+         r[k++].b = qty;
+      }
+      if (x % 4 == 0) {
+         r[k].op = R128TraceOp_ToStringf;
+         r[k].arg = 64;
+         r[k].a = notional;
+         memcpy(&r[k++].b, "%.2f", 5);
+      }
+
+      for (j = 0; j < k && i < n; ++j, ++i) {
+         fwrite(&r[j], sizeof(r[j]), 1, f);
+      }
+   }
+
+   fclose(f);
+   printf("wrote %lu calls to %s\n", (unsigned long)n, path);
+   return 1;
+}
+
+static R128_U32 byte_swap(R128_U32 x)
+{
+   return x >> 24 | (x >> 8 & 0xff00) | (x << 8 & 0xff0000) | x << 24;
+}
+
+// Checks the file header; on success the file is positioned at the records.
+static int load_header(const char *path, FILE *f)
+{
+   R128TraceFileHeader header;
+
+   if (fread(&header, sizeof(header), 1, f) != 1 ||
+      (header.magic != R128_TRACE_MAGIC && header.magic != byte_swap(R128_TRACE_MAGIC))) {
+      fprintf(stderr, "%s: not a trace\n", path);
+      return 0;
+   }
+   if (header.magic != R128_TRACE_MAGIC) {
+      fprintf(stderr, "%s: recorded on a machine of the other byte order\n", path);
+      return 0;
+   }
+   if (header.version != R128_TRACE_VERSION || header.recordSize != sizeof(R128TraceRecord)) {
+      fprintf(stderr, "%s: trace version %u with %u-byte records, this build reads version %u with %u\n",
+         path, header.version, header.recordSize, R128_TRACE_VERSION, (unsigned)sizeof(R128TraceRecord));
+      return 0;
+   }
+   if (header.opCount > R128TraceOp_Count) {
+      fprintf(stderr, "%s: recorded by a newer r128.h, with %u op codes; ops from %u on are unknown here\n",
+         path, header.opCount, (unsigned)R128TraceOp_Count);
+   }
+   return 1;
+}
+
+static int load(const char *path)
+{
+   FILE *f = fopen(path, "rb");
+   long size;
+   size_t i;
+
+   if (!f) {
+      fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+      return 0;
+   }
+   if (!load_header(path, f)) {
+      fclose(f);
+      return 0;
+   }
+   fseek(f, 0, SEEK_END);
+   size = ftell(f) - (long)sizeof(R128TraceFileHeader);
+   fseek(f, (long)sizeof(R128TraceFileHeader), SEEK_SET);
+   if (size <= 0 || size % sizeof(R128TraceRecord)) {
+      fprintf(stderr, "%s: empty or truncated trace\n", path);
+      fclose(f);
+      return 0;
+   }
+
+   count = (size_t)size / sizeof(R128TraceRecord);
+   records = (R128TraceRecord *)malloc((size_t)size);
+   if (!records || fread(records, sizeof(R128TraceRecord), count, f) != count) {
+      fprintf(stderr, "cannot read %s\n", path);
+      fclose(f);
+      return 0;
+   }
+   fclose(f);
+
+   for (i = 0; i < count; ++i) {
+      if (records[i].op == R128TraceOp_None || records[i].op >= R128TraceOp_Count) {
+         fprintf(stderr, "%s: record %lu has unknown op %u\n", path, (unsigned long)i, records[i].op);
+         return 0;
+      }
+   }
+   return 1;
+}
+
+int main(int argc, char **argv)
+{
+   const char *jsonPath = bench_json_arg(&argc, argv);
+   BenchJson json;
+   size_t synth = 0, calls[R128TraceOp_Count] = { 0 }, truncated = 0, i;
+   double nsPerOp[R128TraceOp_Count], total = 0, best;
+   R128TraceRecord *byOp;
+   double *samples;
+   const char *path;
+   int op;
+
+   if (argc > 2 && !strcmp(argv[1], "--synth")) {
+      synth = (size_t)strtoul(argv[2], NULL, 0);
+      argv += 2;
+      argc -= 2;
+   }
+   if (argc < 2) {
+      fprintf(stderr, "usage: bench_replay [--json FILE] [--synth N] trace [repetitions]\n");
+      return 1;
+   }
+   path = argv[1];
+   if (synth) {
+      return synthesize(path, synth) ? 0 : 1;
+   }
+
+   reps = (int)bench_arg(argc, argv, 2, 5);
+   if (!load(path)) {
+      return 1;
+   }
+   if (jsonPath && !bench_json_open(&json, jsonPath, "bench_replay", argc, argv)) {
+      return 1;
+   }
+
+   samples = (double *)malloc(reps * sizeof(double));
+   byOp = (R128TraceRecord *)malloc(count * sizeof(R128TraceRecord));
+   if (!samples || !byOp) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+   }
+
+   for (i = 0; i < count; ++i) {
+      ++calls[records[i].op];
+      truncated += records[i].op == R128TraceOp_FromString && records[i].arg > 31;
+   }
+
+   printf("%s: %lu calls, best of %d\n", path, (unsigned long)count, reps);
+   if (truncated) {
+      printf("%lu strings longer than 31 bytes are parsed truncated\n", (unsigned long)truncated);
+   }
+
+   best = measure(records, count, samples);
+   if (jsonPath) {
+      bench_json_result(&json, "all", "in order", "time", "ns", samples, reps, NULL);
+   }
+   printf("in order: %.2f ns per call, %.3f s for the trace\n\n", best, best * count * 1e-9);
+
+   // each type on its own, gathered into one run
+   for (op = 1; op < R128TraceOp_Count; ++op) {
+      size_t n = 0;
+
+      nsPerOp[op] = 0;
+      if (!calls[op]) {
+         continue;
+      }
+      for (i = 0; i < count; ++i) {
+         if ((int)records[i].op == op) {
+            byOp[n++] = records[i];
+         }
+      }
+      nsPerOp[op] = measure(byOp, n, samples);
+      total += nsPerOp[op] * n;
+      if (jsonPath) {
+         bench_json_result(&json, opNames[op], "per op", "time", "ns", samples, reps, NULL);
+      }
+   }
+
+   printf("%-12s %12s %8s %10s %8s\n", "op", "calls", "% calls", "ns/call", "% time");
+   for (op = 1; op < R128TraceOp_Count; ++op) {
+      if (calls[op]) {
+         printf("%-12s %12lu %8.2f %10.2f %8.2f\n", opNames[op], (unsigned long)calls[op],
+            100.0 * calls[op] / count, nsPerOp[op], 100 * nsPerOp[op] * calls[op] / total);
+      }
+   }
+
+   if (jsonPath) {
+      bench_json_close(&json);
+   }
+   return 0;
+}
@@ -0,0 +1,137 @@
+// bench_sharded: scaling of R128ShardedCounter against an array of R128Atomic.
+//
+// Models per-account fee accrual: every thread adds a small fee to a randomly
+// chosen account, for 1 to max-threads threads. Also reports how long it takes
+// to merge all shards into totals.
+//
+// usage: bench_sharded [ops-per-thread] [accounts] [max-threads]
+
+#define R128_IMPLEMENTATION
+#include "../r128_atomic.h"
+#include "bench.h"
+
+#include <pthread.h>
+
+static long opsPerThread;
+static size_t accounts;
+static R128Atomic *atomics;
+static R128ShardedCounter sharded;
+
+typedef struct Worker {
+   pthread_t tid;
+   int shard;
+} Worker;
+
+static R128_U64 next_rand(R128_U64 *state)
+{
+   R128_U64 x = *state;
+   x ^= x << 13;
+   x ^= x >> 7;
+   x ^= x << 17;
+   return *state = x;
+}
+
+static void *run_atomic(void *arg)
+{
+   Worker *w = (Worker *)arg;
+   R128_U64 rng = 0x9e3779b97f4a7c15ull + w->shard;
+   R128 fee;
+   long i;
+
+   r128FromFloat(&fee, 0.0025);
+   for (i = 0; i < opsPerThread; ++i) {
+      r128AtomicFetchAdd(NULL, &atomics[next_rand(&rng) % accounts], &fee);
+   }
+   return NULL;
+}
+
+static void *run_sharded(void *arg)
+{
+   Worker *w = (Worker *)arg;
+   R128_U64 rng = 0x9e3779b97f4a7c15ull + w->shard;
+   R128 fee;
+   long i;
+
+   r128FromFloat(&fee, 0.0025);
+   for (i = 0; i < opsPerThread; ++i) {
+      r128ShardedCounterAdd(&sharded, w->shard, next_rand(&rng) % accounts, &fee);
+   }
+   return NULL;
+}
+
+// Returns ns per operation, summed over all threads.
+static double run(void *(*fn)(void *), int threads)
+{
+   Worker workers[64];
+   double start;
+   int i;
+
+   start = bench_now();
+   for (i = 0; i < threads; ++i) {
+      workers[i].shard = i;
+      pthread_create(&workers[i].tid, NULL, fn, &workers[i]);
+   }
+   for (i = 0; i < threads; ++i) {
+      pthread_join(workers[i].tid, NULL);
+   }
+   return (bench_now() - start) * 1e9 / ((double)opsPerThread * threads);
+}
+
+int main(int argc, char **argv)
+{
+   int maxThreads, threads;
+   R128 *totals;
+   size_t i;
+
+   opsPerThread = bench_arg(argc, argv, 1, 1000000);
+   accounts = (size_t)bench_arg(argc, argv, 2, 1000);
+   maxThreads = (int)bench_arg(argc, argv, 3, 64);
+   if (maxThreads > 64) {
+      maxThreads = 64;
+   }
+
+   atomics = (R128Atomic *)malloc(accounts * sizeof(R128Atomic));
+   totals = (R128 *)malloc(accounts * sizeof(R128));
+   if (!atomics || !totals) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+   }
+
+   printf("%lu accounts\n", (unsigned long)accounts);
+   printf("%8s %14s %14s %10s %12s\n", "threads", "atomic ns/op", "sharded ns/op", "speedup", "merge us");
+
+   for (threads = 1; threads <= maxThreads; threads *= 2) {
+      double tAtomic, tSharded, tMerge;
+
+      for (i = 0; i < accounts; ++i) {
+         r128AtomicInit(&atomics[i], &R128_zero);
+      }
+      if (!r128ShardedCounterInit(&sharded, accounts, threads)) {
+         fprintf(stderr, "out of memory\n");
+         return 1;
+      }
+
+      tAtomic = run(run_atomic, threads);
+      tSharded = run(run_sharded, threads);
+
+      tMerge = bench_now();
+      r128ShardedCounterTotals(totals, &sharded);
+      tMerge = (bench_now() - tMerge) * 1e6;
+
+      for (i = 0; i < accounts; ++i) {
+         R128 a;
+         r128AtomicLoad(&a, &atomics[i]);
+         if (r128Cmp(&a, &totals[i]) != 0) {
+            fprintf(stderr, "totals differ for account %lu at %d threads\n", (unsigned long)i, threads);
+            return 1;
+         }
+      }
+
+      printf("%8d %14.2f %14.2f %9.2fx %12.1f\n", threads, tAtomic, tSharded, tAtomic / tSharded, tMerge);
+      r128ShardedCounterFree(&sharded);
+   }
+
+   free(atomics);
+   free(totals);
+   return 0;
+}
@@ -0,0 +1,113 @@
+// bench_sort: radix sort of R128 keys against std::sort with the R128 operators.
+//
+// Sorts the same random keys with std::sort, std::stable_sort,
+// r128ParallelSortArray (1 and max-threads threads) and r128ParallelSortIndex.
+// Two key distributions are used: full-range random values, and prices with a
+// few decimals, whose constant high bytes let the radix sort skip passes.
+//
+// usage: bench_sort [keys] [max-threads]
+
+#define R128_IMPLEMENTATION
+#include "../r128_parallel.h"
+#include "bench.h"
+
+#include <algorithm>
+#include <string.h>
+#include <vector>
+
+static R128_U64 next_rand(R128_U64 *state)
+{
+   R128_U64 x = *state;
+   x ^= x << 13;
+   x ^= x >> 7;
+   x ^= x << 17;
+   return *state = x;
+}
+
+static void check_sorted(const std::vector<R128> &v, const char *name)
+{
+   for (size_t i = 1; i < v.size(); ++i) {
+      if (v[i] < v[i - 1]) {
+         fprintf(stderr, "%s: not sorted at %lu\n", name, (unsigned long)i);
+         exit(1);
+      }
+   }
+}
+
+static void report(const char *name, double seconds, size_t n)
+{
+   printf("   %-28s %10.2f ms %8.2f ns/key %8.1f Mkeys/s\n", name, seconds * 1e3, seconds * 1e9 / n, n / seconds * 1e-6);
+}
+
+static void run(const std::vector<R128> &keys, int maxThreads)
+{
+   std::vector<R128> v;
+   std::vector<size_t> index(keys.size());
+   size_t n = keys.size();
+   double t;
+
+   v = keys;
+   t = bench_now();
+   std::sort(v.begin(), v.end());
+   report("std::sort", bench_now() - t, n);
+   check_sorted(v, "std::sort");
+
+   v = keys;
+   t = bench_now();
+   std::stable_sort(v.begin(), v.end());
+   report("std::stable_sort", bench_now() - t, n);
+
+   for (int threads = 1;; threads *= 2) {
+      char name[64];
+
+      if (threads > maxThreads) {
+         threads = maxThreads;
+      }
+      r128ParallelSetThreads(threads);
+
+      v = keys;
+      t = bench_now();
+      r128ParallelSortArray(&v[0], n);
+      t = bench_now() - t;
+      sprintf(name, "r128ParallelSortArray x%d", threads);
+      report(name, t, n);
+      check_sorted(v, name);
+
+      t = bench_now();
+      r128ParallelSortIndex(&index[0], &keys[0], n);
+      t = bench_now() - t;
+      sprintf(name, "r128ParallelSortIndex x%d", threads);
+      report(name, t, n);
+
+      if (threads == maxThreads) {
+         break;
+      }
+   }
+}
+
+int main(int argc, char **argv)
+{
+   size_t n = (size_t)bench_arg(argc, argv, 1, 1 << 22);
+   int maxThreads = (int)bench_arg(argc, argv, 2, r128ParallelGetThreads());
+   std::vector<R128> keys(n);
+   R128_U64 rng = 0x9e3779b97f4a7c15ull;
+
+   printf("%lu keys\n", (unsigned long)n);
+
+   printf("full-range random:\n");
+   for (size_t i = 0; i < n; ++i) {
+      keys[i].lo = next_rand(&rng);
+      keys[i].hi = next_rand(&rng);
+   }
+   run(keys, maxThreads);
+
+   printf("prices (+/-100000, 4 decimals):\n");
+   for (size_t i = 0; i < n; ++i) {
+      R128 cents = R128((R128_S64)(next_rand(&rng) % 2000000001) - 1000000000);
+      keys[i] = cents / R128((R128_S64)10000);
+   }
+   run(keys, maxThreads);
+
+   r128ParallelShutdown();
+   return 0;
+}
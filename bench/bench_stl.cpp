@@ -0,0 +1,195 @@
+// bench_stl: OpenMP reductions and C++17 parallel algorithms over R128 arrays.
+//
+// Computes a sum, a minimum and a dot product of random prices with:
+//   serial   r128SumArray, r128MinArray and r128DotArray on one thread
+//   threads  a hand-written std::thread loop over contiguous slices
+//   omp      a parallel for with the r128_omp.h reductions
+//   stl      std::reduce / std::transform_reduce with std::execution::par and
+//            the r128_functional.h function objects
+//   pool     r128ParallelSumArray, r128ParallelMinArray, r128ParallelDotArray
+// and checks that every result equals the serial one. The parallel STL runs on
+// its backend's default thread count.
+//
+// Needs C++17 and OpenMP; with libstdc++ the parallel algorithms need TBB.
+//
+// usage: bench_stl [elements] [threads]
+
+#define R128_IMPLEMENTATION
+#include "../r128_parallel.h"
+#include "../r128_omp.h"
+#include "../r128_functional.h"
+#include "bench.h"
+
+#include <execution>
+#include <numeric>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include <omp.h>
+
+static size_t count;
+static int threads;
+static std::vector<R128> a, b;
+
+enum { SUM, MIN, DOT, OPS };
+
+static void serial(int op, R128 *r)
+{
+   switch (op) {
+   case SUM: r128SumArray(r, a.data(), count); break;
+   case MIN: r128MinArray(r, a.data(), count); break;
+   default: r128DotArray(r, a.data(), b.data(), count); break;
+   }
+}
+
+static void hand_threads(int op, R128 *r)
+{
+   std::vector<std::thread> pool;
+   std::vector<R128> partial(threads);
+   std::vector<R128DotAccumulator> acc(threads);
+   size_t slice = (count + threads - 1) / threads;
+
+   for (int t = 0; t < threads; ++t) {
+      pool.emplace_back([&, t] {
+         size_t begin = std::min(count, t * slice), n = std::min(count, begin + slice) - begin;
+         switch (op) {
+         case SUM: r128SumArray(&partial[t], &a[begin], n); break;
+         case MIN: r128MinArray(&partial[t], &a[begin], n); break;
+         default: r128DotInit(&acc[t]); r128DotAdd(&acc[t], &a[begin], &b[begin], n); break;
+         }
+      });
+   }
+   for (auto &th : pool) {
+      th.join();
+   }
+
+   switch (op) {
+   case SUM: r128SumArray(r, partial.data(), threads); break;
+   case MIN: r128MinArray(r, partial.data(), threads); break;
+   default:
+      for (int t = 1; t < threads; ++t) {
+         r128DotMerge(&acc[0], &acc[t]);
+      }
+      r128DotResult(r, &acc[0]);
+      break;
+   }
+}
+
+static void omp(int op, R128 *r)
+{
+   const R128 *pa = a.data(), *pb = b.data();
+   long n = (long)count, i;
+
+   if (op == SUM) {
+      R128 total = R128_zero;
+      #pragma omp parallel for reduction(r128sum: total)
+      for (i = 0; i < n; ++i) {
+         r128Add(&total, &total, &pa[i]);
+      }
+      *r = total;
+   } else if (op == MIN) {
+      R128 low = R128_max;
+      #pragma omp parallel for reduction(r128min: low)
+      for (i = 0; i < n; ++i) {
+         r128Min(&low, &low, &pa[i]);
+      }
+      *r = low;
+   } else {
+      R128DotAccumulator acc;
+      r128DotInit(&acc);
+      #pragma omp parallel for reduction(r128dot: acc)
+      for (i = 0; i < n; ++i) {
+         r128DotAdd(&acc, &pa[i], &pb[i], 1);
+      }
+      r128DotResult(r, &acc);
+   }
+}
+
+static void stl(int op, R128 *r)
+{
+   switch (op) {
+   case SUM:
+      *r = std::reduce(std::execution::par, a.begin(), a.end(), R128_zero, r128::plus());
+      break;
+   case MIN:
+      *r = std::reduce(std::execution::par, a.begin(), a.end(), R128_max, r128::minimum());
+      break;
+   default:
+      *r = r128::dot_result(std::transform_reduce(std::execution::par, a.begin(), a.end(), b.begin(),
+         r128::dot_init(), r128::dot_plus(), r128::dot_product()));
+      break;
+   }
+}
+
+static void pool(int op, R128 *r)
+{
+   switch (op) {
+   case SUM: r128ParallelSumArray(r, a.data(), count); break;
+   case MIN: r128ParallelMinArray(r, a.data(), count); break;
+   default: r128ParallelDotArray(r, a.data(), b.data(), count); break;
+   }
+}
+
+static const struct {
+   const char *name;
+   void (*fn)(int op, R128 *r);
+} methods[] = {
+   { "serial", serial },
+   { "threads", hand_threads },
+   { "omp", omp },
+   { "stl", stl },
+   { "pool", pool },
+};
+
+int main(int argc, char **argv)
+{
+   static const char *opNames[OPS] = { "sum", "min", "dot" };
+   R128_U64 rng = 0x9e3779b97f4a7c15ull;
+   R128 expect[OPS];
+   int failures = 0;
+
+   count = (size_t)bench_arg(argc, argv, 1, 1 << 22);
+   threads = (int)bench_arg(argc, argv, 2, (long)std::thread::hardware_concurrency());
+   omp_set_num_threads(threads);
+   r128ParallelSetThreads(threads);
+
+   // prices in (-1000, 1000) and quantities in [0, 100) with full fractions
+   a.resize(count);
+   b.resize(count);
+   for (size_t i = 0; i < count; ++i) {
+      rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+      a[i] = R128(rng, (R128_U64)((R128_S64)(rng % 2000) - 1000));
+      rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+      b[i] = R128(rng, rng % 100);
+   }
+
+   for (int op = 0; op < OPS; ++op) {
+      serial(op, &expect[op]);
+   }
+
+   printf("%lu elements, %d threads\n", (unsigned long)count, threads);
+   printf("%-8s %12s %12s %12s\n", "", "sum ns/elem", "min ns/elem", "dot ns/elem");
+   for (const auto &m : methods) {
+      printf("%-8s", m.name);
+      for (int op = 0; op < OPS; ++op) {
+         R128 r;
+         double start, t;
+
+         m.fn(op, &r);   // warm up
+         start = bench_now();
+         m.fn(op, &r);
+         t = (bench_now() - start) * 1e9 / count;
+         printf(" %12.2f", t);
+
+         if (memcmp(&r, &expect[op], sizeof(R128))) {
+            fprintf(stderr, "\n%s %s differs from the serial result\n", m.name, opNames[op]);
+            ++failures;
+         }
+      }
+      printf("\n");
+   }
+
+   r128ParallelShutdown();
+   return failures ? 1 : 0;
+}
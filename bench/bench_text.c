@@ -0,0 +1,272 @@
+// bench_text: decimal text parsing and formatting throughput.
+//
+// Generates datasets that look like real input:
+//   prices     0 to 100000 with 2 to 8 decimals
+//   notionals  up to 10^15 with 2 decimals
+//   tiny       fractions with 10 to 18 leading decimals
+//   negative   prices in (-1000, 0) with 4 decimals
+//   hex        hexadecimal with up to 4 fraction digits, e.g. 0x1f3a.8c
+// and for each measures r128FromString against strtod, and r128ToString,
+// r128ToStringf (plain, zero-padded with sign, left-aligned) and
+// r128ToStringOpt against snprintf with the equivalent format on doubles.
+//
+// Reports MB/s of text read or written, millions of values per second, and
+// R128's speed relative to double (above 1 is faster).
+//
+// With --json FILE, the ns per value of every repetition is also written to
+// FILE for bench_diff.
+//
+// usage: bench_text [--json FILE] [values] [repetitions]
+
+#define R128_IMPLEMENTATION
+#include "../r128.h"
+#include "bench.h"
+
+#include <string.h>
+
+#define STRIDE 64
+
+enum { PRICES, NOTIONALS, TINY, NEGATIVE, HEX, DATASETS };
+
+static const char *datasetNames[DATASETS] = { "prices", "notionals", "tiny", "negative", "hex" };
+
+// Default precision for "%.Nf" on each dataset.
+static const int datasetDecimals[DATASETS] = { 8, 2, 18, 4, 6 };
+
+static size_t count;
+static int reps;
+static char *text;            // count strings, STRIDE bytes apart
+static size_t textBytes;      // sum of the string lengths
+static R128 *values;
+static double *doubles;
+static char *out;
+static R128_U64 rng = 0x9e3779b97f4a7c15ull;
+static BenchJson json;
+static double *r128Samples, *doubleSamples;
+
+static const unsigned pow10[9] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000 };
+
+static R128_U64 next_rand(void)
+{
+   rng ^= rng << 13;
+   rng ^= rng >> 7;
+   rng ^= rng << 17;
+   return rng;
+}
+
+static void generate(int dataset)
+{
+   size_t i;
+
+   textBytes = 0;
+   for (i = 0; i < count; ++i) {
+      char *s = text + i * STRIDE;
+      R128_U64 r = next_rand();
+      int decimals, n;
+
+      switch (dataset) {
+      case PRICES:
+         decimals = 2 + (int)(r % 7);
+         n = snprintf(s, STRIDE, "%u.%0*u", (unsigned)((r >> 8) % 100000), decimals,
+            (unsigned)((r >> 28) % pow10[decimals]));
+         break;
+
+      case NOTIONALS:
+         n = snprintf(s, STRIDE, "%llu.%02u", (unsigned long long)((r >> 8) % 1000000000000000ull),
+            (unsigned)((r >> 3) % 100));
+         break;
+
+      case TINY:
+         decimals = 10 + (int)(r % 9);
+         n = snprintf(s, STRIDE, "0.%0*u%u", decimals, 0, (unsigned)((r >> 8) % 99999 + 1));
+         break;
+
+      case NEGATIVE:
+         n = snprintf(s, STRIDE, "-%u.%04u", (unsigned)((r >> 8) % 1000), (unsigned)((r >> 24) % 10000));
+         break;
+
+      default:
+         n = snprintf(s, STRIDE, "0x%x.%.*x", (unsigned)((r >> 8) % 0x100000), 1 + (int)(r % 4),
+            (unsigned)((r >> 32) & 0xffff) >> (4 * (3 - (int)(r % 4))));
+         break;
+      }
+
+      textBytes += (size_t)n;
+   }
+
+   for (i = 0; i < count; ++i) {
+      r128FromString(&values[i], text + i * STRIDE, NULL);
+      doubles[i] = strtod(text + i * STRIDE, NULL);
+   }
+}
+
+typedef struct Result {
+   double seconds;
+   size_t bytes;
+} Result;
+
+static volatile R128_U64 checksum;
+
+static void parse_r128(Result *res)
+{
+   R128_U64 sum = 0;
+   size_t i;
+
+   for (i = 0; i < count; ++i) {
+      R128 v;
+      r128FromString(&v, text + i * STRIDE, NULL);
+      sum += v.lo ^ v.hi;
+   }
+   checksum += sum;
+   res->bytes = textBytes;
+}
+
+static void parse_double(Result *res)
+{
+   double sum = 0;
+   size_t i;
+
+   for (i = 0; i < count; ++i) {
+      sum += strtod(text + i * STRIDE, NULL);
+   }
+   checksum += (R128_U64)sum;
+   res->bytes = textBytes;
+}
+
+// The format of the current row: a printf format for doubles, and the same as
+// an r128ToStringf format or as options for r128ToStringOpt.
+static char formatString[32];
+static R128ToStringFormat formatOpt;
+
+static void format_r128(Result *res)
+{
+   size_t i, bytes = 0;
+
+   for (i = 0; i < count; ++i) {
+      bytes += (size_t)r128ToString(out + i * STRIDE, STRIDE, &values[i]);
+   }
+   res->bytes = bytes;
+}
+
+static void formatf_r128(Result *res)
+{
+   size_t i, bytes = 0;
+
+   for (i = 0; i < count; ++i) {
+      bytes += (size_t)r128ToStringf(out + i * STRIDE, STRIDE, formatString, &values[i]);
+   }
+   res->bytes = bytes;
+}
+
+static void formatopt_r128(Result *res)
+{
+   size_t i, bytes = 0;
+
+   for (i = 0; i < count; ++i) {
+      bytes += (size_t)r128ToStringOpt(out + i * STRIDE, STRIDE, &values[i], &formatOpt);
+   }
+   res->bytes = bytes;
+}
+
+static void format_double(Result *res)
+{
+   size_t i, bytes = 0;
+
+   for (i = 0; i < count; ++i) {
+      bytes += (size_t)snprintf(out + i * STRIDE, STRIDE, formatString, doubles[i]);
+   }
+   res->bytes = bytes;
+}
+
+// Keeps the best time in res and every repetition's ns per value in samples.
+static void measure(void (*fn)(Result *), Result *res, double *samples)
+{
+   int rep;
+
+   res->seconds = 1e30;
+   for (rep = 0; rep < reps; ++rep) {
+      double start = bench_now(), t;
+      fn(res);
+      t = bench_now() - start;
+      samples[rep] = t * 1e9 / count;
+      if (t < res->seconds) {
+         res->seconds = t;
+      }
+   }
+}
+
+static void report(const char *dataset, const char *op, void (*r128Fn)(Result *), void (*doubleFn)(Result *))
+{
+   Result r, d;
+
+   measure(r128Fn, &r, r128Samples);
+   measure(doubleFn, &d, doubleSamples);
+   bench_json_result(&json, op, dataset, "r128", "ns", r128Samples, reps, NULL);
+   bench_json_result(&json, op, dataset, "double", "ns", doubleSamples, reps, NULL);
+   printf("%-10s %-18s %10.1f %10.2f %10.1f %10.2f %8.2f\n", dataset, op,
+      r.bytes / r.seconds * 1e-6, count / r.seconds * 1e-6,
+      d.bytes / d.seconds * 1e-6, count / d.seconds * 1e-6, d.seconds / r.seconds);
+   fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+   const char *jsonPath = bench_json_arg(&argc, argv);
+   int dataset;
+
+   count = (size_t)bench_arg(argc, argv, 1, 1000000);
+   reps = (int)bench_arg(argc, argv, 2, 3);
+   if (jsonPath && !bench_json_open(&json, jsonPath, "bench_text", argc, argv)) {
+      return 1;
+   }
+
+   text = (char *)malloc(count * STRIDE);
+   out = (char *)malloc(count * STRIDE);
+   values = (R128 *)malloc(count * sizeof(R128));
+   doubles = (double *)malloc(count * sizeof(double));
+   r128Samples = (double *)malloc(reps * sizeof(double));
+   doubleSamples = (double *)malloc(reps * sizeof(double));
+   if (!text || !out || !values || !doubles || !r128Samples || !doubleSamples) {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+   }
+
+   printf("%lu values per dataset, best of %d\n", (unsigned long)count, reps);
+   printf("%-10s %-18s %21s %21s %8s\n", "", "", "R128", "double", "");
+   printf("%-10s %-18s %10s %10s %10s %10s %8s\n", "dataset", "operation", "MB/s", "Mvalues/s",
+      "MB/s", "Mvalues/s", "speedup");
+
+   for (dataset = 0; dataset < DATASETS; ++dataset) {
+      const char *name = datasetNames[dataset];
+      char label[32];
+
+      generate(dataset);
+
+      report(name, "parse", parse_r128, parse_double);
+
+      strcpy(formatString, "%.17g");
+      report(name, "ToString", format_r128, format_double);
+
+      snprintf(formatString, sizeof(formatString), "%%.%df", datasetDecimals[dataset]);
+      snprintf(label, sizeof(label), "ToStringf %s", formatString);
+      report(name, label, formatf_r128, format_double);
+
+      strcpy(formatString, "%+020.4f");
+      report(name, "ToStringf %+020.4f", formatf_r128, format_double);
+
+      strcpy(formatString, "%-24.6f");
+      report(name, "ToStringf %-24.6f", formatf_r128, format_double);
+
+      // %+020.4f again, through the options struct
+      strcpy(formatString, "%+020.4f");
+      memset(&formatOpt, 0, sizeof(formatOpt));
+      formatOpt.sign = R128ToStringSign_Plus;
+      formatOpt.width = 20;
+      formatOpt.precision = 4;
+      formatOpt.zeroPad = 1;
+      report(name, "ToStringOpt", formatopt_r128, format_double);
+   }
+
+   bench_json_close(&json);
+   return 0;
+}
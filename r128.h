@@ -10,7 +10,11 @@ file in your project, put:
 #define R128_IMPLEMENTATION
 
 before you include this file. You may also provide a definition for R128_ASSERT
-to force the library to use a custom assert macro.
+to force the library to use a custom assert macro. The companion headers
+(r128_atomic.h, r128_parallel.h, r128_pipeline.h) allocate memory with
+R128_MALLOC(size) and R128_FREE(ptr), which default to malloc and free; define
+both in the implementation file, before including any of them, to use another
+allocator. R128_CACHE_LINE (default 64) sets their padding.
 
 COMPILER/LIBRARY SUPPORT
 ------------------------
@@ -23,12 +27,58 @@ This can be avoided by defining an R128_ASSERT macro in your implementation
 file. Since this library uses 64-bit arithmetic, this may implicitly add a
 runtime library dependency on 32-bit platforms.
 
+Define R128_STDC_ONLY in the implementation file to use only the portable C code
+paths, with no intrinsics, inline assembly or __int128. This is slower, and is
+mostly useful for testing those paths on a 64-bit machine (see test/fuzz.c).
+
+Define R128_RECIP_DIV in the implementation file to divide by multiplying with
+a precomputed reciprocal on x86-64, instead of with the divq instruction. This
+is faster on processors where divq takes 40 to 90 cycles, and slower on those
+with a fast divider; bench/ make recip builds benchmarks to compare the two.
+Other 64-bit targets always divide this way.
+
+STATISTICS
+----------
+Define R128_STATS before including this file (in every file that includes it)
+to count, per thread, how often the library takes its slow or saturating paths:
+quotients that overflowed, divisions by zero, quotient corrections in the
+division loops, out-of-range doubles clamped by r128FromFloat, and strings cut
+short by a small dstSize. Read and clear the calling thread's counts with
+r128StatsGet and r128StatsReset. Without R128_STATS the counting compiles to
+nothing.
+
+TRACING
+-------
+Define R128_TRACE before including this file (in every file that includes it)
+to record the scalar calls a thread makes, with their operands, as
+R128TraceRecords: r128TraceStart begins recording into a ring buffer, or into
+a buffer that is handed to a callback whenever it fills up, for example to
+stream it to a file after an R128TraceFileHeader. The element-wise array
+functions record one call per element. Calls the library makes internally,
+including those from r128_atomic.h, r128_parallel.h and r128_pipeline.h, and
+the reduction, dot product and histogram functions, are not recorded. The
+r128_omp.h reductions and r128_functional.h function objects expand in the
+caller's code, so the calls they make are. bench/bench_replay re-runs a trace
+file and reports the time per operation.
+
+CPU DISPATCH
+------------
+The array functions that have SIMD kernels pick the best one for the
+processor on first use (see R128Cpu). r128CpuSet or the R128_CPU environment
+variable can force a lower level for testing, and r128CpuReport lists what was
+chosen. This reads the environment with getenv on x86-64.
+
 C++ SUPPORT
 -----------
 Operator overloads are supplied for C++ files that include this file. Since all
 C++ functions are declared inline (or static inline), the R128_IMPLEMENTATION
 file can be either C++ or C.
 
+In C++11 and later the default constructor is defaulted, so R128 is a trivial
+type: it can be held in unions, copied with memcpy, and used in uninitialized
+buffers by the parallel algorithms. A default-constructed R128 is
+uninitialized, as in C.
+
 LICENSE
 -------
 Copyright (c) 2017 F. Alan Hickman
@@ -76,6 +126,10 @@ SOFTWARE.
 #  define R128_LIT_U64(x) x##ull
 #endif
 
+#if defined(__cplusplus) && (__cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1800))
+#  define R128__CXX11 1
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -85,7 +139,11 @@ typedef struct R128 {
    R128_U64 hi;
 
 #ifdef __cplusplus
+#  ifdef R128__CXX11
+   R128() = default;
+#  else
    R128();
+#  endif
    R128(R128_S64);
    R128(double);
    R128(R128_U64 low, R128_U64 high);
@@ -247,6 +305,157 @@ extern int r128ToString(char *dst, size_t dstSize, const R128 *v);
 //
 extern void r128FromString(R128 *dst, const char *s, char **endptr);
 
+// Array operations
+//
+// Each applies the corresponding scalar operation to n consecutive elements.
+// dst may be the same array as a source, but the arrays may not otherwise overlap.
+//
+extern void r128AddArray(R128 *dst, const R128 *a, const R128 *b, size_t n);  // dst[i] = a[i] + b[i]
+extern void r128SubArray(R128 *dst, const R128 *a, const R128 *b, size_t n);  // dst[i] = a[i] - b[i]
+extern void r128MulArray(R128 *dst, const R128 *a, const R128 *b, size_t n);  // dst[i] = a[i] * b[i]
+extern void r128DivArray(R128 *dst, const R128 *a, const R128 *b, size_t n);  // dst[i] = a[i] / b[i]
+extern void r128FromFloatArray(R128 *dst, const double *src, size_t n);
+extern void r128ToFloatArray(double *dst, const R128 *src, size_t n);
+extern void r128FromStringArray(R128 *dst, const char *const *src, size_t n);
+
+// r128ToStringArray: format n values with r128ToString. String i is written to
+// dst + i * dstStride, truncated to dstStride bytes including the null terminator.
+extern void r128ToStringArray(char *dst, size_t dstStride, const R128 *src, size_t n);
+
+// CPU dispatch
+//
+// r128AddArray, r128SubArray and r128MulArray have kernels for several
+// instruction set levels, and use the best one the processor supports. The
+// level is chosen on the first call to one of them, from CPUID, or from the
+// R128_CPU environment variable if it names a level ("scalar", "avx2",
+// "avx512ifma"). Every kernel gives the same results as the scalar operations,
+// which are not dispatched.
+typedef enum R128Cpu {
+   R128Cpu_Auto = -1,   // r128CpuSet: the best level supported, or R128_CPU
+   R128Cpu_Scalar,      // portable C
+   R128Cpu_AVX2,        // x86-64 with AVX2
+   R128Cpu_AVX512IFMA,  // x86-64 with AVX-512F and AVX-512 IFMA
+   R128Cpu_Count
+} R128Cpu;
+
+// r128CpuSet: selects the kernels of level, or of the best level below it that
+// the processor supports, and returns the level selected. The automatic choice
+// on first use is thread-safe, but do not call r128CpuSet while another thread
+// may be in an array function.
+extern R128Cpu r128CpuSet(R128Cpu level);
+
+// r128CpuGet: returns the level in use.
+extern R128Cpu r128CpuGet(void);
+
+// r128CpuReport: writes the detected and selected levels and the kernel each
+// dispatched function uses, one per line. Returns the number of characters
+// written, not including the final null terminator.
+extern int r128CpuReport(char *dst, size_t dstSize);
+
+// r128SumArray: dst = src[0] + src[1] + ... + src[n - 1]. Since fixed-point
+// addition wraps like integer addition, the result does not depend on the order
+// in which the elements are added.
+extern void r128SumArray(R128 *dst, const R128 *src, size_t n);
+
+// Prefix sums (scans)
+//
+// r128InclusiveScanArray: dst[i] = init + src[0] + ... + src[i]
+// r128ExclusiveScanArray: dst[i] = init + src[0] + ... + src[i - 1]
+//
+// init may be NULL to start from zero. dst may be the same array as src.
+//
+// Returns non-zero if any running sum overflowed (wrapped past R128_max or
+// R128_min); the results wrap in that case, as r128Add does.
+//
+extern int r128InclusiveScanArray(R128 *dst, const R128 *src, size_t n, const R128 *init);
+extern int r128ExclusiveScanArray(R128 *dst, const R128 *src, size_t n, const R128 *init);
+
+// Reductions
+//
+// Every reduction below gives bit-identical results however the input is split
+// into pieces and in whatever order the pieces are combined, so batched and
+// parallel versions can promise the same answer as one serial pass. Sums wrap
+// exactly like integer addition; dot products are summed exactly in a wider
+// accumulator and rounded once.
+//
+// r128MinArray, r128MaxArray: the smallest or largest of n values. For n == 0
+// the result is R128_max or R128_min respectively, so that combining it with
+// any other partial result leaves that result unchanged.
+extern void r128MinArray(R128 *dst, const R128 *src, size_t n);
+extern void r128MaxArray(R128 *dst, const R128 *src, size_t n);
+
+// r128CountArray: the number of values with lo <= v < hi. Either bound may be
+// NULL to leave that side open.
+extern size_t r128CountArray(const R128 *src, size_t n, const R128 *lo, const R128 *hi);
+
+// Exact dot products
+//
+// An R128DotAccumulator holds the exact sum of 64.64 products as a 320-bit
+// fixed-point value (128 fraction bits and 64 guard bits above the product
+// range), so no rounding or overflow happens until the result is taken.
+// r128DotResult rounds like r128Mul: to nearest, halves away from zero, and the
+// result wraps if it does not fit.
+//
+typedef struct R128DotAccumulator {
+   R128_U64 limb[5];    // two's complement, least significant limb first
+} R128DotAccumulator;
+
+extern void r128DotInit(R128DotAccumulator *acc);
+extern void r128DotAdd(R128DotAccumulator *acc, const R128 *a, const R128 *b, size_t n);  // acc += a[i] * b[i]
+extern void r128DotMerge(R128DotAccumulator *acc, const R128DotAccumulator *other);       // acc += other
+extern void r128DotResult(R128 *dst, const R128DotAccumulator *acc);
+
+// r128DotArray: a[0] * b[0] + ... + a[n - 1] * b[n - 1], rounded once.
+extern void r128DotArray(R128 *dst, const R128 *a, const R128 *b, size_t n);
+
+// Histograms
+//
+// An R128Histogram maps values to bucket numbers in [0, buckets). It holds no
+// allocated memory; set one up with one of the init functions:
+//
+// r128HistogramInitLinear: buckets equal-width buckets, bucket i holding
+//    [min + i * width, min + (i + 1) * width). Values below min are counted in
+//    bucket 0 and values past the end in bucket buckets - 1. width must be
+//    positive. Bucket numbers are computed with a shift (when width is a power
+//    of two) or a multiply by a precomputed reciprocal, not a division.
+//
+// r128HistogramInitBounds: boundCount + 1 buckets split at the ascending values
+//    bounds[0], ..., bounds[boundCount - 1]; bucket i holds
+//    [bounds[i - 1], bounds[i]). The array is referenced, not copied.
+//
+// r128HistogramInitLog: HDR-style logarithmic buckets. Each power-of-two range
+//    [2^e, 2^(e+1)) is split into 2^subBucketBits equal buckets, so every bucket
+//    is within a relative 2^-subBucketBits of its start. Values below
+//    2^(subBucketBits - 64) get one bucket per representable value; negative
+//    values are counted in bucket 0. subBucketBits must be in [0, 16], giving
+//    (128 - subBucketBits) << subBucketBits buckets.
+//
+typedef struct R128Histogram {
+   size_t buckets;   // number of buckets; the other fields are private
+   int kind;
+   int shift;
+   R128_U64 recip;
+   R128 min, width, last;
+   const R128 *bounds;
+} R128Histogram;
+
+extern void r128HistogramInitLinear(R128Histogram *h, const R128 *min, const R128 *width, size_t buckets);
+extern void r128HistogramInitBounds(R128Histogram *h, const R128 *bounds, size_t boundCount);
+extern void r128HistogramInitLog(R128Histogram *h, int subBucketBits);
+
+// r128HistogramBucket: the bucket number for v.
+extern size_t r128HistogramBucket(const R128Histogram *h, const R128 *v);
+
+// r128HistogramBucketStart: the smallest value that maps to bucket, ignoring
+// the clamping of out-of-range values (so R128_min for the first bucket of a
+// bounds histogram).
+extern void r128HistogramBucketStart(R128 *dst, const R128Histogram *h, size_t bucket);
+
+// r128HistogramArray: counts[r128HistogramBucket(h, &src[i])] += 1 for each of
+// the n values. counts must have h->buckets elements; it is added to, not
+// cleared.
+extern void r128HistogramArray(R128_U64 *counts, const R128Histogram *h, const R128 *src, size_t n);
+
 // Constants
 extern const R128 R128_min;      // minimum (most negative) value
 extern const R128 R128_max;      // maximum (most positive) value
@@ -256,6 +465,94 @@ extern const R128 R128_one;      // 1.0
 
 extern char R128_decimal;        // decimal point character used by r128From/ToString. defaults to '.'
 
+#ifdef R128_STATS
+// Statistics: counts for the calling thread since it started or last called
+// r128StatsReset.
+typedef struct R128Stats {
+   R128_U64 divOverflow;      // r128Div/r128Mod quotients too large, saturated
+   R128_U64 divByZero;        // r128Div/r128Mod with a zero divisor
+   R128_U64 divRefine;        // quotient digit corrections in the division loops
+   R128_U64 floatClamp;       // r128FromFloat arguments outside the R128 range
+   R128_U64 formatTruncated;  // r128ToString* results cut short by dstSize
+} R128Stats;
+
+extern void r128StatsGet(R128Stats *dst);
+extern void r128StatsReset(void);
+#endif   //R128_STATS
+
+// Operation trace. The record layout is declared even without R128_TRACE, so
+// replay tools can read traces without recording any themselves. The op codes
+// are stored in trace files, so they are append-only: new ones go just before
+// R128TraceOp_Count and existing ones never move.
+typedef enum R128TraceOp {
+   R128TraceOp_None,
+   R128TraceOp_FromInt,       // a.lo = the integer
+   R128TraceOp_FromFloat,     // a.lo = the bits of the double
+   R128TraceOp_FromString,    // a and b: the text parsed, NUL-terminated, at most 31 bytes; arg = its full length
+   R128TraceOp_ToInt,
+   R128TraceOp_ToFloat,
+   R128TraceOp_ToString,      // arg = dstSize
+   R128TraceOp_ToStringf,     // b: the format, NUL-terminated, at most 15 bytes; arg = dstSize
+   R128TraceOp_ToStringOpt,   // b.lo = width | precision << 32; b.hi = sign | zeroPad << 8 | decimal << 16 | leftAlign << 24; arg = dstSize
+   R128TraceOp_Copy,
+   R128TraceOp_Neg,
+   R128TraceOp_Not,
+   R128TraceOp_Or,
+   R128TraceOp_And,
+   R128TraceOp_Xor,
+   R128TraceOp_Shl,           // arg = amount
+   R128TraceOp_Shr,           // arg = amount
+   R128TraceOp_Sar,           // arg = amount
+   R128TraceOp_Add,
+   R128TraceOp_Sub,
+   R128TraceOp_Mul,
+   R128TraceOp_Div,
+   R128TraceOp_Mod,
+   R128TraceOp_Cmp,
+   R128TraceOp_IsNeg,
+   R128TraceOp_Min,
+   R128TraceOp_Max,
+   R128TraceOp_Floor,
+   R128TraceOp_Ceil,
+   R128TraceOp_Count
+} R128TraceOp;
+
+// One call. Unless noted above, a and b are the operands in argument order.
+typedef struct R128TraceRecord {
+   R128_U32 op;               // R128TraceOp
+   R128_S32 arg;
+   R128 a, b;
+} R128TraceRecord;
+
+// A trace file is this header followed by the records, all in the byte order
+// of the machine that recorded them; a reader on the other byte order sees the
+// magic number reversed. Bump the version when the record layout changes.
+#define R128_TRACE_MAGIC 0x52313238u   // "R128"
+#define R128_TRACE_VERSION 1
+
+typedef struct R128TraceFileHeader {
+   R128_U32 magic;            // R128_TRACE_MAGIC
+   R128_U32 version;          // R128_TRACE_VERSION
+   R128_U32 recordSize;       // sizeof(R128TraceRecord)
+   R128_U32 opCount;          // R128TraceOp_Count of the recording build
+} R128TraceFileHeader;
+
+#ifdef R128_TRACE
+// Receives each full buffer of records, e.g. to append them to a file. Calls
+// it makes to the library are not recorded. It must not call r128TraceStart or
+// r128TraceStop.
+typedef void (*R128TraceFlush)(const R128TraceRecord *records, size_t count, void *user);
+
+// Starts recording the calling thread's calls into buffer, which holds
+// capacity records. When it is full, the records are passed to flush if that
+// is not NULL, otherwise the oldest ones are overwritten.
+extern void r128TraceStart(R128TraceRecord *buffer, size_t capacity, R128TraceFlush flush, void *user);
+
+// Stops recording. Flushes what is left, or puts the ring buffer in order,
+// oldest first, and returns the number of records left in the buffer.
+extern size_t r128TraceStop(void);
+#endif   //R128_TRACE
+
 #ifdef __cplusplus
 }
 
@@ -304,7 +601,9 @@ struct numeric_limits<R128>
 };
 }  //namespace std
 
+#ifndef R128__CXX11
 inline R128::R128() {}
+#endif
 
 inline R128::R128(R128_S64 v)
 {
@@ -514,7 +813,8 @@ static inline bool operator!=(const R128 &lhs, const R128 &rhs)
 #endif   //__cplusplus
 #endif   //H_R128_H
 
-#ifdef R128_IMPLEMENTATION
+#if defined(R128_IMPLEMENTATION) && !defined(H_R128_IMPLEMENTATION)
+#define H_R128_IMPLEMENTATION
 
 #define R128_SET2(x, l, h) do { (x)->lo = (R128_U64)(l); (x)->hi = (R128_U64)(h); } while(0)
 #define R128_R0(x) ((R128_U32)(x)->lo)
@@ -536,7 +836,9 @@ static inline bool operator!=(const R128 &lhs, const R128 &rhs)
 #  define R128_R3(x) ((R128_U32)((x)->hi >> 32))
 #endif
 
-#if defined(_M_X64)
+#if defined(R128_STDC_ONLY)
+   // portable C on every target
+#elif defined(_M_X64)
 #  define R128_INTEL 1
 #  define R128_64BIT 1
 #  include <intrin.h>
@@ -557,6 +859,9 @@ static inline bool operator!=(const R128 &lhs, const R128 &rhs)
 #  include <intrin.h>
 #elif defined(__aarch64__)
 #  define R128_64BIT 1
+#elif defined(__SIZEOF_INT128__)
+   // other 64-bit GCC/Clang targets (RISC-V, POWER, z/Architecture, ...)
+#  define R128_64BIT 1
 #endif
 
 #ifndef R128_INTEL
@@ -567,12 +872,159 @@ static inline bool operator!=(const R128 &lhs, const R128 &rhs)
 #  define R128_64BIT 0
 #endif
 
+// unsigned __int128 arithmetic, where the compiler provides it
+#if defined(__SIZEOF_INT128__) && !defined(R128_STDC_ONLY)
+#  define R128__INT128 1
+#else
+#  define R128__INT128 0
+#endif
+
+// division by multiplying with a precomputed reciprocal: on 64-bit targets
+// without a 128/64 divide instruction, and on x86-64 with R128_RECIP_DIV
+#if R128_64BIT && (!R128_INTEL || defined(R128_RECIP_DIV))
+#  define R128__RECIP_DIV 1
+#else
+#  define R128__RECIP_DIV 0
+#endif
+
 #ifndef R128_ASSERT
 #  include <assert.h>
 #  define R128_ASSERT(x) assert(x)
 #endif
 
-#include <stdlib.h>  // for NULL
+#include <stdlib.h>  // for NULL, getenv, malloc and free
+
+// Allocation for the companion headers, which are compiled in this file
+#if defined(R128_MALLOC) != defined(R128_FREE)
+#  error "Define both R128_MALLOC and R128_FREE, or neither"
+#endif
+#ifndef R128_MALLOC
+#  define R128_MALLOC(size) malloc(size)
+#  define R128_FREE(ptr) free(ptr)
+#endif
+
+#ifndef R128_CACHE_LINE
+#  define R128_CACHE_LINE 64
+#endif
+
+// run-time selection of SIMD kernels
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(R128_STDC_ONLY)
+#  define R128__DISPATCH 1
+#  if defined(_MSC_VER)
+#    define R128__TARGET(isa)
+#  else
+#    include <cpuid.h>
+#    define R128__TARGET(isa) __attribute__((target(isa)))
+#  endif
+#else
+#  define R128__DISPATCH 0
+#endif
+
+#if defined(R128_STATS) || defined(R128_TRACE)
+#  if defined(_MSC_VER)
+#    define R128__THREAD_LOCAL __declspec(thread)
+#  elif defined(__GNUC__) || defined(__clang__)
+#    define R128__THREAD_LOCAL __thread
+#  else
+#    define R128__THREAD_LOCAL _Thread_local
+#  endif
+#endif
+
+#ifdef R128_STATS
+static R128__THREAD_LOCAL R128Stats r128__stats;
+#  define R128__STAT(counter) (++r128__stats.counter)
+#else
+#  define R128__STAT(counter) ((void)0)
+#endif
+
+#ifdef R128_TRACE
+typedef struct R128__TraceState {
+   R128TraceRecord *buffer;
+   size_t capacity;
+   size_t count;
+   int wrapped;
+   R128TraceFlush flush;
+   void *user;
+} R128__TraceState;
+
+static R128__THREAD_LOCAL R128__TraceState r128__trace;
+
+// The implementations get internal names, so the library's calls between them
+// are not recorded. The public functions at the end record and forward.
+#  define r128FromInt r128__traceFromInt
+#  define r128FromFloat r128__traceFromFloat
+#  define r128FromString r128__traceFromString
+#  define r128ToInt r128__traceToInt
+#  define r128ToFloat r128__traceToFloat
+#  define r128ToStringOpt r128__traceToStringOpt
+#  define r128ToStringf r128__traceToStringf
+#  define r128ToString r128__traceToString
+#  define r128Copy r128__traceCopy
+#  define r128Neg r128__traceNeg
+#  define r128Not r128__traceNot
+#  define r128Or r128__traceOr
+#  define r128And r128__traceAnd
+#  define r128Xor r128__traceXor
+#  define r128Shl r128__traceShl
+#  define r128Shr r128__traceShr
+#  define r128Sar r128__traceSar
+#  define r128Add r128__traceAdd
+#  define r128Sub r128__traceSub
+#  define r128Mul r128__traceMul
+#  define r128Div r128__traceDiv
+#  define r128Mod r128__traceMod
+#  define r128Cmp r128__traceCmp
+#  define r128IsNeg r128__traceIsNeg
+#  define r128Min r128__traceMin
+#  define r128Max r128__traceMax
+#  define r128Floor r128__traceFloor
+#  define r128Ceil r128__traceCeil
+#  define r128AddArray r128__traceAddArray
+#  define r128SubArray r128__traceSubArray
+#  define r128MulArray r128__traceMulArray
+#  define r128DivArray r128__traceDivArray
+#  define r128FromFloatArray r128__traceFromFloatArray
+#  define r128ToFloatArray r128__traceToFloatArray
+#  define r128FromStringArray r128__traceFromStringArray
+#  define r128ToStringArray r128__traceToStringArray
+
+void r128FromInt(R128 *dst, R128_S64 v);
+void r128FromFloat(R128 *dst, double v);
+void r128FromString(R128 *dst, const char *s, char **endptr);
+R128_S64 r128ToInt(const R128 *v);
+double r128ToFloat(const R128 *v);
+int r128ToStringOpt(char *dst, size_t dstSize, const R128 *v, const R128ToStringFormat *opt);
+int r128ToStringf(char *dst, size_t dstSize, const char *format, const R128 *v);
+int r128ToString(char *dst, size_t dstSize, const R128 *v);
+void r128Copy(R128 *dst, const R128 *src);
+void r128Neg(R128 *dst, const R128 *src);
+void r128Not(R128 *dst, const R128 *src);
+void r128Or(R128 *dst, const R128 *a, const R128 *b);
+void r128And(R128 *dst, const R128 *a, const R128 *b);
+void r128Xor(R128 *dst, const R128 *a, const R128 *b);
+void r128Shl(R128 *dst, const R128 *src, int amount);
+void r128Shr(R128 *dst, const R128 *src, int amount);
+void r128Sar(R128 *dst, const R128 *src, int amount);
+void r128Add(R128 *dst, const R128 *a, const R128 *b);
+void r128Sub(R128 *dst, const R128 *a, const R128 *b);
+void r128Mul(R128 *dst, const R128 *a, const R128 *b);
+void r128Div(R128 *dst, const R128 *a, const R128 *b);
+void r128Mod(R128 *dst, const R128 *a, const R128 *b);
+int r128Cmp(const R128 *a, const R128 *b);
+int r128IsNeg(const R128 *v);
+void r128Min(R128 *dst, const R128 *a, const R128 *b);
+void r128Max(R128 *dst, const R128 *a, const R128 *b);
+void r128Floor(R128 *dst, const R128 *v);
+void r128Ceil(R128 *dst, const R128 *v);
+void r128AddArray(R128 *dst, const R128 *a, const R128 *b, size_t n);
+void r128SubArray(R128 *dst, const R128 *a, const R128 *b, size_t n);
+void r128MulArray(R128 *dst, const R128 *a, const R128 *b, size_t n);
+void r128DivArray(R128 *dst, const R128 *a, const R128 *b, size_t n);
+void r128FromFloatArray(R128 *dst, const double *src, size_t n);
+void r128ToFloatArray(double *dst, const R128 *src, size_t n);
+void r128FromStringArray(R128 *dst, const char *const *src, size_t n);
+void r128ToStringArray(char *dst, size_t dstStride, const R128 *src, size_t n);
+#endif   //R128_TRACE
 
 static const R128ToStringFormat R128__defaultFormat = {
    R128ToStringSign_Default,
@@ -592,7 +1044,18 @@ char R128_decimal = '.';
 
 static int r128__clz64(R128_U64 x)
 {
-#ifdef _M_X64
+#if defined(R128_STDC_ONLY)
+   int n = 0;
+
+   if (!x) {
+      return 64;
+   }
+   while (!(x & R128_LIT_U64(0x8000000000000000))) {
+      x <<= 1;
+      ++n;
+   }
+   return n;
+#elif defined(_M_X64)
    unsigned long idx;
    if (_BitScanReverse64(&idx, x)) {
       return 63 - (int)idx;
@@ -617,7 +1080,7 @@ static int r128__clz64(R128_U64 x)
 // 32*32->64
 static R128_U64 r128__umul64(R128_U32 a, R128_U32 b)
 {
-#  if defined(_M_IX86)
+#  if defined(_M_IX86) && !defined(R128_STDC_ONLY)
    return __emulu(a, b);
 #  else
    return a * (R128_U64)b;
@@ -627,7 +1090,7 @@ static R128_U64 r128__umul64(R128_U32 a, R128_U32 b)
 // 64/32->32
 static R128_U32 r128__udiv64(R128_U32 nlo, R128_U32 nhi, R128_U32 d, R128_U32 *rem)
 {
-#  if defined(_M_IX86)
+#  if defined(_M_IX86) && !defined(R128_STDC_ONLY)
    __asm {
       mov eax, nlo
       mov edx, nhi
@@ -635,11 +1098,11 @@ static R128_U32 r128__udiv64(R128_U32 nlo, R128_U32 nhi, R128_U32 d, R128_U32 *r
       mov ecx, rem
       mov dword ptr [ecx], edx
    }
-#  elif defined(__i386__)
+#  elif defined(__i386__) && !defined(R128_STDC_ONLY)
    R128_U32 q, r;
    __asm("divl %4"
       : "=a"(q), "=d"(r)
-      : "a"(nlo), "d"(nhi), "X"(d));
+      : "a"(nlo), "d"(nhi), "rm"(d));
    *rem = r;
    return q;
 #  else
@@ -648,17 +1111,38 @@ static R128_U32 r128__udiv64(R128_U32 nlo, R128_U32 nhi, R128_U32 d, R128_U32 *r
    return (R128_U32)(n64 / d);
 #  endif
 }
+
+// acc += a * b, for a 96-bit acc
+static void r128__mac32(R128_U32 acc[3], R128_U32 a, R128_U32 b)
+{
+   R128_U64 p = r128__umul64(a, b);
+#  if R128_INTEL
+   unsigned char carry;
+   carry = _addcarry_u32(0, acc[0], (R128_U32)p, &acc[0]);
+   carry = _addcarry_u32(carry, acc[1], (R128_U32)(p >> 32), &acc[1]);
+   _addcarry_u32(carry, acc[2], 0, &acc[2]);
+#  else
+   R128_U64 lo = ((R128_U64)acc[1] << 32 | acc[0]) + p;
+   acc[2] += lo < p;
+   acc[1] = (R128_U32)(lo >> 32);
+   acc[0] = (R128_U32)lo;
+#  endif
+}
 #endif   //!R128_64BIT
 
 // 64*64->128
 static void r128__umul128(R128 *dst, R128_U64 a, R128_U64 b)
 {
-#if defined(_M_X64)
+#if defined(_M_X64) && !defined(R128_STDC_ONLY)
    dst->lo = _umul128(a, b, &dst->hi);
-#elif defined(__x86_64__)
+#elif R128__INT128
+   // one widening multiply: mul, mul/umulh, mulhdu, mlgr, ...
    unsigned __int128 p0 = a * (unsigned __int128)b;
    dst->hi = (R128_U64)(p0 >> 64);
    dst->lo = (R128_U64)p0;
+#elif defined(_M_ARM64) && !defined(R128_STDC_ONLY)
+   dst->lo = a * b;
+   dst->hi = __umulh(a, b);
 #else
    R128_U32 alo = (R128_U32)a;
    R128_U32 ahi = (R128_U32)(a >> 32);
@@ -694,7 +1178,7 @@ static void r128__umul128(R128 *dst, R128_U64 a, R128_U64 b)
       carry = ((R128_U64)(R128_U32)p1 + (R128_U64)(R128_U32)p2 + (p0 >> 32)) >> 32;
 
       lo = p0 + ((p1 + p2) << 32);
-      hi = p3 + ((R128_U32)(p1 >> 32) + (R128_U32)(p2 >> 32)) + carry;
+      hi = p3 + (p1 >> 32) + (p2 >> 32) + carry;
 
       R128_SET2(dst, lo, hi);
 #endif
@@ -702,8 +1186,170 @@ static void r128__umul128(R128 *dst, R128_U64 a, R128_U64 b)
 #endif
 }
 
+#if R128__RECIP_DIV
+// Division by a precomputed reciprocal, for 64-bit targets without a 128/64
+// divide instruction, or where it is slow (N. Moller and T. Granlund,
+// "Improved division by invariant integers", IEEE Transactions on Computers,
+// 2011).
+
+// floor((2^19 - 3 * 2^8) / i) for i = 256..511: the 11-bit first estimates
+static const unsigned short r128__recipTable[256] = {
+   0x7fd, 0x7f5, 0x7ed, 0x7e5, 0x7dd, 0x7d5, 0x7ce, 0x7c6,
+   0x7bf, 0x7b7, 0x7b0, 0x7a8, 0x7a1, 0x79a, 0x792, 0x78b,
+   0x784, 0x77d, 0x776, 0x76f, 0x768, 0x761, 0x75b, 0x754,
+   0x74d, 0x747, 0x740, 0x739, 0x733, 0x72c, 0x726, 0x720,
+   0x719, 0x713, 0x70d, 0x707, 0x700, 0x6fa, 0x6f4, 0x6ee,
+   0x6e8, 0x6e2, 0x6dc, 0x6d6, 0x6d1, 0x6cb, 0x6c5, 0x6bf,
+   0x6ba, 0x6b4, 0x6ae, 0x6a9, 0x6a3, 0x69e, 0x698, 0x693,
+   0x68d, 0x688, 0x683, 0x67d, 0x678, 0x673, 0x66e, 0x669,
+   0x664, 0x65e, 0x659, 0x654, 0x64f, 0x64a, 0x645, 0x640,
+   0x63c, 0x637, 0x632, 0x62d, 0x628, 0x624, 0x61f, 0x61a,
+   0x616, 0x611, 0x60c, 0x608, 0x603, 0x5ff, 0x5fa, 0x5f6,
+   0x5f1, 0x5ed, 0x5e9, 0x5e4, 0x5e0, 0x5dc, 0x5d7, 0x5d3,
+   0x5cf, 0x5cb, 0x5c6, 0x5c2, 0x5be, 0x5ba, 0x5b6, 0x5b2,
+   0x5ae, 0x5aa, 0x5a6, 0x5a2, 0x59e, 0x59a, 0x596, 0x592,
+   0x58e, 0x58a, 0x586, 0x583, 0x57f, 0x57b, 0x577, 0x574,
+   0x570, 0x56c, 0x568, 0x565, 0x561, 0x55e, 0x55a, 0x556,
+   0x553, 0x54f, 0x54c, 0x548, 0x545, 0x541, 0x53e, 0x53a,
+   0x537, 0x534, 0x530, 0x52d, 0x52a, 0x526, 0x523, 0x520,
+   0x51c, 0x519, 0x516, 0x513, 0x50f, 0x50c, 0x509, 0x506,
+   0x503, 0x500, 0x4fc, 0x4f9, 0x4f6, 0x4f3, 0x4f0, 0x4ed,
+   0x4ea, 0x4e7, 0x4e4, 0x4e1, 0x4de, 0x4db, 0x4d8, 0x4d5,
+   0x4d2, 0x4cf, 0x4cc, 0x4ca, 0x4c7, 0x4c4, 0x4c1, 0x4be,
+   0x4bb, 0x4b9, 0x4b6, 0x4b3, 0x4b0, 0x4ad, 0x4ab, 0x4a8,
+   0x4a5, 0x4a3, 0x4a0, 0x49d, 0x49b, 0x498, 0x495, 0x493,
+   0x490, 0x48d, 0x48b, 0x488, 0x486, 0x483, 0x481, 0x47e,
+   0x47c, 0x479, 0x477, 0x474, 0x472, 0x46f, 0x46d, 0x46a,
+   0x468, 0x465, 0x463, 0x461, 0x45e, 0x45c, 0x459, 0x457,
+   0x455, 0x452, 0x450, 0x44e, 0x44b, 0x449, 0x447, 0x444,
+   0x442, 0x440, 0x43e, 0x43b, 0x439, 0x437, 0x435, 0x432,
+   0x430, 0x42e, 0x42c, 0x42a, 0x428, 0x425, 0x423, 0x421,
+   0x41f, 0x41d, 0x41b, 0x419, 0x417, 0x414, 0x412, 0x410,
+   0x40e, 0x40c, 0x40a, 0x408, 0x406, 0x404, 0x402, 0x400,
+};
+
+// floor((2^128 - 1) / d) - 2^64, for d with the high bit set. Newton steps from
+// an 11-bit table estimate (Algorithm 2 of the paper).
+static R128_U64 r128__recip64(R128_U64 d)
+{
+   R128_U64 d0 = d & 1;
+   R128_U64 d9 = d >> 55;
+   R128_U64 d40 = (d >> 24) + 1;
+   R128_U64 d63 = (d >> 1) + d0;
+   R128_U64 v0, v1, v2, v3, e;
+   R128 p;
+
+   v0 = r128__recipTable[d9 - 256];
+   v1 = (v0 << 11) - ((v0 * v0 * d40) >> 40) - 1;
+   v2 = (v1 << 13) + ((v1 * ((R128_LIT_U64(1) << 60) - v1 * d40)) >> 47);
+   e = ((v2 >> 1) & (0 - d0)) - v2 * d63;
+   r128__umul128(&p, v2, e);
+   v3 = (p.hi >> 1) + (v2 << 31);
+
+   // v3 - floor((2^64 + 1 + v3) * d / 2^64)
+   r128__umul128(&p, v3, d);
+   p.lo += d;
+   p.hi += d + (p.lo < d);
+   return v3 - p.hi;
+}
+
+// (u1:u0) / d for d with the high bit set, u1 < d, and v = r128__recip64(d):
+// a multiply and at most two corrections (Algorithm 4 of the paper).
+static R128_U64 r128__udiv2by1(R128_U64 u1, R128_U64 u0, R128_U64 d, R128_U64 v, R128_U64 *rem)
+{
+   R128 q;
+   R128_U64 q1, r;
+
+   r128__umul128(&q, v, u1);
+   q.lo += u0;
+   q.hi += u1 + (q.lo < u0);
+
+   q1 = q.hi + 1;
+   r = u0 - q1 * d;
+   if (r > q.lo) {
+      --q1;
+      r += d;
+   }
+   if (r >= d) {
+      ++q1;
+      r -= d;
+   }
+
+   *rem = r;
+   return q1;
+}
+
+// floor((2^192 - 1) / (d1:d0)) - 2^64, for d1 with the high bit set
+// (Algorithm 6 of the paper).
+static R128_U64 r128__recip3by2(R128_U64 d1, R128_U64 d0)
+{
+   R128_U64 v = r128__recip64(d1);
+   R128_U64 p = d1 * v + d0;
+   R128 t;
+
+   if (p < d0) {
+      --v;
+      if (p >= d1) {
+         --v;
+         p -= d1;
+      }
+      p -= d1;
+   }
+
+   r128__umul128(&t, v, d0);
+   p += t.hi;
+   if (p < t.hi) {
+      --v;
+      if (p > d1 || (p == d1 && t.lo >= d0)) {
+         --v;
+      }
+   }
+
+   return v;
+}
+
+// (u2:u1:u0) / (d1:d0) for d1 with the high bit set, u2:u1 < d1:d0, and
+// v = r128__recip3by2(d1, d0): the quotient digit, and the remainder in rem
+// (Algorithm 5 of the paper).
+static R128_U64 r128__udiv3by2(R128 *rem, R128_U64 u2, R128_U64 u1, R128_U64 u0,
+   R128_U64 d1, R128_U64 d0, R128_U64 v)
+{
+   R128 q, t;
+   R128_U64 r1, r0;
+
+   r128__umul128(&q, v, u2);
+   q.lo += u1;
+   q.hi += u2 + (q.lo < u1);
+
+   // r = (r1:u0) - q.hi * d0 - d, which is the remainder for q.hi + 1
+   r1 = u1 - q.hi * d1;
+   r128__umul128(&t, d0, q.hi);
+   r0 = u0 - t.lo;
+   r1 = r1 - t.hi - (u0 < t.lo);
+   r1 = r1 - d1 - (r0 < d0);
+   r0 -= d0;
+   ++q.hi;
+
+   if (r1 >= q.lo) {
+      --q.hi;
+      R128__STAT(divRefine);
+      r0 += d0;
+      r1 += d1 + (r0 < d0);
+   }
+   if (r1 > d1 || (r1 == d1 && r0 >= d0)) {
+      ++q.hi;
+      R128__STAT(divRefine);
+      r1 = r1 - d1 - (r0 < d0);
+      r0 -= d0;
+   }
+
+   R128_SET2(rem, r0, r1);
+   return q.hi;
+}
+#endif   //R128__RECIP_DIV
+
 // 128/64->64
-#ifdef _M_X64
+#if defined(_M_X64) && !defined(R128_STDC_ONLY) && !defined(R128_RECIP_DIV)
 // MSVC x64 provides neither inline assembly nor a div intrinsic, so we do fake
 // "inline assembly" to avoid long division or outline assembly.
 #pragma code_seg(".text")
@@ -718,11 +1364,30 @@ static r128__udiv128Proc r128__udiv128 = (r128__udiv128Proc)r128__udiv128Code;
 #else
 static R128_U64 r128__udiv128(R128_U64 nlo, R128_U64 nhi, R128_U64 d, R128_U64 *rem)
 {
-#ifdef __x86_64__
+#if R128__RECIP_DIV
+   // no 128/64 divide instruction, or R128_RECIP_DIV (__int128 division is a
+   // libgcc 128/128 call): multiply by the reciprocal
+   R128_U64 q, r;
+   int shift;
+
+   R128_ASSERT(d != 0);    //division by zero
+   R128_ASSERT(nhi < d);   //overflow
+
+   shift = r128__clz64(d);
+   if (shift) {
+      nhi = (nhi << shift) | (nlo >> (64 - shift));
+      nlo <<= shift;
+      d <<= shift;
+   }
+
+   q = r128__udiv2by1(nhi, nlo, d, r128__recip64(d), &r);
+   *rem = r >> shift;
+   return q;
+#elif defined(__x86_64__) && !defined(R128_STDC_ONLY)
    R128_U64 q, r;
    __asm("divq %4"
       : "=a"(q), "=d"(r)
-      : "a"(nlo), "d"(nhi), "X"(d));
+      : "a"(nlo), "d"(nhi), "rm"(d));
    *rem = r;
    return q;
 #else
@@ -736,55 +1401,80 @@ static R128_U64 r128__udiv128(R128_U64 nlo, R128_U64 nhi, R128_U64 d, R128_U64 *
    R128_ASSERT(d != 0);    //division by zero
    R128_ASSERT(nhi < d);   //overflow
 
+   if (d <= 0xffffffff) {
+      // short division, as when parsing: nhi < d, so neither 64/32 step overflows
+      q1 = r128__udiv64((R128_U32)(nlo >> 32), (R128_U32)nhi, (R128_U32)d, &r);
+      q0 = r128__udiv64((R128_U32)nlo, r, (R128_U32)d, &r);
+      *rem = r;
+      return ((R128_U64)q1 << 32) + q0;
+   }
+
    // normalize
    shift = r128__clz64(d);
 
    if (shift) {
-      R128 tmp128;
-      R128_SET2(&tmp128, nlo, nhi);
-      r128Shl(&tmp128, &tmp128, shift);
-      n3 = R128_R3(&tmp128);
-      n2 = R128_R2(&tmp128);
-      n1 = R128_R1(&tmp128);
-      n0 = R128_R0(&tmp128);
+      nhi = (nhi << shift) | (nlo >> (64 - shift));
+      nlo <<= shift;
       d <<= shift;
-   } else {
-      n3 = (R128_U32)(nhi >> 32);
-      n2 = (R128_U32)nhi;
-      n1 = (R128_U32)(nlo >> 32);
-      n0 = (R128_U32)nlo;
    }
 
+   n3 = (R128_U32)(nhi >> 32);
+   n2 = (R128_U32)nhi;
+   n1 = (R128_U32)(nlo >> 32);
+   n0 = (R128_U32)nlo;
+
    d1 = (R128_U32)(d >> 32);
    d0 = (R128_U32)d;
 
    // first digit
-   R128_ASSERT(n3 < d1);
-   q1 = r128__udiv64(n2, n3, d1, &r);
+   R128_ASSERT(n3 <= d1);
+   if (n3 == d1) {
+      // the 64/32 divide would overflow; the digit is at most 2^32 - 1
+      q1 = 0xffffffff;
+      r = n2 + d1;
+      if (r < d1) {
+         goto done1;   // the remainder is at least 2^32, so q1 is exact
+      }
+   } else {
+      q1 = r128__udiv64(n2, n3, d1, &r);
+   }
 refine1:
    if (r128__umul64(q1, d0) > ((R128_U64)r << 32) + n1) {
       --q1;
-      if (r < ~n1 + 1) {
-         r += n1;
+      R128__STAT(divRefine);
+      if (r < ~d1 + 1) {
+         r += d1;
          goto refine1;
       }
    }
+done1:
 
    tmp = ((R128_U64)n2 << 32) + n1 - (r128__umul64(q1, d0) + (r128__umul64(q1, d1) << 32));
    n2 = (R128_U32)(tmp >> 32);
    n1 = (R128_U32)tmp;
 
    // second digit
-   R128_ASSERT(n2 < d1);
-   q0 = r128__udiv64(n1, n2, d1, &r);
+   R128_ASSERT(n2 <= d1);
+   if (n2 == d1) {
+      // the 64/32 divide would overflow; the digit is at most 2^32 - 1
+      q0 = 0xffffffff;
+      r = n1 + d1;
+      if (r < d1) {
+         goto done0;   // the remainder is at least 2^32, so q0 is exact
+      }
+   } else {
+      q0 = r128__udiv64(n1, n2, d1, &r);
+   }
 refine0:
    if (r128__umul64(q0, d0) > ((R128_U64)r << 32) + n0) {
       --q0;
-      if (r < ~n1 + 1) {
-         r += n1;
+      R128__STAT(divRefine);
+      if (r < ~d1 + 1) {
+         r += d1;
          goto refine0;
       }
    }
+done0:
 
    tmp = ((R128_U64)n1 << 32) + n0 - (r128__umul64(q0, d0) + (r128__umul64(q0, d1) << 32));
    n1 = (R128_U32)(tmp >> 32);
@@ -798,7 +1488,7 @@ refine0:
 
 static int r128__ucmp(const R128 *a, const R128 *b)
 {
-   if (a->hi == b->hi) {
+   if (a->hi != b->hi) {
       if (a->hi > b->hi) {
          return 1;
       } else {
@@ -817,7 +1507,7 @@ static int r128__ucmp(const R128 *a, const R128 *b)
 
 static void r128__umul(R128 *dst, const R128 *a, const R128 *b)
 {
-#ifdef _M_X64
+#if defined(_M_X64) && !defined(R128_STDC_ONLY)
    R128_U64 t0, t1;
    R128_U64 lo, hi = 0;
    unsigned char carry;
@@ -838,7 +1528,7 @@ static void r128__umul(R128 *dst, const R128 *a, const R128 *b)
    hi += t0;
 
    R128_SET2(dst, lo, hi);
-#elif defined(__x86_64__)
+#elif R128__INT128
    unsigned __int128 p0, p1, p2, p3;
    p0 = a->lo * (unsigned __int128)b->lo;
    p1 = a->lo * (unsigned __int128)b->hi;
@@ -848,6 +1538,44 @@ static void r128__umul(R128 *dst, const R128 *a, const R128 *b)
    p0 = (p3 << 64) + p2 + p1 + (p0 >> 64) + ((R128_U64)p0 >> 63);
    dst->lo = (R128_U64)p0;
    dst->hi = (R128_U64)(p0 >> 64);
+#elif !R128_64BIT
+   // Column by column in 32-bit digits, keeping a 96-bit column sum. Only the
+   // digits 2 to 5 of the 256-bit product are kept, so the partial products of
+   // column 6 and the high halves of column 5 are never computed.
+   R128_U32 a0 = R128_R0(a), a1 = R128_R1(a), a2 = R128_R2(a), a3 = R128_R3(a);
+   R128_U32 b0 = R128_R0(b), b1 = R128_R1(b), b2 = R128_R2(b), b3 = R128_R3(b);
+   R128_U32 acc[3], r0, r1, r2, r3;
+
+   acc[0] = (R128_U32)(r128__umul64(a0, b0) >> 32);
+   acc[1] = acc[2] = 0;
+   r128__mac32(acc, a0, b1);
+   r128__mac32(acc, a1, b0);
+
+   // round to nearest with the top bit of digit 1
+   acc[0] = acc[1] + (acc[0] >> 31);
+   acc[1] = acc[2] + (acc[0] < acc[1]);
+   acc[2] = 0;
+   r128__mac32(acc, a0, b2);
+   r128__mac32(acc, a1, b1);
+   r128__mac32(acc, a2, b0);
+   r0 = acc[0];
+
+   acc[0] = acc[1]; acc[1] = acc[2]; acc[2] = 0;
+   r128__mac32(acc, a0, b3);
+   r128__mac32(acc, a1, b2);
+   r128__mac32(acc, a2, b1);
+   r128__mac32(acc, a3, b0);
+   r1 = acc[0];
+
+   acc[0] = acc[1]; acc[1] = acc[2]; acc[2] = 0;
+   r128__mac32(acc, a1, b3);
+   r128__mac32(acc, a2, b2);
+   r128__mac32(acc, a3, b1);
+   r2 = acc[0];
+
+   r3 = acc[1] + a2 * b3 + a3 * b2;
+
+   R128_SET4(dst, r0, r1, r2, r3);
 #else
    R128 p0, p1, p2, p3, round;
 
@@ -895,11 +1623,15 @@ static int r128__norm(R128 *n, R128 *d, R128_U64 *n2)
          *n2 = 0;
       }
    } else {
-      shift = r128__clz64(d0);
-      if (r128__clz64(n1) >= shift) {
+      // the quotient only fits in 128 bits if the dividend's whole part is
+      // smaller than the divisor
+      if (n1 >= d0) {
+         R128__STAT(divOverflow);
          return 1; // overflow
       }
 
+      shift = r128__clz64(d0);
+
       if (shift) {
          d1 = d0 << shift;
          d0 = 0;
@@ -948,56 +1680,73 @@ static void r128__udiv(R128 *quotient, const R128 *dividend, const R128 *divisor
       n1 = n.lo;
    }
 
+#if R128__RECIP_DIV
+   // two 3-by-2 digits, with one reciprocal of the divisor
+   R128_ASSERT(n3 < d1);
+   {
+      R128_U64 v = r128__recip3by2(d1, d0);
+      q.hi = r128__udiv3by2(&tmp, n3, n2, n1, d1, d0, v);
+      q.lo = r128__udiv3by2(&tmp, tmp.hi, tmp.lo, 0, d1, d0, v);
+   }
+#else
    // first digit
    R128_ASSERT(n3 < d1);
    {
       R128 t0, t1;
       t0.lo = n1;
       q.hi = r128__udiv128(n2, n3, d1, &t0.hi);
+      r128__umul128(&t1, q.hi, d0);
 
 refine1:
-      r128__umul128(&t1, q.hi, d0);
       if (r128__ucmp(&t1, &t0) > 0) {
+         // t1 -= d0 keeps t1 = q.hi * d0
          --q.hi;
-         if (t0.hi < ~n1 + 1) {
-            t0.hi += n1;
+         t1.hi -= t1.lo < d0;
+         t1.lo -= d0;
+         R128__STAT(divRefine);
+         if (t0.hi < ~d1 + 1) {
+            t0.hi += d1;
             goto refine1;
          }
       }
-   }
-
-   {
-      R128 t0, t1, t2;
-      t0.hi = n2;
-      t0.lo = n1;
 
-      r128__umul128(&t1, q.hi, d0);
-      r128__umul128(&t2, q.hi, d1);
-
-      t2.hi = t2.lo; t2.lo = 0;  //r128Shl(&t2, &t2, 64);
-      r128Add(&tmp, &t1, &t2);
-      r128Sub(&tmp, &t0, &tmp);
+      // the remainder is below d, so only the low 64 bits of q.hi * d1 matter
+      tmp.lo = n1 - t1.lo;
+      tmp.hi = n2 - t1.hi - q.hi * d1 - (n1 < t1.lo);
    }
    n2 = tmp.hi;
    n1 = tmp.lo;
 
    // second digit
-   R128_ASSERT(n2 < d1);
+   R128_ASSERT(n2 <= d1);
    {
       R128 t0, t1;
       t0.lo = 0;
-      q.lo = r128__udiv128(n1, n2, d1, &t0.hi);
+      if (n2 == d1) {
+         // the 128/64 divide would overflow; the digit is at most 2^64 - 1
+         q.lo = R128_LIT_U64(0xffffffffffffffff);
+         t0.hi = n1 + d1;
+         if (t0.hi < d1) {
+            goto done0;    // the remainder is at least 2^64, so q.lo is exact
+         }
+      } else {
+         q.lo = r128__udiv128(n1, n2, d1, &t0.hi);
+      }
 
    refine0:
       r128__umul128(&t1, q.lo, d0);
       if (r128__ucmp(&t1, &t0) > 0) {
          --q.lo;
-         if (t0.hi < ~n1 + 1) {
-            t0.hi += n1;
+         R128__STAT(divRefine);
+         if (t0.hi < ~d1 + 1) {
+            t0.hi += d1;
             goto refine0;
          }
       }
+   done0:
+      ;
    }
+#endif   //R128__RECIP_DIV
 
    r128Copy(quotient, &q);
 }
@@ -1022,6 +1771,12 @@ static R128_U64 r128__umod(R128 *n, R128 *d)
    n1 = n->lo;
 
    R128_ASSERT(n3 < d1);
+#if R128__RECIP_DIV
+   {
+      R128 r;
+      q = r128__udiv3by2(&r, n3, n2, n1, d1, d0, r128__recip3by2(d1, d0));
+   }
+#else
    {
       R128 t0, t1;
       t0.lo = n1;
@@ -1031,12 +1786,14 @@ static R128_U64 r128__umod(R128 *n, R128 *d)
       r128__umul128(&t1, q, d0);
       if (r128__ucmp(&t1, &t0) > 0) {
          --q;
-         if (t0.hi < ~n1 + 1) {
-            t0.hi += n1;
+         R128__STAT(divRefine);
+         if (t0.hi < ~d1 + 1) {
+            t0.hi += d1;
             goto refine1;
          }
       }
    }
+#endif   //R128__RECIP_DIV
 
    return q;
 }
@@ -1081,7 +1838,7 @@ static int r128__format(char *dst, size_t dstSize, const R128 *v, const R128ToSt
    decimal = cursor = buf;
 
    // fractional part first in case a carry into the whole part is required
-   if (tmp.lo || format->decimal) {
+   if (tmp.lo || format->decimal || (fullPrecision && precision)) {
       while (tmp.lo || (fullPrecision && precision)) {
          if ((int)(cursor - buf) == precision) {
             if ((R128_S64)tmp.lo < 0) {
@@ -1103,7 +1860,16 @@ static int r128__format(char *dst, size_t dstSize, const R128 *v, const R128ToSt
             break;
          }
 
+#if R128_64BIT
          r128__umul128(&tmp, tmp.lo, 10);
+#else
+         {
+            // 64*32 is enough: two multiplies instead of four
+            R128_U64 p0 = r128__umul64(R128_R0(&tmp), 10);
+            R128_U64 p1 = r128__umul64(R128_R1(&tmp), 10) + (p0 >> 32);
+            R128_SET4(&tmp, (R128_U32)p0, (R128_U32)p1, p1 >> 32, 0);
+         }
+#endif
          *cursor++ = (char)tmp.hi + '0';
       }
 
@@ -1115,15 +1881,37 @@ static int r128__format(char *dst, size_t dstSize, const R128 *v, const R128ToSt
    }
 
    // whole part
+#if !R128_64BIT
+   // 64-bit division is a library call or a long multiply sequence on 32-bit
+   // targets, so only use it while the value needs it
+   while (whole > 0xffffffff) {
+      R128_U32 rem, hi;
+      hi = r128__udiv64((R128_U32)(whole >> 32), 0, 10, &rem);
+      whole = ((R128_U64)hi << 32) | r128__udiv64((R128_U32)whole, rem, 10, &rem);
+      *cursor++ = (char)rem + '0';
+   }
+   {
+      R128_U32 whole32 = (R128_U32)whole;
+      do {
+         char digit = (char)(whole32 % 10);
+         whole32 /= 10;
+         *cursor++ = digit + '0';
+      } while (whole32);
+   }
+#else
    do {
       char digit = (char)(whole % 10);
       whole /= 10;
       *cursor++ = digit + '0';
    } while (whole);
+#endif
 
 #define R128__WRITE(c) if (dstSize-- == 1) goto finish; *dstp++ = c;
 
-   padCnt = width - (int)(cursor - buf) - 1;
+   padCnt = width - (int)(cursor - buf);
+   if (sign || format->sign != R128ToStringSign_Default) {
+      --padCnt;
+   }
 
    // left padding
    if (!format->leftAlign) {
@@ -1135,8 +1923,6 @@ static int r128__format(char *dst, size_t dstSize, const R128 *v, const R128ToSt
             R128__WRITE('+');
          } else if (format->sign == R128ToStringSign_Space) {
             R128__WRITE(' ');
-         } else {
-            ++padCnt;
          }
       }
 
@@ -1152,8 +1938,6 @@ static int r128__format(char *dst, size_t dstSize, const R128 *v, const R128ToSt
          R128__WRITE('+');
       } else if (format->sign == R128ToStringSign_Space) {
          R128__WRITE(' ');
-      } else {
-         ++padCnt;
       }
    }
 
@@ -1187,6 +1971,11 @@ static int r128__format(char *dst, size_t dstSize, const R128 *v, const R128ToSt
 #undef R128__WRITE
 
 finish:
+#ifdef R128_STATS
+   if (dstSize == 0) {
+      R128__STAT(formatTruncated);
+   }
+#endif
     *dstp = '\0';
     return (int)(dstp - dst);
 }
@@ -1203,8 +1992,10 @@ void r128FromFloat(R128 *dst, double v)
    R128_ASSERT(dst != NULL);
 
    if (v < -9223372036854775808.0) {
+      R128__STAT(floatClamp);
       r128Copy(dst, &R128_min);
    } else if (v >= 9223372036854775808.0) {
+      R128__STAT(floatClamp);
       r128Copy(dst, &R128_max);
    } else {
       R128 r;
@@ -1281,7 +2072,13 @@ void r128FromString(R128 *dst, const char *s, char **endptr)
 
    // fractional part
    if (*s == R128_decimal) {
-      const char *exp = ++s;
+      const char *exp = ++s, *p;
+#if R128_64BIT
+      const int chunk = base == 16 ? 15 : 19;   // base^chunk fits in 64 bits
+#else
+      const int chunk = base == 16 ? 7 : 9;     // 32 bits, for short division
+#endif
+      int n;
 
       // find the last digit and work backwards
       for (;; ++s) {
@@ -1293,18 +2090,29 @@ void r128FromString(R128 *dst, const char *s, char **endptr)
          }
       }
 
-      for (--s; s >= exp; --s) {
-         R128_U64 digit, unused;
+      // up to a chunk of digits per division: floor((digits:lo) / base^n)
+      // equals n successive floor((digit:lo) / base) steps
+      for (p = s; p > exp; p -= n) {
+         R128_U64 digits = 0, scale = 1, unused;
+         const char *c;
+
+         n = p - exp > chunk ? chunk : (int)(p - exp);
+         for (c = p - n; c < p; ++c) {
+            R128_U64 digit;
+
+            if ('0' <= *c && *c <= '9') {
+               digit = *c - '0';
+            } else if ('a' <= *c && *c <= 'f') {
+               digit = *c - 'a' + 10;
+            } else {
+               digit = *c - 'A' + 10;
+            }
 
-         if ('0' <= *s && *s <= '9') {
-            digit = *s - '0';
-         } else if ('a' <= *s && *s <= 'f') {
-            digit = *s - 'a' + 10;
-         } else {
-            digit = *s - 'A' + 10;
+            digits = digits * base + digit;
+            scale *= base;
          }
 
-         lo = r128__udiv128(lo, digit, base, &unused);
+         lo = r128__udiv128(lo, digits, scale, &unused);
       }
    }
 
@@ -1371,8 +2179,10 @@ int r128ToStringf(char *dst, size_t dstSize, const char *format, const R128 *v)
 
    // flags field
    for (;; ++format) {
-      if (*format == ' ' && opts.sign != R128ToStringSign_Plus) {
-         opts.sign = R128ToStringSign_Space;
+      if (*format == ' ') {
+         if (opts.sign != R128ToStringSign_Plus) {
+            opts.sign = R128ToStringSign_Space;
+         }
       } else if (*format == '+') {
          opts.sign = R128ToStringSign_Plus;
       } else if (*format == '0') {
@@ -1427,15 +2237,16 @@ void r128Copy(R128 *dst, const R128 *src)
 
 void r128Neg(R128 *dst, const R128 *src)
 {
-   unsigned char carry = 0;
-
    R128_ASSERT(dst != NULL);
    R128_ASSERT(src != NULL);
 
 #if R128_INTEL
+   unsigned char carry = 0;
 #  if R128_64BIT
-   carry = _addcarry_u64(carry, ~src->lo, 1, &dst->lo);
-   carry = _addcarry_u64(carry, ~src->hi, 0, &dst->hi);
+   unsigned long long r0, r1;
+   carry = _addcarry_u64(carry, ~src->lo, 1, &r0);
+   carry = _addcarry_u64(carry, ~src->hi, 0, &r1);
+   R128_SET2(dst, r0, r1);
 #  else
    R128_U32 r0, r1, r2, r3;
    carry = _addcarry_u32(carry, ~R128_R0(src), 1, &r0);
@@ -1444,8 +2255,12 @@ void r128Neg(R128 *dst, const R128 *src)
    carry = _addcarry_u32(carry, ~R128_R3(src), 0, &r3);
    R128_SET4(dst, r0, r1, r2, r3);
 #  endif //R128_64BIT
+#elif R128__INT128
+   // negs, ngc on AArch64
+   unsigned __int128 r = 0 - (((unsigned __int128)src->hi << 64) | src->lo);
+   R128_SET2(dst, (R128_U64)r, (R128_U64)(r >> 64));
 #else
-   r128Not(dst, a);
+   r128Not(dst, src);
    r128Add(dst, dst, &R128_smallest);
 #endif   //R128_INTEL
 }
@@ -1496,7 +2311,7 @@ void r128Shl(R128 *dst, const R128 *src, int amount)
    R128_ASSERT(dst != NULL);
    R128_ASSERT(src != NULL);
 
-#ifdef _M_IX86
+#if defined(_M_IX86) && !defined(R128_STDC_ONLY)
    __asm {
       // load src
       mov ebx, dword ptr[src]
@@ -1530,6 +2345,13 @@ void r128Shl(R128 *dst, const R128 *src, int amount)
       mov dword ptr[r + ecx + 8], esi
       mov dword ptr[r + ecx + 12], edi
    }
+#elif R128__INT128 && !R128_INTEL
+   // branchless; on x86-64 the branches below are faster for the usual
+   // constant or predictable amounts
+   unsigned __int128 v = ((unsigned __int128)src->hi << 64) | src->lo;
+   v <<= amount & 127;
+   r[0] = (R128_U64)v;
+   r[1] = (R128_U64)(v >> 64);
 #else
 
    r[0] = src->lo;
@@ -1540,7 +2362,7 @@ void r128Shl(R128 *dst, const R128 *src, int amount)
       r[1] = r[0] << (amount - 64);
       r[0] = 0;
    } else if (amount) {
-#  ifdef _M_X64
+#  if defined(_M_X64) && !defined(R128_STDC_ONLY)
       r[1] = __shiftleft128(r[0], r[1], (char) amount);
 #  else
       r[1] = (r[1] << amount) | (r[0] >> (64 - amount));
@@ -1560,7 +2382,7 @@ void r128Shr(R128 *dst, const R128 *src, int amount)
    R128_ASSERT(dst != NULL);
    R128_ASSERT(src != NULL);
 
-#ifdef _M_IX86
+#if defined(_M_IX86) && !defined(R128_STDC_ONLY)
    __asm {
       // load src
       mov ebx, dword ptr[src]
@@ -1595,6 +2417,11 @@ void r128Shr(R128 *dst, const R128 *src, int amount)
       mov dword ptr[r + ecx + 24], esi
       mov dword ptr[r + ecx + 28], edi
    }
+#elif R128__INT128 && !R128_INTEL
+   unsigned __int128 v = ((unsigned __int128)src->hi << 64) | src->lo;
+   v >>= amount & 127;
+   r[2] = (R128_U64)v;
+   r[3] = (R128_U64)(v >> 64);
 #else
    r[2] = src->lo;
    r[3] = src->hi;
@@ -1604,7 +2431,7 @@ void r128Shr(R128 *dst, const R128 *src, int amount)
       r[2] = r[3] >> (amount - 64);
       r[3] = 0;
    } else if (amount) {
-#ifdef _M_X64
+#if defined(_M_X64) && !defined(R128_STDC_ONLY)
       r[2] = __shiftright128(r[2], r[3], (char) amount);
 #else
       r[2] = (r[2] >> amount) | (r[3] << (64 - amount));
@@ -1624,7 +2451,7 @@ void r128Sar(R128 *dst, const R128 *src, int amount)
    R128_ASSERT(dst != NULL);
    R128_ASSERT(src != NULL);
 
-#ifdef _M_IX86
+#if defined(_M_IX86) && !defined(R128_STDC_ONLY)
    __asm {
       // load src
       mov ebx, dword ptr[src]
@@ -1660,6 +2487,11 @@ void r128Sar(R128 *dst, const R128 *src, int amount)
       mov dword ptr[r + ecx + 24], esi
       mov dword ptr[r + ecx + 28], edi
    }
+#elif R128__INT128 && !R128_INTEL
+   __int128 v = (__int128)(((unsigned __int128)src->hi << 64) | src->lo);
+   v >>= amount & 127;
+   r[2] = (R128_U64)v;
+   r[3] = (R128_U64)((unsigned __int128)v >> 64);
 #else
    r[2] = src->lo;
    r[3] = src->hi;
@@ -1669,7 +2501,7 @@ void r128Sar(R128 *dst, const R128 *src, int amount)
       r[2] = (R128_U64)((R128_S64)r[3] >> (amount - 64));
       r[3] = (R128_U64)((R128_S64)r[3] >> 63);
    } else if (amount) {
-      r[2] = (r[2] >> amount) | (R128_U64)((R128_S64)r[3] << (64 - amount));
+      r[2] = (r[2] >> amount) | (r[3] << (64 - amount));
       r[3] = (R128_U64)((R128_S64)r[3] >> amount);
    }
 #endif
@@ -1680,15 +2512,17 @@ void r128Sar(R128 *dst, const R128 *src, int amount)
 
 void r128Add(R128 *dst, const R128 *a, const R128 *b)
 {
-   unsigned char carry = 0;
    R128_ASSERT(dst != NULL);
    R128_ASSERT(a != NULL);
    R128_ASSERT(b != NULL);
 
 #if R128_INTEL
+   unsigned char carry = 0;
 #  if R128_64BIT
-   carry = _addcarry_u64(carry, a->lo, b->lo, &dst->lo);
-   carry = _addcarry_u64(carry, a->hi, b->hi, &dst->hi);
+   unsigned long long r0, r1;
+   carry = _addcarry_u64(carry, a->lo, b->lo, &r0);
+   carry = _addcarry_u64(carry, a->hi, b->hi, &r1);
+   R128_SET2(dst, r0, r1);
 #  else
    R128_U32 r0, r1, r2, r3;
    carry = _addcarry_u32(carry, R128_R0(a), R128_R0(b), &r0);
@@ -1697,9 +2531,14 @@ void r128Add(R128 *dst, const R128 *a, const R128 *b)
    carry = _addcarry_u32(carry, R128_R3(a), R128_R3(b), &r3);
    R128_SET4(dst, r0, r1, r2, r3);
 #  endif //R128_64BIT
+#elif R128__INT128
+   // adds, adc on AArch64
+   unsigned __int128 r = (((unsigned __int128)a->hi << 64) | a->lo) +
+      (((unsigned __int128)b->hi << 64) | b->lo);
+   R128_SET2(dst, (R128_U64)r, (R128_U64)(r >> 64));
 #else
    R128_U64 r = a->lo + b->lo;
-   carry = r < a->lo;
+   R128_U64 carry = r < a->lo;
    dst->lo = r;
    dst->hi = a->hi + b->hi + carry;
 #endif   //R128_INTEL
@@ -1707,15 +2546,17 @@ void r128Add(R128 *dst, const R128 *a, const R128 *b)
 
 void r128Sub(R128 *dst, const R128 *a, const R128 *b)
 {
-   unsigned char borrow = 0;
    R128_ASSERT(dst != NULL);
    R128_ASSERT(a != NULL);
    R128_ASSERT(b != NULL);
 
 #if R128_INTEL
+   unsigned char borrow = 0;
 #  if R128_64BIT
-   borrow = _subborrow_u64(borrow, a->lo, b->lo, &dst->lo);
-   borrow = _subborrow_u64(borrow, a->hi, b->hi, &dst->hi);
+   unsigned long long r0, r1;
+   borrow = _subborrow_u64(borrow, a->lo, b->lo, &r0);
+   borrow = _subborrow_u64(borrow, a->hi, b->hi, &r1);
+   R128_SET2(dst, r0, r1);
 #  else
    R128_U32 r0, r1, r2, r3;
    borrow = _subborrow_u32(borrow, R128_R0(a), R128_R0(b), &r0);
@@ -1724,9 +2565,14 @@ void r128Sub(R128 *dst, const R128 *a, const R128 *b)
    borrow = _subborrow_u32(borrow, R128_R3(a), R128_R3(b), &r3);
    R128_SET4(dst, r0, r1, r2, r3);
 #  endif //R128_64BIT
+#elif R128__INT128
+   // subs, sbc on AArch64
+   unsigned __int128 r = (((unsigned __int128)a->hi << 64) | a->lo) -
+      (((unsigned __int128)b->hi << 64) | b->lo);
+   R128_SET2(dst, (R128_U64)r, (R128_U64)(r >> 64));
 #else
    R128_U64 r = a->lo - b->lo;
-   borrow = r > a->lo;
+   R128_U64 borrow = r > a->lo;
    dst->lo = r;
    dst->hi = a->hi - b->hi - borrow;
 #endif   //R128_INTEL
@@ -1780,6 +2626,7 @@ void r128Div(R128 *dst, const R128 *a, const R128 *b)
 
    if (td.lo == 0 && td.hi == 0) {
       // divide by zero
+      R128__STAT(divByZero);
       if (sign) {
          r128Copy(dst, &R128_min);
       } else {
@@ -1819,6 +2666,7 @@ void r128Mod(R128 *dst, const R128 *a, const R128 *b)
 
    if (td.lo == 0 && td.hi == 0) {
       // divide by zero
+      R128__STAT(divByZero);
       if (sign) {
          r128Copy(dst, &R128_min);
       } else {
@@ -1899,11 +2747,8 @@ void r128Floor(R128 *dst, const R128 *v)
    R128_ASSERT(dst != NULL);
    R128_ASSERT(v != NULL);
 
-   if ((R128_S64)v->hi < 0) {
-      dst->hi = v->hi - (v->lo != 0);
-   } else {
-      dst->hi = v->hi;
-   }
+   // the fraction is never negative: the whole part is already the floor
+   dst->hi = v->hi;
    dst->lo = 0;
 }
 
@@ -1912,12 +2757,1454 @@ void r128Ceil(R128 *dst, const R128 *v)
    R128_ASSERT(dst != NULL);
    R128_ASSERT(v != NULL);
 
-   if ((R128_S64)v->hi > 0) {
-      dst->hi = v->hi + (v->lo != 0);
-   } else {
-      dst->hi = v->hi;
-   }
+   dst->hi = v->hi + (v->lo != 0);
    dst->lo = 0;
 }
 
+typedef void (*R128__ArrayProc)(R128 *dst, const R128 *a, const R128 *b, size_t n);
+
+static void r128__addArrayScalar(R128 *dst, const R128 *a, const R128 *b, size_t n)
+{
+   size_t i;
+
+   for (i = 0; i < n; ++i) {
+      r128Add(&dst[i], &a[i], &b[i]);
+   }
+}
+
+static void r128__subArrayScalar(R128 *dst, const R128 *a, const R128 *b, size_t n)
+{
+   size_t i;
+
+   for (i = 0; i < n; ++i) {
+      r128Sub(&dst[i], &a[i], &b[i]);
+   }
+}
+
+static void r128__mulArrayScalar(R128 *dst, const R128 *a, const R128 *b, size_t n)
+{
+   size_t i;
+
+   for (i = 0; i < n; ++i) {
+      r128Mul(&dst[i], &a[i], &b[i]);
+   }
+}
+
+#if R128__DISPATCH
+// Two values per vector, lo in the even lanes: the carry (or borrow) out of
+// each lo is a compare mask, which a byte shift moves onto its hi.
+static R128__TARGET("avx2") void r128__addArrayAVX2(R128 *dst, const R128 *a, const R128 *b, size_t n)
+{
+   const __m256i sign = _mm256_set1_epi64x((long long)R128_LIT_U64(0x8000000000000000));
+   size_t i;
+
+   for (i = 0; i + 2 <= n; i += 2) {
+      __m256i x = _mm256_loadu_si256((const __m256i *)&a[i]);
+      __m256i y = _mm256_loadu_si256((const __m256i *)&b[i]);
+      __m256i r = _mm256_add_epi64(x, y);
+      __m256i carry = _mm256_cmpgt_epi64(_mm256_xor_si256(x, sign), _mm256_xor_si256(r, sign));
+      r = _mm256_sub_epi64(r, _mm256_bslli_epi128(carry, 8));
+      _mm256_storeu_si256((__m256i *)&dst[i], r);
+   }
+   r128__addArrayScalar(dst + i, a + i, b + i, n - i);
+}
+
+static R128__TARGET("avx2") void r128__subArrayAVX2(R128 *dst, const R128 *a, const R128 *b, size_t n)
+{
+   const __m256i sign = _mm256_set1_epi64x((long long)R128_LIT_U64(0x8000000000000000));
+   size_t i;
+
+   for (i = 0; i + 2 <= n; i += 2) {
+      __m256i x = _mm256_loadu_si256((const __m256i *)&a[i]);
+      __m256i y = _mm256_loadu_si256((const __m256i *)&b[i]);
+      __m256i r = _mm256_sub_epi64(x, y);
+      __m256i borrow = _mm256_cmpgt_epi64(_mm256_xor_si256(y, sign), _mm256_xor_si256(x, sign));
+      r = _mm256_add_epi64(r, _mm256_bslli_epi128(borrow, 8));
+      _mm256_storeu_si256((__m256i *)&dst[i], r);
+   }
+   r128__subArrayScalar(dst + i, a + i, b + i, n - i);
+}
+
+// 128-bit negation of the lanes selected by k
+#  define R128__NEG512(k, lo, hi) do { \
+      __mmask8 nz_ = _mm512_mask_test_epi64_mask(k, lo, lo); \
+      hi = _mm512_mask_sub_epi64(hi, k, _mm512_setzero_si512(), hi); \
+      hi = _mm512_mask_sub_epi64(hi, nz_, hi, _mm512_set1_epi64(1)); \
+      lo = _mm512_mask_sub_epi64(lo, k, _mm512_setzero_si512(), lo); \
+   } while (0)
+
+// Shifts in their zero-masking forms: the plain ones use an undefined source
+// that GCC 12 warns about in C++ with -Wall.
+#  define R128__SRL512(x, n) _mm512_maskz_srli_epi64((__mmask8)-1, x, n)
+#  define R128__SLL512(x, n) _mm512_maskz_slli_epi64((__mmask8)-1, x, n)
+
+// Eight products at a time in radix 2^52, as in r128Mul: the magnitudes are
+// split into three limbs, and the IFMA instructions add the low and high 52
+// bits of each limb product to the column sums. Only columns 0 to 3 are
+// needed for bits 63 to 191 of the product, which r128__umul keeps (bit 63
+// rounds), so the limb products that only reach columns 4 and 5 are skipped.
+static R128__TARGET("avx512f,avx512ifma") void r128__mulArrayAVX512IFMA(R128 *dst, const R128 *a, const R128 *b, size_t n)
+{
+   const __m512i mask52 = _mm512_set1_epi64((long long)R128_LIT_U64(0xfffffffffffff));
+   const __m512i even = _mm512_set_epi64(14, 12, 10, 8, 6, 4, 2, 0);
+   const __m512i odd = _mm512_set_epi64(15, 13, 11, 9, 7, 5, 3, 1);
+   const __m512i mix0 = _mm512_set_epi64(11, 3, 10, 2, 9, 1, 8, 0);
+   const __m512i mix1 = _mm512_set_epi64(15, 7, 14, 6, 13, 5, 12, 4);
+   const __m512i zero = _mm512_setzero_si512();
+   size_t i;
+
+   for (i = 0; i + 8 <= n; i += 8) {
+      __m512i v0, v1, alo, ahi, blo, bhi, a0, a1, a2, b0, b1, b2, c0, c1, c2, c3, rlo, rhi;
+      __mmask8 na, nb, round;
+
+      // lo and hi planes
+      v0 = _mm512_loadu_si512(&a[i]);
+      v1 = _mm512_loadu_si512(&a[i + 4]);
+      alo = _mm512_permutex2var_epi64(v0, even, v1);
+      ahi = _mm512_permutex2var_epi64(v0, odd, v1);
+      v0 = _mm512_loadu_si512(&b[i]);
+      v1 = _mm512_loadu_si512(&b[i + 4]);
+      blo = _mm512_permutex2var_epi64(v0, even, v1);
+      bhi = _mm512_permutex2var_epi64(v0, odd, v1);
+
+      // magnitudes
+      na = _mm512_cmplt_epi64_mask(ahi, zero);
+      nb = _mm512_cmplt_epi64_mask(bhi, zero);
+      R128__NEG512(na, alo, ahi);
+      R128__NEG512(nb, blo, bhi);
+
+      // limbs of 52, 52 and 24 bits
+      a0 = _mm512_and_si512(alo, mask52);
+      a1 = _mm512_and_si512(_mm512_or_si512(R128__SRL512(alo, 52), R128__SLL512(ahi, 12)), mask52);
+      a2 = R128__SRL512(ahi, 40);
+      b0 = _mm512_and_si512(blo, mask52);
+      b1 = _mm512_and_si512(_mm512_or_si512(R128__SRL512(blo, 52), R128__SLL512(bhi, 12)), mask52);
+      b2 = R128__SRL512(bhi, 40);
+
+      // column k gets the low halves of ai * bj for i + j = k and the high
+      // halves for i + j = k - 1
+      c0 = _mm512_madd52lo_epu64(zero, a0, b0);
+      c1 = _mm512_madd52hi_epu64(zero, a0, b0);
+      c1 = _mm512_madd52lo_epu64(c1, a0, b1);
+      c1 = _mm512_madd52lo_epu64(c1, a1, b0);
+      c2 = _mm512_madd52hi_epu64(zero, a0, b1);
+      c2 = _mm512_madd52hi_epu64(c2, a1, b0);
+      c2 = _mm512_madd52lo_epu64(c2, a0, b2);
+      c2 = _mm512_madd52lo_epu64(c2, a1, b1);
+      c2 = _mm512_madd52lo_epu64(c2, a2, b0);
+      c3 = _mm512_madd52hi_epu64(zero, a0, b2);
+      c3 = _mm512_madd52hi_epu64(c3, a1, b1);
+      c3 = _mm512_madd52hi_epu64(c3, a2, b0);
+      c3 = _mm512_madd52lo_epu64(c3, a1, b2);
+      c3 = _mm512_madd52lo_epu64(c3, a2, b1);
+
+      // carries
+      c1 = _mm512_add_epi64(c1, R128__SRL512(c0, 52));
+      c2 = _mm512_add_epi64(c2, R128__SRL512(c1, 52));
+      c1 = _mm512_and_si512(c1, mask52);
+      c3 = _mm512_add_epi64(c3, R128__SRL512(c2, 52));
+      c2 = _mm512_and_si512(c2, mask52);
+
+      // bits 64 to 191, plus bit 63 (bit 11 of column 1)
+      rlo = _mm512_or_si512(R128__SRL512(c1, 12), R128__SLL512(c2, 40));
+      rhi = _mm512_or_si512(R128__SRL512(c2, 24), R128__SLL512(c3, 28));
+      round = _mm512_test_epi64_mask(c1, _mm512_set1_epi64(1 << 11));
+      rhi = _mm512_mask_add_epi64(rhi, round & _mm512_cmpeq_epi64_mask(rlo, _mm512_set1_epi64(-1)),
+         rhi, _mm512_set1_epi64(1));
+      rlo = _mm512_mask_add_epi64(rlo, round, rlo, _mm512_set1_epi64(1));
+
+      R128__NEG512(na ^ nb, rlo, rhi);
+
+      _mm512_storeu_si512(&dst[i], _mm512_permutex2var_epi64(rlo, mix0, rhi));
+      _mm512_storeu_si512(&dst[i + 4], _mm512_permutex2var_epi64(rlo, mix1, rhi));
+   }
+   r128__mulArrayScalar(dst + i, a + i, b + i, n - i);
+}
+
+#  undef R128__NEG512
+#  undef R128__SRL512
+#  undef R128__SLL512
+
+static void r128__cpuid(int leaf, int subleaf, unsigned regs[4])
+{
+#  if defined(_MSC_VER)
+   __cpuidex((int *)regs, leaf, subleaf);
+#  else
+   __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#  endif
+}
+
+// The best level the processor and operating system support.
+static R128Cpu r128__cpuDetect(void)
+{
+   unsigned regs[4];
+   R128_U64 xcr0;
+
+   r128__cpuid(0, 0, regs);
+   if (regs[0] < 7) {
+      return R128Cpu_Scalar;
+   }
+
+   // AVX state saved by the OS (OSXSAVE, then XCR0 bits 1 and 2)
+   r128__cpuid(1, 0, regs);
+   if (!(regs[2] & (1u << 27))) {
+      return R128Cpu_Scalar;
+   }
+#  if defined(_MSC_VER)
+   xcr0 = _xgetbv(0);
+#  else
+   {
+      R128_U32 lo, hi;
+      __asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+      xcr0 = ((R128_U64)hi << 32) | lo;
+   }
+#  endif
+   if ((xcr0 & 6) != 6) {
+      return R128Cpu_Scalar;
+   }
+
+   r128__cpuid(7, 0, regs);
+   if ((regs[1] & (1u << 16)) && (regs[1] & (1u << 21)) && (xcr0 & 0xe0) == 0xe0) {
+      // AVX-512F and IFMA, with the opmask and ZMM state saved
+      return R128Cpu_AVX512IFMA;
+   }
+   if (regs[1] & (1u << 5)) {
+      return R128Cpu_AVX2;
+   }
+   return R128Cpu_Scalar;
+}
+#endif   //R128__DISPATCH
+
+static const char *const r128__cpuNames[R128Cpu_Count] = { "scalar", "avx2", "avx512ifma" };
+
+// Each dispatched function has a kernel for some of the levels (NULL for the
+// others) and uses the one of the highest level not above the selected one.
+// Without dispatch there is only the scalar level, so everything is constant.
+#if R128__DISPATCH
+static R128__ArrayProc r128__addArrayProc, r128__subArrayProc, r128__mulArrayProc;
+#else
+static R128__ArrayProc r128__addArrayProc = r128__addArrayScalar;
+static R128__ArrayProc r128__subArrayProc = r128__subArrayScalar;
+static R128__ArrayProc r128__mulArrayProc = r128__mulArrayScalar;
+#endif
+
+static const struct {
+   const char *name;
+   R128__ArrayProc *proc;
+   R128__ArrayProc kernels[R128Cpu_Count];
+} r128__dispatch[] = {
+#if R128__DISPATCH
+   { "r128AddArray", &r128__addArrayProc, { r128__addArrayScalar, r128__addArrayAVX2 } },
+   { "r128SubArray", &r128__subArrayProc, { r128__subArrayScalar, r128__subArrayAVX2 } },
+   { "r128MulArray", &r128__mulArrayProc, { r128__mulArrayScalar, NULL, r128__mulArrayAVX512IFMA } },
+#else
+   { "r128AddArray", &r128__addArrayProc, { r128__addArrayScalar } },
+   { "r128SubArray", &r128__subArrayProc, { r128__subArrayScalar } },
+   { "r128MulArray", &r128__mulArrayProc, { r128__mulArrayScalar } },
+#endif
+};
+
+static long r128__cpuDetected = R128Cpu_Scalar, r128__cpuSelected = R128Cpu_Scalar;
+
+// The first array call may come from several threads at once (r128_parallel.h
+// does exactly that), so detection runs once behind a compare-and-swap, and
+// the level and kernel pointers are published with release stores and read
+// with acquire loads. x64 MSVC gives volatile accesses those semantics.
+#if R128__DISPATCH
+#  if defined(_MSC_VER)
+#    define R128__CPU_LOAD(type, p) (*(type volatile *)(p))
+#    define R128__CPU_STORE(type, p, v) (*(type volatile *)(p) = (v))
+#    define R128__CPU_CAS(p, expected, desired) \
+   (_InterlockedCompareExchange((volatile long *)(p), (desired), (expected)) == (expected))
+#  else
+#    define R128__CPU_LOAD(type, p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#    define R128__CPU_STORE(type, p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#    define R128__CPU_CAS(p, expected, desired) \
+   __atomic_compare_exchange_n(p, &(expected), desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#  endif
+#else
+#  define R128__CPU_LOAD(type, p) (*(p))
+#  define R128__CPU_STORE(type, p, v) (*(p) = (v))
+#endif
+
+static int r128__cpuKernelLevel(int kernel, long selected)
+{
+   int level = (int)selected;
+   while (!r128__dispatch[kernel].kernels[level]) {
+      --level;
+   }
+   return level;
+}
+
+static R128Cpu r128__cpuSelect(R128Cpu level)
+{
+   long detected = R128__CPU_LOAD(long, &r128__cpuDetected);
+   size_t i;
+
+   if (level == R128Cpu_Auto) {
+#if R128__DISPATCH
+      const char *env = getenv("R128_CPU");
+      level = (R128Cpu)detected;
+      for (i = 0; env && i < R128Cpu_Count; ++i) {
+         const char *p = env, *q = r128__cpuNames[i];
+         while (*p && *p == *q) {
+            ++p;
+            ++q;
+         }
+         if (*p == *q) {
+            level = (R128Cpu)i;
+         }
+      }
+#else
+      level = (R128Cpu)detected;
+#endif
+   }
+   if (level < R128Cpu_Scalar) {
+      level = R128Cpu_Scalar;
+   } else if (level > detected) {
+      level = (R128Cpu)detected;
+   }
+
+   R128__CPU_STORE(long, &r128__cpuSelected, (long)level);
+   for (i = 0; i < sizeof(r128__dispatch) / sizeof(r128__dispatch[0]); ++i) {
+      R128__ArrayProc kernel = r128__dispatch[i].kernels[r128__cpuKernelLevel((int)i, level)];
+      R128__CPU_STORE(R128__ArrayProc, r128__dispatch[i].proc, kernel);
+   }
+   return level;
+}
+
+#if R128__DISPATCH
+// 0 before detection, 1 while one thread runs it, 2 after
+static long r128__cpuOnce;
+
+static void r128__cpuInit(void)
+{
+   long idle = 0;
+
+   if (R128__CPU_LOAD(long, &r128__cpuOnce) == 2) {
+      return;
+   }
+   if (R128__CPU_CAS(&r128__cpuOnce, idle, 1)) {
+      R128__CPU_STORE(long, &r128__cpuDetected, (long)r128__cpuDetect());
+      r128__cpuSelect(R128Cpu_Auto);
+      R128__CPU_STORE(long, &r128__cpuOnce, 2);
+   } else {
+      while (R128__CPU_LOAD(long, &r128__cpuOnce) != 2) {
+         _mm_pause();
+      }
+   }
+}
+#else
+static void r128__cpuInit(void)
+{
+}
+#endif
+
+static R128__ArrayProc r128__cpuProc(R128__ArrayProc *proc)
+{
+   R128__ArrayProc kernel = R128__CPU_LOAD(R128__ArrayProc, proc);
+   if (!kernel) {
+      r128__cpuInit();
+      kernel = R128__CPU_LOAD(R128__ArrayProc, proc);
+   }
+   return kernel;
+}
+
+R128Cpu r128CpuSet(R128Cpu level)
+{
+   r128__cpuInit();
+   return r128__cpuSelect(level);
+}
+
+R128Cpu r128CpuGet(void)
+{
+   r128__cpuInit();
+   return (R128Cpu)R128__CPU_LOAD(long, &r128__cpuSelected);
+}
+
+int r128CpuReport(char *dst, size_t dstSize)
+{
+   char *p = dst, *end = dst + dstSize - 1;
+   long selected;
+   size_t i;
+
+   R128_ASSERT(dst != NULL && dstSize > 0);
+
+   selected = (long)r128CpuGet();
+
+#define R128__PUT(str) do { const char *c_ = (str); while (*c_ && p < end) *p++ = *c_++; } while (0)
+   R128__PUT("detected ");
+   R128__PUT(r128__cpuNames[R128__CPU_LOAD(long, &r128__cpuDetected)]);
+   R128__PUT("\nselected ");
+   R128__PUT(r128__cpuNames[selected]);
+   R128__PUT("\n");
+   for (i = 0; i < sizeof(r128__dispatch) / sizeof(r128__dispatch[0]); ++i) {
+      R128__PUT(r128__dispatch[i].name);
+      R128__PUT(" ");
+      R128__PUT(r128__cpuNames[r128__cpuKernelLevel((int)i, selected)]);
+      R128__PUT("\n");
+   }
+#undef R128__PUT
+
+   *p = '\0';
+   return (int)(p - dst);
+}
+
+void r128AddArray(R128 *dst, const R128 *a, const R128 *b, size_t n)
+{
+   R128_ASSERT(n == 0 || (dst != NULL && a != NULL && b != NULL));
+
+   r128__cpuProc(&r128__addArrayProc)(dst, a, b, n);
+}
+
+void r128SubArray(R128 *dst, const R128 *a, const R128 *b, size_t n)
+{
+   R128_ASSERT(n == 0 || (dst != NULL && a != NULL && b != NULL));
+
+   r128__cpuProc(&r128__subArrayProc)(dst, a, b, n);
+}
+
+void r128MulArray(R128 *dst, const R128 *a, const R128 *b, size_t n)
+{
+   R128_ASSERT(n == 0 || (dst != NULL && a != NULL && b != NULL));
+
+   r128__cpuProc(&r128__mulArrayProc)(dst, a, b, n);
+}
+
+void r128DivArray(R128 *dst, const R128 *a, const R128 *b, size_t n)
+{
+   size_t i;
+
+   R128_ASSERT(n == 0 || (dst != NULL && a != NULL && b != NULL));
+
+   for (i = 0; i < n; ++i) {
+      r128Div(&dst[i], &a[i], &b[i]);
+   }
+}
+
+void r128FromFloatArray(R128 *dst, const double *src, size_t n)
+{
+   size_t i;
+
+   R128_ASSERT(n == 0 || (dst != NULL && src != NULL));
+
+   for (i = 0; i < n; ++i) {
+      r128FromFloat(&dst[i], src[i]);
+   }
+}
+
+void r128ToFloatArray(double *dst, const R128 *src, size_t n)
+{
+   size_t i;
+
+   R128_ASSERT(n == 0 || (dst != NULL && src != NULL));
+
+   for (i = 0; i < n; ++i) {
+      dst[i] = r128ToFloat(&src[i]);
+   }
+}
+
+void r128FromStringArray(R128 *dst, const char *const *src, size_t n)
+{
+   size_t i;
+
+   R128_ASSERT(n == 0 || (dst != NULL && src != NULL));
+
+   for (i = 0; i < n; ++i) {
+      r128FromString(&dst[i], src[i], NULL);
+   }
+}
+
+void r128ToStringArray(char *dst, size_t dstStride, const R128 *src, size_t n)
+{
+   size_t i;
+
+   R128_ASSERT(n == 0 || (dst != NULL && dstStride > 0 && src != NULL));
+
+   for (i = 0; i < n; ++i) {
+      r128ToString(dst + i * dstStride, dstStride, &src[i]);
+   }
+}
+
+void r128SumArray(R128 *dst, const R128 *src, size_t n)
+{
+   R128 sum;
+   size_t i;
+
+   R128_ASSERT(dst != NULL);
+   R128_ASSERT(n == 0 || src != NULL);
+
+   r128Copy(&sum, &R128_zero);
+   for (i = 0; i < n; ++i) {
+      r128Add(&sum, &sum, &src[i]);
+   }
+
+   r128Copy(dst, &sum);
+}
+
+// The running sum is kept in registers rather than going through r128Add, so
+// the loop is a single add/add-with-carry chain. Overflow is tracked as the
+// usual sign test: both operands had the same sign and the sum does not.
+int r128InclusiveScanArray(R128 *dst, const R128 *src, size_t n, const R128 *init)
+{
+   R128_U64 lo = 0, hi = 0, overflow = 0;
+   size_t i;
+
+   R128_ASSERT(n == 0 || (dst != NULL && src != NULL));
+
+   if (init) {
+      lo = init->lo;
+      hi = init->hi;
+   }
+
+   for (i = 0; i < n; ++i) {
+      R128_U64 slo = src[i].lo;
+      R128_U64 shi = src[i].hi;
+      R128_U64 sum = lo + slo;
+      R128_U64 carry = sum < lo;
+
+      lo = sum;
+      sum = hi + shi + carry;
+      overflow |= ~(hi ^ shi) & (hi ^ sum);
+      hi = sum;
+
+      dst[i].lo = lo;
+      dst[i].hi = hi;
+   }
+
+   return (int)(overflow >> 63);
+}
+
+int r128ExclusiveScanArray(R128 *dst, const R128 *src, size_t n, const R128 *init)
+{
+   R128_U64 lo = 0, hi = 0, overflow = 0;
+   size_t i;
+
+   R128_ASSERT(n == 0 || (dst != NULL && src != NULL));
+
+   if (init) {
+      lo = init->lo;
+      hi = init->hi;
+   }
+
+   for (i = 0; i < n; ++i) {
+      R128_U64 slo = src[i].lo;
+      R128_U64 shi = src[i].hi;
+      R128_U64 sum = lo + slo;
+      R128_U64 carry = sum < lo;
+
+      dst[i].lo = lo;
+      dst[i].hi = hi;
+
+      lo = sum;
+      sum = hi + shi + carry;
+      overflow |= ~(hi ^ shi) & (hi ^ sum);
+      hi = sum;
+   }
+
+   return (int)(overflow >> 63);
+}
+
+
+void r128MinArray(R128 *dst, const R128 *src, size_t n)
+{
+   R128 m;
+   size_t i;
+
+   R128_ASSERT(dst != NULL);
+   R128_ASSERT(n == 0 || src != NULL);
+
+   r128Copy(&m, &R128_max);
+   for (i = 0; i < n; ++i) {
+      if ((R128_S64)src[i].hi < (R128_S64)m.hi || (src[i].hi == m.hi && src[i].lo < m.lo)) {
+         m = src[i];
+      }
+   }
+
+   r128Copy(dst, &m);
+}
+
+void r128MaxArray(R128 *dst, const R128 *src, size_t n)
+{
+   R128 m;
+   size_t i;
+
+   R128_ASSERT(dst != NULL);
+   R128_ASSERT(n == 0 || src != NULL);
+
+   r128Copy(&m, &R128_min);
+   for (i = 0; i < n; ++i) {
+      if ((R128_S64)src[i].hi > (R128_S64)m.hi || (src[i].hi == m.hi && src[i].lo > m.lo)) {
+         m = src[i];
+      }
+   }
+
+   r128Copy(dst, &m);
+}
+
+size_t r128CountArray(const R128 *src, size_t n, const R128 *lo, const R128 *hi)
+{
+   size_t i, count = 0;
+
+   R128_ASSERT(n == 0 || src != NULL);
+
+   for (i = 0; i < n; ++i) {
+      count += (!lo || r128Cmp(&src[i], lo) >= 0) && (!hi || r128Cmp(&src[i], hi) < 0);
+   }
+
+   return count;
+}
+
+void r128DotInit(R128DotAccumulator *acc)
+{
+   int i;
+
+   R128_ASSERT(acc != NULL);
+
+   for (i = 0; i < 5; ++i) {
+      acc->limb[i] = 0;
+   }
+}
+
+// Adds (or subtracts, if negate) the 256-bit product of two magnitudes.
+static void r128__dotAccumulate(R128_U64 *limb, const R128 *a, const R128 *b, int negate)
+{
+   R128_U64 p[4], mask = (R128_U64)0 - (R128_U64)negate;
+   int i;
+
+#if R128__INT128
+   unsigned __int128 p0, p1, p2, mid, top, sum;
+   p0 = a->lo * (unsigned __int128)b->lo;
+   p1 = a->lo * (unsigned __int128)b->hi;
+   p2 = a->hi * (unsigned __int128)b->lo;
+   mid = (p0 >> 64) + (R128_U64)p1 + (R128_U64)p2;
+   top = a->hi * (unsigned __int128)b->hi + (p1 >> 64) + (p2 >> 64) + (mid >> 64);
+   p[0] = (R128_U64)p0;
+   p[1] = (R128_U64)mid;
+   p[2] = (R128_U64)top;
+   p[3] = (R128_U64)(top >> 64);
+
+   // adding ~p + 1 subtracts p
+   sum = (R128_U64)negate;
+   for (i = 0; i < 4; ++i) {
+      sum += (unsigned __int128)limb[i] + (p[i] ^ mask);
+      limb[i] = (R128_U64)sum;
+      sum >>= 64;
+   }
+   limb[4] += mask + (R128_U64)sum;
+#else
+   R128 p0, p1, p2, p3;
+   R128_U64 carry, t, u;
+
+   r128__umul128(&p0, a->lo, b->lo);
+   r128__umul128(&p1, a->lo, b->hi);
+   r128__umul128(&p2, a->hi, b->lo);
+   r128__umul128(&p3, a->hi, b->hi);
+
+   // p = p0 + (p1 + p2) << 64 + p3 << 128
+   p[0] = p0.lo;
+   p[1] = p0.hi + p1.lo;
+   carry = p[1] < p0.hi;
+   p[1] += p2.lo;
+   carry += p[1] < p2.lo;
+   p[2] = p3.lo + carry;
+   carry = p[2] < carry;
+   p[2] += p1.hi;
+   carry += p[2] < p1.hi;
+   p[2] += p2.hi;
+   carry += p[2] < p2.hi;
+   p[3] = p3.hi + carry;
+
+   // adding ~p + 1 subtracts p
+   carry = (R128_U64)negate;
+   for (i = 0; i < 4; ++i) {
+      t = p[i] ^ mask;
+      u = limb[i] + t;
+      t = u < t;
+      limb[i] = u + carry;
+      carry = t + (limb[i] < carry);
+   }
+   limb[4] += mask + carry;
+#endif
+}
+
+void r128DotAdd(R128DotAccumulator *acc, const R128 *a, const R128 *b, size_t n)
+{
+   size_t i;
+
+   R128_ASSERT(acc != NULL);
+   R128_ASSERT(n == 0 || (a != NULL && b != NULL));
+
+   for (i = 0; i < n; ++i) {
+      // |x| = (x ^ s) - s, with s all ones for negative x
+      R128_U64 sa = (R128_U64)((R128_S64)a[i].hi >> 63);
+      R128_U64 sb = (R128_U64)((R128_S64)b[i].hi >> 63);
+      R128 ta, tb;
+
+      ta.lo = (a[i].lo ^ sa) - sa;
+      ta.hi = (a[i].hi ^ sa) - sa - ((a[i].lo ^ sa) < sa);
+      tb.lo = (b[i].lo ^ sb) - sb;
+      tb.hi = (b[i].hi ^ sb) - sb - ((b[i].lo ^ sb) < sb);
+
+      r128__dotAccumulate(acc->limb, &ta, &tb, (int)((sa ^ sb) & 1));
+   }
+}
+
+void r128DotMerge(R128DotAccumulator *acc, const R128DotAccumulator *other)
+{
+   R128_U64 carry = 0;
+   int i;
+
+   R128_ASSERT(acc != NULL);
+   R128_ASSERT(other != NULL);
+
+   for (i = 0; i < 5; ++i) {
+      R128_U64 u = acc->limb[i] + other->limb[i];
+      R128_U64 c = u < other->limb[i];
+      acc->limb[i] = u + carry;
+      carry = c + (acc->limb[i] < carry);
+   }
+}
+
+void r128DotResult(R128 *dst, const R128DotAccumulator *acc)
+{
+   R128_U64 m[5];
+   int sign, i;
+
+   R128_ASSERT(dst != NULL);
+   R128_ASSERT(acc != NULL);
+
+   // round the magnitude, as r128Mul does
+   sign = (R128_S64)acc->limb[4] < 0;
+   for (i = 0; i < 5; ++i) {
+      m[i] = acc->limb[i];
+   }
+   if (sign) {
+      R128_U64 carry = 1;
+      for (i = 0; i < 5; ++i) {
+         m[i] = ~m[i] + carry;
+         carry = carry && m[i] == 0;
+      }
+   }
+
+   dst->lo = m[1] + (m[0] >> 63);
+   dst->hi = m[2] + (dst->lo < m[1]);
+   if (sign) {
+      r128Neg(dst, dst);
+   }
+}
+
+void r128DotArray(R128 *dst, const R128 *a, const R128 *b, size_t n)
+{
+   R128DotAccumulator acc;
+
+   r128DotInit(&acc);
+   r128DotAdd(&acc, a, b, n);
+   r128DotResult(dst, &acc);
+}
+
+enum {
+   R128__HISTOGRAM_LINEAR,
+   R128__HISTOGRAM_BOUNDS,
+   R128__HISTOGRAM_LOG
+};
+
+static void r128__histogramClear(R128Histogram *h, int kind, size_t buckets)
+{
+   h->buckets = buckets;
+   h->kind = kind;
+   h->shift = 0;
+   h->recip = 0;
+   r128Copy(&h->min, &R128_zero);
+   r128Copy(&h->width, &R128_zero);
+   r128Copy(&h->last, &R128_zero);
+   h->bounds = NULL;
+}
+
+
+void r128HistogramInitLinear(R128Histogram *h, const R128 *min, const R128 *width, size_t buckets)
+{
+   R128 lo, hi;
+
+   R128_ASSERT(h != NULL);
+   R128_ASSERT(min != NULL);
+   R128_ASSERT(width != NULL);
+   R128_ASSERT(!r128IsNeg(width) && (width->hi != 0 || width->lo != 0));
+   R128_ASSERT(buckets > 0 && (R128_U64)buckets <= R128_LIT_U64(0xffffffff));
+
+   r128__histogramClear(h, R128__HISTOGRAM_LINEAR, buckets);
+   r128Copy(&h->min, min);
+   r128Copy(&h->width, width);
+
+   // last = width * buckets - 1 as a raw integer, the largest difference from
+   // min inside the buckets. When the product does not fit in 128 bits, every
+   // difference is inside and last is all ones.
+   r128__umul128(&lo, width->lo, buckets);
+   r128__umul128(&hi, width->hi, buckets);
+   h->last.lo = lo.lo;
+   h->last.hi = lo.hi + hi.lo;
+   if (hi.hi != 0 || h->last.hi < lo.hi) {
+      R128_SET2(&h->last, R128_LIT_U64(0xffffffffffffffff), R128_LIT_U64(0xffffffffffffffff));
+   } else {
+      h->last.hi -= h->last.lo == 0;
+      --h->last.lo;
+   }
+
+   // width = 2^shift exactly: the bucket is a shift. Otherwise width is in
+   // [2^shift, 2^(shift+1)) and recip = floor(2^(64+shift) / width) < 2^64.
+   h->shift = width->hi ? 127 - r128__clz64(width->hi) : 63 - r128__clz64(width->lo);
+   if (h->shift < 64 ? width->hi != 0 || width->lo != (R128_U64)1 << h->shift
+                     : width->lo != 0 || width->hi != (R128_U64)1 << (h->shift - 64)) {
+      R128 one, q;
+      r128Shl(&one, &R128_smallest, h->shift);
+      r128__udiv(&q, &one, width);
+      h->recip = q.lo;
+   }
+}
+
+void r128HistogramInitBounds(R128Histogram *h, const R128 *bounds, size_t boundCount)
+{
+   R128_ASSERT(h != NULL);
+   R128_ASSERT(boundCount == 0 || bounds != NULL);
+
+   r128__histogramClear(h, R128__HISTOGRAM_BOUNDS, boundCount + 1);
+   h->bounds = bounds;
+}
+
+void r128HistogramInitLog(R128Histogram *h, int subBucketBits)
+{
+   R128_ASSERT(h != NULL);
+   R128_ASSERT(subBucketBits >= 0 && subBucketBits <= 16);
+
+   r128__histogramClear(h, R128__HISTOGRAM_LOG, (size_t)(128 - subBucketBits) << subBucketBits);
+   h->shift = subBucketBits;
+}
+
+static size_t r128__histogramLinear(const R128Histogram *h, const R128 *v)
+{
+   R128 d;
+   R128_U64 q, borrow;
+
+   // d = v - min as an unsigned 128-bit difference
+   d.lo = v->lo - h->min.lo;
+   borrow = d.lo > v->lo;
+   d.hi = v->hi - h->min.hi - borrow;
+   if ((R128_S64)v->hi < (R128_S64)h->min.hi || (v->hi == h->min.hi && v->lo < h->min.lo)) {
+      return 0;
+   }
+   if (r128__ucmp(&d, &h->last) > 0) {
+      return h->buckets - 1;
+   }
+
+   if (!h->recip) {
+      r128Shr(&d, &d, h->shift);
+      return (size_t)d.lo;
+   } else {
+      // estimate from the top bits of d, at most two below the real quotient
+      R128 t, qw;
+      R128_U64 top;
+
+      r128Shr(&t, &d, h->shift);
+      top = t.lo;
+      r128__umul128(&t, top, h->recip);
+      q = t.hi;
+
+      r128__umul128(&qw, q, h->width.lo);
+      qw.hi += q * h->width.hi;
+      r128Sub(&d, &d, &qw);
+      while (r128__ucmp(&d, &h->width) >= 0) {
+         r128Sub(&d, &d, &h->width);
+         ++q;
+      }
+      return (size_t)q;
+   }
+}
+
+// Branchless upper bound: the number of bounds <= v.
+static size_t r128__histogramBounds(const R128Histogram *h, const R128 *v)
+{
+   const R128 *base = h->bounds;
+   size_t len = h->buckets - 1;
+   R128_U64 vhi = v->hi ^ R128_LIT_U64(0x8000000000000000);
+
+   if (len == 0) {
+      return 0;
+   }
+
+   while (len > 1) {
+      size_t half = len / 2;
+      R128_U64 bhi = base[half].hi ^ R128_LIT_U64(0x8000000000000000);
+      size_t le = (bhi < vhi) | ((bhi == vhi) & (base[half].lo <= v->lo));
+      base += le * half;
+      len -= half;
+   }
+
+   {
+      R128_U64 bhi = base->hi ^ R128_LIT_U64(0x8000000000000000);
+      size_t le = (bhi < vhi) | ((bhi == vhi) & (base->lo <= v->lo));
+      return (size_t)(base - h->bounds) + le;
+   }
+}
+
+static size_t r128__histogramLog(const R128Histogram *h, const R128 *v)
+{
+   int s = h->shift;
+   int e;
+   R128 m;
+
+   if ((R128_S64)v->hi < 0) {
+      return 0;
+   }
+
+   // e = position of the top bit
+   e = v->hi ? 127 - r128__clz64(v->hi) : 63 - r128__clz64(v->lo);
+   if (e < s) {
+      return (size_t)v->lo;
+   }
+
+   r128Shr(&m, v, e - s);
+   return ((size_t)(e - s + 1) << s) + (size_t)(m.lo & (((R128_U64)1 << s) - 1));
+}
+
+size_t r128HistogramBucket(const R128Histogram *h, const R128 *v)
+{
+   R128_ASSERT(h != NULL);
+   R128_ASSERT(v != NULL);
+
+   switch (h->kind) {
+   case R128__HISTOGRAM_LINEAR:
+      return r128__histogramLinear(h, v);
+   case R128__HISTOGRAM_BOUNDS:
+      return r128__histogramBounds(h, v);
+   default:
+      return r128__histogramLog(h, v);
+   }
+}
+
+void r128HistogramBucketStart(R128 *dst, const R128Histogram *h, size_t bucket)
+{
+   R128_ASSERT(dst != NULL);
+   R128_ASSERT(h != NULL);
+   R128_ASSERT(bucket < h->buckets);
+
+   switch (h->kind) {
+   case R128__HISTOGRAM_LINEAR:
+      {
+         R128 lo;
+         r128__umul128(&lo, h->width.lo, bucket);
+         lo.hi += h->width.hi * bucket;
+         r128Add(dst, &h->min, &lo);
+      }
+      break;
+   case R128__HISTOGRAM_BOUNDS:
+      r128Copy(dst, bucket ? &h->bounds[bucket - 1] : &R128_min);
+      break;
+   default:
+      {
+         int s = h->shift;
+         size_t e = (bucket >> s) + s - 1;
+
+         if (bucket < ((size_t)1 << s)) {
+            R128_SET2(dst, bucket, 0);
+         } else {
+            R128_SET2(dst, ((size_t)1 << s) | (bucket & (((size_t)1 << s) - 1)), 0);
+            r128Shl(dst, dst, (int)e - s);
+         }
+      }
+      break;
+   }
+}
+
+// One loop per kind, so the dispatch is out of the inner loop.
+void r128HistogramArray(R128_U64 *counts, const R128Histogram *h, const R128 *src, size_t n)
+{
+   size_t i;
+
+   R128_ASSERT(h != NULL);
+   R128_ASSERT(n == 0 || (counts != NULL && src != NULL));
+
+   switch (h->kind) {
+   case R128__HISTOGRAM_LINEAR:
+      for (i = 0; i < n; ++i) {
+         ++counts[r128__histogramLinear(h, &src[i])];
+      }
+      break;
+   case R128__HISTOGRAM_BOUNDS:
+      for (i = 0; i < n; ++i) {
+         ++counts[r128__histogramBounds(h, &src[i])];
+      }
+      break;
+   default:
+      for (i = 0; i < n; ++i) {
+         ++counts[r128__histogramLog(h, &src[i])];
+      }
+      break;
+   }
+}
+
+#ifdef R128_STATS
+void r128StatsGet(R128Stats *dst)
+{
+   R128_ASSERT(dst != NULL);
+   *dst = r128__stats;
+}
+
+void r128StatsReset(void)
+{
+   R128Stats zero = { 0, 0, 0, 0, 0 };
+   r128__stats = zero;
+}
+#endif   //R128_STATS
+
+#ifdef R128_TRACE
+#  undef r128FromInt
+#  undef r128FromFloat
+#  undef r128FromString
+#  undef r128ToInt
+#  undef r128ToFloat
+#  undef r128ToStringOpt
+#  undef r128ToStringf
+#  undef r128ToString
+#  undef r128Copy
+#  undef r128Neg
+#  undef r128Not
+#  undef r128Or
+#  undef r128And
+#  undef r128Xor
+#  undef r128Shl
+#  undef r128Shr
+#  undef r128Sar
+#  undef r128Add
+#  undef r128Sub
+#  undef r128Mul
+#  undef r128Div
+#  undef r128Mod
+#  undef r128Cmp
+#  undef r128IsNeg
+#  undef r128Min
+#  undef r128Max
+#  undef r128Floor
+#  undef r128Ceil
+#  undef r128AddArray
+#  undef r128SubArray
+#  undef r128MulArray
+#  undef r128DivArray
+#  undef r128FromFloatArray
+#  undef r128ToFloatArray
+#  undef r128FromStringArray
+#  undef r128ToStringArray
+
+void r128TraceStart(R128TraceRecord *buffer, size_t capacity, R128TraceFlush flush, void *user)
+{
+   R128_ASSERT(buffer != NULL && capacity > 0);
+
+   r128__trace.buffer = buffer;
+   r128__trace.capacity = capacity;
+   r128__trace.count = 0;
+   r128__trace.wrapped = 0;
+   r128__trace.flush = flush;
+   r128__trace.user = user;
+}
+
+static void r128__traceReverse(R128TraceRecord *first, R128TraceRecord *last)
+{
+   while (first < --last) {
+      R128TraceRecord tmp = *first;
+      *first++ = *last;
+      *last = tmp;
+   }
+}
+
+size_t r128TraceStop(void)
+{
+   R128__TraceState *t = &r128__trace;
+   size_t count = t->count;
+   R128TraceRecord *buffer = t->buffer;
+
+   if (!buffer) {
+      return 0;
+   }
+
+   // stop first, so that calls the callback makes are not recorded
+   t->buffer = NULL;
+   if (t->flush) {
+      if (count) {
+         t->flush(buffer, count, t->user);
+      }
+      count = 0;
+   } else if (t->wrapped) {
+      // rotate the oldest record, at count, to the front
+      r128__traceReverse(buffer, buffer + count);
+      r128__traceReverse(buffer + count, buffer + t->capacity);
+      r128__traceReverse(buffer, buffer + t->capacity);
+      count = t->capacity;
+   }
+
+   return count;
+}
+
+// Returns the next record of the calling thread's trace, cleared, or NULL if
+// it is not recording.
+static R128TraceRecord *r128__traceNext(R128TraceOp op)
+{
+   R128__TraceState *t = &r128__trace;
+   R128TraceRecord *rec;
+
+   if (!t->buffer) {
+      return NULL;
+   }
+
+   if (t->count == t->capacity) {
+      if (t->flush) {
+         // pause recording, so that calls the callback makes do not come back
+         // here and find the buffer still full
+         R128TraceRecord *buffer = t->buffer;
+         t->buffer = NULL;
+         t->flush(buffer, t->count, t->user);
+         t->buffer = buffer;
+      } else {
+         t->wrapped = 1;
+      }
+      t->count = 0;
+   }
+
+   rec = &t->buffer[t->count++];
+   rec->op = (R128_U32)op;
+   rec->arg = 0;
+   R128_SET2(&rec->a, 0, 0);
+   R128_SET2(&rec->b, 0, 0);
+   return rec;
+}
+
+static void r128__traceOp(R128TraceOp op, const R128 *a, const R128 *b, int arg)
+{
+   R128TraceRecord *rec = r128__traceNext(op);
+
+   if (rec) {
+      rec->arg = arg;
+      if (a) {
+         rec->a = *a;
+      }
+      if (b) {
+         rec->b = *b;
+      }
+   }
+}
+
+// Copies at most size - 1 bytes of text, NUL-terminated, into dst.
+static void r128__traceText(char *dst, size_t size, const char *text, size_t len)
+{
+   size_t i;
+
+   if (len > size - 1) {
+      len = size - 1;
+   }
+   for (i = 0; i < len; ++i) {
+      dst[i] = text[i];
+   }
+   dst[len] = '\0';
+}
+
+static int r128__traceSize(size_t size)
+{
+   return size > 0x7fffffff ? 0x7fffffff : (int)size;
+}
+
+static R128_U64 r128__traceDoubleBits(double v)
+{
+   union {
+      double d;
+      R128_U64 u;
+   } bits;
+
+   bits.d = v;
+   return bits.u;
+}
+
+void r128FromInt(R128 *dst, R128_S64 v)
+{
+   R128TraceRecord *rec = r128__traceNext(R128TraceOp_FromInt);
+   if (rec) {
+      rec->a.lo = (R128_U64)v;
+   }
+   r128__traceFromInt(dst, v);
+}
+
+void r128FromFloat(R128 *dst, double v)
+{
+   R128TraceRecord *rec = r128__traceNext(R128TraceOp_FromFloat);
+   if (rec) {
+      rec->a.lo = r128__traceDoubleBits(v);
+   }
+   r128__traceFromFloat(dst, v);
+}
+
+void r128FromString(R128 *dst, const char *s, char **endptr)
+{
+   R128TraceRecord *rec;
+   char *end;
+
+   // recorded afterwards, as only the parse knows how much text it reads
+   r128__traceFromString(dst, s, &end);
+   rec = r128__traceNext(R128TraceOp_FromString);
+   if (rec) {
+      char text[32];
+      size_t i;
+
+      r128__traceText(text, sizeof(text), s, (size_t)(end - s));
+      for (i = 0; i < 16; ++i) {
+         ((char *)&rec->a)[i] = text[i];
+         ((char *)&rec->b)[i] = text[16 + i];
+      }
+      rec->arg = r128__traceSize((size_t)(end - s));
+   }
+   if (endptr) {
+      *endptr = end;
+   }
+}
+
+R128_S64 r128ToInt(const R128 *v)
+{
+   r128__traceOp(R128TraceOp_ToInt, v, NULL, 0);
+   return r128__traceToInt(v);
+}
+
+double r128ToFloat(const R128 *v)
+{
+   r128__traceOp(R128TraceOp_ToFloat, v, NULL, 0);
+   return r128__traceToFloat(v);
+}
+
+int r128ToStringOpt(char *dst, size_t dstSize, const R128 *v, const R128ToStringFormat *opt)
+{
+   R128TraceRecord *rec = r128__traceNext(R128TraceOp_ToStringOpt);
+   if (rec) {
+      rec->a = *v;
+      rec->b.lo = (R128_U32)opt->width | (R128_U64)(R128_U32)opt->precision << 32;
+      rec->b.hi = (R128_U64)(opt->sign & 0xff) | (R128_U64)(opt->zeroPad & 0xff) << 8 |
+         (R128_U64)(opt->decimal & 0xff) << 16 | (R128_U64)(opt->leftAlign & 0xff) << 24;
+      rec->arg = r128__traceSize(dstSize);
+   }
+   return r128__traceToStringOpt(dst, dstSize, v, opt);
+}
+
+int r128ToStringf(char *dst, size_t dstSize, const char *format, const R128 *v)
+{
+   R128TraceRecord *rec = r128__traceNext(R128TraceOp_ToStringf);
+   if (rec) {
+      size_t len = 0;
+      while (len < 15 && format[len]) {
+         ++len;
+      }
+      rec->a = *v;
+      r128__traceText((char *)&rec->b, sizeof(rec->b), format, len);
+      rec->arg = r128__traceSize(dstSize);
+   }
+   return r128__traceToStringf(dst, dstSize, format, v);
+}
+
+int r128ToString(char *dst, size_t dstSize, const R128 *v)
+{
+   r128__traceOp(R128TraceOp_ToString, v, NULL, r128__traceSize(dstSize));
+   return r128__traceToString(dst, dstSize, v);
+}
+
+void r128Copy(R128 *dst, const R128 *src)
+{
+   r128__traceOp(R128TraceOp_Copy, src, NULL, 0);
+   r128__traceCopy(dst, src);
+}
+
+void r128Neg(R128 *dst, const R128 *src)
+{
+   r128__traceOp(R128TraceOp_Neg, src, NULL, 0);
+   r128__traceNeg(dst, src);
+}
+
+void r128Not(R128 *dst, const R128 *src)
+{
+   r128__traceOp(R128TraceOp_Not, src, NULL, 0);
+   r128__traceNot(dst, src);
+}
+
+void r128Or(R128 *dst, const R128 *a, const R128 *b)
+{
+   r128__traceOp(R128TraceOp_Or, a, b, 0);
+   r128__traceOr(dst, a, b);
+}
+
+void r128And(R128 *dst, const R128 *a, const R128 *b)
+{
+   r128__traceOp(R128TraceOp_And, a, b, 0);
+   r128__traceAnd(dst, a, b);
+}
+
+void r128Xor(R128 *dst, const R128 *a, const R128 *b)
+{
+   r128__traceOp(R128TraceOp_Xor, a, b, 0);
+   r128__traceXor(dst, a, b);
+}
+
+void r128Shl(R128 *dst, const R128 *src, int amount)
+{
+   r128__traceOp(R128TraceOp_Shl, src, NULL, amount);
+   r128__traceShl(dst, src, amount);
+}
+
+void r128Shr(R128 *dst, const R128 *src, int amount)
+{
+   r128__traceOp(R128TraceOp_Shr, src, NULL, amount);
+   r128__traceShr(dst, src, amount);
+}
+
+void r128Sar(R128 *dst, const R128 *src, int amount)
+{
+   r128__traceOp(R128TraceOp_Sar, src, NULL, amount);
+   r128__traceSar(dst, src, amount);
+}
+
+void r128Add(R128 *dst, const R128 *a, const R128 *b)
+{
+   r128__traceOp(R128TraceOp_Add, a, b, 0);
+   r128__traceAdd(dst, a, b);
+}
+
+void r128Sub(R128 *dst, const R128 *a, const R128 *b)
+{
+   r128__traceOp(R128TraceOp_Sub, a, b, 0);
+   r128__traceSub(dst, a, b);
+}
+
+void r128Mul(R128 *dst, const R128 *a, const R128 *b)
+{
+   r128__traceOp(R128TraceOp_Mul, a, b, 0);
+   r128__traceMul(dst, a, b);
+}
+
+void r128Div(R128 *dst, const R128 *a, const R128 *b)
+{
+   r128__traceOp(R128TraceOp_Div, a, b, 0);
+   r128__traceDiv(dst, a, b);
+}
+
+void r128Mod(R128 *dst, const R128 *a, const R128 *b)
+{
+   r128__traceOp(R128TraceOp_Mod, a, b, 0);
+   r128__traceMod(dst, a, b);
+}
+
+int r128Cmp(const R128 *a, const R128 *b)
+{
+   r128__traceOp(R128TraceOp_Cmp, a, b, 0);
+   return r128__traceCmp(a, b);
+}
+
+int r128IsNeg(const R128 *v)
+{
+   r128__traceOp(R128TraceOp_IsNeg, v, NULL, 0);
+   return r128__traceIsNeg(v);
+}
+
+void r128Min(R128 *dst, const R128 *a, const R128 *b)
+{
+   r128__traceOp(R128TraceOp_Min, a, b, 0);
+   r128__traceMin(dst, a, b);
+}
+
+void r128Max(R128 *dst, const R128 *a, const R128 *b)
+{
+   r128__traceOp(R128TraceOp_Max, a, b, 0);
+   r128__traceMax(dst, a, b);
+}
+
+void r128Floor(R128 *dst, const R128 *v)
+{
+   r128__traceOp(R128TraceOp_Floor, v, NULL, 0);
+   r128__traceFloor(dst, v);
+}
+
+void r128Ceil(R128 *dst, const R128 *v)
+{
+   r128__traceOp(R128TraceOp_Ceil, v, NULL, 0);
+   r128__traceCeil(dst, v);
+}
+
+// The element-wise array functions record a call per element, before any of
+// dst is written, since it may alias the sources.
+static void r128__traceArray(R128TraceOp op, const R128 *a, const R128 *b, size_t n, int arg)
+{
+   size_t i;
+
+   if (r128__trace.buffer) {
+      for (i = 0; i < n; ++i) {
+         r128__traceOp(op, &a[i], b ? &b[i] : NULL, arg);
+      }
+   }
+}
+
+void r128AddArray(R128 *dst, const R128 *a, const R128 *b, size_t n)
+{
+   r128__traceArray(R128TraceOp_Add, a, b, n, 0);
+   r128__traceAddArray(dst, a, b, n);
+}
+
+void r128SubArray(R128 *dst, const R128 *a, const R128 *b, size_t n)
+{
+   r128__traceArray(R128TraceOp_Sub, a, b, n, 0);
+   r128__traceSubArray(dst, a, b, n);
+}
+
+void r128MulArray(R128 *dst, const R128 *a, const R128 *b, size_t n)
+{
+   r128__traceArray(R128TraceOp_Mul, a, b, n, 0);
+   r128__traceMulArray(dst, a, b, n);
+}
+
+void r128DivArray(R128 *dst, const R128 *a, const R128 *b, size_t n)
+{
+   r128__traceArray(R128TraceOp_Div, a, b, n, 0);
+   r128__traceDivArray(dst, a, b, n);
+}
+
+void r128FromFloatArray(R128 *dst, const double *src, size_t n)
+{
+   size_t i;
+
+   if (r128__trace.buffer) {
+      for (i = 0; i < n; ++i) {
+         R128TraceRecord *rec = r128__traceNext(R128TraceOp_FromFloat);
+         rec->a.lo = r128__traceDoubleBits(src[i]);
+      }
+   }
+   r128__traceFromFloatArray(dst, src, n);
+}
+
+void r128ToFloatArray(double *dst, const R128 *src, size_t n)
+{
+   r128__traceArray(R128TraceOp_ToFloat, src, NULL, n, 0);
+   r128__traceToFloatArray(dst, src, n);
+}
+
+void r128FromStringArray(R128 *dst, const char *const *src, size_t n)
+{
+   size_t i;
+
+   if (!r128__trace.buffer) {
+      r128__traceFromStringArray(dst, src, n);
+      return;
+   }
+
+   R128_ASSERT(n == 0 || (dst != NULL && src != NULL));
+   for (i = 0; i < n; ++i) {
+      r128FromString(&dst[i], src[i], NULL);
+   }
+}
+
+void r128ToStringArray(char *dst, size_t dstStride, const R128 *src, size_t n)
+{
+   r128__traceArray(R128TraceOp_ToString, src, NULL, n, r128__traceSize(dstStride));
+   r128__traceToStringArray(dst, dstStride, src, n);
+}
+#endif   //R128_TRACE
+
 #endif   //R128_IMPLEMENTATION
@@ -0,0 +1,875 @@
+/*
+r128_atomic.h: atomic operations on 128-bit (64.64) signed fixed-point values.
+
+COMPILATION
+-----------
+This is a companion to r128.h and follows the same single-file conventions.
+Include it wherever it is needed. In the ONE file in your project that defines
+R128_IMPLEMENTATION, include this file as well to get the code:
+
+#define R128_IMPLEMENTATION
+#include "r128_atomic.h"
+
+r128.h is included automatically, so it does not need to be included first.
+
+IMPLEMENTATION
+--------------
+On x86-64 (GCC, Clang or MSVC) every operation is lock-free and built on the
+16-byte compare-and-swap instruction (cmpxchg16b). All operations are
+sequentially consistent.
+
+On other targets, or if R128_ATOMIC_USE_LOCKS is defined in the implementation
+file, operations fall back to a small table of spinlocks indexed by the address
+of the R128Atomic. The fallback is correct as long as every access to an
+R128Atomic goes through the functions below, but it is not lock-free;
+r128AtomicIsLockFree reports which implementation was compiled in. The
+fallback requires GCC-compatible __atomic builtins or the MSVC Interlocked
+intrinsics.
+
+SHARDED COUNTERS
+----------------
+Even a lock-free atomic serializes every core on one cache line. For totals
+that are updated far more often than they are read, R128ShardedCounter keeps
+one row of partial sums per shard (normally one shard per thread), each padded
+to its own cache lines. Updates are plain adds into the caller's shard; reading
+a total adds up the shards. Because fixed-point addition is associative (it
+wraps exactly like two's-complement integers), the merged total is exactly the
+sum of every value added, regardless of which shard each value went to.
+
+Each shard must be updated by at most one thread at a time. A per-shard
+sequence count lets readers take a consistent snapshot while owners are still
+adding, so totals may be read at any time.
+
+HASH MAP
+--------
+R128Map maps R128 keys to slots for group-by aggregation from many threads at
+once: totals per price level, per rate bucket, and so on. It is an
+open-addressing table with a fixed capacity, in which keys are only ever added.
+Slots are arranged in groups of eight with one control byte per slot (empty,
+being written, or seven bits of the key's hash), packed into a 64-bit word per
+group. A probe compares all eight control bytes at once with SWAR (SIMD within
+a register) arithmetic and only touches keys whose hash bits match. New keys
+claim a slot with a 64-bit compare-and-swap on the control word.
+
+Each slot has an R128Atomic accumulator. When a few keys take most of the
+updates, the slot numbers returned by r128MapInsert can index an
+R128ShardedCounter with r128MapCapacity counters instead.
+
+The counter and map memory is allocated with R128_MALLOC and released with
+R128_FREE, which default to malloc and free (see r128.h). R128_CACHE_LINE
+(default 64) sets the padding.
+*/
+
+#ifndef H_R128_ATOMIC_H
+#define H_R128_ATOMIC_H
+
+#include "r128.h"
+
+#if defined(_MSC_VER)
+#  define R128_ALIGN16 __declspec(align(16))
+#else
+#  define R128_ALIGN16 __attribute__((aligned(16)))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// An R128 that can be shared between threads. Always 16-byte aligned, as
+// required by cmpxchg16b. Do not access value directly while other threads may
+// be using the object; initialize it with r128AtomicInit (or zero-initialize it)
+// before sharing it.
+typedef struct R128_ALIGN16 R128Atomic {
+   R128 value;
+} R128Atomic;
+
+// Non-atomic initialization. Not safe to call while other threads are using dst.
+extern void r128AtomicInit(R128Atomic *dst, const R128 *v);
+
+// Returns non-zero if the operations below are lock-free.
+extern int r128AtomicIsLockFree(void);
+
+// Atomic load and store. src is written to by the load on x86-64 (cmpxchg16b
+// always writes its operand), so it must not point to read-only memory.
+extern void r128AtomicLoad(R128 *dst, R128Atomic *src);
+extern void r128AtomicStore(R128Atomic *dst, const R128 *v);
+
+// Stores v into dst and writes the previous value to old.
+extern void r128AtomicExchange(R128 *old, R128Atomic *dst, const R128 *v);
+
+// If dst equals *expected, stores desired into dst and returns non-zero.
+// Otherwise, writes the current value of dst to expected and returns zero.
+extern int r128AtomicCompareExchange(R128Atomic *dst, R128 *expected, const R128 *desired);
+
+// Read-modify-write operations. The previous value is written to old, which may
+// be NULL if it is not needed.
+extern void r128AtomicFetchAdd(R128 *old, R128Atomic *dst, const R128 *v);  // dst += v
+extern void r128AtomicFetchSub(R128 *old, R128Atomic *dst, const R128 *v);  // dst -= v
+extern void r128AtomicFetchMin(R128 *old, R128Atomic *dst, const R128 *v);  // dst = min(dst, v)
+extern void r128AtomicFetchMax(R128 *old, R128Atomic *dst, const R128 *v);  // dst = max(dst, v)
+
+// An array of counters, each split into per-shard partial sums. Treat the
+// members as private.
+typedef struct R128ShardedCounter {
+   size_t counters;        // number of counters
+   int shards;             // number of shards
+   size_t stride;          // bytes between shard rows
+   unsigned char *rows;    // first shard row, cache-line aligned
+   void *mem;              // allocation holding the rows
+} R128ShardedCounter;
+
+// Allocates an array of counters, all zero, with the given number of shards
+// (typically the number of threads that will update it). Returns zero if the
+// allocation fails.
+extern int r128ShardedCounterInit(R128ShardedCounter *c, size_t counters, int shards);
+extern void r128ShardedCounterFree(R128ShardedCounter *c);
+
+// Adds v to counter index through the given shard. Only the thread that owns
+// shard may call this; different shards may be updated concurrently.
+extern void r128ShardedCounterAdd(R128ShardedCounter *c, int shard, size_t index, const R128 *v);
+
+// Merges the shards of counter index into dst. Safe to call at any time.
+extern void r128ShardedCounterTotal(R128 *dst, const R128ShardedCounter *c, size_t index);
+
+// Merges every counter at once; dst must hold c->counters values. Cheaper than
+// calling r128ShardedCounterTotal for each counter.
+extern void r128ShardedCounterTotals(R128 *dst, const R128ShardedCounter *c);
+
+// Zeroes all counters. Not safe to call while other threads are adding.
+extern void r128ShardedCounterReset(R128ShardedCounter *c);
+
+// A concurrent map from R128 keys to R128Atomic accumulators. Treat the members
+// as private.
+typedef struct R128Map {
+   R128_U64 *ctrl;               // one control word per group of 8 slots
+   struct R128__MapSlot *slots;
+   size_t capacity;              // number of slots, a power of two
+   void *mem;                    // allocation holding ctrl and slots
+} R128Map;
+
+#define R128_MAP_NONE ((size_t)-1)
+
+// Allocates an empty map with room for at least maxKeys keys, keeping the load
+// factor at or below 7/8. Returns zero if the allocation fails, or if maxKeys
+// is too large to address.
+extern int r128MapInit(R128Map *m, size_t maxKeys);
+extern void r128MapFree(R128Map *m);
+
+// Number of slots; slot numbers are in [0, r128MapCapacity(m)).
+extern size_t r128MapCapacity(const R128Map *m);
+
+// The hash used by the map: a multiply-fold of both halves of the key, so keys
+// that differ only in their integer or only in their fraction part spread out.
+extern R128_U64 r128MapHash(const R128 *key);
+
+// r128MapInsert: returns the slot of key, adding it with a zero accumulator if
+// it is not in the map yet. Returns R128_MAP_NONE if the map is full.
+// r128MapFind: returns the slot of key, or R128_MAP_NONE if it is not there.
+// Both may be called from any number of threads at once.
+extern size_t r128MapInsert(R128Map *m, const R128 *key);
+extern size_t r128MapFind(const R128Map *m, const R128 *key);
+
+// r128MapKey: if slot holds a key, copies it to key and returns non-zero.
+// r128MapValue: the accumulator of slot.
+extern int r128MapKey(const R128Map *m, size_t slot, R128 *key);
+extern R128Atomic *r128MapValue(R128Map *m, size_t slot);
+
+// Adds v to the accumulator of key, inserting the key if needed. Returns zero
+// if the map is full.
+extern int r128MapAdd(R128Map *m, const R128 *key, const R128 *v);
+
+// Adds values[i] to the accumulator of keys[i] for each i in [0, n). Keys are
+// hashed in batches and their control words prefetched before any of them is
+// probed, so the cache misses of a batch overlap. Returns the number of values
+// added, which is less than n only if the map filled up.
+extern size_t r128MapAggregate(R128Map *m, const R128 *keys, const R128 *values, size_t n);
+
+// Number of keys in the map.
+extern size_t r128MapCount(const R128Map *m);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif   //H_R128_ATOMIC_H
+
+#if defined(R128_IMPLEMENTATION) && !defined(H_R128_ATOMIC_IMPLEMENTATION)
+#define H_R128_ATOMIC_IMPLEMENTATION
+
+#ifdef R128_TRACE
+// Call the non-recording implementations (see r128.h), so that a trace holds
+// only the caller's own calls.
+#  define r128Copy r128__traceCopy
+#  define r128Add r128__traceAdd
+#  define r128Sub r128__traceSub
+#  define r128Min r128__traceMin
+#  define r128Max r128__traceMax
+#endif
+
+#if !defined(R128_ATOMIC_USE_LOCKS) && (defined(_M_X64) || (defined(__x86_64__) && defined(__GNUC__)))
+#  define R128__ATOMIC_CAS16 1
+#else
+#  define R128__ATOMIC_CAS16 0
+#endif
+
+#if defined(_MSC_VER)
+#  include <intrin.h>
+#endif
+
+#include <string.h>  // for memset
+
+// Sequence count helpers for the sharded counters. x86 never reorders stores
+// with stores or loads with loads, so MSVC only needs compiler barriers there.
+#if defined(_MSC_VER)
+#  if defined(_M_IX86) || defined(_M_X64)
+#    define R128__FENCE() _ReadWriteBarrier()
+#  else
+#    define R128__FENCE() __dmb(0xB)  //_ARM64_BARRIER_ISH
+#  endif
+#  define R128__LOAD_ACQUIRE(p) r128__loadAcquire(p)
+#  define R128__STORE_RELAXED(p, v) (*(volatile R128_U64 *)(p) = (v))
+#  define R128__STORE_RELEASE(p, v) do { R128__FENCE(); *(volatile R128_U64 *)(p) = (v); } while(0)
+#  define R128__FENCE_ACQUIRE() R128__FENCE()
+#  define R128__FENCE_RELEASE() R128__FENCE()
+
+static R128_U64 r128__loadAcquire(R128_U64 *p)
+{
+   R128_U64 v = *(volatile R128_U64 *)p;
+   R128__FENCE();
+   return v;
+}
+#else
+#  define R128__LOAD_ACQUIRE(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#  define R128__STORE_RELAXED(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+#  define R128__STORE_RELEASE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#  define R128__FENCE_ACQUIRE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#  define R128__FENCE_RELEASE() __atomic_thread_fence(__ATOMIC_RELEASE)
+#endif
+
+typedef void (*r128__atomicOp)(R128 *dst, const R128 *a, const R128 *b);
+
+#if R128__ATOMIC_CAS16
+static int r128__atomicCas(R128Atomic *dst, R128 *expected, const R128 *desired)
+{
+#  if defined(_M_X64)
+   return _InterlockedCompareExchange128((volatile __int64 *)&dst->value,
+      (__int64)desired->hi, (__int64)desired->lo, (__int64 *)expected);
+#  else
+   unsigned char ok;
+   __asm__ __volatile__("lock; cmpxchg16b %1\n\tsete %0"
+      : "=q"(ok), "+m"(dst->value), "+a"(expected->lo), "+d"(expected->hi)
+      : "b"(desired->lo), "c"(desired->hi)
+      : "memory", "cc");
+   return ok;
+#  endif
+}
+
+// Plain read used to seed a CAS loop. It may be torn; the CAS catches that.
+static void r128__atomicPeek(R128 *dst, const R128Atomic *src)
+{
+   const volatile R128_U64 *p = (const volatile R128_U64 *)&src->value;
+   dst->lo = p[0];
+   dst->hi = p[1];
+}
+#else
+#  define R128__ATOMIC_LOCK_COUNT 64
+
+static struct {
+   volatile long lock;
+   char pad[64 - sizeof(long)];
+} r128__atomicLocks[R128__ATOMIC_LOCK_COUNT];
+
+static volatile long *r128__atomicLockFor(const R128Atomic *p)
+{
+   return &r128__atomicLocks[((size_t)p >> 4) % R128__ATOMIC_LOCK_COUNT].lock;
+}
+
+static void r128__atomicLock(volatile long *lock)
+{
+#  if defined(_MSC_VER)
+   while (_InterlockedExchange(lock, 1)) {
+      while (*lock) {
+#    if defined(_M_IX86)
+         _mm_pause();
+#    endif
+      }
+   }
+#  else
+   while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+      while (__atomic_load_n(lock, __ATOMIC_RELAXED)) {
+#    if defined(__i386__) || defined(__x86_64__)
+         __builtin_ia32_pause();
+#    endif
+      }
+   }
+#  endif
+}
+
+static void r128__atomicUnlock(volatile long *lock)
+{
+#  if defined(_MSC_VER)
+   _InterlockedExchange(lock, 0);
+#  else
+   __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+#  endif
+}
+#endif   //R128__ATOMIC_CAS16
+
+// Applies dst = op(dst, v) atomically and returns the previous value in old.
+static void r128__atomicUpdate(R128 *old, R128Atomic *dst, const R128 *v, r128__atomicOp op)
+{
+   R128 prev;
+
+   R128_ASSERT(dst != NULL);
+   R128_ASSERT(v != NULL);
+
+#if R128__ATOMIC_CAS16
+   {
+      R128 next;
+      r128__atomicPeek(&prev, dst);
+      do {
+         op(&next, &prev, v);
+      } while (!r128__atomicCas(dst, &prev, &next));
+   }
+#else
+   {
+      volatile long *lock = r128__atomicLockFor(dst);
+      r128__atomicLock(lock);
+      r128Copy(&prev, &dst->value);
+      op(&dst->value, &prev, v);
+      r128__atomicUnlock(lock);
+   }
+#endif
+
+   if (old) {
+      r128Copy(old, &prev);
+   }
+}
+
+static void r128__atomicReplace(R128 *dst, const R128 *a, const R128 *b)
+{
+   (void)a;
+   r128Copy(dst, b);
+}
+
+void r128AtomicInit(R128Atomic *dst, const R128 *v)
+{
+   R128_ASSERT(dst != NULL);
+   R128_ASSERT(v != NULL);
+
+   r128Copy(&dst->value, v);
+}
+
+int r128AtomicIsLockFree(void)
+{
+   return R128__ATOMIC_CAS16;
+}
+
+void r128AtomicLoad(R128 *dst, R128Atomic *src)
+{
+   R128_ASSERT(dst != NULL);
+   R128_ASSERT(src != NULL);
+
+#if R128__ATOMIC_CAS16
+   {
+      // compare against an arbitrary value; on failure the current value is
+      // returned, on success the same value is written back.
+      R128 expected = { 0, 0 };
+      r128__atomicCas(src, &expected, &expected);
+      r128Copy(dst, &expected);
+   }
+#else
+   {
+      volatile long *lock = r128__atomicLockFor(src);
+      r128__atomicLock(lock);
+      r128Copy(dst, &src->value);
+      r128__atomicUnlock(lock);
+   }
+#endif
+}
+
+void r128AtomicStore(R128Atomic *dst, const R128 *v)
+{
+   r128__atomicUpdate(NULL, dst, v, r128__atomicReplace);
+}
+
+void r128AtomicExchange(R128 *old, R128Atomic *dst, const R128 *v)
+{
+   R128_ASSERT(old != NULL);
+   r128__atomicUpdate(old, dst, v, r128__atomicReplace);
+}
+
+int r128AtomicCompareExchange(R128Atomic *dst, R128 *expected, const R128 *desired)
+{
+   R128_ASSERT(dst != NULL);
+   R128_ASSERT(expected != NULL);
+   R128_ASSERT(desired != NULL);
+
+#if R128__ATOMIC_CAS16
+   return r128__atomicCas(dst, expected, desired);
+#else
+   {
+      volatile long *lock = r128__atomicLockFor(dst);
+      int ok;
+
+      r128__atomicLock(lock);
+      ok = dst->value.lo == expected->lo && dst->value.hi == expected->hi;
+      if (ok) {
+         r128Copy(&dst->value, desired);
+      } else {
+         r128Copy(expected, &dst->value);
+      }
+      r128__atomicUnlock(lock);
+      return ok;
+   }
+#endif
+}
+
+void r128AtomicFetchAdd(R128 *old, R128Atomic *dst, const R128 *v)
+{
+   r128__atomicUpdate(old, dst, v, r128Add);
+}
+
+void r128AtomicFetchSub(R128 *old, R128Atomic *dst, const R128 *v)
+{
+   r128__atomicUpdate(old, dst, v, r128Sub);
+}
+
+void r128AtomicFetchMin(R128 *old, R128Atomic *dst, const R128 *v)
+{
+   r128__atomicUpdate(old, dst, v, r128Min);
+}
+
+void r128AtomicFetchMax(R128 *old, R128Atomic *dst, const R128 *v)
+{
+   r128__atomicUpdate(old, dst, v, r128Max);
+}
+
+// Each shard row is a sequence count padded to 16 bytes followed by the
+// partial sums, rounded up to a whole number of cache lines.
+#define R128__SHARD_SEQ(c, shard) ((R128_U64 *)((c)->rows + (size_t)(shard) * (c)->stride))
+#define R128__SHARD_SUMS(c, shard) ((R128 *)((c)->rows + (size_t)(shard) * (c)->stride + 16))
+
+int r128ShardedCounterInit(R128ShardedCounter *c, size_t counters, int shards)
+{
+   R128_ASSERT(c != NULL);
+   R128_ASSERT(shards > 0);
+
+   c->counters = counters;
+   c->shards = shards;
+   c->stride = (16 + counters * sizeof(R128) + R128_CACHE_LINE - 1) & ~(size_t)(R128_CACHE_LINE - 1);
+   c->mem = R128_MALLOC(c->stride * shards + R128_CACHE_LINE - 1);
+   if (!c->mem) {
+      c->rows = NULL;
+      return 0;
+   }
+
+   c->rows = (unsigned char *)(((size_t)c->mem + R128_CACHE_LINE - 1) & ~(size_t)(R128_CACHE_LINE - 1));
+   r128ShardedCounterReset(c);
+   return 1;
+}
+
+void r128ShardedCounterFree(R128ShardedCounter *c)
+{
+   R128_ASSERT(c != NULL);
+
+   R128_FREE(c->mem);
+   c->mem = NULL;
+   c->rows = NULL;
+}
+
+void r128ShardedCounterAdd(R128ShardedCounter *c, int shard, size_t index, const R128 *v)
+{
+   R128_U64 *seq;
+   R128 *sum;
+   R128_U64 s;
+
+   R128_ASSERT(c != NULL);
+   R128_ASSERT(v != NULL);
+   R128_ASSERT(shard >= 0 && shard < c->shards);
+   R128_ASSERT(index < c->counters);
+
+   seq = R128__SHARD_SEQ(c, shard);
+   sum = R128__SHARD_SUMS(c, shard) + index;
+
+   // odd while the sum is being modified. Only this thread writes seq.
+   s = *seq;
+   R128__STORE_RELAXED(seq, s + 1);
+   R128__FENCE_RELEASE();
+   r128Add(sum, sum, v);
+   R128__STORE_RELEASE(seq, s + 2);
+}
+
+// Copies n sums starting at index from one shard, consistent with each other.
+static void r128__shardSnapshot(R128 *dst, const R128ShardedCounter *c, int shard, size_t index, size_t n)
+{
+   const volatile R128_U64 *sums = (const volatile R128_U64 *)(R128__SHARD_SUMS(c, shard) + index);
+   R128_U64 *seq = R128__SHARD_SEQ(c, shard);
+   R128_U64 s0, s1;
+   size_t i;
+
+   for (;;) {
+      s0 = R128__LOAD_ACQUIRE(seq);
+      if (s0 & 1) {
+         continue;
+      }
+
+      for (i = 0; i < n; ++i) {
+         dst[i].lo = sums[2 * i];
+         dst[i].hi = sums[2 * i + 1];
+      }
+
+      R128__FENCE_ACQUIRE();
+      s1 = *(volatile R128_U64 *)seq;
+      if (s0 == s1) {
+         return;
+      }
+   }
+}
+
+void r128ShardedCounterTotal(R128 *dst, const R128ShardedCounter *c, size_t index)
+{
+   R128 total, part;
+   int shard;
+
+   R128_ASSERT(dst != NULL);
+   R128_ASSERT(c != NULL);
+   R128_ASSERT(index < c->counters);
+
+   r128Copy(&total, &R128_zero);
+   for (shard = 0; shard < c->shards; ++shard) {
+      r128__shardSnapshot(&part, c, shard, index, 1);
+      r128Add(&total, &total, &part);
+   }
+
+   r128Copy(dst, &total);
+}
+
+void r128ShardedCounterTotals(R128 *dst, const R128ShardedCounter *c)
+{
+   R128 part[16];
+   size_t index, i, n;
+   int shard;
+
+   R128_ASSERT(dst != NULL);
+   R128_ASSERT(c != NULL);
+
+   for (index = 0; index < c->counters; ++index) {
+      r128Copy(&dst[index], &R128_zero);
+   }
+
+   // snapshot in small blocks so a busy owner rarely forces a retry
+   for (shard = 0; shard < c->shards; ++shard) {
+      for (index = 0; index < c->counters; index += n) {
+         n = c->counters - index;
+         if (n > sizeof(part) / sizeof(part[0])) {
+            n = sizeof(part) / sizeof(part[0]);
+         }
+
+         r128__shardSnapshot(part, c, shard, index, n);
+         for (i = 0; i < n; ++i) {
+            r128Add(&dst[index + i], &dst[index + i], &part[i]);
+         }
+      }
+   }
+}
+
+void r128ShardedCounterReset(R128ShardedCounter *c)
+{
+   unsigned char *p, *end;
+
+   R128_ASSERT(c != NULL);
+
+   end = c->rows + c->stride * c->shards;
+   for (p = c->rows; p < end; ++p) {
+      *p = 0;
+   }
+}
+
+#undef R128__SHARD_SEQ
+#undef R128__SHARD_SUMS
+
+
+// Control bytes: 0 is empty, 1 is claimed while the key is being written, and
+// 0x80-0xff is a used slot holding the top seven bits of the key's hash. A used
+// byte is published by adding tag - 1 to the claimed byte.
+#define R128__MAP_GROUP 8
+#define R128__MAP_BUSY 1
+#define R128__MAP_BATCH 16
+#define R128__MAP_BYTES R128_LIT_U64(0x0101010101010101)
+#define R128__MAP_LOW7 R128_LIT_U64(0x7f7f7f7f7f7f7f7f)
+
+typedef struct R128__MapSlot {
+   R128 key;
+   R128Atomic value;
+} R128__MapSlot;
+
+#if defined(_MSC_VER)
+#  define R128__CAS64(p, expected, desired) \
+   (_InterlockedCompareExchange64((volatile __int64 *)(p), (__int64)(desired), (__int64)(expected)) == (__int64)(expected))
+#  define R128__FETCH_ADD64(p, v) _InterlockedExchangeAdd64((volatile __int64 *)(p), (__int64)(v))
+#  if defined(_M_IX86) || defined(_M_X64)
+#    define R128__PREFETCH(p) _mm_prefetch((const char *)(p), _MM_HINT_T0)
+#  else
+#    define R128__PREFETCH(p) ((void)(p))
+#  endif
+#else
+#  define R128__CAS64(p, expected, desired) \
+   __atomic_compare_exchange_n(p, &(expected), desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#  define R128__FETCH_ADD64(p, v) __atomic_fetch_add(p, v, __ATOMIC_RELEASE)
+#  define R128__PREFETCH(p) __builtin_prefetch(p)
+#endif
+
+// 0x80 in every byte of word that equals b, and 0 in the others.
+static R128_U64 r128__mapMatch(R128_U64 word, unsigned b)
+{
+   R128_U64 x = word ^ (R128__MAP_BYTES * b);
+   return ~(((x & R128__MAP_LOW7) + R128__MAP_LOW7) | x | R128__MAP_LOW7);
+}
+
+// Index of the lowest byte flagged in a non-zero match mask.
+static unsigned r128__mapFirst(R128_U64 mask)
+{
+   R128_U64 lowest = mask & (~mask + 1);
+   return (unsigned)(((lowest >> 7) * R128_LIT_U64(0x0001020304050607)) >> 56);
+}
+
+static R128_U64 r128__mapFold(R128_U64 a, R128_U64 b)
+{
+   R128 p;
+   r128__umul128(&p, a, b);
+   return p.lo ^ p.hi;
+}
+
+R128_U64 r128MapHash(const R128 *key)
+{
+   R128_U64 x;
+
+   R128_ASSERT(key != NULL);
+
+   x = r128__mapFold(key->lo ^ R128_LIT_U64(0xa0761d6478bd642f), key->hi ^ R128_LIT_U64(0xe7037ed1a0b428db));
+   x ^= key->lo ^ key->hi;
+   return r128__mapFold(x ^ R128_LIT_U64(0x8ebc6af09c88c6e3), R128_LIT_U64(0x589965cc75374cc3));
+}
+
+int r128MapInit(R128Map *m, size_t maxKeys)
+{
+   // the largest capacity whose slots and control words fit in a size_t
+   const size_t maxCapacity = (size_t)-1 / 2 / sizeof(R128__MapSlot);
+   size_t capacity = R128__MAP_GROUP, groups, bytes;
+
+   R128_ASSERT(m != NULL);
+
+   while (capacity / 8 * 7 < maxKeys) {
+      if (capacity > maxCapacity / 2) {
+         m->capacity = 0;
+         m->mem = NULL;
+         m->ctrl = NULL;
+         m->slots = NULL;
+         return 0;
+      }
+      capacity *= 2;
+   }
+   groups = capacity / R128__MAP_GROUP;
+   bytes = groups * sizeof(R128_U64) + capacity * sizeof(R128__MapSlot);
+
+   m->capacity = capacity;
+   m->mem = R128_MALLOC(bytes + R128_CACHE_LINE - 1);
+   if (!m->mem) {
+      m->ctrl = NULL;
+      m->slots = NULL;
+      return 0;
+   }
+
+   memset(m->mem, 0, bytes + R128_CACHE_LINE - 1);
+   // slots first, to keep the accumulators 16-byte aligned
+   m->slots = (R128__MapSlot *)(((size_t)m->mem + R128_CACHE_LINE - 1) & ~(size_t)(R128_CACHE_LINE - 1));
+   m->ctrl = (R128_U64 *)(m->slots + capacity);
+   return 1;
+}
+
+void r128MapFree(R128Map *m)
+{
+   R128_ASSERT(m != NULL);
+
+   R128_FREE(m->mem);
+   m->mem = NULL;
+   m->ctrl = NULL;
+   m->slots = NULL;
+}
+
+size_t r128MapCapacity(const R128Map *m)
+{
+   R128_ASSERT(m != NULL);
+   return m->capacity;
+}
+
+// Probes the groups from hash on. A key being written into a group might be
+// the one we are looking for, so the probe waits for it before going on.
+static size_t r128__mapProbe(R128Map *m, const R128 *key, R128_U64 hash, int insert)
+{
+   size_t mask = m->capacity / R128__MAP_GROUP - 1;
+   size_t group = (size_t)hash & mask;
+   unsigned tag = 0x80 | (unsigned)(hash >> 57);
+   size_t probes;
+
+   for (probes = 0; probes <= mask; ++probes, group = (group + 1) & mask) {
+      R128_U64 *ctrl = &m->ctrl[group];
+
+      for (;;) {
+         R128_U64 word = R128__LOAD_ACQUIRE(ctrl);
+         R128_U64 hits = r128__mapMatch(word, tag);
+         R128_U64 empty;
+
+         for (; hits; hits &= hits - 1) {
+            size_t slot = group * R128__MAP_GROUP + r128__mapFirst(hits);
+            if (m->slots[slot].key.lo == key->lo && m->slots[slot].key.hi == key->hi) {
+               return slot;
+            }
+         }
+
+         if (r128__mapMatch(word, R128__MAP_BUSY)) {
+            continue;
+         }
+
+         empty = r128__mapMatch(word, 0);
+         if (!empty) {
+            break;
+         } else if (!insert) {
+            return R128_MAP_NONE;
+         } else {
+            unsigned shift = r128__mapFirst(empty) * 8;
+            size_t slot = group * R128__MAP_GROUP + shift / 8;
+
+            if (R128__CAS64(ctrl, word, word | ((R128_U64)R128__MAP_BUSY << shift))) {
+               m->slots[slot].key = *key;
+               R128__FETCH_ADD64(ctrl, (R128_U64)(tag - R128__MAP_BUSY) << shift);
+               return slot;
+            }
+         }
+      }
+   }
+
+   return R128_MAP_NONE;
+}
+
+size_t r128MapInsert(R128Map *m, const R128 *key)
+{
+   R128_ASSERT(m != NULL);
+   R128_ASSERT(key != NULL);
+
+   return r128__mapProbe(m, key, r128MapHash(key), 1);
+}
+
+size_t r128MapFind(const R128Map *m, const R128 *key)
+{
+   R128_ASSERT(m != NULL);
+   R128_ASSERT(key != NULL);
+
+   return r128__mapProbe((R128Map *)m, key, r128MapHash(key), 0);
+}
+
+int r128MapKey(const R128Map *m, size_t slot, R128 *key)
+{
+   R128_U64 word;
+
+   R128_ASSERT(m != NULL);
+   R128_ASSERT(key != NULL);
+   R128_ASSERT(slot < m->capacity);
+
+   word = R128__LOAD_ACQUIRE(&m->ctrl[slot / R128__MAP_GROUP]);
+   if (!((word >> (slot % R128__MAP_GROUP * 8)) & 0x80)) {
+      return 0;
+   }
+
+   r128Copy(key, &m->slots[slot].key);
+   return 1;
+}
+
+R128Atomic *r128MapValue(R128Map *m, size_t slot)
+{
+   R128_ASSERT(m != NULL);
+   R128_ASSERT(slot < m->capacity);
+
+   return &m->slots[slot].value;
+}
+
+int r128MapAdd(R128Map *m, const R128 *key, const R128 *v)
+{
+   size_t slot;
+
+   R128_ASSERT(v != NULL);
+
+   slot = r128MapInsert(m, key);
+   if (slot == R128_MAP_NONE) {
+      return 0;
+   }
+
+   r128AtomicFetchAdd(NULL, &m->slots[slot].value, v);
+   return 1;
+}
+
+size_t r128MapAggregate(R128Map *m, const R128 *keys, const R128 *values, size_t n)
+{
+   R128_U64 hash[R128__MAP_BATCH];
+   size_t mask, base, i, count;
+
+   R128_ASSERT(m != NULL);
+   R128_ASSERT(n == 0 || (keys != NULL && values != NULL));
+
+   mask = m->capacity / R128__MAP_GROUP - 1;
+   for (base = 0; base < n; base += count) {
+      count = n - base < R128__MAP_BATCH ? n - base : R128__MAP_BATCH;
+
+      for (i = 0; i < count; ++i) {
+         size_t group;
+
+         hash[i] = r128MapHash(&keys[base + i]);
+         group = (size_t)hash[i] & mask;
+         R128__PREFETCH(&m->ctrl[group]);
+         R128__PREFETCH(&m->slots[group * R128__MAP_GROUP]);
+      }
+
+      for (i = 0; i < count; ++i) {
+         size_t slot = r128__mapProbe(m, &keys[base + i], hash[i], 1);
+         if (slot == R128_MAP_NONE) {
+            return base + i;
+         }
+         r128AtomicFetchAdd(NULL, &m->slots[slot].value, &values[base + i]);
+      }
+   }
+
+   return n;
+}
+
+size_t r128MapCount(const R128Map *m)
+{
+   size_t group, count = 0;
+
+   R128_ASSERT(m != NULL);
+
+   for (group = 0; group < m->capacity / R128__MAP_GROUP; ++group) {
+      R128_U64 used = R128__LOAD_ACQUIRE(&m->ctrl[group]) & (R128__MAP_BYTES << 7);
+      for (; used; used &= used - 1) {
+         ++count;
+      }
+   }
+
+   return count;
+}
+
+#undef R128__MAP_GROUP
+#undef R128__MAP_BUSY
+#undef R128__MAP_BATCH
+#undef R128__MAP_BYTES
+#undef R128__MAP_LOW7
+
+#ifdef R128_TRACE
+#  undef r128Copy
+#  undef r128Add
+#  undef r128Sub
+#  undef r128Min
+#  undef r128Max
+#endif
+
+#endif   //R128_IMPLEMENTATION
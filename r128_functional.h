@@ -0,0 +1,119 @@
+/*
+r128_functional.h: C++ function objects for reducing 128-bit (64.64) values with
+the standard algorithms, including the C++17 parallel ones.
+
+COMPILATION
+-----------
+This is a C++ companion to r128.h. It has no implementation part: include it
+wherever it is needed, and define R128_IMPLEMENTATION in one C or C++ file as
+usual to get the r128.h code.
+
+USAGE
+-----
+In C++11 and later R128 and R128DotAccumulator are trivial types, which the
+parallel algorithms may copy freely and keep in uninitialized storage.
+
+   R128 total = std::reduce(std::execution::par, v.begin(), v.end(), R128_zero, r128::plus());
+   R128 low = std::reduce(std::execution::par, v.begin(), v.end(), R128_max, r128::minimum());
+
+   R128DotAccumulator acc = std::transform_reduce(std::execution::par,
+      price.begin(), price.end(), qty.begin(), r128::dot_init(), r128::dot_plus(), r128::dot_product());
+   R128 notional = r128::dot_result(acc);
+
+plus, minimum, maximum and dot_plus are associative and commutative without
+rounding (addition wraps like unsigned integers), so results equal a serial
+loop whatever the partitioning. The dot product objects sum products exactly and
+round once in dot_result; a transform_reduce with plus and multiplies instead
+rounds every product.
+*/
+
+#ifndef H_R128_FUNCTIONAL_H
+#define H_R128_FUNCTIONAL_H
+
+#ifndef __cplusplus
+#  error "r128_functional.h requires C++"
+#endif
+
+#include "r128.h"
+
+#ifdef R128__CXX11
+#  include <type_traits>
+static_assert(std::is_trivial<R128>::value, "R128 must be trivial");
+static_assert(std::is_trivially_copyable<R128DotAccumulator>::value, "R128DotAccumulator must be trivially copyable");
+#endif
+
+namespace r128 {
+
+struct plus {
+   R128 operator()(const R128 &a, const R128 &b) const
+   {
+      R128 r;
+      r128Add(&r, &a, &b);
+      return r;
+   }
+};
+
+struct multiplies {
+   R128 operator()(const R128 &a, const R128 &b) const
+   {
+      R128 r;
+      r128Mul(&r, &a, &b);
+      return r;
+   }
+};
+
+struct minimum {
+   R128 operator()(const R128 &a, const R128 &b) const
+   {
+      R128 r;
+      r128Min(&r, &a, &b);
+      return r;
+   }
+};
+
+struct maximum {
+   R128 operator()(const R128 &a, const R128 &b) const
+   {
+      R128 r;
+      r128Max(&r, &a, &b);
+      return r;
+   }
+};
+
+// The exact product a * b, as an accumulator.
+struct dot_product {
+   R128DotAccumulator operator()(const R128 &a, const R128 &b) const
+   {
+      R128DotAccumulator acc;
+      r128DotInit(&acc);
+      r128DotAdd(&acc, &a, &b, 1);
+      return acc;
+   }
+};
+
+struct dot_plus {
+   R128DotAccumulator operator()(const R128DotAccumulator &a, const R128DotAccumulator &b) const
+   {
+      R128DotAccumulator r = a;
+      r128DotMerge(&r, &b);
+      return r;
+   }
+};
+
+static inline R128DotAccumulator dot_init()
+{
+   R128DotAccumulator acc;
+   r128DotInit(&acc);
+   return acc;
+}
+
+static inline R128 dot_result(const R128DotAccumulator &acc)
+{
+   R128 r;
+   r128DotResult(&r, &acc);
+   return r;
+}
+
+}  //namespace r128
+
+#endif   //H_R128_FUNCTIONAL_H
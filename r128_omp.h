@@ -0,0 +1,78 @@
+/*
+r128_omp.h: OpenMP reductions for 128-bit (64.64) fixed-point values.
+
+COMPILATION
+-----------
+This is a companion to r128.h. It has no implementation part: include it
+wherever it is needed, after (or instead of) r128.h. The reductions are declared
+only when compiling with OpenMP 4.0 or later (-fopenmp); otherwise the header
+only includes r128.h and the pragmas using them are ignored.
+
+REDUCTIONS
+----------
+r128sum      R128, r128Add; starts at zero
+r128min      R128, r128Min; starts at R128_max
+r128max      R128, r128Max; starts at R128_min
+r128dot      R128DotAccumulator, r128DotMerge; starts empty
+
+   R128 total = R128_zero;
+   #pragma omp parallel for reduction(r128sum: total)
+   for (i = 0; i < n; ++i) {
+      r128Add(&total, &total, &prices[i]);
+   }
+
+r128dot is the wide-accumulator sum: add to it with r128DotAdd, which keeps
+products (or values times R128_one) exactly with 192 integer bits, and round
+once at the end with r128DotResult.
+
+   R128DotAccumulator acc;
+   r128DotInit(&acc);
+   #pragma omp parallel for reduction(r128dot: acc)
+   for (i = 0; i < n; ++i) {
+      r128DotAdd(&acc, &prices[i], &quantities[i], 1);
+   }
+   r128DotResult(&notional, &acc);
+
+All four combine exactly (addition wraps like unsigned integers), so the results
+do not depend on the thread count or the schedule and equal a serial loop.
+
+Per-element calls in the loop body cost a function call each. For whole arrays,
+r128SumArray, r128DotAdd over a chunk, or the r128_parallel.h functions are
+faster; bench/bench_stl compares them.
+*/
+
+#ifndef H_R128_OMP_H
+#define H_R128_OMP_H
+
+#include "r128.h"
+
+#if defined(_OPENMP) && _OPENMP >= 201307
+
+// Initializers may not refer to global variables such as R128_max.
+static __inline void r128__ompMin(R128 *dst)
+{
+   dst->lo = 0;
+   dst->hi = R128_LIT_U64(0x8000000000000000);
+}
+
+static __inline void r128__ompMax(R128 *dst)
+{
+   dst->lo = R128_LIT_U64(0xffffffffffffffff);
+   dst->hi = R128_LIT_U64(0x7fffffffffffffff);
+}
+
+#pragma omp declare reduction(r128sum : R128 : r128Add(&omp_out, &omp_out, &omp_in)) \
+   initializer(r128FromInt(&omp_priv, 0))
+
+#pragma omp declare reduction(r128min : R128 : r128Min(&omp_out, &omp_out, &omp_in)) \
+   initializer(r128__ompMax(&omp_priv))
+
+#pragma omp declare reduction(r128max : R128 : r128Max(&omp_out, &omp_out, &omp_in)) \
+   initializer(r128__ompMin(&omp_priv))
+
+#pragma omp declare reduction(r128dot : R128DotAccumulator : r128DotMerge(&omp_out, &omp_in)) \
+   initializer(r128DotInit(&omp_priv))
+
+#endif   //_OPENMP
+
+#endif   //H_R128_OMP_H
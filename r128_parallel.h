@@ -0,0 +1,1508 @@
+/*
+r128_parallel.h: multithreaded batch operations on 128-bit (64.64) fixed-point
+arrays.
+
+COMPILATION
+-----------
+This is a companion to r128.h and follows the same single-file conventions.
+Include it wherever it is needed. In the ONE file in your project that defines
+R128_IMPLEMENTATION, include this file as well to get the code:
+
+#define R128_IMPLEMENTATION
+#include "r128_parallel.h"
+
+r128.h is included automatically, so it does not need to be included first.
+
+Threads are created with pthreads, or with the Win32 API (Vista or later) on
+Windows. Memory is allocated with R128_MALLOC and R128_FREE, which default to
+malloc and free (see r128.h).
+
+THREAD POOL
+-----------
+r128ParallelFor splits a range of indices into chunks and runs them on a pool
+of worker threads that is created on first use. Each thread starts with an
+equal, contiguous block of chunks and works through it from the front; a thread
+that runs out steals the back half of another thread's remaining block. The
+calling thread takes part, so a pool of N threads starts N - 1 workers.
+
+The pool runs one loop at a time. A loop started while the pool is busy (from
+another thread, or from a task inside a running loop) runs serially on the
+calling thread rather than waiting.
+
+To run loops on an existing scheduler instead (TBB, OpenMP, an application's
+own pool), install it with r128ParallelSetExecutor.
+
+SORTING
+-------
+r128ParallelSortArray and its variants are stable most-significant-digit radix
+sorts on 8-bit digits of the two's-complement key, with the sign bit flipped so
+that unsigned digit order matches signed value order. Each partition step
+starts at the highest digit where the keys actually differ, so the identical
+high bytes of most real-world data cost nothing. Large partition steps count
+and scatter in parallel chunks; the resulting buckets are sorted in parallel.
+
+DETERMINISM
+-----------
+The results of the array functions below are identical to the serial functions
+in r128.h for any thread count, chunk size or executor: elementwise operations
+write each output independently, and reductions are built only from operations
+that are exact and associative. Sums wrap like integer addition; dot products
+are summed in an R128DotAccumulator wide enough that nothing is rounded or lost
+before the single final rounding; min, max and counts combine trivially.
+Histograms count each chunk separately and add the counts up afterwards.
+Partial results are merged in chunk order, though none of them depend on it.
+
+bench/bench_reduce checks this contract against random partitions, thread
+counts and chunk orders.
+*/
+
+#ifndef H_R128_PARALLEL_H
+#define H_R128_PARALLEL_H
+
+#include "r128.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Body of a parallel loop: process indices [begin, end).
+typedef void (*R128ParallelTask)(void *ctx, size_t begin, size_t end);
+
+// r128ParallelFor: run task over [0, n) in chunks of grain indices.
+//
+// Chunk i always covers [i * grain, min(n, (i + 1) * grain)), so tasks can
+// compute their chunk number as begin / grain. If grain is 0, a chunk size is
+// chosen based on n and the thread count.
+//
+// Returns once every chunk has run. Tasks may run on any thread, in any order.
+//
+extern void r128ParallelFor(size_t n, size_t grain, R128ParallelTask task, void *ctx);
+
+// Sets the number of threads used by the built-in pool, including the calling
+// thread. 0 (the default) uses one thread per online processor; 1 runs every
+// loop serially. Stops any existing workers, so it must not be called while a
+// loop is running.
+extern void r128ParallelSetThreads(int threads);
+
+// Returns the number of threads the built-in pool will use.
+extern int r128ParallelGetThreads(void);
+
+// Stops the built-in pool's workers and frees its memory. The pool is created
+// again by the next loop.
+extern void r128ParallelShutdown(void);
+
+// External executor support.
+//
+// An executor receives the number of chunks and must call run(job, i) exactly
+// once for each i in [0, chunks), on any threads and in any order, returning
+// only after all calls have completed. It may be invoked by several threads at
+// once. Pass NULL to go back to the built-in pool.
+//
+typedef void (*R128ParallelChunk)(void *job, size_t chunk);
+typedef void (*R128Executor)(void *executorCtx, size_t chunks, R128ParallelChunk run, void *job);
+extern void r128ParallelSetExecutor(R128Executor executor, void *executorCtx);
+
+// Parallel versions of the array operations in r128.h, with the same arguments
+// and results.
+extern void r128ParallelAddArray(R128 *dst, const R128 *a, const R128 *b, size_t n);
+extern void r128ParallelSubArray(R128 *dst, const R128 *a, const R128 *b, size_t n);
+extern void r128ParallelMulArray(R128 *dst, const R128 *a, const R128 *b, size_t n);
+extern void r128ParallelDivArray(R128 *dst, const R128 *a, const R128 *b, size_t n);
+extern void r128ParallelFromFloatArray(R128 *dst, const double *src, size_t n);
+extern void r128ParallelToFloatArray(double *dst, const R128 *src, size_t n);
+extern void r128ParallelFromStringArray(R128 *dst, const char *const *src, size_t n);
+extern void r128ParallelToStringArray(char *dst, size_t dstStride, const R128 *src, size_t n);
+extern void r128ParallelSumArray(R128 *dst, const R128 *src, size_t n);
+
+// Parallel reductions, bit-identical to the serial ones in r128.h for any
+// thread count, chunking or executor (see DETERMINISM above).
+// r128ParallelDotAdd adds the products to an accumulator, like r128DotAdd.
+extern void r128ParallelMinArray(R128 *dst, const R128 *src, size_t n);
+extern void r128ParallelMaxArray(R128 *dst, const R128 *src, size_t n);
+extern size_t r128ParallelCountArray(const R128 *src, size_t n, const R128 *lo, const R128 *hi);
+extern void r128ParallelDotArray(R128 *dst, const R128 *a, const R128 *b, size_t n);
+extern void r128ParallelDotAdd(R128DotAccumulator *acc, const R128 *a, const R128 *b, size_t n);
+
+// Parallel prefix sums, bit-identical to r128InclusiveScanArray and
+// r128ExclusiveScanArray, including the overflow result. Uses two passes over
+// src: one to sum each chunk, and one to scan each chunk starting from the sum
+// of the chunks before it.
+extern int r128ParallelInclusiveScanArray(R128 *dst, const R128 *src, size_t n, const R128 *init);
+extern int r128ParallelExclusiveScanArray(R128 *dst, const R128 *src, size_t n, const R128 *init);
+
+// Sorting
+//
+// Each function sorts in ascending order, keeping equal keys in their original
+// order. They allocate temporary memory of two to three times the size of the
+// keys (plus a copy of the payload), and return zero, leaving their outputs
+// unchanged, if it cannot be allocated.
+//
+// r128ParallelSortArray: sorts keys in place.
+extern int r128ParallelSortArray(R128 *keys, size_t n);
+
+// r128ParallelSortIndex: leaves keys unchanged and fills index with the
+// permutation that sorts them, so keys[index[0]] is the smallest key.
+extern int r128ParallelSortIndex(size_t *index, const R128 *keys, size_t n);
+
+// r128ParallelSortArrayPayload: sorts keys in place and moves the payloadSize
+// byte element payload[i] along with keys[i].
+extern int r128ParallelSortArrayPayload(R128 *keys, void *payload, size_t payloadSize, size_t n);
+
+// r128ParallelHistogramArray: r128HistogramArray across threads. Each chunk of
+// src is counted into its own sub-histogram and the sub-histograms are summed
+// into counts, so the result is identical to the serial function. Returns zero,
+// leaving counts unchanged, if the sub-histograms cannot be allocated.
+extern int r128ParallelHistogramArray(R128_U64 *counts, const R128Histogram *h, const R128 *src, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif   //H_R128_PARALLEL_H
+
+#if defined(R128_IMPLEMENTATION) && !defined(H_R128_PARALLEL_IMPLEMENTATION)
+#define H_R128_PARALLEL_IMPLEMENTATION
+
+#ifdef R128_TRACE
+// Call the non-recording implementations (see r128.h), so that a trace holds
+// only the caller's own calls.
+#  define r128Copy r128__traceCopy
+#  define r128AddArray r128__traceAddArray
+#  define r128SubArray r128__traceSubArray
+#  define r128MulArray r128__traceMulArray
+#  define r128DivArray r128__traceDivArray
+#  define r128FromFloatArray r128__traceFromFloatArray
+#  define r128ToFloatArray r128__traceToFloatArray
+#  define r128FromStringArray r128__traceFromStringArray
+#  define r128ToStringArray r128__traceToStringArray
+#endif
+
+#include <string.h>  // for memcpy
+
+// Chunk sizes used by the array functions, roughly 10-50us of work each.
+#define R128__GRAIN_ADD    16384
+#define R128__GRAIN_MUL    4096
+#define R128__GRAIN_DIV    1024
+#define R128__GRAIN_STRING 512
+
+// Threads, locks and the few atomic operations the pool needs.
+#if defined(_WIN32)
+#  ifndef WIN32_LEAN_AND_MEAN
+#    define WIN32_LEAN_AND_MEAN
+#  endif
+#  include <windows.h>
+#  include <intrin.h>
+
+typedef HANDLE r128__thread;
+typedef SRWLOCK r128__mutex;
+typedef CONDITION_VARIABLE r128__cond;
+
+static DWORD WINAPI r128__threadStart(LPVOID arg);
+
+static int r128__threadCreate(r128__thread *t, void *arg)
+{
+   *t = CreateThread(NULL, 0, r128__threadStart, arg, 0, NULL);
+   return *t != NULL;
+}
+
+static void r128__threadJoin(r128__thread t)
+{
+   WaitForSingleObject(t, INFINITE);
+   CloseHandle(t);
+}
+
+static void r128__mutexInit(r128__mutex *m) { InitializeSRWLock(m); }
+static void r128__mutexDestroy(r128__mutex *m) { (void)m; }
+static void r128__mutexLock(r128__mutex *m) { AcquireSRWLockExclusive(m); }
+static void r128__mutexUnlock(r128__mutex *m) { ReleaseSRWLockExclusive(m); }
+static void r128__condInit(r128__cond *c) { InitializeConditionVariable(c); }
+static void r128__condDestroy(r128__cond *c) { (void)c; }
+static void r128__condWait(r128__cond *c, r128__mutex *m) { SleepConditionVariableSRW(c, m, INFINITE, 0); }
+static void r128__condBroadcast(r128__cond *c) { WakeAllConditionVariable(c); }
+
+static int r128__processorCount(void)
+{
+   SYSTEM_INFO info;
+   GetSystemInfo(&info);
+   return (int)info.dwNumberOfProcessors;
+}
+
+static R128_U64 r128__load64(volatile R128_U64 *p)
+{
+   return (R128_U64)_InterlockedCompareExchange64((volatile __int64 *)p, 0, 0);
+}
+
+static int r128__cas64(volatile R128_U64 *p, R128_U64 expected, R128_U64 desired)
+{
+   return (R128_U64)_InterlockedCompareExchange64((volatile __int64 *)p, (__int64)desired, (__int64)expected) == expected;
+}
+
+// _InterlockedExchange64 is not an intrinsic on 32-bit x86
+static void r128__store64(volatile R128_U64 *p, R128_U64 v)
+{
+   R128_U64 old;
+   do {
+      old = r128__load64(p);
+   } while (!r128__cas64(p, old, v));
+}
+
+static long r128__exchange(volatile long *p, long v)
+{
+   return _InterlockedExchange(p, v);
+}
+#else
+#  include <pthread.h>
+#  include <unistd.h>
+
+typedef pthread_t r128__thread;
+typedef pthread_mutex_t r128__mutex;
+typedef pthread_cond_t r128__cond;
+
+static void *r128__threadStart(void *arg);
+
+static int r128__threadCreate(r128__thread *t, void *arg)
+{
+   return pthread_create(t, NULL, r128__threadStart, arg) == 0;
+}
+
+static void r128__threadJoin(r128__thread t)
+{
+   pthread_join(t, NULL);
+}
+
+static void r128__mutexInit(r128__mutex *m) { pthread_mutex_init(m, NULL); }
+static void r128__mutexDestroy(r128__mutex *m) { pthread_mutex_destroy(m); }
+static void r128__mutexLock(r128__mutex *m) { pthread_mutex_lock(m); }
+static void r128__mutexUnlock(r128__mutex *m) { pthread_mutex_unlock(m); }
+static void r128__condInit(r128__cond *c) { pthread_cond_init(c, NULL); }
+static void r128__condDestroy(r128__cond *c) { pthread_cond_destroy(c); }
+static void r128__condWait(r128__cond *c, r128__mutex *m) { pthread_cond_wait(c, m); }
+static void r128__condBroadcast(r128__cond *c) { pthread_cond_broadcast(c); }
+
+static int r128__processorCount(void)
+{
+   long n = sysconf(_SC_NPROCESSORS_ONLN);
+   return n > 0 ? (int)n : 1;
+}
+
+static R128_U64 r128__load64(volatile R128_U64 *p)
+{
+   return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void r128__store64(volatile R128_U64 *p, R128_U64 v)
+{
+   __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static int r128__cas64(volatile R128_U64 *p, R128_U64 expected, R128_U64 desired)
+{
+   return __atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static long r128__exchange(volatile long *p, long v)
+{
+   return __atomic_exchange_n(p, v, __ATOMIC_ACQ_REL);
+}
+#endif   //_WIN32
+
+// A participant's remaining chunks, packed as begin | (end << 32) so both ends
+// can be updated with one compare-and-swap. Padded to avoid false sharing.
+typedef struct R128__Range {
+   volatile R128_U64 packed;
+   char pad[R128_CACHE_LINE - sizeof(R128_U64)];
+} R128__Range;
+
+#define R128__RANGE(begin, end) ((R128_U64)(begin) | ((R128_U64)(end) << 32))
+#define R128__RANGE_BEGIN(r) ((R128_U32)(r))
+#define R128__RANGE_END(r) ((R128_U32)((r) >> 32))
+#define R128__MAX_CHUNKS 0x7fffffff
+
+typedef struct R128__Job {
+   size_t n;
+   size_t grain;
+   size_t chunks;
+   R128ParallelTask task;
+   void *ctx;
+} R128__Job;
+
+typedef struct R128__Worker {
+   struct R128__Pool *pool;
+   int index;
+   r128__thread thread;
+} R128__Worker;
+
+typedef struct R128__Pool {
+   int threads;               // participants, including the calling thread
+   R128__Worker *workers;     // threads - 1 entries
+   R128__Range *ranges;       // threads entries
+   void *rangeMem;
+
+   r128__mutex lock;          // guards the fields below
+   r128__cond wake;
+   r128__cond done;
+   unsigned generation;       // incremented for each loop
+   int pending;               // workers still running the current loop
+   int shutdown;
+   R128__Job *job;
+} R128__Pool;
+
+static R128__Pool *r128__pool;
+static volatile long r128__poolBusy;
+static int r128__poolThreads;
+static R128Executor r128__executor;
+static void *r128__executorCtx;
+
+static void r128__runChunk(void *job, size_t chunk)
+{
+   R128__Job *j = (R128__Job *)job;
+   size_t begin = chunk * j->grain;
+   size_t end = begin + j->grain;
+
+   if (end > j->n) {
+      end = j->n;
+   }
+   j->task(j->ctx, begin, end);
+}
+
+static void r128__runSerial(R128__Job *job)
+{
+   size_t i;
+
+   for (i = 0; i < job->chunks; ++i) {
+      r128__runChunk(job, i);
+   }
+}
+
+// Runs the caller's own chunks, then steals from the others until no work is
+// left anywhere. Stolen chunks are taken off the victim before they are added
+// to our own range, so each chunk runs exactly once.
+static void r128__participate(R128__Pool *pool, R128__Job *job, int self)
+{
+   volatile R128_U64 *own = &pool->ranges[self].packed;
+   int victim, i;
+
+   for (;;) {
+      R128_U64 r = r128__load64(own);
+      R128_U32 begin = R128__RANGE_BEGIN(r);
+      R128_U32 end = R128__RANGE_END(r);
+
+      if (begin < end) {
+         if (r128__cas64(own, r, R128__RANGE(begin + 1, end))) {
+            r128__runChunk(job, begin);
+         }
+         continue;
+      }
+
+      for (i = 1; i < pool->threads; ++i) {
+         victim = (self + i) % pool->threads;
+         for (;;) {
+            R128_U64 v = r128__load64(&pool->ranges[victim].packed);
+            R128_U32 vb = R128__RANGE_BEGIN(v);
+            R128_U32 ve = R128__RANGE_END(v);
+            R128_U32 split = vb + (ve - vb) / 2;
+
+            if (vb >= ve) {
+               break;
+            }
+            if (r128__cas64(&pool->ranges[victim].packed, v, R128__RANGE(vb, split))) {
+               r128__store64(own, R128__RANGE(split, ve));
+               goto stolen;
+            }
+         }
+      }
+
+      return;
+   stolen:;
+   }
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI r128__threadStart(LPVOID arg)
+#else
+static void *r128__threadStart(void *arg)
+#endif
+{
+   R128__Worker *worker = (R128__Worker *)arg;
+   R128__Pool *pool = worker->pool;
+   unsigned seen;
+
+   // pools start at generation 0, and workers are started before any loop is posted
+   seen = 0;
+
+   r128__mutexLock(&pool->lock);
+   for (;;) {
+      R128__Job *job;
+
+      while (pool->generation == seen && !pool->shutdown) {
+         r128__condWait(&pool->wake, &pool->lock);
+      }
+      if (pool->shutdown) {
+         break;
+      }
+
+      seen = pool->generation;
+      job = pool->job;
+      r128__mutexUnlock(&pool->lock);
+
+      r128__participate(pool, job, worker->index);
+
+      r128__mutexLock(&pool->lock);
+      if (--pool->pending == 0) {
+         r128__condBroadcast(&pool->done);
+      }
+   }
+   r128__mutexUnlock(&pool->lock);
+
+   return 0;
+}
+
+static void r128__poolDestroy(R128__Pool *pool)
+{
+   int i;
+
+   r128__mutexLock(&pool->lock);
+   pool->shutdown = 1;
+   r128__condBroadcast(&pool->wake);
+   r128__mutexUnlock(&pool->lock);
+
+   for (i = 0; i < pool->threads - 1; ++i) {
+      r128__threadJoin(pool->workers[i].thread);
+   }
+
+   r128__condDestroy(&pool->done);
+   r128__condDestroy(&pool->wake);
+   r128__mutexDestroy(&pool->lock);
+   R128_FREE(pool->rangeMem);
+   R128_FREE(pool->workers);
+   R128_FREE(pool);
+}
+
+// Returns NULL if the pool could not be created; loops then run serially.
+static R128__Pool *r128__poolCreate(int threads)
+{
+   R128__Pool *pool;
+   int i;
+
+   pool = (R128__Pool *)R128_MALLOC(sizeof(R128__Pool));
+   if (!pool) {
+      return NULL;
+   }
+
+   pool->workers = (R128__Worker *)R128_MALLOC(sizeof(R128__Worker) * threads);
+   pool->rangeMem = R128_MALLOC(sizeof(R128__Range) * (threads + 1));
+   if (!pool->workers || !pool->rangeMem) {
+      R128_FREE(pool->workers);
+      R128_FREE(pool->rangeMem);
+      R128_FREE(pool);
+      return NULL;
+   }
+
+   pool->ranges = (R128__Range *)(((size_t)pool->rangeMem + R128_CACHE_LINE - 1) & ~(size_t)(R128_CACHE_LINE - 1));
+   pool->threads = 1;
+   pool->generation = 0;
+   pool->pending = 0;
+   pool->shutdown = 0;
+   pool->job = NULL;
+   r128__mutexInit(&pool->lock);
+   r128__condInit(&pool->wake);
+   r128__condInit(&pool->done);
+
+   // count threads as they start so a partial failure still shuts down cleanly
+   for (i = 0; i < threads - 1; ++i) {
+      pool->workers[i].pool = pool;
+      pool->workers[i].index = i + 1;
+      if (!r128__threadCreate(&pool->workers[i].thread, &pool->workers[i])) {
+         break;
+      }
+      ++pool->threads;
+   }
+
+   return pool;
+}
+
+void r128ParallelFor(size_t n, size_t grain, R128ParallelTask task, void *ctx)
+{
+   R128__Job job;
+   R128__Pool *pool;
+   size_t i;
+
+   R128_ASSERT(task != NULL);
+
+   if (n == 0) {
+      return;
+   }
+
+   if (grain == 0) {
+      grain = n / ((size_t)r128ParallelGetThreads() * 8);
+      if (grain < 256) {
+         grain = 256;
+      }
+   }
+   if ((n - 1) / grain >= R128__MAX_CHUNKS) {
+      grain = (n - 1) / (R128__MAX_CHUNKS - 1) + 1;
+   }
+
+   job.n = n;
+   job.grain = grain;
+   job.chunks = (n - 1) / grain + 1;
+   job.task = task;
+   job.ctx = ctx;
+
+   if (r128__executor) {
+      r128__executor(r128__executorCtx, job.chunks, r128__runChunk, &job);
+      return;
+   }
+
+   if (job.chunks == 1 || r128ParallelGetThreads() == 1 || r128__exchange(&r128__poolBusy, 1)) {
+      r128__runSerial(&job);
+      return;
+   }
+
+   if (!r128__pool) {
+      r128__pool = r128__poolCreate(r128ParallelGetThreads());
+   }
+   pool = r128__pool;
+   if (!pool || pool->threads == 1) {
+      r128__runSerial(&job);
+      r128__exchange(&r128__poolBusy, 0);
+      return;
+   }
+
+   for (i = 0; i < (size_t)pool->threads; ++i) {
+      size_t begin = job.chunks * i / pool->threads;
+      size_t end = job.chunks * (i + 1) / pool->threads;
+      pool->ranges[i].packed = R128__RANGE(begin, end);
+   }
+
+   r128__mutexLock(&pool->lock);
+   pool->job = &job;
+   pool->pending = pool->threads - 1;
+   ++pool->generation;
+   r128__condBroadcast(&pool->wake);
+   r128__mutexUnlock(&pool->lock);
+
+   r128__participate(pool, &job, 0);
+
+   r128__mutexLock(&pool->lock);
+   while (pool->pending) {
+      r128__condWait(&pool->done, &pool->lock);
+   }
+   pool->job = NULL;
+   r128__mutexUnlock(&pool->lock);
+
+   r128__exchange(&r128__poolBusy, 0);
+}
+
+void r128ParallelSetThreads(int threads)
+{
+   R128_ASSERT(threads >= 0);
+
+   r128ParallelShutdown();
+   r128__poolThreads = threads;
+}
+
+int r128ParallelGetThreads(void)
+{
+   if (r128__poolThreads > 0) {
+      return r128__poolThreads;
+   }
+   return r128__processorCount();
+}
+
+void r128ParallelShutdown(void)
+{
+   if (r128__pool) {
+      r128__poolDestroy(r128__pool);
+      r128__pool = NULL;
+   }
+}
+
+void r128ParallelSetExecutor(R128Executor executor, void *executorCtx)
+{
+   r128__executor = executor;
+   r128__executorCtx = executorCtx;
+}
+
+// Elementwise binary operations, split into chunks of the serial kernel.
+typedef struct R128__BinaryJob {
+   R128 *dst;
+   const R128 *a;
+   const R128 *b;
+   void (*op)(R128 *dst, const R128 *a, const R128 *b, size_t n);
+} R128__BinaryJob;
+
+static void r128__binaryTask(void *ctx, size_t begin, size_t end)
+{
+   R128__BinaryJob *job = (R128__BinaryJob *)ctx;
+   job->op(job->dst + begin, job->a + begin, job->b + begin, end - begin);
+}
+
+static void r128__parallelBinary(R128 *dst, const R128 *a, const R128 *b, size_t n, size_t grain,
+   void (*op)(R128 *dst, const R128 *a, const R128 *b, size_t n))
+{
+   R128__BinaryJob job;
+
+   R128_ASSERT(n == 0 || (dst != NULL && a != NULL && b != NULL));
+
+   job.dst = dst;
+   job.a = a;
+   job.b = b;
+   job.op = op;
+
+   // pick the array kernels here, not in the first worker to get there
+   r128CpuGet();
+   r128ParallelFor(n, grain, r128__binaryTask, &job);
+}
+
+void r128ParallelAddArray(R128 *dst, const R128 *a, const R128 *b, size_t n)
+{
+   r128__parallelBinary(dst, a, b, n, R128__GRAIN_ADD, r128AddArray);
+}
+
+void r128ParallelSubArray(R128 *dst, const R128 *a, const R128 *b, size_t n)
+{
+   r128__parallelBinary(dst, a, b, n, R128__GRAIN_ADD, r128SubArray);
+}
+
+void r128ParallelMulArray(R128 *dst, const R128 *a, const R128 *b, size_t n)
+{
+   r128__parallelBinary(dst, a, b, n, R128__GRAIN_MUL, r128MulArray);
+}
+
+void r128ParallelDivArray(R128 *dst, const R128 *a, const R128 *b, size_t n)
+{
+   r128__parallelBinary(dst, a, b, n, R128__GRAIN_DIV, r128DivArray);
+}
+
+// Conversions. The job carries untyped pointers and element sizes so one task
+// can slice any of them.
+typedef struct R128__ConvertJob {
+   void *dst;
+   const void *src;
+   size_t dstSize;
+   size_t srcSize;
+   void (*op)(void *dst, const void *src, size_t n);
+} R128__ConvertJob;
+
+static void r128__convertTask(void *ctx, size_t begin, size_t end)
+{
+   R128__ConvertJob *job = (R128__ConvertJob *)ctx;
+   job->op((char *)job->dst + begin * job->dstSize, (const char *)job->src + begin * job->srcSize, end - begin);
+}
+
+static void r128__fromFloatOp(void *dst, const void *src, size_t n)
+{
+   r128FromFloatArray((R128 *)dst, (const double *)src, n);
+}
+
+static void r128__toFloatOp(void *dst, const void *src, size_t n)
+{
+   r128ToFloatArray((double *)dst, (const R128 *)src, n);
+}
+
+static void r128__fromStringOp(void *dst, const void *src, size_t n)
+{
+   r128FromStringArray((R128 *)dst, (const char *const *)src, n);
+}
+
+static void r128__parallelConvert(void *dst, size_t dstSize, const void *src, size_t srcSize, size_t n,
+   size_t grain, void (*op)(void *dst, const void *src, size_t n))
+{
+   R128__ConvertJob job;
+
+   R128_ASSERT(n == 0 || (dst != NULL && src != NULL));
+
+   job.dst = dst;
+   job.src = src;
+   job.dstSize = dstSize;
+   job.srcSize = srcSize;
+   job.op = op;
+   r128ParallelFor(n, grain, r128__convertTask, &job);
+}
+
+void r128ParallelFromFloatArray(R128 *dst, const double *src, size_t n)
+{
+   r128__parallelConvert(dst, sizeof(R128), src, sizeof(double), n, R128__GRAIN_MUL, r128__fromFloatOp);
+}
+
+void r128ParallelToFloatArray(double *dst, const R128 *src, size_t n)
+{
+   r128__parallelConvert(dst, sizeof(double), src, sizeof(R128), n, R128__GRAIN_MUL, r128__toFloatOp);
+}
+
+void r128ParallelFromStringArray(R128 *dst, const char *const *src, size_t n)
+{
+   r128__parallelConvert(dst, sizeof(R128), src, sizeof(const char *), n, R128__GRAIN_STRING, r128__fromStringOp);
+}
+
+typedef struct R128__ToStringJob {
+   char *dst;
+   size_t dstStride;
+   const R128 *src;
+} R128__ToStringJob;
+
+static void r128__toStringTask(void *ctx, size_t begin, size_t end)
+{
+   R128__ToStringJob *job = (R128__ToStringJob *)ctx;
+   r128ToStringArray(job->dst + begin * job->dstStride, job->dstStride, job->src + begin, end - begin);
+}
+
+void r128ParallelToStringArray(char *dst, size_t dstStride, const R128 *src, size_t n)
+{
+   R128__ToStringJob job;
+
+   R128_ASSERT(n == 0 || (dst != NULL && dstStride > 0 && src != NULL));
+
+   job.dst = dst;
+   job.dstStride = dstStride;
+   job.src = src;
+   r128ParallelFor(n, R128__GRAIN_STRING, r128__toStringTask, &job);
+}
+
+// Sums are computed per chunk and combined in chunk order. The chunk count is
+// capped so the partial sums fit on the stack.
+#define R128__SUM_CHUNKS 256
+
+typedef struct R128__SumJob {
+   const R128 *src;
+   size_t grain;
+   R128 partial[R128__SUM_CHUNKS];
+} R128__SumJob;
+
+static void r128__sumTask(void *ctx, size_t begin, size_t end)
+{
+   R128__SumJob *job = (R128__SumJob *)ctx;
+   r128SumArray(&job->partial[begin / job->grain], job->src + begin, end - begin);
+}
+
+// Chunk size for a reduction over n elements: at most R128__SUM_CHUNKS chunks,
+// each at least minGrain elements. Stores the number of chunks in chunks.
+static size_t r128__reduceGrain(size_t n, size_t minGrain, size_t *chunks)
+{
+   size_t grain = (n + R128__SUM_CHUNKS - 1) / R128__SUM_CHUNKS;
+   if (grain < minGrain) {
+      grain = minGrain;
+   }
+   *chunks = n ? (n - 1) / grain + 1 : 0;
+   return grain;
+}
+
+void r128ParallelSumArray(R128 *dst, const R128 *src, size_t n)
+{
+   R128__SumJob job;
+   size_t chunks;
+
+   R128_ASSERT(dst != NULL);
+   R128_ASSERT(n == 0 || src != NULL);
+
+   job.src = src;
+   job.grain = r128__reduceGrain(n, R128__GRAIN_ADD, &chunks);
+
+   r128ParallelFor(n, job.grain, r128__sumTask, &job);
+   r128SumArray(dst, job.partial, chunks);
+}
+
+typedef struct R128__ReduceJob {
+   const R128 *a;
+   const R128 *b;
+   const R128 *lo;
+   const R128 *hi;
+   size_t grain;
+   int max;
+   R128 value[R128__SUM_CHUNKS];   // outside the union: R128 is not trivial in C++
+   union {
+      size_t count[R128__SUM_CHUNKS];
+      R128DotAccumulator dot[R128__SUM_CHUNKS];
+   } partial;
+} R128__ReduceJob;
+
+static void r128__minMaxTask(void *ctx, size_t begin, size_t end)
+{
+   R128__ReduceJob *job = (R128__ReduceJob *)ctx;
+   R128 *dst = &job->value[begin / job->grain];
+
+   if (job->max) {
+      r128MaxArray(dst, job->a + begin, end - begin);
+   } else {
+      r128MinArray(dst, job->a + begin, end - begin);
+   }
+}
+
+static void r128__countTask(void *ctx, size_t begin, size_t end)
+{
+   R128__ReduceJob *job = (R128__ReduceJob *)ctx;
+   job->partial.count[begin / job->grain] = r128CountArray(job->a + begin, end - begin, job->lo, job->hi);
+}
+
+static void r128__dotTask(void *ctx, size_t begin, size_t end)
+{
+   R128__ReduceJob *job = (R128__ReduceJob *)ctx;
+   R128DotAccumulator *acc = &job->partial.dot[begin / job->grain];
+
+   r128DotInit(acc);
+   r128DotAdd(acc, job->a + begin, job->b + begin, end - begin);
+}
+
+static void r128__parallelMinMax(R128 *dst, const R128 *src, size_t n, int max)
+{
+   R128__ReduceJob job;
+   size_t chunks;
+
+   R128_ASSERT(dst != NULL);
+   R128_ASSERT(n == 0 || src != NULL);
+
+   job.a = src;
+   job.max = max;
+   job.grain = r128__reduceGrain(n, R128__GRAIN_ADD, &chunks);
+
+   r128ParallelFor(n, job.grain, r128__minMaxTask, &job);
+   if (max) {
+      r128MaxArray(dst, job.value, chunks);
+   } else {
+      r128MinArray(dst, job.value, chunks);
+   }
+}
+
+void r128ParallelMinArray(R128 *dst, const R128 *src, size_t n)
+{
+   r128__parallelMinMax(dst, src, n, 0);
+}
+
+void r128ParallelMaxArray(R128 *dst, const R128 *src, size_t n)
+{
+   r128__parallelMinMax(dst, src, n, 1);
+}
+
+size_t r128ParallelCountArray(const R128 *src, size_t n, const R128 *lo, const R128 *hi)
+{
+   R128__ReduceJob job;
+   size_t chunks, i, count = 0;
+
+   R128_ASSERT(n == 0 || src != NULL);
+
+   job.a = src;
+   job.lo = lo;
+   job.hi = hi;
+   job.grain = r128__reduceGrain(n, R128__GRAIN_ADD, &chunks);
+
+   r128ParallelFor(n, job.grain, r128__countTask, &job);
+   for (i = 0; i < chunks; ++i) {
+      count += job.partial.count[i];
+   }
+   return count;
+}
+
+void r128ParallelDotAdd(R128DotAccumulator *acc, const R128 *a, const R128 *b, size_t n)
+{
+   R128__ReduceJob job;
+   size_t chunks, i;
+
+   R128_ASSERT(acc != NULL);
+   R128_ASSERT(n == 0 || (a != NULL && b != NULL));
+
+   job.a = a;
+   job.b = b;
+   job.grain = r128__reduceGrain(n, R128__GRAIN_MUL, &chunks);
+
+   r128ParallelFor(n, job.grain, r128__dotTask, &job);
+   for (i = 0; i < chunks; ++i) {
+      r128DotMerge(acc, &job.partial.dot[i]);
+   }
+}
+
+void r128ParallelDotArray(R128 *dst, const R128 *a, const R128 *b, size_t n)
+{
+   R128DotAccumulator acc;
+
+   r128DotInit(&acc);
+   r128ParallelDotAdd(&acc, a, b, n);
+   r128DotResult(dst, &acc);
+}
+
+typedef struct R128__ScanJob {
+   R128 *dst;
+   const R128 *src;
+   size_t grain;
+   int inclusive;
+   R128 offset[R128__SUM_CHUNKS];
+   int overflow[R128__SUM_CHUNKS];
+} R128__ScanJob;
+
+static void r128__scanSumTask(void *ctx, size_t begin, size_t end)
+{
+   R128__ScanJob *job = (R128__ScanJob *)ctx;
+   r128SumArray(&job->offset[begin / job->grain], job->src + begin, end - begin);
+}
+
+static void r128__scanTask(void *ctx, size_t begin, size_t end)
+{
+   R128__ScanJob *job = (R128__ScanJob *)ctx;
+   size_t chunk = begin / job->grain;
+
+   if (job->inclusive) {
+      job->overflow[chunk] = r128InclusiveScanArray(job->dst + begin, job->src + begin, end - begin, &job->offset[chunk]);
+   } else {
+      job->overflow[chunk] = r128ExclusiveScanArray(job->dst + begin, job->src + begin, end - begin, &job->offset[chunk]);
+   }
+}
+
+static int r128__parallelScan(R128 *dst, const R128 *src, size_t n, const R128 *init, int inclusive)
+{
+   R128__ScanJob job;
+   size_t chunks, i;
+   int overflow = 0;
+
+   R128_ASSERT(n == 0 || (dst != NULL && src != NULL));
+
+   job.dst = dst;
+   job.src = src;
+   job.inclusive = inclusive;
+   job.grain = (n + R128__SUM_CHUNKS - 1) / R128__SUM_CHUNKS;
+   if (job.grain < R128__GRAIN_ADD) {
+      job.grain = R128__GRAIN_ADD;
+   }
+   chunks = n ? (n - 1) / job.grain + 1 : 0;
+
+   if (chunks <= 1) {
+      if (inclusive) {
+         return r128InclusiveScanArray(dst, src, n, init);
+      } else {
+         return r128ExclusiveScanArray(dst, src, n, init);
+      }
+   }
+
+   // pass 1: chunk sums, turned into each chunk's starting value. The last
+   // chunk's sum is never needed.
+   r128ParallelFor(n - (n - 1) % job.grain - 1, job.grain, r128__scanSumTask, &job);
+   r128Copy(&job.offset[chunks - 1], &R128_zero);
+   r128ExclusiveScanArray(job.offset, job.offset, chunks, init);
+
+   // pass 2: scan each chunk from its starting value
+   r128ParallelFor(n, job.grain, r128__scanTask, &job);
+
+   for (i = 0; i < chunks; ++i) {
+      overflow |= job.overflow[i];
+   }
+   return overflow;
+}
+
+int r128ParallelInclusiveScanArray(R128 *dst, const R128 *src, size_t n, const R128 *init)
+{
+   return r128__parallelScan(dst, src, n, init, 1);
+}
+
+int r128ParallelExclusiveScanArray(R128 *dst, const R128 *src, size_t n, const R128 *init)
+{
+   return r128__parallelScan(dst, src, n, init, 0);
+}
+
+// Radix sort: most-significant-digit first on 8-bit digits. Each partition
+// step finds the highest digit at which the keys actually differ, so runs of
+// identical high bytes cost nothing, then scatters stably into 256 buckets and
+// recurses into each bucket, finishing small buckets with insertion sort.
+// Scatters alternate between the key array and the scratch array; toTmp says
+// which one the sorted result has to end up in.
+#define R128__SORT_BUCKETS 256
+#define R128__SORT_SMALL 32
+#define R128__SORT_PARALLEL 65536
+#define R128__SORT_MAX_CHUNKS 64
+
+static unsigned r128__sortByte(R128_U64 lo, R128_U64 hi, int digit)
+{
+   R128_U64 w = digit < 8 ? lo : hi;
+   return (unsigned)(w >> ((digit & 7) * 8)) & (R128__SORT_BUCKETS - 1);
+}
+
+static unsigned r128__sortDigit(const R128 *key, int digit)
+{
+   return r128__sortByte(key->lo, key->hi ^ R128_LIT_U64(0x8000000000000000), digit);
+}
+
+// Highest digit that is non-zero in diff, or -1.
+static int r128__sortTopDigit(R128_U64 diffLo, R128_U64 diffHi)
+{
+   int digit;
+
+   for (digit = 15; digit >= 0; --digit) {
+      if (r128__sortByte(diffLo, diffHi, digit)) {
+         break;
+      }
+   }
+   return digit;
+}
+
+static int r128__sortLess(const R128 *a, const R128 *b)
+{
+   if (a->hi != b->hi) {
+      return (R128_S64)a->hi < (R128_S64)b->hi;
+   }
+   return a->lo < b->lo;
+}
+
+static void r128__sortCopy(R128 *dst, size_t *dstIndex, const R128 *src, const size_t *srcIndex, size_t n)
+{
+   memcpy(dst, src, sizeof(R128) * n);
+   if (srcIndex) {
+      memcpy(dstIndex, srcIndex, sizeof(size_t) * n);
+   }
+}
+
+static void r128__insertionSort(R128 *keys, size_t *index, size_t n)
+{
+   size_t i, j, x = 0;
+
+   for (i = 1; i < n; ++i) {
+      R128 k = keys[i];
+      if (index) {
+         x = index[i];
+      }
+
+      for (j = i; j > 0 && r128__sortLess(&k, &keys[j - 1]); --j) {
+         keys[j] = keys[j - 1];
+         if (index) {
+            index[j] = index[j - 1];
+         }
+      }
+
+      keys[j] = k;
+      if (index) {
+         index[j] = x;
+      }
+   }
+}
+
+static void r128__sortScatter(R128 *dst, size_t *dstIndex, const R128 *src, const size_t *srcIndex,
+   size_t n, int digit, size_t *offsets)
+{
+   size_t i;
+
+   if (srcIndex) {
+      for (i = 0; i < n; ++i) {
+         size_t pos = offsets[r128__sortDigit(&src[i], digit)]++;
+         dst[pos] = src[i];
+         dstIndex[pos] = srcIndex[i];
+      }
+   } else {
+      for (i = 0; i < n; ++i) {
+         size_t pos = offsets[r128__sortDigit(&src[i], digit)]++;
+         dst[pos] = src[i];
+      }
+   }
+}
+
+#define R128__SORT_OFFSET(p, i) ((p) ? (p) + (i) : NULL)
+
+static void r128__msdSort(R128 *src, size_t *srcIndex, R128 *tmp, size_t *tmpIndex, size_t n, int toTmp)
+{
+   size_t offsets[R128__SORT_BUCKETS + 1];
+   R128_U64 diffLo = 0, diffHi = 0;
+   size_t i, total;
+   int digit;
+
+   if (n <= R128__SORT_SMALL) {
+      r128__insertionSort(src, srcIndex, n);
+      if (toTmp) {
+         r128__sortCopy(tmp, tmpIndex, src, srcIndex, n);
+      }
+      return;
+   }
+
+   for (i = 1; i < n; ++i) {
+      diffLo |= src[i].lo ^ src[0].lo;
+      diffHi |= src[i].hi ^ src[0].hi;
+   }
+
+   digit = r128__sortTopDigit(diffLo, diffHi);
+   if (digit < 0) {
+      if (toTmp) {
+         r128__sortCopy(tmp, tmpIndex, src, srcIndex, n);
+      }
+      return;
+   }
+
+   memset(offsets, 0, sizeof(offsets));
+   for (i = 0; i < n; ++i) {
+      ++offsets[r128__sortDigit(&src[i], digit) + 1];
+   }
+   for (i = 1, total = 0; i <= R128__SORT_BUCKETS; ++i) {
+      total += offsets[i];
+      offsets[i] = total;
+   }
+
+   r128__sortScatter(tmp, tmpIndex, src, srcIndex, n, digit, offsets);
+
+   // offsets[b] is now the end of bucket b
+   for (i = 0, total = 0; i < R128__SORT_BUCKETS; total = offsets[i++]) {
+      if (offsets[i] > total) {
+         r128__msdSort(tmp + total, R128__SORT_OFFSET(tmpIndex, total), src + total,
+            R128__SORT_OFFSET(srcIndex, total), offsets[i] - total, !toTmp);
+      }
+   }
+}
+
+typedef struct R128__SortJob {
+   R128 *src;
+   size_t *srcIndex;
+   R128 *tmp;
+   size_t *tmpIndex;
+   size_t grain;
+   int digit;
+   int toTmp;
+   size_t big;                      // buckets at least this big are partitioned in parallel
+   R128_U64 *diff;                  // per chunk, lo and hi
+   size_t *counts;                  // per chunk, R128__SORT_BUCKETS each
+   size_t start[R128__SORT_BUCKETS + 1];
+} R128__SortJob;
+
+static void r128__sortDiffTask(void *ctx, size_t begin, size_t end)
+{
+   R128__SortJob *job = (R128__SortJob *)ctx;
+   R128_U64 *diff = job->diff + begin / job->grain * 2;
+   const R128 *src = job->src;
+   size_t i;
+
+   diff[0] = diff[1] = 0;
+   for (i = begin; i < end; ++i) {
+      diff[0] |= src[i].lo ^ src[0].lo;
+      diff[1] |= src[i].hi ^ src[0].hi;
+   }
+}
+
+static void r128__sortCountTask(void *ctx, size_t begin, size_t end)
+{
+   R128__SortJob *job = (R128__SortJob *)ctx;
+   size_t *counts = job->counts + begin / job->grain * R128__SORT_BUCKETS;
+   size_t i;
+
+   memset(counts, 0, sizeof(size_t) * R128__SORT_BUCKETS);
+   for (i = begin; i < end; ++i) {
+      ++counts[r128__sortDigit(&job->src[i], job->digit)];
+   }
+}
+
+static void r128__sortScatterTask(void *ctx, size_t begin, size_t end)
+{
+   R128__SortJob *job = (R128__SortJob *)ctx;
+
+   r128__sortScatter(job->tmp, job->tmpIndex, job->src + begin, R128__SORT_OFFSET(job->srcIndex, begin),
+      end - begin, job->digit, job->counts + begin / job->grain * R128__SORT_BUCKETS);
+}
+
+static void r128__sortBucketTask(void *ctx, size_t begin, size_t end)
+{
+   R128__SortJob *job = (R128__SortJob *)ctx;
+
+   for (; begin < end; ++begin) {
+      size_t s = job->start[begin];
+      size_t n = job->start[begin + 1] - s;
+
+      if (n && n < job->big) {
+         r128__msdSort(job->tmp + s, R128__SORT_OFFSET(job->tmpIndex, s), job->src + s,
+            R128__SORT_OFFSET(job->srcIndex, s), n, !job->toTmp);
+      }
+   }
+}
+
+// One partition step with the counting and scattering split into chunks.
+// Buckets that are still large are partitioned the same way, one after the
+// other; all the others are then sorted in parallel, one bucket per task.
+// scratch holds per-chunk counts and diffs for R128__SORT_MAX_CHUNKS chunks.
+static void r128__parallelMsdSort(R128 *src, size_t *srcIndex, R128 *tmp, size_t *tmpIndex, size_t n,
+   int toTmp, size_t *scratch)
+{
+   R128__SortJob job;
+   R128_U64 diffLo = 0, diffHi = 0;
+   size_t chunks, c, b, total;
+
+   if (n < R128__SORT_PARALLEL || r128ParallelGetThreads() == 1) {
+      r128__msdSort(src, srcIndex, tmp, tmpIndex, n, toTmp);
+      return;
+   }
+
+   chunks = (size_t)r128ParallelGetThreads() * 4;
+   if (chunks > R128__SORT_MAX_CHUNKS) {
+      chunks = R128__SORT_MAX_CHUNKS;
+   }
+   job.grain = (n + chunks - 1) / chunks;
+   chunks = (n - 1) / job.grain + 1;
+
+   job.src = src;
+   job.srcIndex = srcIndex;
+   job.tmp = tmp;
+   job.tmpIndex = tmpIndex;
+   job.toTmp = toTmp;
+   job.counts = scratch;
+   job.diff = (R128_U64 *)(scratch + R128__SORT_MAX_CHUNKS * R128__SORT_BUCKETS);
+
+   r128ParallelFor(n, job.grain, r128__sortDiffTask, &job);
+   for (c = 0; c < chunks; ++c) {
+      diffLo |= job.diff[c * 2];
+      diffHi |= job.diff[c * 2 + 1];
+   }
+
+   job.digit = r128__sortTopDigit(diffLo, diffHi);
+   if (job.digit < 0) {
+      if (toTmp) {
+         r128__sortCopy(tmp, tmpIndex, src, srcIndex, n);
+      }
+      return;
+   }
+
+   // bucket b of chunk c goes after bucket b of the chunks before it, so the
+   // scatter is stable
+   r128ParallelFor(n, job.grain, r128__sortCountTask, &job);
+   total = 0;
+   for (b = 0; b < R128__SORT_BUCKETS; ++b) {
+      job.start[b] = total;
+      for (c = 0; c < chunks; ++c) {
+         size_t count = job.counts[c * R128__SORT_BUCKETS + b];
+         job.counts[c * R128__SORT_BUCKETS + b] = total;
+         total += count;
+      }
+   }
+   job.start[R128__SORT_BUCKETS] = total;
+
+   r128ParallelFor(n, job.grain, r128__sortScatterTask, &job);
+
+   job.big = n / r128ParallelGetThreads();
+   if (job.big < R128__SORT_PARALLEL) {
+      job.big = R128__SORT_PARALLEL;
+   }
+   for (b = 0; b < R128__SORT_BUCKETS; ++b) {
+      size_t s = job.start[b];
+      size_t count = job.start[b + 1] - s;
+
+      if (count >= job.big) {
+         r128__parallelMsdSort(tmp + s, R128__SORT_OFFSET(tmpIndex, s), src + s,
+            R128__SORT_OFFSET(srcIndex, s), count, !toTmp, scratch);
+      }
+   }
+   r128ParallelFor(R128__SORT_BUCKETS, 1, r128__sortBucketTask, &job);
+}
+
+// Sorts keys (and index, if not NULL) using tmpKeys and tmpIndex as scratch.
+// The sorted result ends up back in keys and index.
+static int r128__radixSort(R128 *keys, size_t *index, R128 *tmpKeys, size_t *tmpIndex, size_t n)
+{
+   size_t *scratch;
+
+   if (n < 2) {
+      return 1;
+   }
+
+   scratch = (size_t *)R128_MALLOC(sizeof(size_t) * R128__SORT_MAX_CHUNKS * (R128__SORT_BUCKETS + 2));
+   if (!scratch) {
+      return 0;
+   }
+
+   r128__parallelMsdSort(keys, index, tmpKeys, tmpIndex, n, 0, scratch);
+
+   R128_FREE(scratch);
+   return 1;
+}
+
+#undef R128__SORT_OFFSET
+
+typedef struct R128__PayloadJob {
+   const size_t *index;
+   const char *src;
+   char *dst;
+   size_t size;
+} R128__PayloadJob;
+
+static void r128__gatherTask(void *ctx, size_t begin, size_t end)
+{
+   R128__PayloadJob *job = (R128__PayloadJob *)ctx;
+   size_t i;
+
+   for (i = begin; i < end; ++i) {
+      memcpy(job->dst + i * job->size, job->src + job->index[i] * job->size, job->size);
+   }
+}
+
+int r128ParallelSortArray(R128 *keys, size_t n)
+{
+   R128 *tmp;
+   int ok;
+
+   R128_ASSERT(n == 0 || keys != NULL);
+
+   if (n < 2) {
+      return 1;
+   }
+
+   tmp = (R128 *)R128_MALLOC(sizeof(R128) * n);
+   if (!tmp) {
+      return 0;
+   }
+
+   ok = r128__radixSort(keys, NULL, tmp, NULL, n);
+   R128_FREE(tmp);
+   return ok;
+}
+
+int r128ParallelSortIndex(size_t *index, const R128 *keys, size_t n)
+{
+   R128 *k;
+   size_t *tmpIndex, i;
+   int ok = 0;
+
+   R128_ASSERT(n == 0 || (index != NULL && keys != NULL));
+
+   if (n == 0) {
+      return 1;
+   }
+
+   // sort a copy of the keys, plus scratch space for both arrays
+   k = (R128 *)R128_MALLOC(sizeof(R128) * n * 2);
+   tmpIndex = (size_t *)R128_MALLOC(sizeof(size_t) * n * 2);
+   if (k && tmpIndex) {
+      for (i = 0; i < n; ++i) {
+         k[i] = keys[i];
+         tmpIndex[i] = i;
+      }
+
+      ok = r128__radixSort(k, tmpIndex, k + n, tmpIndex + n, n);
+      if (ok) {
+         for (i = 0; i < n; ++i) {
+            index[i] = tmpIndex[i];
+         }
+      }
+   }
+
+   R128_FREE(tmpIndex);
+   R128_FREE(k);
+   return ok;
+}
+
+int r128ParallelSortArrayPayload(R128 *keys, void *payload, size_t payloadSize, size_t n)
+{
+   R128__PayloadJob job;
+   size_t *index;
+   void *tmp;
+   int ok = 0;
+
+   R128_ASSERT(n == 0 || (keys != NULL && payload != NULL));
+
+   if (n < 2) {
+      return 1;
+   }
+
+   index = (size_t *)R128_MALLOC(sizeof(size_t) * n);
+   tmp = R128_MALLOC(payloadSize * n > sizeof(R128) * n ? payloadSize * n : sizeof(R128) * n);
+   if (index && tmp) {
+      size_t *tmpIndex = (size_t *)R128_MALLOC(sizeof(size_t) * n);
+      size_t i;
+
+      if (tmpIndex) {
+         for (i = 0; i < n; ++i) {
+            index[i] = i;
+         }
+
+         ok = r128__radixSort(keys, index, (R128 *)tmp, tmpIndex, n);
+         R128_FREE(tmpIndex);
+      }
+
+      if (ok) {
+         job.index = index;
+         job.src = (const char *)payload;
+         job.dst = (char *)tmp;
+         job.size = payloadSize;
+         r128ParallelFor(n, 0, r128__gatherTask, &job);
+         memcpy(payload, tmp, payloadSize * n);
+      }
+   }
+
+   R128_FREE(tmp);
+   R128_FREE(index);
+   return ok;
+}
+
+
+typedef struct R128__HistogramJob {
+   R128_U64 *counts;
+   R128_U64 *sub;       // chunks * buckets
+   const R128Histogram *h;
+   const R128 *src;
+   size_t grain;
+   size_t chunks;
+} R128__HistogramJob;
+
+static void r128__histogramTask(void *ctx, size_t begin, size_t end)
+{
+   R128__HistogramJob *job = (R128__HistogramJob *)ctx;
+   R128_U64 *sub = job->sub + begin / job->grain * job->h->buckets;
+
+   memset(sub, 0, sizeof(R128_U64) * job->h->buckets);
+   r128HistogramArray(sub, job->h, job->src + begin, end - begin);
+}
+
+static void r128__histogramMergeTask(void *ctx, size_t begin, size_t end)
+{
+   R128__HistogramJob *job = (R128__HistogramJob *)ctx;
+   size_t buckets = job->h->buckets;
+   size_t c, i;
+
+   for (c = 0; c < job->chunks; ++c) {
+      const R128_U64 *sub = job->sub + c * buckets;
+      for (i = begin; i < end; ++i) {
+         job->counts[i] += sub[i];
+      }
+   }
+}
+
+int r128ParallelHistogramArray(R128_U64 *counts, const R128Histogram *h, const R128 *src, size_t n)
+{
+   R128__HistogramJob job;
+
+   R128_ASSERT(h != NULL);
+   R128_ASSERT(n == 0 || (counts != NULL && src != NULL));
+
+   // one chunk per thread keeps the number of sub-histograms down
+   job.grain = (n + r128ParallelGetThreads() - 1) / r128ParallelGetThreads();
+   if (job.grain < R128__GRAIN_MUL) {
+      job.grain = R128__GRAIN_MUL;
+   }
+   if (n <= job.grain) {
+      r128HistogramArray(counts, h, src, n);
+      return 1;
+   }
+
+   job.chunks = (n - 1) / job.grain + 1;
+   job.sub = (R128_U64 *)R128_MALLOC(sizeof(R128_U64) * h->buckets * job.chunks);
+   if (!job.sub) {
+      return 0;
+   }
+
+   job.counts = counts;
+   job.h = h;
+   job.src = src;
+   r128ParallelFor(n, job.grain, r128__histogramTask, &job);
+   r128ParallelFor(h->buckets, R128__GRAIN_ADD, r128__histogramMergeTask, &job);
+
+   R128_FREE(job.sub);
+   return 1;
+}
+
+#undef R128__SORT_BUCKETS
+#undef R128__SORT_SMALL
+#undef R128__SORT_PARALLEL
+#undef R128__SORT_MAX_CHUNKS
+#undef R128__RANGE
+#undef R128__RANGE_BEGIN
+#undef R128__RANGE_END
+
+#ifdef R128_TRACE
+#  undef r128Copy
+#  undef r128AddArray
+#  undef r128SubArray
+#  undef r128MulArray
+#  undef r128DivArray
+#  undef r128FromFloatArray
+#  undef r128ToFloatArray
+#  undef r128FromStringArray
+#  undef r128ToStringArray
+#endif
+
+#endif   //R128_IMPLEMENTATION
@@ -0,0 +1,928 @@
+/*
+r128_pipeline.h: multithreaded parse -> compute -> format pipelines over text
+streams of 128-bit (64.64) fixed-point values.
+
+COMPILATION
+-----------
+This is a companion to r128.h and follows the same single-file conventions.
+Include it wherever it is needed. In the ONE file in your project that defines
+R128_IMPLEMENTATION, include this file as well to get the code:
+
+#define R128_IMPLEMENTATION
+#include "r128_pipeline.h"
+
+r128.h is included automatically, so it does not need to be included first.
+
+Threads are created with pthreads, or with the Win32 API (Vista or later) on
+Windows. Memory is allocated with R128_MALLOC and R128_FREE, which default to
+malloc and free (see r128.h).
+
+OVERVIEW
+--------
+A pipeline reads text from a file or a memory buffer, one value per line, and
+passes it in batches through a chain of stages before writing the resulting
+text in the original order:
+
+   read -> stage 1 -> stage 2 -> ... -> write
+
+Each stage runs a batch kernel (typically r128PipelineParse, an arithmetic
+kernel built on the array functions in r128.h, and r128PipelineFormat) on as
+many threads as it is given. Reading runs on its own thread and writing on the
+calling thread.
+
+Stages are connected by bounded lock-free queues of batch pointers: a
+single-producer single-consumer ring where both sides have one thread, and a
+multi-producer multi-consumer ring (one sequence number per cell) otherwise.
+Batches come from a fixed pool, so a slow stage fills its input queue, the
+stages before it stall on their full output queues, and reading stops until the
+writer hands batches back. Threads waiting on a queue spin briefly and then
+yield.
+
+Every thread times its kernel and its waits. After a run, r128PipelineReport
+prints per-stage throughput and utilization, and names the stage that was busy
+for the largest share of the run: the bottleneck, and the first candidate for
+more threads.
+
+Lines may end in "\n" or "\r\n". A line must fit in a batch's input buffer (64
+bytes per value); longer lines are split.
+*/
+
+#ifndef H_R128_PIPELINE_H
+#define H_R128_PIPELINE_H
+
+#include "r128.h"
+
+#include <stdio.h>
+
+#ifndef R128_PIPELINE_MAX_STAGES
+#  define R128_PIPELINE_MAX_STAGES 16
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A batch of consecutive input lines on its way through the pipeline. Kernels
+// read and write values[0..count) and may append output to text. The other
+// members are private.
+typedef struct R128Batch {
+   size_t count;           // number of values (and input lines)
+   R128 *values;           // capacity values
+   const char **lines;     // start of each input line; not null-terminated
+   char *text;             // output text written by the sink
+   size_t textSize;        // bytes used in text
+   size_t textCapacity;    // capacity * R128_PIPELINE_TEXT_PER_VALUE bytes
+   size_t capacity;        // maximum count
+   size_t seq;
+   char *input;
+   size_t inputCapacity;
+} R128Batch;
+
+// Output bytes reserved per value: r128ToString's 43 bytes plus a newline.
+#define R128_PIPELINE_TEXT_PER_VALUE 44
+
+// Processes one batch in place. Called concurrently from all of a stage's
+// threads, each with a different batch.
+typedef void (*R128StageKernel)(void *ctx, R128Batch *batch);
+
+// Built-in kernels. ctx is unused.
+// r128PipelineParse: values[i] = r128FromString(lines[i]).
+// r128PipelineFormat: appends each value as r128ToString(values[i]) plus "\n" to
+// the batch text.
+extern void r128PipelineParse(void *ctx, R128Batch *batch);
+extern void r128PipelineFormat(void *ctx, R128Batch *batch);
+
+typedef struct R128PipelineStats {
+   const char *name;       // "read", a stage name, or "write"
+   int threads;
+   R128_U64 batches;
+   R128_U64 values;
+   double busySeconds;     // running the kernel, summed over threads
+   double starvedSeconds;  // waiting for input
+   double blockedSeconds;  // waiting for room downstream (backpressure)
+} R128PipelineStats;
+
+// Treat the members as private.
+typedef struct R128Pipeline {
+   size_t batchSize;
+   size_t queueDepth;
+   int stageCount;
+   struct {
+      const char *name;
+      R128StageKernel kernel;
+      void *ctx;
+      int threads;
+   } stages[R128_PIPELINE_MAX_STAGES];
+   R128PipelineStats stats[R128_PIPELINE_MAX_STAGES + 2];
+   double seconds;
+} R128Pipeline;
+
+// Sets up an empty pipeline. batchSize is the number of values per batch and
+// queueDepth the number of batches each queue holds; 0 selects 1024 and 4.
+extern void r128PipelineInit(R128Pipeline *p, size_t batchSize, size_t queueDepth);
+
+// Appends a stage. name must stay valid while the pipeline is used. Returns
+// zero if there are already R128_PIPELINE_MAX_STAGES stages.
+extern int r128PipelineAddStage(R128Pipeline *p, const char *name, R128StageKernel kernel, void *ctx, int threads);
+
+// Runs the pipeline over inSize bytes at in. On success, returns non-zero and
+// stores the output in a buffer allocated with R128_MALLOC, to be released with
+// R128_FREE. Returns zero if memory or threads could not be allocated.
+extern int r128PipelineRunMemory(R128Pipeline *p, const char *in, size_t inSize, char **out, size_t *outSize);
+
+// Runs the pipeline from one stream to another. Returns zero if memory or
+// threads could not be allocated or writing failed.
+extern int r128PipelineRunFile(R128Pipeline *p, FILE *in, FILE *out);
+
+// Statistics for the last run: read, then each stage in order, then write.
+// Stores the number of entries in count.
+extern const R128PipelineStats *r128PipelineStats(const R128Pipeline *p, int *count);
+
+// Prints the statistics of the last run as a table, with the bottleneck.
+extern void r128PipelineReport(const R128Pipeline *p, FILE *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif   //H_R128_PIPELINE_H
+
+#if defined(R128_IMPLEMENTATION) && !defined(H_R128_PIPELINE_IMPLEMENTATION)
+#define H_R128_PIPELINE_IMPLEMENTATION
+
+#ifdef R128_TRACE
+// Call the non-recording implementations (see r128.h), so that a trace holds
+// only the caller's own calls.
+#  define r128ToString r128__traceToString
+#  define r128FromStringArray r128__traceFromStringArray
+#endif
+
+#include <string.h>  // for memcpy, memchr
+
+#define R128__PIPE_INPUT_PER_VALUE 64
+#define R128__PIPE_SPINS 256
+
+// Threads, clock and the atomic operations the queues need.
+#if defined(_WIN32)
+#  ifndef WIN32_LEAN_AND_MEAN
+#    define WIN32_LEAN_AND_MEAN
+#  endif
+#  include <windows.h>
+#  include <intrin.h>
+
+typedef HANDLE r128__pipeThread;
+typedef DWORD (WINAPI *r128__pipeEntry)(LPVOID arg);
+#  define R128__PIPE_ENTRY(name) static DWORD WINAPI name(LPVOID arg)
+#  define R128__PIPE_RETURN return 0
+
+static int r128__pipeThreadCreate(r128__pipeThread *t, r128__pipeEntry entry, void *arg)
+{
+   *t = CreateThread(NULL, 0, entry, arg, 0, NULL);
+   return *t != NULL;
+}
+
+static void r128__pipeThreadJoin(r128__pipeThread t)
+{
+   WaitForSingleObject(t, INFINITE);
+   CloseHandle(t);
+}
+
+static void r128__pipeYield(void)
+{
+   SwitchToThread();
+}
+
+static double r128__pipeNow(void)
+{
+   LARGE_INTEGER count, freq;
+   QueryPerformanceCounter(&count);
+   QueryPerformanceFrequency(&freq);
+   return (double)count.QuadPart / (double)freq.QuadPart;
+}
+
+static R128_U64 r128__pipeLoad(volatile R128_U64 *p)
+{
+   return (R128_U64)_InterlockedCompareExchange64((volatile __int64 *)p, 0, 0);
+}
+
+static int r128__pipeCas(volatile R128_U64 *p, R128_U64 expected, R128_U64 desired)
+{
+   return (R128_U64)_InterlockedCompareExchange64((volatile __int64 *)p, (__int64)desired, (__int64)expected) == expected;
+}
+
+static void r128__pipeStore(volatile R128_U64 *p, R128_U64 v)
+{
+   R128_U64 old;
+   do {
+      old = r128__pipeLoad(p);
+   } while (!r128__pipeCas(p, old, v));
+}
+
+static R128_U64 r128__pipeDecrement(volatile R128_U64 *p)
+{
+   R128_U64 old;
+   do {
+      old = r128__pipeLoad(p);
+   } while (!r128__pipeCas(p, old, old - 1));
+   return old - 1;
+}
+#else
+#  include <pthread.h>
+#  include <sched.h>
+#  include <time.h>
+
+typedef pthread_t r128__pipeThread;
+typedef void *(*r128__pipeEntry)(void *arg);
+#  define R128__PIPE_ENTRY(name) static void *name(void *arg)
+#  define R128__PIPE_RETURN return NULL
+
+static int r128__pipeThreadCreate(r128__pipeThread *t, r128__pipeEntry entry, void *arg)
+{
+   return pthread_create(t, NULL, entry, arg) == 0;
+}
+
+static void r128__pipeThreadJoin(r128__pipeThread t)
+{
+   pthread_join(t, NULL);
+}
+
+static void r128__pipeYield(void)
+{
+   sched_yield();
+}
+
+static double r128__pipeNow(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static R128_U64 r128__pipeLoad(volatile R128_U64 *p)
+{
+   return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void r128__pipeStore(volatile R128_U64 *p, R128_U64 v)
+{
+   __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static int r128__pipeCas(volatile R128_U64 *p, R128_U64 expected, R128_U64 desired)
+{
+   return __atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static R128_U64 r128__pipeDecrement(volatile R128_U64 *p)
+{
+   return __atomic_sub_fetch(p, 1, __ATOMIC_ACQ_REL);
+}
+#endif   //_WIN32
+
+// Bounded queue of batch pointers. Each cell's sequence number says whose turn
+// it is: pos when empty and waiting for the producer claiming position pos, and
+// pos + 1 once filled for the consumer claiming position pos. With a single
+// producer (or consumer) the position is advanced with a plain store instead
+// of a compare-and-swap.
+typedef struct R128__PipeCell {
+   volatile R128_U64 seq;
+   R128Batch *batch;
+} R128__PipeCell;
+
+typedef struct R128__PipeQueue {
+   volatile R128_U64 head;   // next position to fill
+   char pad0[R128_CACHE_LINE - sizeof(R128_U64)];
+   volatile R128_U64 tail;   // next position to take
+   char pad1[R128_CACHE_LINE - sizeof(R128_U64)];
+   volatile R128_U64 producers;   // producer threads still running
+   R128__PipeCell *cells;
+   R128_U64 mask;
+   int singleProducer;
+   int singleConsumer;
+} R128__PipeQueue;
+
+static int r128__pipeQueueInit(R128__PipeQueue *q, size_t depth, int producers, int consumers)
+{
+   size_t size = 1, i;
+
+   while (size < depth) {
+      size *= 2;
+   }
+
+   q->cells = (R128__PipeCell *)R128_MALLOC(sizeof(R128__PipeCell) * size);
+   if (!q->cells) {
+      return 0;
+   }
+
+   for (i = 0; i < size; ++i) {
+      q->cells[i].seq = i;
+      q->cells[i].batch = NULL;
+   }
+   q->head = q->tail = 0;
+   q->mask = size - 1;
+   q->producers = (R128_U64)producers;
+   q->singleProducer = producers == 1;
+   q->singleConsumer = consumers == 1;
+   return 1;
+}
+
+static int r128__pipeTryPush(R128__PipeQueue *q, R128Batch *batch)
+{
+   for (;;) {
+      R128_U64 pos = r128__pipeLoad(&q->head);
+      R128__PipeCell *cell = &q->cells[pos & q->mask];
+      R128_U64 seq = r128__pipeLoad(&cell->seq);
+
+      if (seq != pos) {
+         if ((R128_S64)(seq - pos) < 0) {
+            return 0;   // full
+         }
+      } else if (q->singleProducer) {
+         r128__pipeStore(&q->head, pos + 1);
+      } else if (!r128__pipeCas(&q->head, pos, pos + 1)) {
+         continue;
+      }
+
+      if (seq == pos) {
+         cell->batch = batch;
+         r128__pipeStore(&cell->seq, pos + 1);
+         return 1;
+      }
+   }
+}
+
+static R128Batch *r128__pipeTryPop(R128__PipeQueue *q)
+{
+   for (;;) {
+      R128_U64 pos = r128__pipeLoad(&q->tail);
+      R128__PipeCell *cell = &q->cells[pos & q->mask];
+      R128_U64 seq = r128__pipeLoad(&cell->seq);
+
+      if (seq != pos + 1) {
+         if ((R128_S64)(seq - (pos + 1)) < 0) {
+            return NULL;   // empty
+         }
+      } else if (q->singleConsumer) {
+         r128__pipeStore(&q->tail, pos + 1);
+      } else if (!r128__pipeCas(&q->tail, pos, pos + 1)) {
+         continue;
+      }
+
+      if (seq == pos + 1) {
+         R128Batch *batch = cell->batch;
+         r128__pipeStore(&cell->seq, pos + q->mask + 1);
+         return batch;
+      }
+   }
+}
+
+// Blocking push; adds the time spent waiting to *waited.
+static void r128__pipePush(R128__PipeQueue *q, R128Batch *batch, double *waited)
+{
+   double start;
+   int spins = 0;
+
+   if (r128__pipeTryPush(q, batch)) {
+      return;
+   }
+
+   start = r128__pipeNow();
+   while (!r128__pipeTryPush(q, batch)) {
+      if (++spins > R128__PIPE_SPINS) {
+         r128__pipeYield();
+      }
+   }
+   *waited += r128__pipeNow() - start;
+}
+
+// Blocking pop; returns NULL once every producer has finished and the queue is
+// empty.
+static R128Batch *r128__pipePop(R128__PipeQueue *q, double *waited)
+{
+   R128Batch *batch = r128__pipeTryPop(q);
+   double start;
+   int spins = 0;
+
+   if (batch) {
+      return batch;
+   }
+
+   start = r128__pipeNow();
+   for (;;) {
+      // check producers first, so a batch pushed just before the last producer
+      // finished is still seen
+      int done = r128__pipeLoad(&q->producers) == 0;
+
+      batch = r128__pipeTryPop(q);
+      if (batch || done) {
+         break;
+      }
+      if (++spins > R128__PIPE_SPINS) {
+         r128__pipeYield();
+      }
+   }
+   *waited += r128__pipeNow() - start;
+   return batch;
+}
+
+static void r128__pipeProducerDone(R128__PipeQueue *q)
+{
+   r128__pipeDecrement(&q->producers);
+}
+
+typedef struct R128__PipeRun R128__PipeRun;
+
+typedef struct R128__PipeWorker {
+   R128__PipeRun *run;
+   int stage;
+   r128__pipeThread thread;
+   R128PipelineStats stats;
+} R128__PipeWorker;
+
+struct R128__PipeRun {
+   R128Pipeline *p;
+   R128__PipeQueue queues[R128_PIPELINE_MAX_STAGES + 1];   // queue i feeds stage i; the last feeds the writer
+   R128__PipeQueue freeBatches;
+   R128Batch *batches;
+   size_t batchCount;
+   R128__PipeWorker *workers;
+   int workerCount;
+
+   // input: a memory buffer, or a stream
+   const char *in;
+   size_t inSize;
+   FILE *inFile;
+   char *carry;            // partial line left over from the last read
+   size_t carrySize;
+   int eof;
+};
+
+void r128PipelineParse(void *ctx, R128Batch *batch)
+{
+   (void)ctx;
+   r128FromStringArray(batch->values, batch->lines, batch->count);
+}
+
+void r128PipelineFormat(void *ctx, R128Batch *batch)
+{
+   char *dst = batch->text + batch->textSize;
+   size_t i;
+
+   (void)ctx;
+   R128_ASSERT(batch->textSize + batch->count * R128_PIPELINE_TEXT_PER_VALUE <= batch->textCapacity);
+
+   for (i = 0; i < batch->count; ++i) {
+      dst += r128ToString(dst, R128_PIPELINE_TEXT_PER_VALUE, &batch->values[i]);
+      *dst++ = '\n';
+   }
+   batch->textSize = (size_t)(dst - batch->text);
+}
+
+// Splits text[0..size) into lines, adding them to batch. Stops when the batch
+// is full and returns the number of bytes consumed. A final line without a
+// newline is taken only if last is set.
+static size_t r128__pipeSplit(R128Batch *batch, const char *text, size_t size, int last)
+{
+   size_t pos = 0;
+
+   while (pos < size && batch->count < batch->capacity) {
+      const char *nl = (const char *)memchr(text + pos, '\n', size - pos);
+      if (!nl && !last) {
+         break;
+      }
+
+      batch->lines[batch->count++] = text + pos;
+      pos = nl ? (size_t)(nl - text) + 1 : size;
+   }
+
+   return pos;
+}
+
+// Fills the next batch from the input. Returns zero at the end of the input.
+static int r128__pipeRead(R128__PipeRun *run, R128Batch *batch)
+{
+   batch->count = 0;
+   batch->textSize = 0;
+
+   if (!run->inFile) {
+      size_t used = r128__pipeSplit(batch, run->in, run->inSize, 0);
+      if (used < run->inSize && batch->count < batch->capacity) {
+         // the last line has no newline; copy it so parsing stops at its end
+         size_t n = run->inSize - used;
+         if (n > batch->inputCapacity - 1) {
+            n = batch->inputCapacity - 1;
+         }
+         memcpy(batch->input, run->in + used, n);
+         batch->input[n] = '\0';
+         r128__pipeSplit(batch, batch->input, n, 1);
+         used += n;
+      }
+      run->in += used;
+      run->inSize -= used;
+      return batch->count > 0;
+   } else {
+      size_t size = run->carrySize, used;
+
+      memcpy(batch->input, run->carry, size);
+      if (!run->eof) {
+         size_t want = batch->inputCapacity - 1 - size;
+         size_t got = fread(batch->input + size, 1, want, run->inFile);
+         size += got;
+         run->eof = got < want;
+      }
+      batch->input[size] = '\0';
+
+      used = r128__pipeSplit(batch, batch->input, size, run->eof);
+      if (batch->count == 0 && size > 0) {
+         // a line longer than the buffer
+         used = r128__pipeSplit(batch, batch->input, size, 1);
+      }
+
+      run->carrySize = size - used;
+      memcpy(run->carry, batch->input + used, run->carrySize);
+      return batch->count > 0;
+   }
+}
+
+R128__PIPE_ENTRY(r128__pipeReader)
+{
+   R128__PipeWorker *w = (R128__PipeWorker *)arg;
+   R128__PipeRun *run = w->run;
+   double start;
+
+   for (;;) {
+      R128Batch *batch = r128__pipePop(&run->freeBatches, &w->stats.starvedSeconds);
+      int more;
+
+      start = r128__pipeNow();
+      more = r128__pipeRead(run, batch);
+      w->stats.busySeconds += r128__pipeNow() - start;
+      if (!more) {
+         break;
+      }
+
+      batch->seq = (size_t)w->stats.batches++;
+      w->stats.values += batch->count;
+      r128__pipePush(&run->queues[0], batch, &w->stats.blockedSeconds);
+   }
+
+   r128__pipeProducerDone(&run->queues[0]);
+   R128__PIPE_RETURN;
+}
+
+R128__PIPE_ENTRY(r128__pipeStage)
+{
+   R128__PipeWorker *w = (R128__PipeWorker *)arg;
+   R128__PipeRun *run = w->run;
+   R128StageKernel kernel = run->p->stages[w->stage].kernel;
+   void *ctx = run->p->stages[w->stage].ctx;
+   R128Batch *batch;
+   double start;
+
+   while ((batch = r128__pipePop(&run->queues[w->stage], &w->stats.starvedSeconds)) != NULL) {
+      start = r128__pipeNow();
+      kernel(ctx, batch);
+      w->stats.busySeconds += r128__pipeNow() - start;
+      ++w->stats.batches;
+      w->stats.values += batch->count;
+      r128__pipePush(&run->queues[w->stage + 1], batch, &w->stats.blockedSeconds);
+   }
+
+   r128__pipeProducerDone(&run->queues[w->stage + 1]);
+   R128__PIPE_RETURN;
+}
+
+static void r128__pipeFree(R128__PipeRun *run)
+{
+   int i;
+
+   for (i = 0; i <= R128_PIPELINE_MAX_STAGES; ++i) {
+      R128_FREE(run->queues[i].cells);
+   }
+   R128_FREE(run->freeBatches.cells);
+   if (run->batches) {
+      R128_FREE(run->batches[0].values);
+   }
+   R128_FREE(run->batches);
+   R128_FREE(run->workers);
+   R128_FREE(run->carry);
+}
+
+// Allocates the queues and the batch pool. The pool holds enough batches to
+// fill every queue and keep every thread busy.
+static int r128__pipeAlloc(R128__PipeRun *run, R128Pipeline *p)
+{
+   size_t perBatch, i;
+   unsigned char *mem;
+   int s, threads = 2;
+
+   memset(run, 0, sizeof(*run));
+   run->p = p;
+
+   for (s = 0; s < p->stageCount; ++s) {
+      threads += p->stages[s].threads;
+   }
+   run->batchCount = (size_t)(p->stageCount + 1) * p->queueDepth + (size_t)threads;
+
+   for (s = 0; s <= p->stageCount; ++s) {
+      int producers = s == 0 ? 1 : p->stages[s - 1].threads;
+      int consumers = s == p->stageCount ? 1 : p->stages[s].threads;
+      if (!r128__pipeQueueInit(&run->queues[s], p->queueDepth, producers, consumers)) {
+         return 0;
+      }
+   }
+   if (!r128__pipeQueueInit(&run->freeBatches, run->batchCount, 1, 1)) {
+      return 0;
+   }
+
+   run->batches = (R128Batch *)R128_MALLOC(sizeof(R128Batch) * run->batchCount);
+   run->workers = (R128__PipeWorker *)R128_MALLOC(sizeof(R128__PipeWorker) * threads);
+   run->carry = (char *)R128_MALLOC(p->batchSize * R128__PIPE_INPUT_PER_VALUE);
+   perBatch = p->batchSize * (sizeof(R128) + sizeof(char *) + R128_PIPELINE_TEXT_PER_VALUE + R128__PIPE_INPUT_PER_VALUE);
+   mem = (unsigned char *)R128_MALLOC(perBatch * run->batchCount);
+   if (!run->batches || !run->workers || !run->carry || !mem) {
+      R128_FREE(mem);
+      if (run->batches) {
+         run->batches[0].values = NULL;
+      }
+      return 0;
+   }
+
+   // values first, so they stay aligned
+   for (i = 0; i < run->batchCount; ++i) {
+      R128Batch *b = &run->batches[i];
+      b->values = (R128 *)(mem + sizeof(R128) * p->batchSize * i);
+   }
+   mem += sizeof(R128) * p->batchSize * run->batchCount;
+   for (i = 0; i < run->batchCount; ++i) {
+      R128Batch *b = &run->batches[i];
+      b->lines = (const char **)mem;
+      mem += sizeof(char *) * p->batchSize;
+      b->text = (char *)mem;
+      b->textCapacity = p->batchSize * R128_PIPELINE_TEXT_PER_VALUE;
+      mem += b->textCapacity;
+      b->input = (char *)mem;
+      b->inputCapacity = p->batchSize * R128__PIPE_INPUT_PER_VALUE;
+      mem += b->inputCapacity;
+      b->capacity = p->batchSize;
+      b->count = b->textSize = 0;
+      r128__pipeTryPush(&run->freeBatches, b);
+   }
+
+   return 1;
+}
+
+static void r128__pipeStatsInit(R128PipelineStats *stats, const char *name, int threads)
+{
+   stats->name = name;
+   stats->threads = threads;
+   stats->batches = stats->values = 0;
+   stats->busySeconds = stats->starvedSeconds = stats->blockedSeconds = 0;
+}
+
+static void r128__pipeStatsAdd(R128PipelineStats *dst, const R128PipelineStats *src)
+{
+   dst->batches += src->batches;
+   dst->values += src->values;
+   dst->busySeconds += src->busySeconds;
+   dst->starvedSeconds += src->starvedSeconds;
+   dst->blockedSeconds += src->blockedSeconds;
+}
+
+// Starts the reader and stage threads, then writes batches in sequence order
+// on the calling thread, to outFile or to the growing buffer *out.
+static int r128__pipeRun(R128Pipeline *p, R128__PipeRun *run, FILE *outFile, char **out, size_t *outSize)
+{
+   R128PipelineStats *writer = &p->stats[p->stageCount + 1];
+   R128Batch **pending = NULL;
+   size_t next = 0, outCapacity = 0;
+   int ok = 1, started = 0, s, t, i;
+   double start = r128__pipeNow();
+
+   r128__pipeStatsInit(&p->stats[0], "read", 1);
+   for (s = 0; s < p->stageCount; ++s) {
+      r128__pipeStatsInit(&p->stats[s + 1], p->stages[s].name, p->stages[s].threads);
+   }
+   r128__pipeStatsInit(writer, "write", 1);
+
+   pending = (R128Batch **)R128_MALLOC(sizeof(R128Batch *) * run->batchCount);
+   if (out) {
+      *out = NULL;
+      *outSize = 0;
+   }
+   if (!pending) {
+      return 0;
+   }
+   for (i = 0; i < (int)run->batchCount; ++i) {
+      pending[i] = NULL;
+   }
+
+   // the stages first and the reader last, so that if a thread cannot be
+   // started no batch is in flight and the started threads simply drain
+   for (s = 0; s < p->stageCount; ++s) {
+      for (t = 0; t < p->stages[s].threads; ++t) {
+         R128__PipeWorker *w = &run->workers[started];
+         w->run = run;
+         w->stage = s;
+         r128__pipeStatsInit(&w->stats, p->stages[s].name, 1);
+         if (ok && r128__pipeThreadCreate(&w->thread, r128__pipeStage, w)) {
+            ++started;
+         } else {
+            ok = 0;
+            r128__pipeProducerDone(&run->queues[s + 1]);
+         }
+      }
+   }
+   if (ok) {
+      R128__PipeWorker *w = &run->workers[started];
+      w->run = run;
+      w->stage = -1;
+      r128__pipeStatsInit(&w->stats, "read", 1);
+      ok = r128__pipeThreadCreate(&w->thread, r128__pipeReader, w);
+      started += ok;
+   }
+   if (!ok) {
+      r128__pipeProducerDone(&run->queues[0]);
+   }
+
+   for (;;) {
+      R128Batch *batch = r128__pipePop(&run->queues[p->stageCount], &writer->starvedSeconds);
+      double busy;
+
+      if (!batch) {
+         break;
+      }
+
+      pending[batch->seq % run->batchCount] = batch;
+      busy = r128__pipeNow();
+      while ((batch = pending[next % run->batchCount]) != NULL && batch->seq == next) {
+         pending[next % run->batchCount] = NULL;
+         ++next;
+
+         if (outFile) {
+            ok &= fwrite(batch->text, 1, batch->textSize, outFile) == batch->textSize;
+         } else if (ok && batch->textSize) {
+            if (*outSize + batch->textSize > outCapacity) {
+               char *grown;
+               size_t capacity = outCapacity ? outCapacity : 4096;
+               while (capacity < *outSize + batch->textSize) {
+                  capacity *= 2;
+               }
+               grown = (char *)R128_MALLOC(capacity);
+               if (grown) {
+                  memcpy(grown, *out, *outSize);
+               }
+               R128_FREE(*out);
+               *out = grown;
+               outCapacity = capacity;
+               if (!grown) {
+                  *outSize = 0;
+                  ok = 0;
+               }
+            }
+            if (ok) {
+               memcpy(*out + *outSize, batch->text, batch->textSize);
+               *outSize += batch->textSize;
+            }
+         }
+
+         ++writer->batches;
+         writer->values += batch->count;
+         batch->count = batch->textSize = 0;
+         r128__pipePush(&run->freeBatches, batch, &writer->blockedSeconds);
+      }
+      writer->busySeconds += r128__pipeNow() - busy;
+   }
+
+   for (i = 0; i < started; ++i) {
+      R128__PipeWorker *w = &run->workers[i];
+      r128__pipeThreadJoin(w->thread);
+      r128__pipeStatsAdd(&p->stats[w->stage + 1], &w->stats);
+   }
+
+   p->seconds = r128__pipeNow() - start;
+   R128_FREE(pending);
+   return ok;
+}
+
+void r128PipelineInit(R128Pipeline *p, size_t batchSize, size_t queueDepth)
+{
+   int i;
+
+   R128_ASSERT(p != NULL);
+
+   p->batchSize = batchSize ? batchSize : 1024;
+   p->queueDepth = queueDepth ? queueDepth : 4;
+   p->stageCount = 0;
+   p->seconds = 0;
+   for (i = 0; i < R128_PIPELINE_MAX_STAGES + 2; ++i) {
+      r128__pipeStatsInit(&p->stats[i], NULL, 0);
+   }
+}
+
+int r128PipelineAddStage(R128Pipeline *p, const char *name, R128StageKernel kernel, void *ctx, int threads)
+{
+   R128_ASSERT(p != NULL);
+   R128_ASSERT(kernel != NULL);
+   R128_ASSERT(threads > 0);
+
+   if (p->stageCount == R128_PIPELINE_MAX_STAGES) {
+      return 0;
+   }
+
+   p->stages[p->stageCount].name = name;
+   p->stages[p->stageCount].kernel = kernel;
+   p->stages[p->stageCount].ctx = ctx;
+   p->stages[p->stageCount].threads = threads;
+   ++p->stageCount;
+   return 1;
+}
+
+int r128PipelineRunMemory(R128Pipeline *p, const char *in, size_t inSize, char **out, size_t *outSize)
+{
+   R128__PipeRun run;
+   int ok;
+
+   R128_ASSERT(p != NULL);
+   R128_ASSERT(inSize == 0 || in != NULL);
+   R128_ASSERT(out != NULL && outSize != NULL);
+
+   *out = NULL;
+   *outSize = 0;
+   ok = r128__pipeAlloc(&run, p);
+   if (ok) {
+      run.in = in;
+      run.inSize = inSize;
+      ok = r128__pipeRun(p, &run, NULL, out, outSize);
+   }
+   r128__pipeFree(&run);
+   return ok;
+}
+
+int r128PipelineRunFile(R128Pipeline *p, FILE *in, FILE *out)
+{
+   R128__PipeRun run;
+   int ok;
+
+   R128_ASSERT(p != NULL);
+   R128_ASSERT(in != NULL && out != NULL);
+
+   ok = r128__pipeAlloc(&run, p);
+   if (ok) {
+      run.inFile = in;
+      ok = r128__pipeRun(p, &run, out, NULL, NULL);
+   }
+   r128__pipeFree(&run);
+   return ok;
+}
+
+const R128PipelineStats *r128PipelineStats(const R128Pipeline *p, int *count)
+{
+   R128_ASSERT(p != NULL);
+   R128_ASSERT(count != NULL);
+
+   *count = p->stageCount + 2;
+   return p->stats;
+}
+
+void r128PipelineReport(const R128Pipeline *p, FILE *f)
+{
+   int i, bottleneck = 0;
+   double worst = -1;
+
+   R128_ASSERT(p != NULL);
+   R128_ASSERT(f != NULL);
+
+   fprintf(f, "%-12s %7s %10s %12s %10s %10s %10s %14s %6s\n", "stage", "threads", "batches", "values",
+      "busy s", "starved s", "blocked s", "Mvalues/s/thr", "util");
+
+   for (i = 0; i < p->stageCount + 2; ++i) {
+      const R128PipelineStats *s = &p->stats[i];
+      double util = p->seconds > 0 && s->threads ? s->busySeconds / (p->seconds * s->threads) : 0;
+      double rate = s->busySeconds > 0 ? (double)s->values / s->busySeconds * 1e-6 : 0;
+
+      fprintf(f, "%-12s %7d %10lu %12lu %10.3f %10.3f %10.3f %14.2f %5.0f%%\n", s->name ? s->name : "",
+         s->threads, (unsigned long)s->batches, (unsigned long)s->values, s->busySeconds,
+         s->starvedSeconds, s->blockedSeconds, rate, util * 100);
+
+      if (util > worst) {
+         worst = util;
+         bottleneck = i;
+      }
+   }
+
+   fprintf(f, "%.3f s total; bottleneck: %s\n", p->seconds,
+      p->stats[bottleneck].name ? p->stats[bottleneck].name : "");
+}
+
+#undef R128__PIPE_INPUT_PER_VALUE
+#undef R128__PIPE_SPINS
+#undef R128__PIPE_ENTRY
+#undef R128__PIPE_RETURN
+
+#ifdef R128_TRACE
+#  undef r128ToString
+#  undef r128FromStringArray
+#endif
+
+#endif   //R128_IMPLEMENTATION
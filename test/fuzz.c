@@ -0,0 +1,801 @@
+// fuzz: differential testing of r128.h against a reference implementation.
+//
+// Every input is decoded into a few operands (biased towards edge cases: zero,
+// R128_min, R128_max, carries across the halves, powers of two, divisors that
+// make the quotient just fit or just overflow) and every scalar and array
+// operation is compared against a straightforward reference built on
+// unsigned __int128 and 256-bit integers. Strings and doubles are checked the
+// same way.
+//
+// Standalone, it feeds itself random inputs:
+//
+//    make fuzz && ./fuzz [iterations] [seed]
+//
+// Define R128_STDC_ONLY to check the portable C paths (32-bit multiply and
+// division digits, no intrinsics) on a 64-bit machine:
+//
+//    make fuzz_stdc && ./fuzz_stdc
+//
+// With libFuzzer, define R128_LIBFUZZER so the harness provides only
+// LLVMFuzzerTestOneInput:
+//
+//    clang -g -O1 -fsanitize=fuzzer,address -DR128_LIBFUZZER fuzz.c -o fuzz_lf
+//
+// The reference needs unsigned __int128 (GCC or Clang on a 64-bit target).
+
+#define R128_IMPLEMENTATION
+#include "../r128.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef unsigned __int128 u128;
+typedef __int128 s128;
+
+typedef struct U256 {
+   u128 lo, hi;
+} U256;
+
+typedef struct Input {
+   const unsigned char *data;
+   size_t size;
+} Input;
+
+static unsigned long failures;
+
+// Reads input bytes; past the end every byte is zero.
+static unsigned next8(Input *in)
+{
+   if (!in->size) {
+      return 0;
+   }
+   --in->size;
+   return *in->data++;
+}
+
+static R128_U64 next64(Input *in)
+{
+   R128_U64 v = 0;
+   int i;
+
+   for (i = 0; i < 8; ++i) {
+      v = (v << 8) | next8(in);
+   }
+   return v;
+}
+
+static u128 to_u128(const R128 *v)
+{
+   return ((u128)v->hi << 64) | v->lo;
+}
+
+static R128 from_u128(u128 v)
+{
+   R128 r;
+   r.lo = (R128_U64)v;
+   r.hi = (R128_U64)(v >> 64);
+   return r;
+}
+
+static int is_neg(u128 v)
+{
+   return (s128)v < 0;
+}
+
+// magnitude as unsigned, so that |R128_min| = 2^127
+static u128 mag(u128 v)
+{
+   return is_neg(v) ? -v : v;
+}
+
+//
+// 256-bit reference arithmetic
+//
+
+static U256 u256(u128 hi, u128 lo)
+{
+   U256 r;
+   r.lo = lo;
+   r.hi = hi;
+   return r;
+}
+
+static U256 add256(U256 a, U256 b)
+{
+   U256 r;
+   r.lo = a.lo + b.lo;
+   r.hi = a.hi + b.hi + (r.lo < a.lo);
+   return r;
+}
+
+static U256 sub256(U256 a, U256 b)
+{
+   U256 r;
+   r.lo = a.lo - b.lo;
+   r.hi = a.hi - b.hi - (a.lo < b.lo);
+   return r;
+}
+
+static int cmp256(U256 a, U256 b)
+{
+   if (a.hi != b.hi) {
+      return a.hi < b.hi ? -1 : 1;
+   }
+   if (a.lo != b.lo) {
+      return a.lo < b.lo ? -1 : 1;
+   }
+   return 0;
+}
+
+static U256 mul256(u128 a, u128 b)
+{
+   u128 a0 = (R128_U64)a, a1 = a >> 64, b0 = (R128_U64)b, b1 = b >> 64;
+   U256 r = u256(a1 * b1, a0 * b0);
+   r = add256(r, u256((a0 * b1) >> 64, (a0 * b1) << 64));
+   r = add256(r, u256((a1 * b0) >> 64, (a1 * b0) << 64));
+   return r;
+}
+
+// n / d by binary long division; the quotient is truncated to 128 bits.
+static u128 div256(U256 n, u128 d)
+{
+   u128 q = 0, r = 0;
+   int i;
+
+   for (i = 255; i >= 0; --i) {
+      u128 top = r >> 127;
+      u128 bit = i >= 128 ? (n.hi >> (i - 128)) & 1 : (n.lo >> i) & 1;
+      r = (r << 1) | bit;
+      if (top || r >= d) {
+         r -= d;
+         if (i < 128) {
+            q |= (u128)1 << i;
+         }
+      }
+   }
+   return q;
+}
+
+// magnitude of a product, rounded to 64 fraction bits as r128Mul does
+static u128 round_product(U256 p)
+{
+   p = add256(p, u256(0, (u128)1 << 63));
+   return (p.lo >> 64) | (p.hi << 64);
+}
+
+//
+// reference operations on two's complement 64.64 values
+//
+
+static u128 ref_mul(u128 a, u128 b)
+{
+   u128 r = round_product(mul256(mag(a), mag(b)));
+   return is_neg(a) != is_neg(b) ? -r : r;
+}
+
+static u128 ref_div(u128 a, u128 b)
+{
+   u128 na = mag(a), nb = mag(b), q;
+
+   if (b == 0) {
+      return is_neg(a) ? to_u128(&R128_min) : to_u128(&R128_max);
+   }
+
+   if ((nb >> 64) == 0 && (na >> 64) >= nb) {
+      q = to_u128(&R128_max);    // quotient does not fit in 128 bits
+   } else {
+      q = div256(u256(na >> 64, na << 64), nb);
+   }
+   return is_neg(a) != is_neg(b) ? -q : q;
+}
+
+static u128 ref_mod(u128 a, u128 b)
+{
+   u128 na = mag(a), nb = mag(b);
+   R128_U64 q;
+
+   if (b == 0) {
+      return is_neg(a) ? to_u128(&R128_min) : to_u128(&R128_max);
+   }
+
+   // whole part of the quotient, truncated towards zero
+   if ((nb >> 64) == 0 && (na >> 64) >= nb) {
+      q = ~(R128_U64)0;
+   } else {
+      q = (R128_U64)(na / nb);
+   }
+   if (is_neg(a) != is_neg(b)) {
+      q = ~q + 1;
+   }
+   return a - ref_mul((u128)q << 64, b);
+}
+
+static int ref_cmp(u128 a, u128 b)
+{
+   return (s128)a < (s128)b ? -1 : (s128)a > (s128)b;
+}
+
+// r128FromFloat: truncates towards zero and clamps out-of-range values.
+static u128 ref_from_float(double v)
+{
+   u128 r;
+
+   if (v < -9223372036854775808.0) {
+      return to_u128(&R128_min);
+   } else if (v >= 9223372036854775808.0) {
+      return to_u128(&R128_max);
+   }
+
+   r = (u128)(fabs(v) * 18446744073709551616.0);
+   return v < 0 ? -r : r;
+}
+
+// r128ToString with a precision of prec fraction digits, or, for prec < 0, up
+// to 20 digits stopping early when the value is exact. Rounds half up.
+static void ref_to_string(char *dst, u128 v, int prec)
+{
+   static const char digits[] = "0123456789";
+   u128 m = mag(v), frac, scale = 1;
+   R128_U64 whole = (R128_U64)(m >> 64), lo = (R128_U64)m;
+   char buf[64], *p = buf + sizeof(buf);
+   int n = prec, i;
+
+   if (prec < 0) {
+      if (!lo) {
+         n = 0;
+      } else {
+         int tz = 0;
+         while (!((lo >> tz) & 1)) {
+            ++tz;
+         }
+         n = 64 - tz < 20 ? 64 - tz : 20;
+      }
+   }
+
+   for (i = 0; i < n; ++i) {
+      scale *= 10;
+   }
+   frac = round_product(mul256(lo, scale));
+   if (frac == scale) {
+      ++whole;
+      frac = 0;
+   }
+
+   *--p = '\0';
+   for (i = 0; i < n; ++i) {
+      *--p = digits[frac % 10];
+      frac /= 10;
+   }
+   if (n) {
+      *--p = '.';
+   }
+   do {
+      *--p = digits[whole % 10];
+      whole /= 10;
+   } while (whole);
+   if (is_neg(v)) {
+      *--p = '-';
+   }
+   strcpy(dst, p);
+}
+
+//
+// operand generation
+//
+
+static R128 gen_value(Input *in)
+{
+   static const R128 special[] = {
+      { 0, 0 },
+      { 0, 1 },
+      { 0, R128_LIT_U64(0xffffffffffffffff) },                          // -1
+      { 1, 0 },                                                          // R128_smallest
+      { R128_LIT_U64(0xffffffffffffffff), R128_LIT_U64(0xffffffffffffffff) },
+      { 0, R128_LIT_U64(0x8000000000000000) },                          // R128_min
+      { 1, R128_LIT_U64(0x8000000000000000) },
+      { R128_LIT_U64(0xffffffffffffffff), R128_LIT_U64(0x7fffffffffffffff) },  // R128_max
+      { R128_LIT_U64(0xfffffffffffffffe), R128_LIT_U64(0x7fffffffffffffff) },
+      { R128_LIT_U64(0xffffffffffffffff), 0 },
+      { R128_LIT_U64(0x8000000000000000), 0 },                          // 0.5
+      { R128_LIT_U64(0x8000000000000000), R128_LIT_U64(0xffffffffffffffff) },  // -0.5
+      { R128_LIT_U64(0x7fffffffffffffff), 0 },
+      { 0, R128_LIT_U64(0x100000000) },
+      { R128_LIT_U64(0xffffffff00000000), R128_LIT_U64(0x00000000ffffffff) },
+      { R128_LIT_U64(0x00000000ffffffff), R128_LIT_U64(0xffffffff00000000) },
+   };
+   R128 v;
+   unsigned sel = next8(in);
+
+   switch (sel & 15) {
+   case 0:
+      v = special[next8(in) % (sizeof(special) / sizeof(special[0]))];
+      break;
+
+   case 1:     // small integer
+      r128FromInt(&v, (signed char)next8(in));
+      break;
+
+   case 2:     // small integer with a fraction
+      v.lo = next64(in);
+      v.hi = (R128_U64)(R128_S64)(short)(next8(in) << 8 | next8(in));
+      break;
+
+   case 3:     // fraction only
+      v.lo = next64(in);
+      v.hi = (sel & 16) ? R128_LIT_U64(0xffffffffffffffff) : 0;
+      break;
+
+   case 4: {   // power of two, off by one either way
+      unsigned k = next8(in);
+      v = from_u128(((u128)1 << (k & 127)) + (u128)(R128_S64)((int)(k >> 7) - (int)((sel >> 4) & 1)));
+      break;
+   }
+
+   case 5:     // runs of ones and zeros across the 32-bit digits
+      v.lo = next64(in);
+      v.hi = next64(in);
+      v.lo = (sel & 16) ? v.lo | R128_LIT_U64(0xffffffff00000000) : v.lo & R128_LIT_U64(0x00000000ffffffff);
+      v.hi = (sel & 32) ? v.hi | R128_LIT_U64(0x00000000ffffffff) : v.hi & R128_LIT_U64(0xffffffff00000000);
+      break;
+
+   case 6:     // near R128_min and R128_max
+      v.lo = next64(in);
+      v.hi = ((sel & 16) ? R128_LIT_U64(0x7fffffffffffffff) : R128_LIT_U64(0x8000000000000000)) - (next8(in) & 3);
+      break;
+
+   case 7:     // 32-bit magnitude
+      v.lo = (R128_U64)next8(in) << 56 | (next64(in) & 0xffffffff);
+      v.hi = next64(in) & 0xffffffff;
+      if (sel & 16) {
+         r128Neg(&v, &v);
+      }
+      break;
+
+   default:
+      v.lo = next64(in);
+      v.hi = next64(in);
+      break;
+   }
+
+   return v;
+}
+
+// A second operand, often related to the first.
+static R128 gen_related(Input *in, const R128 *a)
+{
+   u128 ua = to_u128(a), na = mag(ua), v;
+   unsigned sel = next8(in);
+
+   switch (sel & 7) {
+   case 0:     // divisor at the edge of quotient overflow: |a| / v just fits or not
+      v = (na >> 64) + (R128_U64)(R128_S64)((int)(sel >> 3 & 3) - 1);
+      break;
+
+   case 1:     // close to a
+      v = ua + (u128)(s128)(signed char)next8(in);
+      break;
+
+   case 2:     // a scaled down
+      v = na >> (next8(in) & 127);
+      break;
+
+   case 3:     // same high half, for the second quotient digit
+      v = (na & ~(u128)0 << 64) | next64(in);
+      break;
+
+   default:
+      return gen_value(in);
+   }
+
+   if (sel & 64) {
+      v = -v;
+   }
+   return from_u128(v);
+}
+
+//
+// checks
+//
+
+static void print_value(const char *name, const R128 *v)
+{
+   char buf[64];
+   r128ToString(buf, sizeof(buf), v);
+   fprintf(stderr, "   %-6s 0x%016llx.%016llx  %s\n", name, (unsigned long long)v->hi,
+      (unsigned long long)v->lo, buf);
+}
+
+static void fail(const char *op, const R128 *a, const R128 *b)
+{
+   if (++failures <= 20) {
+      fprintf(stderr, "%s differs\n", op);
+      print_value("a", a);
+      if (b) {
+         print_value("b", b);
+      }
+   }
+}
+
+static void check(const char *op, const R128 *a, const R128 *b, const R128 *got, u128 expect)
+{
+   if (to_u128(got) != expect) {
+      R128 e = from_u128(expect);
+      fail(op, a, b);
+      if (failures <= 20) {
+         print_value("got", got);
+         print_value("expect", &e);
+      }
+   }
+}
+
+static void check_string(const char *op, const R128 *a, const char *got, const char *expect)
+{
+   if (strcmp(got, expect)) {
+      fail(op, a, NULL);
+      if (failures <= 20) {
+         fprintf(stderr, "   got    \"%s\"\n   expect \"%s\"\n", got, expect);
+      }
+   }
+}
+
+static void check_arith(const R128 *a, const R128 *b)
+{
+   u128 ua = to_u128(a), ub = to_u128(b);
+   R128 r;
+
+   r128Add(&r, a, b);
+   check("r128Add", a, b, &r, ua + ub);
+   r128Sub(&r, a, b);
+   check("r128Sub", a, b, &r, ua - ub);
+   r128Mul(&r, a, b);
+   check("r128Mul", a, b, &r, ref_mul(ua, ub));
+   r128Div(&r, a, b);
+   check("r128Div", a, b, &r, ref_div(ua, ub));
+   r128Mod(&r, a, b);
+   check("r128Mod", a, b, &r, ref_mod(ua, ub));
+
+   // in place
+   r = *a;
+   r128Mul(&r, &r, b);
+   check("r128Mul in place", a, b, &r, ref_mul(ua, ub));
+   r = *a;
+   r128Div(&r, &r, b);
+   check("r128Div in place", a, b, &r, ref_div(ua, ub));
+
+   r128And(&r, a, b);
+   check("r128And", a, b, &r, ua & ub);
+   r128Or(&r, a, b);
+   check("r128Or", a, b, &r, ua | ub);
+   r128Xor(&r, a, b);
+   check("r128Xor", a, b, &r, ua ^ ub);
+
+   if (r128Cmp(a, b) != ref_cmp(ua, ub)) {
+      fail("r128Cmp", a, b);
+   }
+   r128Min(&r, a, b);
+   check("r128Min", a, b, &r, ref_cmp(ua, ub) < 0 ? ua : ub);
+   r128Max(&r, a, b);
+   check("r128Max", a, b, &r, ref_cmp(ua, ub) > 0 ? ua : ub);
+}
+
+static void check_unary(const R128 *a, int amount)
+{
+   u128 ua = to_u128(a);
+   int n = amount & 127;
+   R128 r;
+
+   r128Neg(&r, a);
+   check("r128Neg", a, NULL, &r, -ua);
+   r128Not(&r, a);
+   check("r128Not", a, NULL, &r, ~ua);
+   r128Shl(&r, a, amount);
+   check("r128Shl", a, NULL, &r, ua << n);
+   r128Shr(&r, a, amount);
+   check("r128Shr", a, NULL, &r, ua >> n);
+   r128Sar(&r, a, amount);
+   check("r128Sar", a, NULL, &r, (u128)((s128)ua >> n));
+
+   r128Floor(&r, a);
+   check("r128Floor", a, NULL, &r, ua >> 64 << 64);
+   r128Ceil(&r, a);
+   check("r128Ceil", a, NULL, &r, ((ua >> 64) + ((R128_U64)ua != 0)) << 64);
+
+   if (r128IsNeg(a) != is_neg(ua)) {
+      fail("r128IsNeg", a, NULL);
+   }
+   if (r128ToInt(a) != (R128_S64)(ua >> 64)) {
+      fail("r128ToInt", a, NULL);
+   }
+   r128FromInt(&r, (R128_S64)a->lo);
+   check("r128FromInt", a, NULL, &r, (u128)(s128)(R128_S64)a->lo << 64);
+}
+
+static void check_float(const R128 *a, double d)
+{
+   u128 ua = to_u128(a);
+   long double expect = (long double)(s128)ua / 18446744073709551616.0L;
+   double got = r128ToFloat(a);
+   R128 r;
+
+   // r128ToFloat rounds twice, so allow for two ulps
+   if (fabsl(got - expect) > fabsl(expect) * 0x1p-51L) {
+      fail("r128ToFloat", a, NULL);
+      if (failures <= 20) {
+         fprintf(stderr, "   got %.17g, expected %.17Lg\n", got, expect);
+      }
+   }
+
+   if (d == d) {
+      r128FromFloat(&r, d);
+      if (to_u128(&r) != ref_from_float(d)) {
+         R128 e = from_u128(ref_from_float(d));
+         fail("r128FromFloat", &r, NULL);
+         if (failures <= 20) {
+            fprintf(stderr, "   from %.17g\n", d);
+            print_value("expect", &e);
+         }
+      }
+   }
+}
+
+static void check_format(Input *in, const R128 *a)
+{
+   char got[128], expect[128], core[64], format[32];
+   unsigned flags = next8(in);
+   int prec = (int)(next8(in) % 20), width = (int)(next8(in) % 48);
+   size_t len, i;
+   const char *digits;
+
+   r128ToString(got, sizeof(got), a);
+   ref_to_string(expect, to_u128(a), -1);
+   check_string("r128ToString", a, got, expect);
+
+   // truncation to a short buffer keeps the prefix
+   len = strlen(expect);
+   for (i = 1; i <= len + 1; i += 1 + (flags & 3)) {
+      int n = r128ToString(got, i, a);
+      if (n != (int)(i - 1) || strncmp(got, expect, i - 1) || got[i - 1] != '\0') {
+         fail("r128ToString truncated", a, NULL);
+         break;
+      }
+   }
+
+   // %[flags][width].[prec]f; printf pads the reference digits
+   ref_to_string(core, to_u128(a), prec);
+   digits = core[0] == '-' ? core + 1 : core;
+   {
+      char sign[2] = { 0, 0 };
+      char padded[128];
+
+      if (core[0] == '-') {
+         sign[0] = '-';
+      } else if (flags & 4) {
+         sign[0] = '+';
+      } else if (flags & 8) {
+         sign[0] = ' ';
+      }
+
+      if (flags & 16) {       // left align
+         snprintf(padded, sizeof(padded), "%s%s", sign, digits);
+         snprintf(expect, sizeof(expect), "%-*s", width, padded);
+      } else if (flags & 32) { // zero pad after the sign
+         int pad = width - (int)strlen(sign) - (int)strlen(digits);
+         snprintf(expect, sizeof(expect), "%s%0*d%s", sign, pad > 0 ? pad : 1, 0, digits);
+         if (pad <= 0) {
+            snprintf(expect, sizeof(expect), "%s%s", sign, digits);
+         }
+      } else {
+         snprintf(padded, sizeof(padded), "%s%s", sign, digits);
+         snprintf(expect, sizeof(expect), "%*s", width, padded);
+      }
+   }
+
+   snprintf(format, sizeof(format), "%%%s%s%s%s%d.%df", (flags & 4) ? "+" : "", (flags & 8) ? " " : "",
+      (flags & 16) ? "-" : "", (flags & 32) && !(flags & 16) ? "0" : "", width, prec);
+   r128ToStringf(got, sizeof(got), format, a);
+   check_string(format, a, got, expect);
+}
+
+// Builds a decimal or hex string from the input and checks r128FromString
+// against the exact value truncated to 64 fraction bits.
+static void check_parse(Input *in)
+{
+   static const char lower[] = "0123456789abcdef", upper[] = "0123456789ABCDEF";
+   char s[96], *end;
+   unsigned flags = next8(in);
+   unsigned base = (flags & 1) ? 16 : 10;
+   int wholeDigits = (int)(next8(in) % 24), fracDigits = (int)(next8(in) % (base == 16 ? 32 : 39));
+   const char *alphabet = (flags & 2) ? upper : lower;
+   R128_U64 whole = 0;
+   u128 frac = 0, scale = 1, expect;
+   size_t len = 0;
+   int i, neg = 0;
+   R128 r;
+
+   if (flags & 4) {
+      s[len++] = ' ';
+   }
+   if (flags & 8) {
+      neg = 1;
+      s[len++] = '-';
+   } else if (flags & 16) {
+      s[len++] = '+';
+   }
+   if (base == 16) {
+      s[len++] = '0';
+      s[len++] = (flags & 32) ? 'X' : 'x';
+   }
+
+   for (i = 0; i < wholeDigits; ++i) {
+      unsigned digit = next8(in) % base;
+      whole = whole * base + digit;    // wraps, like r128FromString
+      s[len++] = alphabet[digit];
+   }
+   if (fracDigits || (flags & 64)) {
+      s[len++] = '.';
+   }
+   for (i = 0; i < fracDigits; ++i) {
+      unsigned digit = next8(in) % base;
+      frac = frac * base + digit;
+      scale *= base;
+      s[len++] = alphabet[digit];
+   }
+   s[len] = ';';
+   s[len + 1] = '\0';
+
+   expect = ((u128)whole << 64) | (R128_U64)div256(u256(frac >> 64, frac << 64), scale);
+   if (neg) {
+      expect = -expect;
+   }
+
+   r128FromString(&r, s, &end);
+   if (to_u128(&r) != expect || end != s + len) {
+      R128 e = from_u128(expect);
+      fail("r128FromString", &r, NULL);
+      if (failures <= 20) {
+         fprintf(stderr, "   from \"%s\", stopped at %d of %d\n", s, (int)(end - s), (int)len);
+         print_value("expect", &e);
+      }
+   }
+}
+
+// signed sum of 256-bit magnitudes
+static void add_signed(int *neg, U256 *sum, int pneg, U256 p)
+{
+   if (*neg == pneg) {
+      *sum = add256(*sum, p);
+   } else if (cmp256(*sum, p) >= 0) {
+      *sum = sub256(*sum, p);
+   } else {
+      *sum = sub256(p, *sum);
+      *neg = pneg;
+   }
+}
+
+static void check_arrays(const R128 *v, const R128 *w)
+{
+   R128 r[3], s;
+   u128 expect;
+   U256 sum = u256(0, 0);
+   int i, neg = 0;
+
+   r128AddArray(r, v, w, 3);
+   for (i = 0; i < 3; ++i) {
+      check("r128AddArray", &v[i], &w[i], &r[i], to_u128(&v[i]) + to_u128(&w[i]));
+   }
+   r128SubArray(r, v, w, 3);
+   for (i = 0; i < 3; ++i) {
+      check("r128SubArray", &v[i], &w[i], &r[i], to_u128(&v[i]) - to_u128(&w[i]));
+   }
+   r128MulArray(r, v, w, 3);
+   for (i = 0; i < 3; ++i) {
+      check("r128MulArray", &v[i], &w[i], &r[i], ref_mul(to_u128(&v[i]), to_u128(&w[i])));
+   }
+   r128DivArray(r, v, w, 3);
+   for (i = 0; i < 3; ++i) {
+      check("r128DivArray", &v[i], &w[i], &r[i], ref_div(to_u128(&v[i]), to_u128(&w[i])));
+   }
+
+   r128SumArray(&s, v, 3);
+   check("r128SumArray", &v[0], &v[1], &s, to_u128(&v[0]) + to_u128(&v[1]) + to_u128(&v[2]));
+
+   expect = to_u128(&v[0]);
+   for (i = 1; i < 3; ++i) {
+      if (ref_cmp(to_u128(&v[i]), expect) < 0) {
+         expect = to_u128(&v[i]);
+      }
+   }
+   r128MinArray(&s, v, 3);
+   check("r128MinArray", &v[0], &v[1], &s, expect);
+
+   expect = to_u128(&v[0]);
+   for (i = 1; i < 3; ++i) {
+      if (ref_cmp(to_u128(&v[i]), expect) > 0) {
+         expect = to_u128(&v[i]);
+      }
+   }
+   r128MaxArray(&s, v, 3);
+   check("r128MaxArray", &v[0], &v[1], &s, expect);
+
+   // the products are summed exactly and rounded once
+   for (i = 0; i < 3; ++i) {
+      u128 a = to_u128(&v[i]), b = to_u128(&w[i]);
+      add_signed(&neg, &sum, is_neg(a) != is_neg(b), mul256(mag(a), mag(b)));
+   }
+   expect = round_product(sum);
+   r128DotArray(&s, v, w, 3);
+   check("r128DotArray", &v[0], &w[0], &s, neg ? -expect : expect);
+}
+
+static void fuzz_one(const unsigned char *data, size_t size)
+{
+   Input in;
+   R128 a, b, v[3], w[3];
+   double d;
+   int i;
+
+   in.data = data;
+   in.size = size;
+
+   a = gen_value(&in);
+   b = gen_related(&in, &a);
+
+   check_arith(&a, &b);
+   check_arith(&b, &a);
+   check_unary(&a, (signed char)next8(&in));
+
+   // doubles: the raw bits, or a value near the range of R128
+   {
+      R128_U64 bits = next64(&in);
+      memcpy(&d, &bits, sizeof(d));
+      if (!(next8(&in) & 1)) {
+         d = ldexp((double)(R128_S64)bits, (int)(next8(&in) % 128) - 128);
+      }
+   }
+   check_float(&a, d);
+
+   check_format(&in, &a);
+   check_parse(&in);
+
+   for (i = 0; i < 3; ++i) {
+      v[i] = gen_value(&in);
+      w[i] = gen_related(&in, &v[i]);
+   }
+   check_arrays(v, w);
+}
+
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size)
+{
+   fuzz_one(data, size);
+   if (failures) {
+      abort();
+   }
+   return 0;
+}
+
+#ifndef R128_LIBFUZZER
+int main(int argc, char **argv)
+{
+   unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+   R128_U64 seed = argc > 2 ? strtoull(argv[2], NULL, 0) : 1;
+   R128_U64 rng = seed * R128_LIT_U64(0x9e3779b97f4a7c15) + 1;
+   unsigned char data[256];
+   unsigned long i;
+   size_t j;
+
+   for (i = 0; i < iterations; ++i) {
+      for (j = 0; j < sizeof(data); ++j) {
+         rng ^= rng << 13;
+         rng ^= rng >> 7;
+         rng ^= rng << 17;
+         data[j] = (unsigned char)(rng >> 32);
+      }
+      fuzz_one(data, sizeof(data));
+   }
+
+   printf("%lu inputs, %lu failures (seed %llu)\n", iterations, failures, (unsigned long long)seed);
+   return failures ? 1 : 0;
+}
+#endif
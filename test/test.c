@@ -2,6 +2,10 @@
 
 #define R128_IMPLEMENTATION
 #include "../r128.h"
+#include "../r128_atomic.h"
+#include "../r128_parallel.h"
+#include "../r128_pipeline.h"
+#include "../r128_omp.h"
 
 #include <math.h>
 #include <stdint.h>
@@ -37,7 +41,7 @@ static int testsRun, testsFailed;
    if ((v).lo != r0 || (v).hi != r1) { \
       PRINT_FAILURE("%s(%d): TEST FAILED: Got 0x%08x%08x.%08x%08x, expected 0x%08x%08x.%08x%08x\n", \
          __FILE__, __LINE__, R128_R3(&(v)), R128_R2(&(v)), R128_R1(&(v)), R128_R0(&(v)), \
-         (uint32_t)((r1) >> 32), (uint32_t)(r1), (uint32_t)((r0) >> 32), (uint32_t)(r0)); \
+         (uint32_t)((uint64_t)(r1) >> 32), (uint32_t)(r1), (uint32_t)((uint64_t)(r0) >> 32), (uint32_t)(r0)); \
       ++testsFailed; \
    }\
 } while(0)
@@ -180,6 +184,31 @@ static void test_string()
    sprintf(bufb, "%1.200f", b);
    r128ToStringf(bufa, sizeof(bufa), "%1.200f", &a);
    R128_TEST_STRSTREQ(bufa, bufb);
+
+   b = 1234.5;
+   r128FromFloat(&a, b);
+
+   sprintf(bufb, "%10.1f", b);
+   r128ToStringf(bufa, sizeof(bufa), "%10.1f", &a);
+   R128_TEST_STRSTREQ(bufa, bufb);
+   sprintf(bufb, "%+10.2f", b);               // ' ' is ignored with '+'
+   r128ToStringf(bufa, sizeof(bufa), "%+ 10.2f", &a);
+   R128_TEST_STRSTREQ(bufa, bufb);
+
+   b = -70;
+   r128FromFloat(&a, b);
+
+   sprintf(bufb, "%08.3f", b);
+   r128ToStringf(bufa, sizeof(bufa), "%08.3f", &a);
+   R128_TEST_STRSTREQ(bufa, bufb);
+
+   {
+      char *end;
+      const char *s = "-1.25;";
+      r128FromString(&a, s, &end);
+      R128_TEST_FLEQ(a, -1.25);
+      R128_TEST_FLFLEQ((int)(end - s), 5);
+   }
 }
 
 static void test_cmp()
@@ -222,6 +251,16 @@ static void test_cmp()
    R128_TEST_FLFLEQ(cmp, -1);
    cmp = r128Cmp(&d, &d);
    R128_TEST_FLFLEQ(cmp, 0);
+
+   // c is -0.5: hi holds the floor and lo the (positive) fraction
+   r128Floor(&a, &c);
+   R128_TEST_FLEQ(a, -1);
+   r128Ceil(&a, &c);
+   R128_TEST_FLEQ(a, 0);
+   r128Floor(&a, &b);
+   R128_TEST_FLEQ(a, 1);
+   r128Ceil(&a, &b);
+   R128_TEST_FLEQ(a, 2);
 }
 
 static void test_div()
@@ -255,6 +294,31 @@ static void test_div()
 
    r128Div(&c, &R128_one, &R128_smallest);
    R128_TEST_EQ(c, R128_max);
+
+   // divisors below one, and quotient digits that need correcting; the exact
+   // truncated quotients and remainders
+   r128FromInt(&a, 7);
+   r128FromString(&b, "0.3", NULL);
+   r128Div(&c, &a, &b);
+   R128_TEST_EQ2(c, R128_LIT_U64(0x5555555555555593), R128_LIT_U64(0x17));
+   r128Mod(&c, &a, &b);
+   R128_TEST_EQ2(c, R128_LIT_U64(0x19999999999999ac), R128_LIT_U64(0));
+
+   r128FromInt(&a, 65536);
+   r128FromString(&b, "0.000003", NULL);
+   r128Div(&c, &a, &b);
+   R128_TEST_EQ2(c, R128_LIT_U64(0x55664638638e391b), R128_LIT_U64(0x516155555));
+
+   r128FromString(&a, "1234.5678", NULL);
+   r128FromString(&b, "8765.4321", NULL);
+   r128Div(&c, &a, &b);
+   R128_TEST_EQ2(c, R128_LIT_U64(0x240e6bf9941c54bc), R128_LIT_U64(0));
+
+   // the remainder after the first quotient digit equals the divisor's top half
+   R128_SET2(&a, R128_LIT_U64(0x72000000544ba268), R128_LIT_U64(0x3a046eee));
+   R128_SET2(&b, R128_LIT_U64(0x72000000544ba27f), R128_LIT_U64(0x3a046eee));
+   r128Div(&c, &a, &b);
+   R128_TEST_EQ2(c, R128_LIT_U64(0xffffffffffffffff), 0);
 }
 
 static void test_mod()
@@ -334,6 +398,900 @@ static void test_shift()
    R128_TEST_EQ4(b, 0xa0000000, 0xffffffff, 0xffffffff, 0xffffffff);
 }
 
+static void test_atomic()
+{
+   R128Atomic a;
+   R128 b, c, d;
+
+   r128FromInt(&b, 5);
+   r128AtomicInit(&a, &b);
+   r128AtomicLoad(&c, &a);
+   R128_TEST_EQ(c, b);
+
+   r128FromFloat(&b, -2.25);
+   r128AtomicStore(&a, &b);
+   r128AtomicLoad(&c, &a);
+   R128_TEST_EQ(c, b);
+
+   r128AtomicExchange(&c, &a, &R128_one);
+   R128_TEST_EQ(c, b);
+   r128AtomicLoad(&c, &a);
+   R128_TEST_EQ(c, R128_one);
+
+   // failed exchange returns the current value
+   r128Copy(&c, &R128_zero);
+   r128FromInt(&d, 7);
+   R128_TEST_FLFLEQ(r128AtomicCompareExchange(&a, &c, &d), 0);
+   R128_TEST_EQ(c, R128_one);
+   R128_TEST_FLFLEQ(r128AtomicCompareExchange(&a, &c, &d), 1);
+   r128AtomicLoad(&c, &a);
+   R128_TEST_EQ(c, d);
+
+   // carry out of the low word
+   R128_SET2(&b, R128_LIT_U64(0x8000000000000000), 0);
+   r128AtomicFetchAdd(&c, &a, &b);
+   R128_TEST_EQ(c, d);
+   r128AtomicFetchAdd(NULL, &a, &b);
+   r128AtomicLoad(&c, &a);
+   R128_TEST_EQ2(c, 0, 8);
+
+   r128AtomicFetchSub(NULL, &a, &R128_max);
+   r128AtomicLoad(&c, &a);
+   R128_TEST_EQ2(c, 1, R128_LIT_U64(0x8000000000000008));
+
+   r128AtomicFetchMax(NULL, &a, &R128_zero);
+   r128AtomicLoad(&c, &a);
+   R128_TEST_EQ(c, R128_zero);
+   r128AtomicFetchMin(&c, &a, &R128_min);
+   R128_TEST_EQ(c, R128_zero);
+   r128AtomicLoad(&c, &a);
+   R128_TEST_EQ(c, R128_min);
+   r128AtomicFetchMin(NULL, &a, &R128_one);
+   r128AtomicLoad(&c, &a);
+   R128_TEST_EQ(c, R128_min);
+}
+
+static void test_sharded()
+{
+   R128ShardedCounter c;
+   R128 a, b, totals[3];
+   int shard;
+
+   if (!r128ShardedCounterInit(&c, 3, 4)) {
+      PRINT_FAILURE("%s(%d): TEST FAILED: out of memory\n", __FILE__, __LINE__);
+      ++testsFailed;
+      return;
+   }
+
+   // carries out of each shard's low word must survive the merge
+   R128_SET2(&a, R128_LIT_U64(0xc000000000000000), 0);
+   for (shard = 0; shard < 4; ++shard) {
+      r128ShardedCounterAdd(&c, shard, 0, &a);
+      r128ShardedCounterAdd(&c, shard, 2, &R128_one);
+   }
+   r128FromFloat(&b, -1.5);
+   r128ShardedCounterAdd(&c, 3, 1, &b);
+
+   r128ShardedCounterTotal(&a, &c, 0);
+   R128_TEST_EQ2(a, 0, 3);
+   r128ShardedCounterTotal(&a, &c, 1);
+   R128_TEST_EQ(a, b);
+
+   r128ShardedCounterTotals(totals, &c);
+   R128_TEST_EQ2(totals[0], 0, 3);
+   R128_TEST_EQ(totals[1], b);
+   R128_TEST_EQ2(totals[2], 0, 4);
+
+   r128ShardedCounterReset(&c);
+   r128ShardedCounterTotal(&a, &c, 2);
+   R128_TEST_EQ(a, R128_zero);
+
+   r128ShardedCounterFree(&c);
+}
+
+static void test_array()
+{
+   static const char *strs[] = { "1.5", "-0.25", "0x10.8", "3" };
+   R128 a[4], b[4], c[4], d[4];
+   double f[4];
+   char buf[4][8];
+   int i;
+
+   for (i = 0; i < 4; ++i) {
+      r128FromInt(&a[i], i + 1);
+      r128FromFloat(&b[i], -0.5 * i);
+   }
+
+   r128AddArray(c, a, b, 4);
+   R128_TEST_FLEQ(c[3], 2.5);
+   r128SubArray(c, a, b, 4);
+   R128_TEST_FLEQ(c[2], 4);
+   r128MulArray(c, a, b, 4);
+   R128_TEST_FLEQ(c[3], -6);
+   r128DivArray(c, b, a, 4);
+   R128_TEST_FLEQ(c[1], -0.25);
+
+   r128ToFloatArray(f, b, 4);
+   r128FromFloatArray(c, f, 4);
+   for (i = 0; i < 4; ++i) {
+      R128_TEST_EQ(c[i], b[i]);
+   }
+
+   r128FromStringArray(d, strs, 4);
+   R128_TEST_FLEQ(d[2], 16.5);
+   r128ToStringArray(buf[0], sizeof(buf[0]), d, 4);
+   R128_TEST_STRSTREQ(buf[0], "1.5");
+   R128_TEST_STRSTREQ(buf[1], "-0.25");
+   R128_TEST_STRSTREQ(buf[2], "16.5");
+   R128_TEST_STRSTREQ(buf[3], "3");
+
+   r128SumArray(&c[0], d, 4);
+   R128_TEST_FLEQ(c[0], 20.75);
+}
+
+static void test_cpu()
+{
+   // lo words that carry or borrow, signs, products that round, and a count
+   // that leaves a scalar tail after the vector loops
+   enum { N = 19 };
+   static const R128_U64 lo[7] = {
+      R128_LIT_U64(0xffffffffffffffff), 1, R128_LIT_U64(0x8000000000000000), 0,
+      R128_LIT_U64(0x7fffffffffffffff), R128_LIT_U64(0xfffffffffffffffe), 2
+   };
+   R128 a[N], b[N], c[N], d[N], m[N], e;
+   R128Cpu best = r128CpuSet(R128Cpu_Count);
+   char report[256];
+   int level, i;
+
+   for (i = 0; i < N; ++i) {
+      R128_SET2(&a[i], lo[i % 7], (R128_U64)i - 9);
+      R128_SET2(&b[i], lo[6 - i % 7], R128_LIT_U64(0x7fffffffffffffff) * (R128_U64)(i % 3) + (R128_U64)i);
+   }
+   r128Copy(&a[5], &R128_min);
+   r128Copy(&b[6], &R128_max);
+
+   for (level = R128Cpu_Scalar; level <= best; ++level) {
+      R128_TEST_FLFLEQ(r128CpuSet((R128Cpu)level), level);
+      R128_TEST_FLFLEQ(r128CpuGet(), level);
+
+      r128AddArray(c, a, b, N);
+      r128SubArray(d, a, b, N);
+      r128MulArray(m, a, b, N);
+      for (i = 0; i < N; ++i) {
+         r128Add(&e, &a[i], &b[i]);
+         R128_TEST_EQ(c[i], e);
+         r128Sub(&e, &a[i], &b[i]);
+         R128_TEST_EQ(d[i], e);
+         r128Mul(&e, &a[i], &b[i]);
+         R128_TEST_EQ(m[i], e);
+      }
+
+      // in place
+      memcpy(d, a, sizeof(a));
+      r128AddArray(d, d, b, N);
+      for (i = 0; i < N; ++i) {
+         R128_TEST_EQ(d[i], c[i]);
+      }
+      memcpy(d, a, sizeof(a));
+      r128MulArray(d, d, b, N);
+      for (i = 0; i < N; ++i) {
+         R128_TEST_EQ(d[i], m[i]);
+      }
+   }
+
+   r128CpuSet(R128Cpu_Scalar);
+   r128CpuReport(report, sizeof(report));
+   R128_TEST_FLFLEQ(strstr(report, "selected scalar\n") != NULL, 1);
+   R128_TEST_FLFLEQ(strstr(report, "r128MulArray scalar\n") != NULL, 1);
+   R128_TEST_FLFLEQ(r128CpuReport(report, 10), 9);
+   R128_TEST_STRSTREQ(report, "detected ");
+
+   r128CpuSet(R128Cpu_Auto);
+}
+
+typedef struct ParallelTestJob {
+   size_t grain;
+   int *hits;
+   R128Atomic total;
+} ParallelTestJob;
+
+static void parallel_test_task(void *ctx, size_t begin, size_t end)
+{
+   ParallelTestJob *job = (ParallelTestJob *)ctx;
+   R128 v;
+
+   // chunks must be aligned to the grain
+   if (begin % job->grain != 0 || (end - begin > job->grain)) {
+      job->hits[0] += 1000;
+   }
+
+   for (; begin < end; ++begin) {
+      ++job->hits[begin];
+      r128FromInt(&v, (R128_S64)begin);
+      r128AtomicFetchAdd(NULL, &job->total, &v);
+   }
+}
+
+static void test_parallel()
+{
+   enum { N = 100003 };
+   static int hits[N];
+   static R128 a[N], b[N], c[N], d[N];
+   static char sbuf[N][48], tbuf[N][48];
+   static const char *strs[N];
+   ParallelTestJob job;
+   R128 total;
+   int threads, i, ok;
+
+   for (i = 0; i < N; ++i) {
+      R128_SET2(&a[i], (R128_U64)i * R128_LIT_U64(0x9e3779b97f4a7c15), (R128_U64)(i - N / 2) * 977);
+      R128_SET2(&b[i], (R128_U64)i * R128_LIT_U64(0xc2b2ae3d27d4eb4f), (R128_U64)(i % 13 + 1));
+   }
+
+   for (threads = 1; threads <= 4; threads += 3) {
+      r128ParallelSetThreads(threads);
+
+      memset(hits, 0, sizeof(hits));
+      job.grain = 1000;
+      job.hits = hits;
+      r128AtomicInit(&job.total, &R128_zero);
+      r128ParallelFor(N, job.grain, parallel_test_task, &job);
+      for (ok = 1, i = 0; i < N; ++i) {
+         ok &= hits[i] == 1;
+      }
+      R128_TEST_FLFLEQ(ok, 1);
+      r128AtomicLoad(&total, &job.total);
+      R128_TEST_EQ2(total, 0, (R128_U64)N * (N - 1) / 2);
+
+      // parallel kernels match the serial ones exactly
+      r128MulArray(c, a, b, N);
+      r128ParallelMulArray(d, a, b, N);
+      R128_TEST_FLFLEQ(memcmp(c, d, sizeof(c)), 0);
+      r128DivArray(c, a, b, N);
+      r128ParallelDivArray(d, a, b, N);
+      R128_TEST_FLFLEQ(memcmp(c, d, sizeof(c)), 0);
+      r128ParallelAddArray(d, a, b, N);
+      r128AddArray(c, a, b, N);
+      R128_TEST_FLFLEQ(memcmp(c, d, sizeof(c)), 0);
+
+      r128ToStringArray(sbuf[0], sizeof(sbuf[0]), a, N);
+      r128ParallelToStringArray(tbuf[0], sizeof(tbuf[0]), a, N);
+      R128_TEST_FLFLEQ(memcmp(sbuf, tbuf, sizeof(sbuf)), 0);
+      for (i = 0; i < N; ++i) {
+         strs[i] = sbuf[i];
+      }
+      r128FromStringArray(c, strs, N);
+      r128ParallelFromStringArray(d, strs, N);
+      R128_TEST_FLFLEQ(memcmp(c, d, sizeof(c)), 0);
+
+      r128SumArray(&c[0], a, N);
+      r128ParallelSumArray(&d[0], a, N);
+      R128_TEST_EQ(c[0], d[0]);
+      r128DotArray(&c[0], a, b, N);
+      r128ParallelDotArray(&d[0], a, b, N);
+      R128_TEST_EQ(c[0], d[0]);
+      r128MinArray(&c[0], a, N);
+      r128ParallelMinArray(&d[0], a, N);
+      R128_TEST_EQ(c[0], d[0]);
+      r128MaxArray(&c[0], a, N);
+      r128ParallelMaxArray(&d[0], a, N);
+      R128_TEST_EQ(c[0], d[0]);
+      R128_TEST_FLFLEQ(r128ParallelCountArray(a, N, &b[0], &b[1]), r128CountArray(a, N, &b[0], &b[1]));
+
+      R128_TEST_FLFLEQ(r128ParallelInclusiveScanArray(d, a, N, &b[0]), r128InclusiveScanArray(c, a, N, &b[0]));
+      R128_TEST_FLFLEQ(memcmp(c, d, sizeof(c)), 0);
+      memcpy(d, a, sizeof(d));
+      r128Copy(&d[N / 2], &R128_max);
+      R128_TEST_FLFLEQ(r128ExclusiveScanArray(c, d, N, NULL), 1);
+      R128_TEST_FLFLEQ(r128ParallelExclusiveScanArray(d, d, N, NULL), 1);
+      R128_TEST_FLFLEQ(memcmp(c, d, sizeof(c)), 0);
+
+      memcpy(c, a, sizeof(c));
+      R128_TEST_FLFLEQ(r128ParallelSortArray(c, N), 1);
+      for (ok = 1, i = 1; i < N; ++i) {
+         ok &= r128Cmp(&c[i - 1], &c[i]) <= 0;
+      }
+      R128_TEST_FLFLEQ(ok, 1);
+
+      {
+         static R128_U64 serial[1 << 10], parallel[1 << 10];
+         R128Histogram h;
+
+         memset(serial, 0, sizeof(serial));
+         memset(parallel, 0, sizeof(parallel));
+         r128HistogramInitLog(&h, 3);
+         r128HistogramArray(serial, &h, b, N);
+         R128_TEST_FLFLEQ(r128ParallelHistogramArray(parallel, &h, b, N), 1);
+         R128_TEST_FLFLEQ(memcmp(serial, parallel, sizeof(serial)), 0);
+      }
+   }
+
+   r128ParallelShutdown();
+   r128ParallelSetThreads(0);
+}
+
+static void test_scan()
+{
+   R128 a[5], b[5], init;
+   int i;
+
+   for (i = 0; i < 5; ++i) {
+      r128FromFloat(&a[i], 0.75 * (i + 1));
+   }
+   r128FromInt(&init, -1);
+
+   R128_TEST_FLFLEQ(r128InclusiveScanArray(b, a, 5, NULL), 0);
+   R128_TEST_FLEQ(b[0], 0.75);
+   R128_TEST_FLEQ(b[4], 11.25);
+   R128_TEST_FLFLEQ(r128ExclusiveScanArray(b, a, 5, &init), 0);
+   R128_TEST_FLEQ(b[0], -1);
+   R128_TEST_FLEQ(b[1], -0.25);
+   R128_TEST_FLEQ(b[4], 6.5);
+
+   // in place, with overflow past R128_max
+   r128Copy(&a[2], &R128_max);
+   R128_TEST_FLFLEQ(r128InclusiveScanArray(a, a, 5, NULL), 1);
+   R128_TEST_EQ2(a[2], R128_LIT_U64(0x3fffffffffffffff), R128_LIT_U64(0x8000000000000002));
+
+   // negative overflow
+   r128Copy(&a[0], &R128_min);
+   r128FromInt(&a[1], -1);
+   R128_TEST_FLFLEQ(r128ExclusiveScanArray(b, a, 2, NULL), 1);
+   R128_TEST_FLFLEQ(r128ExclusiveScanArray(b, a, 1, NULL), 0);
+}
+
+static void test_sort()
+{
+   static const char *strs[] = { "3", "-1.5", "0.25", "-1.5", "0x100000000", "-0x100000000.8", "0", "0.25" };
+   static const int order[] = { 5, 1, 3, 6, 2, 7, 0, 4 };
+   R128 keys[8], sorted[8];
+   size_t index[8];
+   int payload[8];
+   int i, ok;
+
+   r128FromStringArray(keys, strs, 8);
+   for (i = 0; i < 8; ++i) {
+      payload[i] = i;
+   }
+
+   // equal keys keep their original order
+   R128_TEST_FLFLEQ(r128ParallelSortIndex(index, keys, 8), 1);
+   for (ok = 1, i = 0; i < 8; ++i) {
+      ok &= index[i] == (size_t)order[i];
+   }
+   R128_TEST_FLFLEQ(ok, 1);
+
+   memcpy(sorted, keys, sizeof(keys));
+   R128_TEST_FLFLEQ(r128ParallelSortArrayPayload(sorted, payload, sizeof(payload[0]), 8), 1);
+   for (ok = 1, i = 0; i < 8; ++i) {
+      ok &= payload[i] == order[i];
+      R128_TEST_EQ(sorted[i], keys[order[i]]);
+   }
+   R128_TEST_FLFLEQ(ok, 1);
+
+   R128_TEST_FLFLEQ(r128ParallelSortArray(keys, 8), 1);
+   R128_TEST_FLFLEQ(memcmp(keys, sorted, sizeof(keys)), 0);
+}
+
+static void test_histogram()
+{
+   static const char *bounds[] = { "-10", "0", "0.5", "100" };
+   static const char *widths[] = { "0.25", "0.3", "7", "0x1000000000000", "0.0000000001" };
+   R128Histogram h;
+   R128 bnd[4], min, width, v, d;
+   R128_U64 counts[5];
+   R128_U64 rng = R128_LIT_U64(0x9e3779b97f4a7c15);
+   int i, w, ok;
+
+   // equal width, against a division; power-of-two and reciprocal widths
+   r128FromInt(&min, -1000);
+   for (w = 0; w < 5; ++w) {
+      r128FromString(&width, widths[w], NULL);
+      r128HistogramInitLinear(&h, &min, &width, 1000);
+      for (ok = 1, i = 0; i < 10000; ++i) {
+         size_t expect;
+
+         rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+         R128_SET2(&v, rng, (R128_S64)(rng >> 40) - 2000);
+         if (i & 1) {
+            // near bucket edges
+            r128FromInt(&d, (R128_S64)(rng % 1000));
+            r128Mul(&d, &d, &width);
+            r128Add(&v, &d, &min);
+            R128_SET2(&d, rng >> 63, 0);
+            r128Sub(&v, &v, &d);
+         }
+
+         if (r128Cmp(&v, &min) < 0) {
+            expect = 0;
+         } else {
+            r128Sub(&d, &v, &min);
+            r128Div(&d, &d, &width);
+            expect = r128Cmp(&d, &R128_zero) < 0 || d.hi >= 1000 ? 999 : (size_t)d.hi;
+         }
+         ok &= r128HistogramBucket(&h, &v) == expect;
+      }
+      R128_TEST_FLFLEQ(ok, 1);
+   }
+   r128HistogramBucketStart(&v, &h, 3);
+   r128FromInt(&d, 3);
+   r128Mul(&d, &d, &width);
+   r128Add(&d, &d, &min);
+   R128_TEST_EQ(v, d);
+
+   // the whole range in four buckets
+   r128Copy(&min, &R128_min);
+   R128_SET2(&width, 0, R128_LIT_U64(0x4000000000000000));
+   r128HistogramInitLinear(&h, &min, &width, 4);
+   R128_TEST_FLFLEQ(r128HistogramBucket(&h, &R128_max), 3);
+   R128_TEST_FLFLEQ(r128HistogramBucket(&h, &R128_zero), 2);
+   r128FromInt(&v, -1);
+   R128_TEST_FLFLEQ(r128HistogramBucket(&h, &v), 1);
+   R128_SET2(&width, 0, R128_LIT_U64(0x5000000000000000));
+   r128HistogramInitLinear(&h, &min, &width, 4);
+   R128_TEST_FLFLEQ(r128HistogramBucket(&h, &R128_max), 3);
+
+   // width * buckets exactly 2^128 - 1: R128_max is in the last bucket, not
+   // one past it
+   R128_SET2(&width, R128_LIT_U64(0x5555555555555555), R128_LIT_U64(0x5555555555555555));
+   r128HistogramInitLinear(&h, &min, &width, 3);
+   R128_TEST_FLFLEQ(r128HistogramBucket(&h, &R128_max), 2);
+   R128_SET2(&v, R128_LIT_U64(0xfffffffffffffffe), R128_LIT_U64(0x7fffffffffffffff));
+   R128_TEST_FLFLEQ(r128HistogramBucket(&h, &v), 2);
+   memset(counts, 0, sizeof(counts));
+   r128HistogramArray(counts, &h, &R128_max, 1);
+   R128_TEST_FLFLEQ(counts[2] == 1 && counts[3] == 0, 1);
+
+   // sorted boundaries
+   r128FromStringArray(bnd, bounds, 4);
+   r128HistogramInitBounds(&h, bnd, 4);
+   R128_TEST_FLFLEQ(h.buckets, 5);
+   R128_TEST_FLFLEQ(r128HistogramBucket(&h, &R128_min), 0);
+   R128_TEST_FLFLEQ(r128HistogramBucket(&h, &bnd[0]), 1);
+   r128FromFloat(&v, -0.0001);
+   R128_TEST_FLFLEQ(r128HistogramBucket(&h, &v), 1);
+   R128_TEST_FLFLEQ(r128HistogramBucket(&h, &R128_zero), 2);
+   R128_TEST_FLFLEQ(r128HistogramBucket(&h, &bnd[2]), 3);
+   R128_TEST_FLFLEQ(r128HistogramBucket(&h, &R128_max), 4);
+   memset(counts, 0, sizeof(counts));
+   r128HistogramArray(counts, &h, bnd, 4);
+   R128_TEST_FLFLEQ(counts[0] == 0 && counts[1] == 1 && counts[4] == 1, 1);
+
+   // logarithmic, 2 bits: [1, 1.25) [1.25, 1.5) [1.5, 1.75) [1.75, 2)
+   r128HistogramInitLog(&h, 2);
+   R128_TEST_FLFLEQ(h.buckets, 126 * 4);
+   R128_TEST_FLFLEQ(r128HistogramBucket(&h, &R128_smallest), 1);
+   r128FromInt(&v, -5);
+   R128_TEST_FLFLEQ(r128HistogramBucket(&h, &v), 0);
+   R128_TEST_FLFLEQ(r128HistogramBucket(&h, &R128_one), (64 - 1) * 4);
+   r128FromFloat(&v, 1.7);
+   R128_TEST_FLFLEQ(r128HistogramBucket(&h, &v), (64 - 1) * 4 + 2);
+   R128_TEST_FLFLEQ(r128HistogramBucket(&h, &R128_max), h.buckets - 1);
+   r128HistogramBucketStart(&v, &h, (64 - 1) * 4 + 2);
+   R128_TEST_FLEQ(v, 1.5);
+   for (ok = 1, i = 0; i < (int)h.buckets; ++i) {
+      r128HistogramBucketStart(&v, &h, i);
+      ok &= r128HistogramBucket(&h, &v) == (size_t)i;
+   }
+   R128_TEST_FLFLEQ(ok, 1);
+}
+
+typedef struct MapTestJob {
+   R128Map *map;
+   const R128 *keys;
+   const R128 *values;
+   size_t added;
+} MapTestJob;
+
+static void map_test_task(void *ctx, size_t begin, size_t end)
+{
+   MapTestJob *job = (MapTestJob *)ctx;
+   size_t added = r128MapAggregate(job->map, job->keys + begin, job->values + begin, end - begin);
+
+   if (added != end - begin) {
+      job->added = 0;
+   }
+}
+
+static void test_map()
+{
+   enum { N = 50000, KEYS = 1000 };
+   static R128 keys[N], values[N];
+   R128Map map;
+   MapTestJob job;
+   R128 k, v, expect;
+   size_t slot;
+   int i, ok;
+
+   // too many keys for the slots to fit in memory
+   R128_TEST_FLFLEQ(r128MapInit(&map, (size_t)-1), 0);
+   R128_TEST_FLFLEQ(r128MapInit(&map, (size_t)-1 / 64), 0);
+
+   R128_TEST_FLFLEQ(r128MapInit(&map, 100), 1);
+   R128_TEST_FLFLEQ(r128MapCapacity(&map), 128);
+   for (i = 0; i < 100; ++i) {
+      r128FromFloat(&k, i * 0.5 - 20);
+      r128FromInt(&v, i);
+      R128_TEST_FLFLEQ(r128MapAdd(&map, &k, &v), 1);
+   }
+   R128_TEST_FLFLEQ(r128MapCount(&map), 100);
+   for (ok = 1, i = 0; i < 100; ++i) {
+      r128FromFloat(&k, i * 0.5 - 20);
+      slot = r128MapFind(&map, &k);
+      ok &= slot != R128_MAP_NONE && r128MapInsert(&map, &k) == slot;
+      ok &= r128MapKey(&map, slot, &v) && r128Cmp(&v, &k) == 0;
+      r128AtomicLoad(&v, r128MapValue(&map, slot));
+      ok &= r128ToInt(&v) == i;
+   }
+   R128_TEST_FLFLEQ(ok, 1);
+   R128_TEST_FLFLEQ(r128MapCount(&map), 100);
+
+   // keys differing only in the integer part, and only in the fraction part
+   r128FromInt(&k, -21);
+   R128_TEST_FLFLEQ(r128MapFind(&map, &k) == R128_MAP_NONE, 1);
+   R128_SET2(&k, 1, (R128_U64)-20);
+   R128_TEST_FLFLEQ(r128MapFind(&map, &k) == R128_MAP_NONE, 1);
+   R128_TEST_FLFLEQ(r128MapHash(&k) != r128MapHash(&R128_zero), 1);
+   r128MapFree(&map);
+
+   // full map
+   R128_TEST_FLFLEQ(r128MapInit(&map, 7), 1);
+   R128_TEST_FLFLEQ(r128MapCapacity(&map), 8);
+   for (i = 0; i < 8; ++i) {
+      r128FromInt(&k, i);
+      R128_TEST_FLFLEQ(r128MapInsert(&map, &k) != R128_MAP_NONE, 1);
+   }
+   R128_TEST_FLFLEQ(r128MapInsert(&map, &R128_max) == R128_MAP_NONE, 1);
+   R128_TEST_FLFLEQ(r128MapAggregate(&map, &R128_max, &R128_one, 1), 0);
+   r128MapFree(&map);
+
+   // concurrent aggregation matches the serial sums
+   for (i = 0; i < N; ++i) {
+      r128FromFloat(&keys[i], (i % KEYS) * 0.01 - 3);
+      r128FromInt(&values[i], i);
+   }
+
+   R128_TEST_FLFLEQ(r128MapInit(&map, KEYS), 1);
+   r128ParallelSetThreads(4);
+   job.map = &map;
+   job.keys = keys;
+   job.values = values;
+   job.added = 1;
+   r128ParallelFor(N, 1000, map_test_task, &job);
+   r128ParallelShutdown();
+   r128ParallelSetThreads(0);
+
+   R128_TEST_FLFLEQ(job.added, 1);
+   R128_TEST_FLFLEQ(r128MapCount(&map), KEYS);
+   for (ok = 1, i = 0; i < KEYS; ++i) {
+      slot = r128MapFind(&map, &keys[i]);
+      ok &= slot != R128_MAP_NONE;
+      if (slot != R128_MAP_NONE) {
+         r128FromInt(&expect, (R128_S64)i * (N / KEYS) + (R128_S64)KEYS * (N / KEYS) * (N / KEYS - 1) / 2);
+         r128AtomicLoad(&v, r128MapValue(&map, slot));
+         ok &= r128Cmp(&v, &expect) == 0;
+      }
+   }
+   R128_TEST_FLFLEQ(ok, 1);
+   r128MapFree(&map);
+}
+
+static void test_reduce()
+{
+   static const char *strs[] = { "3", "-1.5", "0.25", "-1.5", "0x100000000", "-0x100000000.8", "0", "0.25" };
+   R128 v[8], w[8], r, m, lo, hi;
+   R128DotAccumulator acc, part;
+   R128_U64 rng = R128_LIT_U64(0x9e3779b97f4a7c15);
+   int i, ok;
+
+   r128FromStringArray(v, strs, 8);
+   r128MinArray(&r, v, 8);
+   R128_TEST_EQ(r, v[5]);
+   r128MaxArray(&r, v, 8);
+   R128_TEST_EQ(r, v[4]);
+   r128MinArray(&r, v, 0);
+   R128_TEST_EQ(r, R128_max);
+   r128MaxArray(&r, v, 0);
+   R128_TEST_EQ(r, R128_min);
+
+   r128FromFloat(&lo, -1.5);
+   r128FromInt(&hi, 3);
+   R128_TEST_FLFLEQ(r128CountArray(v, 8, &lo, &hi), 5);
+   R128_TEST_FLFLEQ(r128CountArray(v, 8, NULL, &hi), 6);
+   R128_TEST_FLFLEQ(r128CountArray(v, 8, &hi, NULL), 2);
+   R128_TEST_FLFLEQ(r128CountArray(v, 8, NULL, NULL), 8);
+
+   // one product rounds like r128Mul, including halves and negative values
+   for (ok = 1, i = 0; i < 10000; ++i) {
+      rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+      R128_SET2(&v[0], rng, (R128_S64)rng >> (i % 64));
+      rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+      R128_SET2(&v[1], (i & 1) ? R128_LIT_U64(0x8000000000000000) : rng, (R128_S64)rng >> (i % 61));
+      r128Mul(&m, &v[0], &v[1]);
+      r128DotArray(&r, &v[0], &v[1], 1);
+      ok &= r128Cmp(&r, &m) == 0;
+   }
+   R128_TEST_FLFLEQ(ok, 1);
+
+   // the sum is rounded once: four half-ulp products make two ulps, not four
+   for (i = 0; i < 4; ++i) {
+      r128Copy(&v[i], &R128_smallest);
+      r128FromFloat(&w[i], (i & 2) ? -0.5 : 0.5);
+   }
+   r128DotArray(&r, v, w, 2);
+   R128_TEST_EQ2(r, 1, 0);
+   r128DotArray(&r, v + 2, w + 2, 2);
+   R128_TEST_EQ2(r, (R128_U64)-1, (R128_U64)-1);
+   r128FromFloat(&w[2], 0.5);
+   r128FromFloat(&w[3], 0.5);
+   r128DotArray(&r, v, w, 4);
+   R128_TEST_EQ2(r, 2, 0);
+
+   // partial accumulators merge exactly, and carry past the 64.64 range
+   for (i = 0; i < 8; ++i) {
+      r128Copy(&v[i], &R128_max);
+      r128Copy(&w[i], (i & 1) ? &R128_min : &R128_max);
+   }
+   r128DotInit(&acc);
+   r128DotAdd(&acc, v, w, 3);
+   r128DotInit(&part);
+   r128DotAdd(&part, v + 3, w + 3, 5);
+   r128DotMerge(&acc, &part);
+   r128DotResult(&r, &acc);
+   r128DotArray(&m, v, w, 8);
+   R128_TEST_EQ(r, m);
+}
+
+static void pipeline_test_scale(void *ctx, R128Batch *batch)
+{
+   size_t i;
+   for (i = 0; i < batch->count; ++i) {
+      r128Mul(&batch->values[i], &batch->values[i], (const R128 *)ctx);
+   }
+}
+
+static void test_pipeline()
+{
+   enum { N = 1000 };
+   static char input[N * 48], expect[N * 48];
+   char *out = NULL, buf[48];
+   size_t inSize = 0, expectSize = 0, outSize = 0;
+   const R128PipelineStats *stats;
+   R128Pipeline p;
+   R128 v, scale;
+   FILE *in, *fout;
+   int i, count, ok;
+
+   // the last line has no newline, and some end in "\r\n"
+   r128FromFloat(&scale, 1.5);
+   for (i = 0; i < N; ++i) {
+      r128FromFloat(&v, i * 0.25 - 100);
+      inSize += r128ToString(input + inSize, 48, &v);
+      if (i + 1 < N) {
+         inSize += sprintf(input + inSize, (i % 3) ? "\n" : "\r\n");
+      }
+      r128Mul(&v, &v, &scale);
+      expectSize += r128ToString(expect + expectSize, 48, &v);
+      expect[expectSize++] = '\n';
+   }
+
+   r128PipelineInit(&p, 7, 2);
+   R128_TEST_FLFLEQ(r128PipelineAddStage(&p, "parse", r128PipelineParse, NULL, 2), 1);
+   R128_TEST_FLFLEQ(r128PipelineAddStage(&p, "scale", pipeline_test_scale, &scale, 3), 1);
+   R128_TEST_FLFLEQ(r128PipelineAddStage(&p, "format", r128PipelineFormat, NULL, 1), 1);
+
+   R128_TEST_FLFLEQ(r128PipelineRunMemory(&p, input, inSize, &out, &outSize), 1);
+   R128_TEST_FLFLEQ(outSize == expectSize && !memcmp(out, expect, expectSize), 1);
+   R128_FREE(out);
+
+   stats = r128PipelineStats(&p, &count);
+   R128_TEST_FLFLEQ(count, 5);
+   for (ok = 1, i = 0; i < count; ++i) {
+      ok &= stats[i].values == N && stats[i].batches == (N + 6) / 7;
+   }
+   R128_TEST_FLFLEQ(ok, 1);
+   R128_TEST_STRSTREQ(stats[2].name, "scale");
+   R128_TEST_FLFLEQ(stats[2].threads, 3);
+
+   // streams, with lines split across reads
+   in = tmpfile();
+   fout = tmpfile();
+   if (in && fout) {
+      fwrite(input, 1, inSize, in);
+      rewind(in);
+      R128_TEST_FLFLEQ(r128PipelineRunFile(&p, in, fout), 1);
+      rewind(fout);
+      outSize = fread(input, 1, sizeof(input), fout);
+      R128_TEST_FLFLEQ(outSize == expectSize && !memcmp(input, expect, expectSize), 1);
+   }
+   if (in) {
+      fclose(in);
+   }
+   if (fout) {
+      fclose(fout);
+   }
+
+   // empty input
+   R128_TEST_FLFLEQ(r128PipelineRunMemory(&p, buf, 0, &out, &outSize), 1);
+   R128_TEST_FLFLEQ(outSize, 0);
+   R128_FREE(out);
+}
+
+static void test_omp()
+{
+   enum { N = 10000 };
+   static R128 a[N], b[N];
+   R128 sum, low, high, expect, r;
+   R128DotAccumulator acc;
+   R128_U64 rng = R128_LIT_U64(0x9e3779b97f4a7c15);
+   int i;
+
+   for (i = 0; i < N; ++i) {
+      rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+      R128_SET2(&a[i], rng, (R128_S64)rng >> 40);
+      rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+      R128_SET2(&b[i], rng, (R128_S64)rng >> 50);
+   }
+
+   // the reductions are exact, so any thread count gives the serial results
+   r128Copy(&sum, &R128_zero);
+   r128Copy(&low, &R128_max);
+   r128Copy(&high, &R128_min);
+   r128DotInit(&acc);
+#if defined(_OPENMP) && _OPENMP >= 201307
+#  pragma omp parallel for reduction(r128sum: sum) reduction(r128min: low) reduction(r128max: high) reduction(r128dot: acc)
+#endif
+   for (i = 0; i < N; ++i) {
+      r128Add(&sum, &sum, &a[i]);
+      r128Min(&low, &low, &a[i]);
+      r128Max(&high, &high, &a[i]);
+      r128DotAdd(&acc, &a[i], &b[i], 1);
+   }
+
+   r128SumArray(&expect, a, N);
+   R128_TEST_EQ(sum, expect);
+   r128MinArray(&expect, a, N);
+   R128_TEST_EQ(low, expect);
+   r128MaxArray(&expect, a, N);
+   R128_TEST_EQ(high, expect);
+   r128DotArray(&expect, a, b, N);
+   r128DotResult(&r, &acc);
+   R128_TEST_EQ(r, expect);
+}
+
+#if defined(R128_STATS) && defined(R128_TRACE)
+static void test_stats()
+{
+   R128Stats stats;
+   R128 a, b, r;
+   char buf[8];
+
+   r128StatsReset();
+   r128StatsGet(&stats);
+   R128_TEST_FLFLEQ(stats.divOverflow + stats.divByZero + stats.divRefine + stats.floatClamp + stats.formatTruncated, 0);
+
+   r128FromInt(&a, 1000000);
+   r128Div(&r, &a, &R128_zero);
+   r128Mod(&r, &a, &R128_zero);
+   r128Div(&r, &a, &R128_smallest);         // quotient too large
+   r128Div(&r, &R128_max, &R128_smallest);
+   r128FromFloat(&r, 1e30);
+   r128FromFloat(&r, -1e30);
+   r128FromFloat(&r, 1e18);
+   r128ToString(buf, sizeof(buf), &a);      // "1000000" fits exactly
+   r128FromFloat(&b, -3.25);
+   r128ToString(buf, sizeof(buf), &b);      // "-3.25"
+   r128ToString(buf, 4, &b);                // cut short
+   r128StatsGet(&stats);
+   R128_TEST_FLFLEQ(stats.divByZero, 2);
+   R128_TEST_FLFLEQ(stats.divOverflow, 2);
+   R128_TEST_FLFLEQ(stats.floatClamp, 2);
+   R128_TEST_FLFLEQ(stats.formatTruncated, 1);
+
+   // quotient digits estimated from the top 64 bits of the divisor can be too
+   // large, and are corrected
+   R128_SET2(&a, 0, 0x13);
+   R128_SET2(&b, R128_LIT_U64(0x9fded21c82caf2bb), 0x13);
+   r128StatsReset();
+   r128Div(&r, &a, &b);
+   r128StatsGet(&stats);
+   R128_TEST_FLFLEQ(stats.divRefine > 0, 1);
+   R128_TEST_FLFLEQ(stats.divByZero, 0);
+}
+
+static size_t traceFlushed;
+
+static void trace_flush(const R128TraceRecord *records, size_t count, void *user)
+{
+   char buf[64];
+   size_t i;
+
+   // like a text log; these calls must not be recorded into the full buffer
+   for (i = 0; i < count; ++i) {
+      r128ToString(buf, sizeof(buf), &records[i].a);
+   }
+   *(size_t *)user += count;
+}
+
+static void test_trace()
+{
+   R128TraceRecord records[4];
+   R128 a, b, r, arr[3];
+   char buf[32];
+   size_t n;
+
+   r128FromFloat(&a, -7.5);
+   r128FromInt(&b, 2);
+
+   // calls the library makes internally (r128Div negates) are not recorded
+   r128TraceStart(records, 4, NULL, NULL);
+   r128FromString(&r, "12.75;", NULL);
+   r128Div(&r, &a, &b);
+   r128Shl(&r, &r, 3);
+   r128ToStringf(buf, sizeof(buf), "%+.2f", &r);
+   n = r128TraceStop();
+   R128_TEST_FLFLEQ(n, 4);
+   R128_TEST_FLFLEQ(records[0].op, R128TraceOp_FromString);
+   R128_TEST_FLFLEQ(records[0].arg, 5);
+   R128_TEST_STRSTREQ((const char *)&records[0].a, "12.75");
+   R128_TEST_FLFLEQ(records[1].op, R128TraceOp_Div);
+   R128_TEST_EQ(records[1].a, a);
+   R128_TEST_EQ(records[1].b, b);
+   R128_TEST_FLFLEQ(records[2].op, R128TraceOp_Shl);
+   R128_TEST_FLFLEQ(records[2].arg, 3);
+   R128_TEST_FLFLEQ(records[3].op, R128TraceOp_ToStringf);
+   R128_TEST_FLFLEQ(records[3].arg, sizeof(buf));
+   R128_TEST_STRSTREQ((const char *)&records[3].b, "%+.2f");
+
+   // the companion headers' calls are the library's too
+   {
+      R128Atomic acc;
+      R128 arrA[2], arrB[2], arrR[2];
+
+      arrA[0] = arrA[1] = a;
+      arrB[0] = arrB[1] = b;
+      r128TraceStart(records, 4, NULL, NULL);
+      r128AtomicInit(&acc, &a);
+      r128AtomicFetchAdd(&r, &acc, &b);
+      r128AtomicFetchMax(&r, &acc, &b);
+      r128ParallelAddArray(arrR, arrA, arrB, 2);
+      r128Sub(&r, &a, &b);
+      n = r128TraceStop();
+      R128_TEST_FLFLEQ(n, 1);
+      R128_TEST_FLFLEQ(records[0].op, R128TraceOp_Sub);
+   }
+
+   // not recording
+   r128Add(&r, &a, &b);
+   R128_TEST_FLFLEQ(r128TraceStop(), 0);
+
+   // a ring buffer keeps the newest records, oldest first
+   r128TraceStart(records, 4, NULL, NULL);
+   r128Add(&r, &a, &b);
+   r128Sub(&r, &a, &b);
+   r128Mul(&r, &a, &b);
+   arr[0] = a; arr[1] = b; arr[2] = r;
+   r128MulArray(arr, arr, arr, 3);     // one record per element
+   n = r128TraceStop();
+   R128_TEST_FLFLEQ(n, 4);
+   R128_TEST_FLFLEQ(records[0].op, R128TraceOp_Mul);
+   R128_TEST_EQ(records[0].a, a);
+   R128_TEST_EQ(records[1].a, a);
+   R128_TEST_EQ(records[2].b, b);
+   R128_TEST_EQ(records[3].a, r);
+
+   // or hands full buffers to a callback
+   traceFlushed = 0;
+   r128TraceStart(records, 4, trace_flush, &traceFlushed);
+   for (n = 0; n < 10; ++n) {
+      r128Neg(&r, &a);
+   }
+   R128_TEST_FLFLEQ(traceFlushed, 8);
+   R128_TEST_FLFLEQ(r128TraceStop(), 0);
+   R128_TEST_FLFLEQ(traceFlushed, 10);
+}
+#endif   //R128_STATS && R128_TRACE
+
 int main()
 {
    R128 a, b, c;
@@ -350,6 +1308,22 @@ int main()
    test_mod();
    test_div();
    test_shift();
+   test_atomic();
+   test_sharded();
+   test_array();
+   test_cpu();
+   test_scan();
+   test_reduce();
+   test_parallel();
+   test_sort();
+   test_histogram();
+   test_map();
+   test_pipeline();
+   test_omp();
+#if defined(R128_STATS) && defined(R128_TRACE)
+   test_stats();
+   test_trace();
+#endif
 
    printf("%d tests run. %d tests passed. %d tests failed.\n",
       testsRun, testsRun - testsFailed, testsFailed);